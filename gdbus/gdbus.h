@@ -223,6 +223,10 @@ struct GDBusSecurityTable {
 void g_dbus_set_flags(int flags);
 int g_dbus_get_flags(void);
 
+void g_dbus_set_changes_interval(unsigned int interval);
+void g_dbus_set_property_interval(const char *interface, const char *name,
+							unsigned int interval);
+
 gboolean g_dbus_register_interface(DBusConnection *connection,
 					const char *path, const char *name,
 					const GDBusMethodTable *methods,
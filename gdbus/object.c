@@ -56,6 +56,7 @@ struct generic_data {
 	GSList *added;
 	GSList *removed;
 	guint process_id;
+	gboolean scheduled;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
@@ -67,10 +68,22 @@ struct interface_data {
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
 	GSList *pending_prop;
+	GSList *prop_stamps;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
 
+struct property_stamp {
+	const GDBusPropertyTable *property;
+	gint64 last;
+};
+
+struct property_interval {
+	char *interface;
+	char *name;
+	guint interval;
+};
+
 struct security_data {
 	GDBusPendingReply pending;
 	DBusMessage *message;
@@ -87,11 +100,17 @@ struct property_data {
 static int global_flags = 0;
 static struct generic_data *root;
 static GSList *pending = NULL;
+static guint changes_interval = 0;
+static guint changes_id = 0;
+static GSList *property_intervals = NULL;
 
 static gboolean process_changes(gpointer user_data);
-static void process_properties_from_interface(struct generic_data *data,
-						struct interface_data *iface);
-static void process_property_changes(struct generic_data *data);
+static void process_object_changes(struct generic_data *data,
+							gboolean force);
+static gint64 process_properties_from_interface(struct generic_data *data,
+						struct interface_data *iface,
+						gboolean force);
+static gint64 process_property_changes(struct generic_data *data);
 
 static void print_arguments(GString *gstr, const GDBusArgInfo *args,
 						const char *direction)
@@ -633,24 +652,57 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
+static gboolean flush_changes(gpointer user_data)
+{
+	changes_id = 0;
+
+	while (pending)
+		process_changes(pending->data);
+
+	return FALSE;
+}
+
 static void add_pending(struct generic_data *data)
 {
 	guint old_id = data->process_id;
 
-	data->process_id = g_idle_add(process_changes, data);
+	/*
+	 * With a coalescing interval all objects are flushed together from
+	 * a single timer, otherwise each object gets its own idler.
+	 */
+	if (changes_interval > 0) {
+		data->process_id = 0;
+
+		if (changes_id == 0)
+			changes_id = g_timeout_add(changes_interval,
+							flush_changes, NULL);
+	} else
+		data->process_id = g_idle_add(process_changes, data);
 
-	if (old_id > 0) {
-		/*
-		 * If the element already had an old idler, remove the old one,
-		 * no need to re-add it to the pending list.
-		 */
+	/*
+	 * If the element already had an old idler or a timer for rate
+	 * limited properties, remove the old one.
+	 */
+	if (old_id > 0)
 		g_source_remove(old_id);
+
+	if (data->scheduled)
 		return;
-	}
 
+	data->scheduled = TRUE;
 	pending = g_slist_append(pending, data);
 }
 
+static void defer_pending(struct generic_data *data, gint64 delay)
+{
+	/* Already going to be processed, which defers again if needed */
+	if (data->process_id > 0 || data->scheduled)
+		return;
+
+	data->process_id = g_timeout_add((delay + 999) / 1000,
+						process_changes, data);
+}
+
 static gboolean remove_interface(struct generic_data *data, const char *name)
 {
 	struct interface_data *iface;
@@ -659,7 +711,10 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 	if (iface == NULL)
 		return FALSE;
 
-	process_properties_from_interface(data, iface);
+	process_properties_from_interface(data, iface, TRUE);
+
+	g_slist_free_full(iface->prop_stamps, g_free);
+	iface->prop_stamps = NULL;
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
 
@@ -996,12 +1051,17 @@ static void remove_pending(struct generic_data *data)
 		data->process_id = 0;
 	}
 
-	pending = g_slist_remove(pending, data);
+	if (data->scheduled) {
+		pending = g_slist_remove(pending, data);
+		data->scheduled = FALSE;
+	}
 }
 
-static gboolean process_changes(gpointer user_data)
+static void process_object_changes(struct generic_data *data,
+							gboolean force)
 {
-	struct generic_data *data = user_data;
+	gint64 delay = 0;
+	GSList *l;
 
 	remove_pending(data);
 
@@ -1009,14 +1069,32 @@ static gboolean process_changes(gpointer user_data)
 		emit_interfaces_added(data);
 
 	/* Flush pending properties */
-	if (data->pending_prop == TRUE)
-		process_property_changes(data);
+	if (data->pending_prop == TRUE) {
+		if (force) {
+			data->pending_prop = FALSE;
+
+			for (l = data->interfaces; l != NULL; l = l->next)
+				process_properties_from_interface(data,
+								l->data, TRUE);
+		} else
+			delay = process_property_changes(data);
+	}
 
 	if (data->removed != NULL)
 		emit_interfaces_removed(data);
 
 	data->process_id = 0;
 
+	if (delay > 0)
+		defer_pending(data, delay);
+}
+
+static gboolean process_changes(gpointer user_data)
+{
+	struct generic_data *data = user_data;
+
+	process_object_changes(data, FALSE);
+
 	return FALSE;
 }
 
@@ -1028,11 +1106,8 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	if (parent != NULL)
 		parent->objects = g_slist_remove(parent->objects, data);
 
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
-		process_changes(data);
-	}
+	if (data->process_id > 0 || data->scheduled)
+		process_object_changes(data, TRUE);
 
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
@@ -1657,27 +1732,118 @@ fail:
 	return ret;
 }
 
-static void process_properties_from_interface(struct generic_data *data,
-						struct interface_data *iface)
+static guint find_property_interval(const char *interface, const char *name)
+{
+	GSList *l;
+
+	for (l = property_intervals; l != NULL; l = l->next) {
+		struct property_interval *pi = l->data;
+
+		if (pi->interface && strcmp(pi->interface, interface))
+			continue;
+
+		if (!strcmp(pi->name, name))
+			return pi->interval;
+	}
+
+	return 0;
+}
+
+static struct property_stamp *find_property_stamp(
+					struct interface_data *iface,
+					const GDBusPropertyTable *property)
+{
+	GSList *l;
+
+	for (l = iface->prop_stamps; l != NULL; l = l->next) {
+		struct property_stamp *stamp = l->data;
+
+		if (stamp->property == property)
+			return stamp;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns how long a rate limited property still has to wait before it
+ * can be emitted again, in microseconds, or 0 if it can be emitted now in
+ * which case it is stamped with the current time.
+ */
+static gint64 property_delay(struct interface_data *iface,
+				const GDBusPropertyTable *property, gint64 now)
+{
+	struct property_stamp *stamp;
+	guint interval;
+
+	interval = find_property_interval(iface->name, property->name);
+	if (interval == 0)
+		return 0;
+
+	stamp = find_property_stamp(iface, property);
+	if (stamp == NULL) {
+		stamp = g_new0(struct property_stamp, 1);
+		stamp->property = property;
+		iface->prop_stamps = g_slist_prepend(iface->prop_stamps,
+									stamp);
+	} else if (now - stamp->last < (gint64) interval * 1000)
+		return stamp->last + (gint64) interval * 1000 - now;
+
+	stamp->last = now;
+
+	return 0;
+}
+
+static gint64 process_properties_from_interface(struct generic_data *data,
+						struct interface_data *iface,
+						gboolean force)
 {
 	GSList *l;
 	DBusMessage *signal;
 	DBusMessageIter iter, dict, array;
-	GSList *invalidated;
+	GSList *invalidated, *changed, *deferred;
+	gint64 now, delay, next = 0;
 
 	if (iface->pending_prop == NULL)
-		return;
+		return 0;
+
+	iface->pending_prop = g_slist_reverse(iface->pending_prop);
+
+	changed = NULL;
+	deferred = NULL;
+	now = g_get_monotonic_time();
+
+	for (l = iface->pending_prop; l != NULL; l = l->next) {
+		GDBusPropertyTable *p = l->data;
+
+		delay = force ? 0 : property_delay(iface, p, now);
+		if (delay > 0) {
+			deferred = g_slist_prepend(deferred, p);
+			if (next == 0 || delay < next)
+				next = delay;
+			continue;
+		}
+
+		changed = g_slist_prepend(changed, p);
+	}
+
+	g_slist_free(iface->pending_prop);
+	iface->pending_prop = deferred;
+
+	if (changed == NULL)
+		return next;
+
+	changed = g_slist_reverse(changed);
 
 	signal = dbus_message_new_signal(data->path,
 			DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
 	if (signal == NULL) {
 		error("Unable to allocate new " DBUS_INTERFACE_PROPERTIES
 						".PropertiesChanged signal");
-		return;
+		g_slist_free(changed);
+		return next;
 	}
 
-	iface->pending_prop = g_slist_reverse(iface->pending_prop);
-
 	dbus_message_iter_init_append(signal, &iter);
 	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,	&iface->name);
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
@@ -1687,7 +1853,7 @@ static void process_properties_from_interface(struct generic_data *data,
 
 	invalidated = NULL;
 
-	for (l = iface->pending_prop; l != NULL; l = l->next) {
+	for (l = changed; l != NULL; l = l->next) {
 		GDBusPropertyTable *p = l->data;
 
 		if (p->get == NULL)
@@ -1714,25 +1880,35 @@ static void process_properties_from_interface(struct generic_data *data,
 	g_slist_free(invalidated);
 	dbus_message_iter_close_container(&iter, &array);
 
-	g_slist_free(iface->pending_prop);
-	iface->pending_prop = NULL;
+	g_slist_free(changed);
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
 	dbus_connection_send(data->conn, signal, NULL);
 	dbus_message_unref(signal);
+
+	return next;
 }
 
-static void process_property_changes(struct generic_data *data)
+static gint64 process_property_changes(struct generic_data *data)
 {
 	GSList *l;
+	gint64 delay, next = 0;
 
 	data->pending_prop = FALSE;
 
 	for (l = data->interfaces; l != NULL; l = l->next) {
 		struct interface_data *iface = l->data;
 
-		process_properties_from_interface(data, iface);
+		delay = process_properties_from_interface(data, iface, FALSE);
+		if (delay > 0 && (next == 0 || delay < next))
+			next = delay;
 	}
+
+	/* Rate limited properties stay pending until they are due */
+	if (next > 0)
+		data->pending_prop = TRUE;
+
+	return next;
 }
 
 void g_dbus_emit_property_changed_full(DBusConnection *connection,
@@ -1776,9 +1952,12 @@ void g_dbus_emit_property_changed_full(DBusConnection *connection,
 	iface->pending_prop = g_slist_prepend(iface->pending_prop,
 						(void *) property);
 
-	if (flags & G_DBUS_PROPERTY_CHANGED_FLAG_FLUSH)
-		process_property_changes(data);
-	else
+	if (flags & G_DBUS_PROPERTY_CHANGED_FLAG_FLUSH) {
+		gint64 delay = process_property_changes(data);
+
+		if (delay > 0)
+			defer_pending(data, delay);
+	} else
 		add_pending(data);
 }
 
@@ -1846,3 +2025,55 @@ int g_dbus_get_flags(void)
 {
 	return global_flags;
 }
+
+void g_dbus_set_changes_interval(unsigned int interval)
+{
+	changes_interval = interval;
+}
+
+static void property_interval_free(void *data)
+{
+	struct property_interval *pi = data;
+
+	g_free(pi->interface);
+	g_free(pi->name);
+	g_free(pi);
+}
+
+void g_dbus_set_property_interval(const char *interface, const char *name,
+							unsigned int interval)
+{
+	struct property_interval *pi;
+	GSList *l;
+
+	if (name == NULL)
+		return;
+
+	for (l = property_intervals; l != NULL; l = l->next) {
+		pi = l->data;
+
+		if (g_strcmp0(pi->interface, interface) ||
+						strcmp(pi->name, name))
+			continue;
+
+		if (interval > 0) {
+			pi->interval = interval;
+			return;
+		}
+
+		property_intervals = g_slist_delete_link(property_intervals,
+									l);
+		property_interval_free(pi);
+		return;
+	}
+
+	if (interval == 0)
+		return;
+
+	pi = g_new0(struct property_interval, 1);
+	pi->interface = g_strdup(interface);
+	pi->name = g_strdup(name);
+	pi->interval = interval;
+
+	property_intervals = g_slist_append(property_intervals, pi);
+}
@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
 
 #include "lib/bluetooth.h"
 
@@ -35,8 +37,73 @@
 #include "src/shared/queue.h"
 #include "src/shared/btsnoop.h"
 #include "monitor/bt.h"
+#include "packet.h"
 #include "analyze.h"
 
+/* Latency histogram bucket n counts samples in [2^n, 2^(n+1)) usec */
+#define LATENCY_BUCKETS	24
+
+struct latency {
+	unsigned long count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	unsigned long hist[LATENCY_BUCKETS];
+};
+
+struct traffic {
+	unsigned long num;
+	uint64_t bytes;
+	struct timeval first;
+	struct timeval last;
+};
+
+/* Controller buffers, returned through Number Of Completed Packets */
+struct credits {
+	uint16_t max;
+	unsigned int pending;
+	bool starving;
+	struct timeval since;
+	unsigned long starved;
+	uint64_t starved_usec;
+};
+
+#define CONN_TYPE_UNKNOWN	0x00
+#define CONN_TYPE_BREDR		0x01
+#define CONN_TYPE_LE		0x02
+#define CONN_TYPE_SCO		0x03
+
+struct hci_conn {
+	uint16_t handle;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	bool setup;
+	bool disconnected;
+	struct timeval time_setup;
+	struct timeval time_disconnect;
+	struct traffic tx;
+	struct traffic rx;
+	struct queue *tx_queue;
+	struct latency tx_latency;
+	struct queue *chan_list;
+};
+
+struct l2cap_chan {
+	uint16_t cid;
+	struct traffic tx;
+	struct traffic rx;
+};
+
+struct cmd_stat {
+	uint16_t opcode;
+	struct latency latency;
+};
+
+struct pending_cmd {
+	uint16_t opcode;
+	struct timeval tv;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -52,13 +119,362 @@ struct hci_dev {
 	unsigned long user_log;
 	unsigned long unknown;
 	uint16_t manufacturer;
+	struct queue *conn_list;
+	struct queue *cmd_list;
+	struct queue *pending_cmds;
+	struct credits acl_credits;
+	struct credits le_credits;
 };
 
 static struct queue *dev_list;
+static enum analyze_format out_format;
 
-static void dev_destroy(void *data)
+static uint64_t elapsed_usec(const struct timeval *start,
+					const struct timeval *end)
+{
+	struct timeval res;
+
+	if (timercmp(end, start, <))
+		return 0;
+
+	timersub(end, start, &res);
+
+	return res.tv_sec * 1000000ull + res.tv_usec;
+}
+
+static void latency_add(struct latency *lat, uint64_t usec)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < LATENCY_BUCKETS - 1 && (usec >> (bucket + 1)))
+		bucket++;
+
+	if (!lat->count || usec < lat->min)
+		lat->min = usec;
+
+	if (usec > lat->max)
+		lat->max = usec;
+
+	lat->count++;
+	lat->total += usec;
+	lat->hist[bucket]++;
+}
+
+static uint64_t latency_avg(const struct latency *lat)
+{
+	return lat->count ? lat->total / lat->count : 0;
+}
+
+static void traffic_add(struct traffic *traffic, struct timeval *tv,
+							uint16_t bytes)
+{
+	if (!traffic->num)
+		traffic->first = *tv;
+
+	traffic->last = *tv;
+	traffic->num++;
+	traffic->bytes += bytes;
+}
+
+/* Average rate in kbit/s between the first and the last packet */
+static double traffic_kbps(const struct traffic *traffic)
+{
+	uint64_t usec = elapsed_usec(&traffic->first, &traffic->last);
+
+	if (!usec)
+		return 0;
+
+	return traffic->bytes * 8000.0 / usec;
+}
+
+static void credits_take(struct credits *credits, struct timeval *tv)
+{
+	credits->pending++;
+
+	if (!credits->max || credits->starving)
+		return;
+
+	if (credits->pending >= credits->max) {
+		credits->starving = true;
+		credits->since = *tv;
+		credits->starved++;
+	}
+}
+
+static void credits_return(struct credits *credits, struct timeval *tv,
+							unsigned int count)
+{
+	credits->pending -= count < credits->pending ? count :
+							credits->pending;
+
+	if (credits->starving && credits->pending < credits->max) {
+		credits->starving = false;
+		credits->starved_usec += elapsed_usec(&credits->since, tv);
+	}
+}
+
+static const char *conn_type_str(uint8_t type)
+{
+	switch (type) {
+	case CONN_TYPE_BREDR:
+		return "BR/EDR";
+	case CONN_TYPE_LE:
+		return "LE";
+	case CONN_TYPE_SCO:
+		return "SCO";
+	default:
+		return "unknown";
+	}
+}
+
+static void print_addr(const uint8_t bdaddr[6])
+{
+	printf("%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
+			bdaddr[5], bdaddr[4], bdaddr[3],
+			bdaddr[2], bdaddr[1], bdaddr[0]);
+}
+
+static void print_latency_text(const struct latency *lat)
+{
+	int i;
+
+	printf("latency min %.3f ms avg %.3f ms max %.3f ms\n",
+				lat->min / 1000.0, latency_avg(lat) / 1000.0,
+				lat->max / 1000.0);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (!lat->hist[i])
+			continue;
+
+		printf("      %8" PRIu64 " - %8" PRIu64 " us: %lu\n",
+					i ? UINT64_C(1) << i : 0,
+					UINT64_C(1) << (i + 1), lat->hist[i]);
+	}
+}
+
+static void print_latency_json(const struct latency *lat)
+{
+	bool first = true;
+	int i;
+
+	printf("\"count\":%lu,\"min_us\":%" PRIu64 ",\"avg_us\":%" PRIu64
+				",\"max_us\":%" PRIu64 ",\"histogram\":[",
+				lat->count, lat->min, latency_avg(lat),
+				lat->max);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (!lat->hist[i])
+			continue;
+
+		printf("%s{\"low_us\":%" PRIu64 ",\"high_us\":%" PRIu64
+					",\"count\":%lu}", first ? "" : ",",
+					i ? UINT64_C(1) << i : 0,
+					UINT64_C(1) << (i + 1), lat->hist[i]);
+		first = false;
+	}
+
+	printf("]");
+}
+
+static void print_latency_csv(const char *prefix, const struct latency *lat)
+{
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (!lat->hist[i])
+			continue;
+
+		printf("%s,%" PRIu64 ",%" PRIu64 ",%lu\n", prefix,
+					i ? UINT64_C(1) << i : 0,
+					UINT64_C(1) << (i + 1), lat->hist[i]);
+	}
+}
+
+static void chan_destroy(void *data)
+{
+	free(data);
+}
+
+static void print_chan(struct hci_dev *dev, struct hci_conn *conn,
+						struct l2cap_chan *chan)
+{
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		printf("    L2CAP CID 0x%4.4x: TX %lu frames %" PRIu64
+				" bytes (%.1f kb/s), RX %lu frames %" PRIu64
+				" bytes (%.1f kb/s)\n", chan->cid,
+				chan->tx.num, chan->tx.bytes,
+				traffic_kbps(&chan->tx), chan->rx.num,
+				chan->rx.bytes, traffic_kbps(&chan->rx));
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("l2cap,%u,%u,%u,%lu,%" PRIu64 ",%.1f,%lu,%" PRIu64
+				",%.1f\n", dev->index, conn->handle, chan->cid,
+				chan->tx.num, chan->tx.bytes,
+				traffic_kbps(&chan->tx), chan->rx.num,
+				chan->rx.bytes, traffic_kbps(&chan->rx));
+		break;
+	case ANALYZE_FORMAT_JSON:
+		printf("{\"type\":\"l2cap\",\"index\":%u,\"handle\":%u,"
+				"\"cid\":%u,\"tx_frames\":%lu,\"tx_bytes\":%"
+				PRIu64 ",\"tx_kbps\":%.1f,\"rx_frames\":%lu,"
+				"\"rx_bytes\":%" PRIu64 ",\"rx_kbps\":%.1f}\n",
+				dev->index, conn->handle, chan->cid,
+				chan->tx.num, chan->tx.bytes,
+				traffic_kbps(&chan->tx), chan->rx.num,
+				chan->rx.bytes, traffic_kbps(&chan->rx));
+		break;
+	}
+}
+
+static void print_conn(struct hci_dev *dev, struct hci_conn *conn)
+{
+	const struct queue_entry *entry;
+	uint64_t duration = 0;
+	char prefix[32];
+
+	if (conn->setup && conn->disconnected)
+		duration = elapsed_usec(&conn->time_setup,
+						&conn->time_disconnect);
+
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		printf("  Found %s connection with handle %u\n",
+				conn_type_str(conn->type), conn->handle);
+		if (conn->setup) {
+			printf("    BD_ADDR ");
+			print_addr(conn->bdaddr);
+			printf("\n");
+		}
+		if (duration)
+			printf("    Connected for %.3f seconds\n",
+							duration / 1000000.0);
+		printf("    TX %lu packets %" PRIu64 " bytes (%.1f kb/s)\n",
+					conn->tx.num, conn->tx.bytes,
+					traffic_kbps(&conn->tx));
+		printf("    RX %lu packets %" PRIu64 " bytes (%.1f kb/s)\n",
+					conn->rx.num, conn->rx.bytes,
+					traffic_kbps(&conn->rx));
+		if (conn->tx_latency.count) {
+			printf("    %lu packets completed, ",
+						conn->tx_latency.count);
+			print_latency_text(&conn->tx_latency);
+		}
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("conn,%u,%u,%s,%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X,"
+				"%" PRIu64 ",%lu,%" PRIu64 ",%.1f,%lu,%" PRIu64
+				",%.1f,%lu,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+				"\n",
+				dev->index, conn->handle,
+				conn_type_str(conn->type),
+				conn->bdaddr[5], conn->bdaddr[4],
+				conn->bdaddr[3], conn->bdaddr[2],
+				conn->bdaddr[1], conn->bdaddr[0], duration,
+				conn->tx.num, conn->tx.bytes,
+				traffic_kbps(&conn->tx), conn->rx.num,
+				conn->rx.bytes, traffic_kbps(&conn->rx),
+				conn->tx_latency.count, conn->tx_latency.min,
+				latency_avg(&conn->tx_latency),
+				conn->tx_latency.max);
+		snprintf(prefix, sizeof(prefix), "conn_hist,%u,%u",
+						dev->index, conn->handle);
+		print_latency_csv(prefix, &conn->tx_latency);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		printf("{\"type\":\"conn\",\"index\":%u,\"handle\":%u,"
+				"\"link\":\"%s\",\"address\":\"%2.2X:%2.2X:"
+				"%2.2X:%2.2X:%2.2X:%2.2X\",\"duration_us\":%"
+				PRIu64 ",\"tx_packets\":%lu,\"tx_bytes\":%"
+				PRIu64 ",\"tx_kbps\":%.1f,\"rx_packets\":%lu,"
+				"\"rx_bytes\":%" PRIu64 ",\"rx_kbps\":%.1f,"
+				"\"completed\":{", dev->index, conn->handle,
+				conn_type_str(conn->type),
+				conn->bdaddr[5], conn->bdaddr[4],
+				conn->bdaddr[3], conn->bdaddr[2],
+				conn->bdaddr[1], conn->bdaddr[0], duration,
+				conn->tx.num, conn->tx.bytes,
+				traffic_kbps(&conn->tx), conn->rx.num,
+				conn->rx.bytes, traffic_kbps(&conn->rx));
+		print_latency_json(&conn->tx_latency);
+		printf("}}\n");
+		break;
+	}
+
+	for (entry = queue_get_entries(conn->chan_list); entry;
+							entry = entry->next)
+		print_chan(dev, conn, entry->data);
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+
+	queue_destroy(conn->tx_queue, free);
+	queue_destroy(conn->chan_list, chan_destroy);
+	free(conn);
+}
+
+static void print_cmd(struct hci_dev *dev, struct cmd_stat *stat)
+{
+	char prefix[32];
+
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		printf("  Command 0x%4.4x (%s): %lu completed\n",
+					stat->opcode,
+					packet_opcode_str(stat->opcode),
+					stat->latency.count);
+		printf("    ");
+		print_latency_text(&stat->latency);
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("cmd,%u,0x%4.4x,%lu,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+				"\n", dev->index, stat->opcode,
+				stat->latency.count, stat->latency.min,
+				latency_avg(&stat->latency), stat->latency.max);
+		snprintf(prefix, sizeof(prefix), "cmd_hist,%u,0x%4.4x",
+						dev->index, stat->opcode);
+		print_latency_csv(prefix, &stat->latency);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		printf("{\"type\":\"cmd\",\"index\":%u,\"opcode\":%u,",
+						dev->index, stat->opcode);
+		print_latency_json(&stat->latency);
+		printf("}\n");
+		break;
+	}
+}
+
+static void print_credits(struct hci_dev *dev, const char *label,
+						struct credits *credits)
+{
+	if (!credits->max)
+		return;
+
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		printf("  %s buffers %u: starved %lu times for %.3f ms\n",
+					label, credits->max, credits->starved,
+					credits->starved_usec / 1000.0);
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("credits,%u,%s,%u,%lu,%" PRIu64 "\n", dev->index,
+					label, credits->max, credits->starved,
+					credits->starved_usec);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		printf("{\"type\":\"credits\",\"index\":%u,\"link\":\"%s\","
+				"\"buffers\":%u,\"starved\":%lu,"
+				"\"starved_us\":%" PRIu64 "}\n", dev->index,
+				label, credits->max, credits->starved,
+				credits->starved_usec);
+		break;
+	}
+}
+
+static void print_dev_text(struct hci_dev *dev)
 {
-	struct hci_dev *dev = data;
 	const char *str;
 
 	switch (dev->type) {
@@ -74,9 +490,8 @@ static void dev_destroy(void *data)
 	}
 
 	printf("Found %s controller with index %u\n", str, dev->index);
-	printf("  BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
-			dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
-			dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0]);
+	printf("  BD_ADDR ");
+	print_addr(dev->bdaddr);
 	if (dev->manufacturer != 0xffff)
 		printf(" (%s)", bt_compidtostr(dev->manufacturer));
 	printf("\n");
@@ -90,8 +505,55 @@ static void dev_destroy(void *data)
 	printf("  %lu system notes\n", dev->system_note);
 	printf("  %lu user logs\n", dev->user_log);
 	printf("  %lu unknown opcodes\n", dev->unknown);
-	printf("\n");
+}
 
+static void dev_destroy(void *data)
+{
+	struct hci_dev *dev = data;
+	const struct queue_entry *entry;
+
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		print_dev_text(dev);
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("dev,%u,%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X,%lu,%lu,"
+				"%lu,%lu\n", dev->index,
+				dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
+				dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0],
+				dev->num_cmd, dev->num_evt, dev->num_acl,
+				dev->num_sco);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		printf("{\"type\":\"dev\",\"index\":%u,\"address\":\"%2.2X:"
+				"%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\","
+				"\"commands\":%lu,\"events\":%lu,\"acl\":%lu,"
+				"\"sco\":%lu}\n",
+				dev->index,
+				dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
+				dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0],
+				dev->num_cmd, dev->num_evt, dev->num_acl,
+				dev->num_sco);
+		break;
+	}
+
+	print_credits(dev, "ACL", &dev->acl_credits);
+	print_credits(dev, "LE", &dev->le_credits);
+
+	for (entry = queue_get_entries(dev->cmd_list); entry;
+							entry = entry->next)
+		print_cmd(dev, entry->data);
+
+	for (entry = queue_get_entries(dev->conn_list); entry;
+							entry = entry->next)
+		print_conn(dev, entry->data);
+
+	if (out_format == ANALYZE_FORMAT_TEXT)
+		printf("\n");
+
+	queue_destroy(dev->conn_list, conn_destroy);
+	queue_destroy(dev->cmd_list, free);
+	queue_destroy(dev->pending_cmds, free);
 	free(dev);
 }
 
@@ -103,6 +565,9 @@ static struct hci_dev *dev_alloc(uint16_t index)
 
 	dev->index = index;
 	dev->manufacturer = 0xffff;
+	dev->conn_list = queue_new();
+	dev->cmd_list = queue_new();
+	dev->pending_cmds = queue_new();
 
 	return dev;
 }
@@ -131,6 +596,75 @@ static struct hci_dev *dev_lookup(uint16_t index)
 	return dev;
 }
 
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return !conn->disconnected && conn->handle == handle;
+}
+
+/*
+ * Connections that were already up when the trace started are created on
+ * first use of their handle; a handle reused after a disconnection gets
+ * a new entry.
+ */
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle,
+								uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (conn) {
+		if (conn->type == CONN_TYPE_UNKNOWN)
+			conn->type = type;
+		return conn;
+	}
+
+	conn = new0(struct hci_conn, 1);
+	conn->handle = handle;
+	conn->type = type;
+	conn->tx_queue = queue_new();
+	conn->chan_list = queue_new();
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static struct credits *conn_credits(struct hci_dev *dev,
+						struct hci_conn *conn)
+{
+	if (conn->type == CONN_TYPE_LE && dev->le_credits.max)
+		return &dev->le_credits;
+
+	return &dev->acl_credits;
+}
+
+static bool chan_match_cid(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+	uint16_t cid = PTR_TO_UINT(b);
+
+	return chan->cid == cid;
+}
+
+static struct l2cap_chan *chan_lookup(struct hci_conn *conn, uint16_t cid)
+{
+	struct l2cap_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match_cid, UINT_TO_PTR(cid));
+	if (!chan) {
+		chan = new0(struct l2cap_chan, 1);
+		chan->cid = cid;
+
+		queue_push_tail(conn->chan_list, chan);
+	}
+
+	return chan;
+}
+
 static void new_index(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -163,6 +697,7 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_cmd_hdr *hdr = data;
+	struct pending_cmd *cmd;
 	struct hci_dev *dev;
 
 	data += sizeof(*hdr);
@@ -173,6 +708,56 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_cmd++;
+
+	cmd = new0(struct pending_cmd, 1);
+	cmd->opcode = le16_to_cpu(hdr->opcode);
+	cmd->tv = *tv;
+
+	queue_push_tail(dev->pending_cmds, cmd);
+}
+
+static bool pending_match_opcode(const void *a, const void *b)
+{
+	const struct pending_cmd *cmd = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return cmd->opcode == opcode;
+}
+
+static bool stat_match_opcode(const void *a, const void *b)
+{
+	const struct cmd_stat *stat = a;
+	uint16_t opcode = PTR_TO_UINT(b);
+
+	return stat->opcode == opcode;
+}
+
+static void cmd_done(struct hci_dev *dev, struct timeval *tv,
+							uint16_t opcode)
+{
+	struct pending_cmd *cmd;
+	struct cmd_stat *stat;
+
+	if (!opcode)
+		return;
+
+	cmd = queue_remove_if(dev->pending_cmds, pending_match_opcode,
+							UINT_TO_PTR(opcode));
+	if (!cmd)
+		return;
+
+	stat = queue_find(dev->cmd_list, stat_match_opcode,
+							UINT_TO_PTR(opcode));
+	if (!stat) {
+		stat = new0(struct cmd_stat, 1);
+		stat->opcode = opcode;
+
+		queue_push_tail(dev->cmd_list, stat);
+	}
+
+	latency_add(&stat->latency, elapsed_usec(&cmd->tv, tv));
+
+	free(cmd);
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -180,7 +765,9 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 {
 	const struct bt_hci_rsp_read_bd_addr *rsp = data;
 
-	printf("Read BD Addr event with status 0x%2.2x\n", rsp->status);
+	if (out_format == ANALYZE_FORMAT_TEXT)
+		printf("Read BD Addr event with status 0x%2.2x\n",
+								rsp->status);
 
 	if (rsp->status)
 		return;
@@ -188,6 +775,28 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
+static void rsp_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->acl_credits.max = le16_to_cpu(rsp->acl_max_pkt);
+}
+
+static void rsp_le_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->le_credits.max = rsp->le_max_pkt;
+}
+
 static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
@@ -199,10 +808,164 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 
 	opcode = le16_to_cpu(evt->opcode);
 
+	cmd_done(dev, tv, opcode);
+
 	switch (opcode) {
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		rsp_read_buffer_size(dev, tv, data, size);
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		rsp_le_read_buffer_size(dev, tv, data, size);
+		break;
+	}
+}
+
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	cmd_done(dev, tv, le16_to_cpu(evt->opcode));
+}
+
+static void conn_setup(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, const uint8_t *bdaddr,
+				uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, handle, type);
+
+	conn->setup = true;
+	conn->time_setup = *tv;
+	memcpy(conn->bdaddr, bdaddr, 6);
+}
+
+static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle), evt->bdaddr,
+							CONN_TYPE_BREDR);
+}
+
+static void evt_sync_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_sync_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle), evt->bdaddr,
+							CONN_TYPE_SCO);
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+				UINT_TO_PTR(le16_to_cpu(evt->handle)));
+	if (!conn)
+		return;
+
+	conn->disconnected = true;
+	conn->time_disconnect = *tv;
+
+	/* Buffers of packets still in flight are implicitly returned */
+	credits_return(conn_credits(dev, conn), tv,
+					queue_length(conn->tx_queue));
+	queue_remove_all(conn->tx_queue, NULL, NULL, free);
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *num_handles = data;
+	const uint8_t *ptr = data + 1;
+	struct hci_conn *conn;
+	uint16_t handle, count;
+	struct timeval *sent;
+	int i;
+
+	if (size < 1 || size < 1 + *num_handles * 4)
+		return;
+
+	for (i = 0; i < *num_handles; i++, ptr += 4) {
+		handle = get_le16(ptr);
+		count = get_le16(ptr + 2);
+
+		conn = queue_find(dev->conn_list, conn_match_handle,
+							UINT_TO_PTR(handle));
+		if (!conn)
+			continue;
+
+		credits_return(conn_credits(dev, conn), tv, count);
+
+		while (count--) {
+			sent = queue_pop_head(conn->tx_queue);
+			if (!sent)
+				break;
+
+			latency_add(&conn->tx_latency,
+						elapsed_usec(sent, tv));
+			free(sent);
+		}
+	}
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *subevent = data;
+
+	if (size < 1)
+		return;
+
+	data += 1;
+	size -= 1;
+
+	switch (*subevent) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		{
+			const struct bt_hci_evt_le_conn_complete *evt = data;
+
+			if (size < sizeof(*evt) || evt->status)
+				return;
+
+			conn_setup(dev, tv, le16_to_cpu(evt->handle),
+					evt->peer_addr, CONN_TYPE_LE);
+		}
+		break;
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		{
+			const struct bt_hci_evt_le_enhanced_conn_complete *evt;
+
+			evt = data;
+
+			if (size < sizeof(*evt) || evt->status)
+				return;
+
+			conn_setup(dev, tv, le16_to_cpu(evt->handle),
+					evt->peer_addr, CONN_TYPE_LE);
+		}
+		break;
 	}
 }
 
@@ -225,14 +988,38 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		evt_sync_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
+	const struct bt_l2cap_hdr *l2cap;
+	struct l2cap_chan *chan;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
+	struct timeval *sent;
+	uint16_t handle = le16_to_cpu(hdr->handle);
+	uint8_t flags = handle >> 12;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -242,12 +1029,34 @@ static void acl_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_acl++;
+
+	conn = conn_lookup(dev, handle & 0x0fff, CONN_TYPE_UNKNOWN);
+
+	traffic_add(out ? &conn->tx : &conn->rx, tv, size);
+
+	if (out) {
+		sent = new0(struct timeval, 1);
+		*sent = *tv;
+		queue_push_tail(conn->tx_queue, sent);
+
+		credits_take(conn_credits(dev, conn), tv);
+	}
+
+	/* Goodput is accounted from the L2CAP header of start fragments */
+	if ((flags & 0x03) == 0x01 || size < sizeof(*l2cap))
+		return;
+
+	l2cap = data;
+	chan = chan_lookup(conn, le16_to_cpu(l2cap->cid));
+
+	traffic_add(out ? &chan->tx : &chan->rx, tv, le16_to_cpu(l2cap->len));
 }
 
-static void sco_pkt(struct timeval *tv, uint16_t index,
+static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_sco_hdr *hdr = data;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
 
 	data += sizeof(*hdr);
@@ -258,6 +1067,11 @@ static void sco_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_sco++;
+
+	conn = conn_lookup(dev, le16_to_cpu(hdr->handle) & 0x0fff,
+							CONN_TYPE_SCO);
+
+	traffic_add(out ? &conn->tx : &conn->rx, tv, size);
 }
 
 static void info_index(struct timeval *tv, uint16_t index,
@@ -324,7 +1138,7 @@ static void unknown_opcode(struct timeval *tv, uint16_t index,
 	dev->unknown++;
 }
 
-void analyze_trace(const char *path)
+void analyze_trace(const char *path, enum analyze_format fmt)
 {
 	struct btsnoop *btsnoop_file;
 	unsigned long num_packets = 0;
@@ -346,6 +1160,28 @@ void analyze_trace(const char *path)
 		goto done;
 	}
 
+	out_format = fmt;
+
+	switch (out_format) {
+	case ANALYZE_FORMAT_TEXT:
+		break;
+	case ANALYZE_FORMAT_CSV:
+		printf("# dev,index,address,commands,events,acl,sco\n");
+		printf("# credits,index,link,buffers,starved,starved_us\n");
+		printf("# cmd,index,opcode,count,min_us,avg_us,max_us\n");
+		printf("# cmd_hist,index,opcode,low_us,high_us,count\n");
+		printf("# conn,index,handle,link,address,duration_us,"
+				"tx_packets,tx_bytes,tx_kbps,rx_packets,"
+				"rx_bytes,rx_kbps,completed,min_us,avg_us,"
+				"max_us\n");
+		printf("# conn_hist,index,handle,low_us,high_us,count\n");
+		printf("# l2cap,index,handle,cid,tx_frames,tx_bytes,tx_kbps,"
+				"rx_frames,rx_bytes,rx_kbps\n");
+		break;
+	case ANALYZE_FORMAT_JSON:
+		break;
+	}
+
 	dev_list = queue_new();
 
 	while (1) {
@@ -372,11 +1208,15 @@ void analyze_trace(const char *path)
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(&tv, index,
+				opcode == BTSNOOP_OPCODE_ACL_TX_PKT,
+				buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, buf, pktlen);
+			sco_pkt(&tv, index,
+				opcode == BTSNOOP_OPCODE_SCO_TX_PKT,
+				buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_OPEN_INDEX:
 		case BTSNOOP_OPCODE_CLOSE_INDEX:
@@ -402,7 +1242,8 @@ void analyze_trace(const char *path)
 		num_packets++;
 	}
 
-	printf("Trace contains %lu packets\n\n", num_packets);
+	if (out_format == ANALYZE_FORMAT_TEXT)
+		printf("Trace contains %lu packets\n\n", num_packets);
 
 	queue_destroy(dev_list, dev_destroy);
 
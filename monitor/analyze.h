@@ -22,4 +22,10 @@
  *
  */
 
-void analyze_trace(const char *path);
+enum analyze_format {
+	ANALYZE_FORMAT_TEXT,
+	ANALYZE_FORMAT_CSV,
+	ANALYZE_FORMAT_JSON,
+};
+
+void analyze_trace(const char *path, enum analyze_format format);
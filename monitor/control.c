@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -52,6 +53,7 @@
 #include "packet.h"
 #include "hcidump.h"
 #include "ellisys.h"
+#include "filter.h"
 #include "tty.h"
 #include "control.h"
 
@@ -59,6 +61,11 @@ static struct btsnoop *btsnoop_file = NULL;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
 
+static unsigned long reader_start_packet = 0;
+static struct timeval reader_start_time;
+static bool reader_start_time_set = false;
+static bool reader_save_index = false;
+
 struct control_data {
 	uint16_t channel;
 	int fd;
@@ -974,6 +981,9 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 							data->buf, pktlen);
 			break;
 		case HCI_CHANNEL_MONITOR:
+			if (!filter_packet(index, opcode, data->buf, pktlen))
+				break;
+
 			btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0,
 							data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
@@ -1025,6 +1035,10 @@ static int open_socket(uint16_t channel)
 		return -1;
 	}
 
+	/* Not fatal, filter_packet() still drops unwanted packets */
+	if (channel == HCI_CHANNEL_MONITOR && filter_attach(fd) < 0)
+		fprintf(stderr, "Failed to attach packet filter\n");
+
 	return fd;
 }
 
@@ -1078,7 +1092,9 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 		opcode = le16_to_cpu(hdr->opcode);
 		index = le16_to_cpu(hdr->index);
 
-		packet_monitor(NULL, NULL, index, opcode,
+		if (filter_packet(index, opcode, data->buf + MGMT_HDR_SIZE,
+								pktlen))
+			packet_monitor(NULL, NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
 
 		data->offset -= pktlen + MGMT_HDR_SIZE;
@@ -1305,11 +1321,16 @@ static void tty_callback(int fd, uint32_t events, void *user_data)
 		opcode = le16_to_cpu(hdr->opcode);
 		pktlen = data_len - 4 - hdr->hdr_len;
 
+		if (!filter_packet(0, opcode, hdr->ext_hdr + hdr->hdr_len,
+								pktlen))
+			goto next;
+
 		btsnoop_write_hci(btsnoop_file, tv, 0, opcode, drops,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 		packet_monitor(tv, NULL, 0, opcode,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
 
+next:
 		data->offset -= 2 + data_len;
 
 		if (data->offset > 0)
@@ -1371,16 +1392,125 @@ int control_tty(const char *path, unsigned int speed)
 	return 0;
 }
 
-bool control_writer(const char *path)
+#define WRITER_FLUSH_INTERVAL 1000
+
+static int writer_flush_id = -1;
+
+static void writer_flush_callback(int id, void *user_data)
+{
+	btsnoop_flush(btsnoop_file);
+
+	mainloop_modify_timeout(id, WRITER_FLUSH_INTERVAL);
+}
+
+bool control_writer(const char *path, size_t buffer_size)
 {
 	btsnoop_file = btsnoop_create(path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	if (!buffer_size)
+		return true;
+
+	/*
+	 * Buffered records are written by a background thread at least
+	 * once per flush interval, even if no more traffic arrives.
+	 */
+	if (!btsnoop_set_buffer(btsnoop_file, buffer_size,
+					WRITER_FLUSH_INTERVAL, true)) {
+		btsnoop_unref(btsnoop_file);
+		btsnoop_file = NULL;
+		return false;
+	}
+
+	writer_flush_id = mainloop_add_timeout(WRITER_FLUSH_INTERVAL,
+						writer_flush_callback,
+						NULL, NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	if (writer_flush_id >= 0) {
+		mainloop_remove_timeout(writer_flush_id);
+		writer_flush_id = -1;
+	}
 
-	return !!btsnoop_file;
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+void control_reader_start_packet(unsigned long num)
+{
+	reader_start_packet = num;
+	reader_start_time_set = false;
+}
+
+void control_reader_start_time(const struct timeval *offset)
+{
+	reader_start_time = *offset;
+	reader_start_time_set = true;
+	reader_start_packet = 0;
+}
+
+void control_reader_save_index(void)
+{
+	reader_save_index = true;
+}
+
+/*
+ * Jumping into a trace goes through an index of all records. Only when
+ * asked for, it is kept as <trace>.idx next to the trace so that later
+ * runs can use it right away.
+ */
+static bool reader_seek(const char *path)
+{
+	char index_path[PATH_MAX], *index_file = NULL;
+	unsigned long count;
+	const void *data;
+	struct timeval tv;
+	uint16_t index, opcode, size;
+
+	if (!reader_start_packet && !reader_start_time_set)
+		return true;
+
+	if (reader_save_index) {
+		snprintf(index_path, sizeof(index_path), "%s.idx", path);
+		index_file = index_path;
+	}
+
+	if (!btsnoop_build_index(btsnoop_file, index_file)) {
+		fprintf(stderr, "Failed to index trace file\n");
+		return false;
+	}
+
+	count = btsnoop_get_index_count(btsnoop_file);
+
+	if (reader_start_packet) {
+		if (reader_start_packet > count) {
+			fprintf(stderr, "Trace has only %lu packets\n", count);
+			return false;
+		}
+
+		return btsnoop_seek_packet(btsnoop_file,
+						reader_start_packet - 1);
+	}
+
+	/* Time offsets count from the first packet of the trace */
+	if (!btsnoop_read_hci_data(btsnoop_file, &tv, &index, &opcode,
+								&data, &size))
+		return true;
+
+	timeradd(&tv, &reader_start_time, &tv);
+
+	return btsnoop_seek_time(btsnoop_file, &tv, NULL);
 }
 
 void control_reader(const char *path, bool pager)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+	const void *data;
 	uint16_t pktlen;
 	uint32_t format;
 	struct timeval tv;
@@ -1389,6 +1519,12 @@ void control_reader(const char *path, bool pager)
 	if (!btsnoop_file)
 		return;
 
+	if (!reader_seek(path)) {
+		btsnoop_unref(btsnoop_file);
+		btsnoop_file = NULL;
+		return;
+	}
+
 	format = btsnoop_get_format(btsnoop_file);
 
 	switch (format) {
@@ -1413,15 +1549,18 @@ void control_reader(const char *path, bool pager)
 		while (1) {
 			uint16_t index, opcode;
 
-			if (!btsnoop_read_hci(btsnoop_file, &tv, &index,
-							&opcode, buf, &pktlen))
+			if (!btsnoop_read_hci_data(btsnoop_file, &tv, &index,
+							&opcode, &data, &pktlen))
 				break;
 
 			if (opcode == 0xffff)
 				continue;
 
-			packet_monitor(&tv, NULL, index, opcode, buf, pktlen);
-			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
+			if (!filter_packet(index, opcode, data, pktlen))
+				continue;
+
+			packet_monitor(&tv, NULL, index, opcode, data, pktlen);
+			ellisys_inject_hci(&tv, index, opcode, data, pktlen);
 		}
 		break;
 
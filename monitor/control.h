@@ -23,12 +23,17 @@
  */
 
 #include <stdint.h>
+#include <sys/time.h>
 
-bool control_writer(const char *path);
+bool control_writer(const char *path, size_t buffer_size);
+void control_reader_start_packet(unsigned long num);
+void control_reader_start_time(const struct timeval *offset);
+void control_reader_save_index(void);
 void control_reader(const char *path, bool pager);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
 int control_tracing(void);
 void control_disable_decoding(void);
+void control_cleanup(void);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
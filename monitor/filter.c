@@ -0,0 +1,623 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+
+#include "filter.h"
+
+/*
+ * A filter is a comma separated list of key=value terms. Terms with the
+ * same key match if any of their values match, terms with different keys
+ * must all match. Every key only applies to the packets that carry that
+ * field; all other packets pass it unchanged:
+ *
+ *	index=<num>	controller index, also given as hci<num>
+ *	type=<name>	cmd, evt, acl or sco
+ *	handle=<num>	connection handle of ACL and SCO data
+ *	opcode=<num>	command opcode, also matched in Command Complete
+ *			and Command Status events
+ *	event=<num>	event code
+ *	cid=<num>	L2CAP channel of ACL data
+ *
+ * The same filter is compiled into a classic BPF program for the monitor
+ * socket, so that most unwanted packets never leave the kernel.
+ */
+
+#define FILTER_MAX_VALUES	16
+
+#define FILTER_TYPE_CMD		(1 << 0)
+#define FILTER_TYPE_EVT		(1 << 1)
+#define FILTER_TYPE_ACL		(1 << 2)
+#define FILTER_TYPE_SCO		(1 << 3)
+
+struct filter_set {
+	unsigned int count;
+	uint16_t values[FILTER_MAX_VALUES];
+};
+
+static bool filter_enabled;
+static uint8_t filter_types;
+static struct filter_set filter_index;
+static struct filter_set filter_handle;
+static struct filter_set filter_opcode;
+static struct filter_set filter_event;
+static struct filter_set filter_cid;
+
+/* Result of the last start fragment, used for ACL continuations */
+struct acl_state {
+	uint16_t index;
+	uint16_t handle;
+	bool match;
+};
+
+static struct queue *acl_list;
+
+static const struct {
+	const char *str;
+	uint8_t type;
+} type_table[] = {
+	{ "cmd", FILTER_TYPE_CMD },
+	{ "evt", FILTER_TYPE_EVT },
+	{ "acl", FILTER_TYPE_ACL },
+	{ "sco", FILTER_TYPE_SCO },
+	{ }
+};
+
+static bool set_add(struct filter_set *set, const char *str,
+							unsigned long max)
+{
+	unsigned long val;
+	char *end;
+
+	if (set->count == FILTER_MAX_VALUES)
+		return false;
+
+	errno = 0;
+	val = strtoul(str, &end, 0);
+	if (errno || end == str || *end || val > max)
+		return false;
+
+	set->values[set->count++] = val;
+
+	return true;
+}
+
+static bool set_match(const struct filter_set *set, uint16_t value)
+{
+	unsigned int i;
+
+	if (!set->count)
+		return true;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->values[i] == value)
+			return true;
+	}
+
+	return false;
+}
+
+static bool parse_type(const char *str)
+{
+	int i;
+
+	for (i = 0; type_table[i].str; i++) {
+		if (!strcmp(type_table[i].str, str)) {
+			filter_types |= type_table[i].type;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool parse_term(char *term)
+{
+	char *value;
+
+	if (!strncmp(term, "hci", 3))
+		return set_add(&filter_index, term + 3, 0xfffe);
+
+	value = strchr(term, '=');
+	if (!value)
+		return false;
+
+	*value++ = '\0';
+
+	if (!strcmp(term, "index")) {
+		if (!strncmp(value, "hci", 3))
+			value += 3;
+		return set_add(&filter_index, value, 0xfffe);
+	}
+
+	if (!strcmp(term, "type"))
+		return parse_type(value);
+
+	if (!strcmp(term, "handle"))
+		return set_add(&filter_handle, value, 0x0fff);
+
+	if (!strcmp(term, "opcode"))
+		return set_add(&filter_opcode, value, 0xffff);
+
+	if (!strcmp(term, "event"))
+		return set_add(&filter_event, value, 0xff);
+
+	if (!strcmp(term, "cid"))
+		return set_add(&filter_cid, value, 0xffff);
+
+	return false;
+}
+
+bool filter_set(const char *expr)
+{
+	char *str, *term, *saveptr = NULL;
+	bool result = true;
+
+	str = strdup(expr);
+	if (!str)
+		return false;
+
+	for (term = strtok_r(str, ", ", &saveptr); term;
+				term = strtok_r(NULL, ", ", &saveptr)) {
+		if (!parse_term(term)) {
+			result = false;
+			break;
+		}
+	}
+
+	free(str);
+
+	if (result)
+		filter_enabled = true;
+
+	return result;
+}
+
+static bool filter_type(uint8_t type)
+{
+	return !filter_types || (filter_types & type);
+}
+
+static bool filter_command(const uint8_t *data, uint16_t size)
+{
+	if (!filter_type(FILTER_TYPE_CMD))
+		return false;
+
+	if (!filter_opcode.count)
+		return true;
+
+	if (size < 2)
+		return false;
+
+	return set_match(&filter_opcode, get_le16(data));
+}
+
+static bool filter_event_pkt(const uint8_t *data, uint16_t size)
+{
+	if (!filter_type(FILTER_TYPE_EVT))
+		return false;
+
+	if (!filter_event.count && !filter_opcode.count)
+		return true;
+
+	if (size < 1 || !set_match(&filter_event, data[0]))
+		return false;
+
+	if (!filter_opcode.count)
+		return true;
+
+	switch (data[0]) {
+	case 0x0e:
+		if (size < 5)
+			return false;
+		return set_match(&filter_opcode, get_le16(data + 3));
+	case 0x0f:
+		if (size < 6)
+			return false;
+		return set_match(&filter_opcode, get_le16(data + 4));
+	}
+
+	return true;
+}
+
+static bool match_acl_state(const void *data, const void *user_data)
+{
+	const struct acl_state *state = data;
+	const struct acl_state *key = user_data;
+
+	return state->index == key->index && state->handle == key->handle;
+}
+
+static struct acl_state *acl_state_get(uint16_t index, uint16_t handle)
+{
+	struct acl_state key = { .index = index, .handle = handle };
+	struct acl_state *state;
+
+	if (!acl_list)
+		acl_list = queue_new();
+
+	state = queue_find(acl_list, match_acl_state, &key);
+	if (state)
+		return state;
+
+	state = new0(struct acl_state, 1);
+	state->index = index;
+	state->handle = handle;
+
+	queue_push_tail(acl_list, state);
+
+	return state;
+}
+
+static bool filter_acl(uint16_t index, const uint8_t *data, uint16_t size)
+{
+	struct acl_state *state;
+	uint16_t handle;
+
+	if (!filter_type(FILTER_TYPE_ACL))
+		return false;
+
+	if (!filter_handle.count && !filter_cid.count)
+		return true;
+
+	if (size < 2)
+		return false;
+
+	handle = get_le16(data) & 0x0fff;
+
+	if (!set_match(&filter_handle, handle))
+		return false;
+
+	if (!filter_cid.count)
+		return true;
+
+	state = acl_state_get(index, handle);
+
+	/* Continuation fragments follow their start fragment */
+	if ((get_le16(data) >> 12 & 0x03) == 0x01)
+		return state->match;
+
+	state->match = size >= 8 &&
+			set_match(&filter_cid, get_le16(data + 6));
+
+	return state->match;
+}
+
+static bool filter_sco(const uint8_t *data, uint16_t size)
+{
+	if (!filter_type(FILTER_TYPE_SCO))
+		return false;
+
+	if (!filter_handle.count)
+		return true;
+
+	if (size < 2)
+		return false;
+
+	return set_match(&filter_handle, get_le16(data) & 0x0fff);
+}
+
+bool filter_packet(uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	if (!filter_enabled)
+		return true;
+
+	/* Packets not bound to a controller always pass */
+	if (index != 0xffff && !set_match(&filter_index, index))
+		return false;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		return filter_command(data, size);
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		return filter_event_pkt(data, size);
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		return filter_acl(index, data, size);
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		return filter_sco(data, size);
+	}
+
+	return true;
+}
+
+/*
+ * Monitor socket packets start with the little endian opcode, index and
+ * length fields, followed by the HCI packet. BPF loads halfwords in big
+ * endian, so all compared 16-bit values are byte swapped.
+ */
+#define MON_OPCODE	0
+#define MON_INDEX	2
+#define MON_DATA	6
+
+#define PROG_MAX	256
+#define LABEL_MAX	16
+#define LABEL_NEXT	-1
+
+struct prog {
+	struct sock_filter insns[PROG_MAX];
+	int jt[PROG_MAX];
+	int jf[PROG_MAX];
+	unsigned int len;
+	int labels[LABEL_MAX];
+	unsigned int num_labels;
+};
+
+static uint16_t swap16(uint16_t val)
+{
+	return val << 8 | val >> 8;
+}
+
+static int new_label(struct prog *prog)
+{
+	prog->labels[prog->num_labels] = -1;
+
+	return prog->num_labels++;
+}
+
+static void set_label(struct prog *prog, int label)
+{
+	prog->labels[label] = prog->len;
+}
+
+static void emit_jump(struct prog *prog, uint16_t code, uint32_t k,
+							int jt, int jf)
+{
+	if (prog->len == PROG_MAX)
+		return;
+
+	prog->insns[prog->len].code = code;
+	prog->insns[prog->len].k = k;
+	prog->jt[prog->len] = jt;
+	prog->jf[prog->len] = jf;
+	prog->len++;
+}
+
+static void emit(struct prog *prog, uint16_t code, uint32_t k)
+{
+	emit_jump(prog, code, k, LABEL_NEXT, LABEL_NEXT);
+}
+
+static void emit_goto(struct prog *prog, int label)
+{
+	emit_jump(prog, BPF_JMP | BPF_JA, 0, label, LABEL_NEXT);
+}
+
+/* Jump to match if the accumulator holds one of the values of the set */
+static void emit_set(struct prog *prog, const struct filter_set *set,
+						bool swap, int match)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++) {
+		uint16_t val = swap ? swap16(set->values[i]) : set->values[i];
+
+		emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K, val,
+							match, LABEL_NEXT);
+	}
+}
+
+static bool resolve(struct prog *prog)
+{
+	unsigned int i;
+
+	if (prog->len == PROG_MAX)
+		return false;
+
+	for (i = 0; i < prog->len; i++) {
+		struct sock_filter *insn = &prog->insns[i];
+		int jt = 0, jf = 0;
+
+		if (prog->jt[i] != LABEL_NEXT)
+			jt = prog->labels[prog->jt[i]] - i - 1;
+
+		if (prog->jf[i] != LABEL_NEXT)
+			jf = prog->labels[prog->jf[i]] - i - 1;
+
+		if (jt < 0 || jf < 0 || jt > 255 || jf > 255)
+			return false;
+
+		/* Unconditional jumps take their offset in k */
+		if (BPF_CLASS(insn->code) == BPF_JMP &&
+					BPF_OP(insn->code) == BPF_JA) {
+			insn->k = jt;
+			continue;
+		}
+
+		insn->jt = jt;
+		insn->jf = jf;
+	}
+
+	return true;
+}
+
+/* Reject the packet unless its type passes the type filter */
+static void emit_type(struct prog *prog, uint8_t type, int reject)
+{
+	if (!filter_type(type))
+		emit_goto(prog, reject);
+}
+
+static void emit_handle(struct prog *prog, int reject)
+{
+	int match;
+
+	if (!filter_handle.count)
+		return;
+
+	match = new_label(prog);
+
+	emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_DATA);
+	emit(prog, BPF_ALU | BPF_AND | BPF_K, swap16(0x0fff));
+	emit_set(prog, &filter_handle, true, match);
+	emit_goto(prog, reject);
+	set_label(prog, match);
+}
+
+static bool build_prog(struct prog *prog)
+{
+	int accept, reject, cmd, evt, acl, sco;
+
+	memset(prog, 0, sizeof(*prog));
+
+	accept = new_label(prog);
+	reject = new_label(prog);
+	cmd = new_label(prog);
+	evt = new_label(prog);
+	acl = new_label(prog);
+	sco = new_label(prog);
+
+	if (filter_index.count) {
+		int match = new_label(prog);
+
+		emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_INDEX);
+		emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K, 0xffff,
+							match, LABEL_NEXT);
+		emit_set(prog, &filter_index, true, match);
+		emit_goto(prog, reject);
+		set_label(prog, match);
+	}
+
+	emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_OPCODE);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_COMMAND_PKT), cmd, LABEL_NEXT);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_EVENT_PKT), evt, LABEL_NEXT);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_ACL_TX_PKT), acl, LABEL_NEXT);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_ACL_RX_PKT), acl, LABEL_NEXT);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_SCO_TX_PKT), sco, LABEL_NEXT);
+	emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K,
+			swap16(BTSNOOP_OPCODE_SCO_RX_PKT), sco, LABEL_NEXT);
+	emit_goto(prog, accept);
+
+	set_label(prog, cmd);
+	emit_type(prog, FILTER_TYPE_CMD, reject);
+	if (filter_opcode.count) {
+		emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_DATA);
+		emit_set(prog, &filter_opcode, true, accept);
+		emit_goto(prog, reject);
+	}
+	emit_goto(prog, accept);
+
+	set_label(prog, evt);
+	emit_type(prog, FILTER_TYPE_EVT, reject);
+	if (filter_event.count) {
+		int match = new_label(prog);
+
+		emit(prog, BPF_LD | BPF_B | BPF_ABS, MON_DATA);
+		emit_set(prog, &filter_event, false, match);
+		emit_goto(prog, reject);
+		set_label(prog, match);
+	}
+	if (filter_opcode.count) {
+		int cc = new_label(prog);
+		int cs = new_label(prog);
+
+		emit(prog, BPF_LD | BPF_B | BPF_ABS, MON_DATA);
+		emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K, 0x0e,
+							cc, LABEL_NEXT);
+		emit_jump(prog, BPF_JMP | BPF_JEQ | BPF_K, 0x0f,
+							cs, LABEL_NEXT);
+		emit_goto(prog, accept);
+
+		set_label(prog, cc);
+		emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_DATA + 3);
+		emit_set(prog, &filter_opcode, true, accept);
+		emit_goto(prog, reject);
+
+		set_label(prog, cs);
+		emit(prog, BPF_LD | BPF_H | BPF_ABS, MON_DATA + 4);
+		emit_set(prog, &filter_opcode, true, accept);
+		emit_goto(prog, reject);
+	}
+	emit_goto(prog, accept);
+
+	set_label(prog, acl);
+	emit_type(prog, FILTER_TYPE_ACL, reject);
+	/*
+	 * The channel is left to filter_packet(), since it has to see every
+	 * start fragment to decide about the continuations that follow.
+	 */
+	emit_handle(prog, reject);
+	emit_goto(prog, accept);
+
+	set_label(prog, sco);
+	emit_type(prog, FILTER_TYPE_SCO, reject);
+	emit_handle(prog, reject);
+
+	set_label(prog, accept);
+	emit(prog, BPF_RET | BPF_K, 0xffffffff);
+
+	set_label(prog, reject);
+	emit(prog, BPF_RET | BPF_K, 0);
+
+	return resolve(prog);
+}
+
+int filter_attach(int fd)
+{
+	struct sock_fprog fprog;
+	struct prog *prog;
+	int err = 0;
+
+	if (!filter_enabled)
+		return 0;
+
+	prog = malloc(sizeof(*prog));
+	if (!prog)
+		return -ENOMEM;
+
+	if (!build_prog(prog)) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	fprog.len = prog->len;
+	fprog.filter = prog->insns;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+					&fprog, sizeof(fprog)) < 0)
+		err = -errno;
+
+done:
+	free(prog);
+
+	return err;
+}
@@ -28,9 +28,11 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <limits.h>
 #include <sys/un.h>
 
 #include "src/shared/mainloop.h"
@@ -41,6 +43,7 @@
 #include "keys.h"
 #include "analyze.h"
 #include "ellisys.h"
+#include "filter.h"
 #include "control.h"
 
 static void signal_callback(int signum, void *user_data)
@@ -60,11 +63,17 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t--start <num>          Start reading at packet number\n"
+		"\t--start-time <sec>     Start reading at seconds into trace\n"
+		"\t--save-index           Keep trace index in <file>.idx\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-W, --write-buffer <n> Buffer n KiB of saved traces\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
+		"\t--analyze-format <fmt> Analyze output (text, csv, json)\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
 		"\t-i, --index <num>      Show only specified controller\n"
+		"\t-f, --filter <expr>    Show only matching packets\n"
 		"\t-d, --tty <tty>        Read data from TTY\n"
 		"\t-B, --tty-speed <rate> Set TTY speed (default 115200)\n"
 		"\t-t, --time             Show time instead of time offset\n"
@@ -76,15 +85,61 @@ static void usage(void)
 		"\t-h, --help             Show help options\n");
 }
 
+/* Write buffer limits in KiB, the minimum holds one maximum sized record */
+#define WRITER_BUFFER_MIN	2
+#define WRITER_BUFFER_MAX	(1024 * 1024)
+
+static size_t parse_buffer_size(const char *str)
+{
+	unsigned long val;
+	char *end;
+
+	if (!isdigit(*str))
+		return 0;
+
+	errno = 0;
+	val = strtoul(str, &end, 10);
+	if (errno || *end || val < WRITER_BUFFER_MIN ||
+						val > WRITER_BUFFER_MAX)
+		return 0;
+
+	return val * 1024;
+}
+
+static bool parse_start_time(const char *str, struct timeval *tv)
+{
+	double val;
+	char *end;
+
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	val = strtod(str, &end);
+	if (errno || *end || val > LONG_MAX)
+		return false;
+
+	tv->tv_sec = val;
+	tv->tv_usec = (val - tv->tv_sec) * 1000000;
+
+	return true;
+}
+
 static const struct option main_options[] = {
 	{ "tty",       required_argument, NULL, 'd' },
 	{ "tty-speed", required_argument, NULL, 'B' },
 	{ "read",      required_argument, NULL, 'r' },
+	{ "start",     required_argument, NULL, 'j' },
+	{ "start-time", required_argument, NULL, 'J' },
+	{ "save-index", no_argument,      NULL, 'X' },
 	{ "write",     required_argument, NULL, 'w' },
+	{ "write-buffer", required_argument, NULL, 'W' },
 	{ "analyze",   required_argument, NULL, 'a' },
+	{ "analyze-format", required_argument, NULL, 'F' },
 	{ "server",    required_argument, NULL, 's' },
 	{ "priority",  required_argument, NULL, 'p' },
 	{ "index",     required_argument, NULL, 'i' },
+	{ "filter",    required_argument, NULL, 'f' },
 	{ "time",      no_argument,       NULL, 't' },
 	{ "date",      no_argument,       NULL, 'T' },
 	{ "sco",       no_argument,       NULL, 'S' },
@@ -103,7 +158,11 @@ int main(int argc, char *argv[])
 	bool use_pager = true;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	size_t writer_buffer = 0;
+	unsigned long start_packet;
+	struct timeval start_time;
 	const char *analyze_path = NULL;
+	enum analyze_format analyze_format = ANALYZE_FORMAT_TEXT;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
 	unsigned int tty_speed = B115200;
@@ -120,7 +179,7 @@ int main(int argc, char *argv[])
 		int opt;
 		struct sockaddr_un addr;
 
-		opt = getopt_long(argc, argv, "d:r:w:a:s:p:i:tTSAEP:vh",
+		opt = getopt_long(argc, argv, "d:r:w:W:a:s:p:i:f:tTSAEP:vh",
 							main_options, NULL);
 		if (opt < 0)
 			break;
@@ -139,12 +198,53 @@ int main(int argc, char *argv[])
 		case 'r':
 			reader_path = optarg;
 			break;
+		case 'j':
+			start_packet = isdigit(*optarg) ? atol(optarg) : 0;
+			if (!start_packet) {
+				fprintf(stderr, "Invalid packet number: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			control_reader_start_packet(start_packet);
+			break;
+		case 'J':
+			if (!parse_start_time(optarg, &start_time)) {
+				fprintf(stderr, "Invalid start time: %s\n",
+									optarg);
+				return EXIT_FAILURE;
+			}
+			control_reader_start_time(&start_time);
+			break;
+		case 'X':
+			control_reader_save_index();
+			break;
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'W':
+			writer_buffer = parse_buffer_size(optarg);
+			if (!writer_buffer) {
+				fprintf(stderr, "Invalid write buffer size: %s "
+					"(%d-%d KiB)\n", optarg,
+					WRITER_BUFFER_MIN, WRITER_BUFFER_MAX);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case 'F':
+			if (!strcasecmp(optarg, "text"))
+				analyze_format = ANALYZE_FORMAT_TEXT;
+			else if (!strcasecmp(optarg, "csv"))
+				analyze_format = ANALYZE_FORMAT_CSV;
+			else if (!strcasecmp(optarg, "json"))
+				analyze_format = ANALYZE_FORMAT_JSON;
+			else {
+				fprintf(stderr, "Unknown format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			if (strlen(optarg) > sizeof(addr.sun_path) - 1) {
 				fprintf(stderr, "Socket name too long\n");
@@ -166,6 +266,12 @@ int main(int argc, char *argv[])
 			}
 			packet_select_index(atoi(str));
 			break;
+		case 'f':
+			if (!filter_set(optarg)) {
+				fprintf(stderr, "Invalid filter: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 't':
 			filter_mask &= ~PACKET_FILTER_SHOW_TIME_OFFSET;
 			filter_mask |= PACKET_FILTER_SHOW_TIME;
@@ -213,20 +319,25 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (writer_buffer && !writer_path)
+		fprintf(stderr, "Write buffer without --write is ignored\n");
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	/* Keep machine readable analyze output free of the banner */
+	if (!analyze_path || analyze_format == ANALYZE_FORMAT_TEXT)
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
 	packet_set_filter(filter_mask);
 
 	if (analyze_path) {
-		analyze_trace(analyze_path);
+		analyze_trace(analyze_path, analyze_format);
 		return EXIT_SUCCESS;
 	}
 
@@ -238,7 +349,7 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, writer_buffer)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -254,6 +365,8 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	control_cleanup();
+
 	keys_cleanup();
 
 	return exit_status;
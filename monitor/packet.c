@@ -509,19 +509,37 @@ static const struct {
 	{ }
 };
 
-static void print_error(const char *label, uint8_t error)
+static const char *error2str_index[256];
+static bool error2str_index_initialized;
+
+static const char *find_error_str(uint8_t error)
 {
-	const char *str = "Unknown";
-	const char *color_on, *color_off;
-	bool unknown = true;
 	int i;
 
-	for (i = 0; error2str_table[i].str; i++) {
-		if (error2str_table[i].error == error) {
-			str = error2str_table[i].str;
-			unknown = false;
-			break;
+	if (!error2str_index_initialized) {
+		for (i = 0; error2str_table[i].str; i++) {
+			uint8_t err = error2str_table[i].error;
+
+			if (!error2str_index[err])
+				error2str_index[err] = error2str_table[i].str;
 		}
+
+		error2str_index_initialized = true;
+	}
+
+	return error2str_index[error];
+}
+
+static void print_error(const char *label, uint8_t error)
+{
+	const char *str;
+	const char *color_on, *color_off;
+	bool unknown = false;
+
+	str = find_error_str(error);
+	if (!str) {
+		str = "Unknown";
+		unknown = true;
 	}
 
 	if (use_color()) {
@@ -7561,6 +7579,54 @@ static void le_set_priv_mode_cmd(const void *data, uint8_t size)
 	print_field("Privacy Mode: %s (0x%2.2x)", str, cmd->priv_mode);
 }
 
+#define OPCODE_HASH_SIZE 1024
+
+/*
+ * Open addressed hash from a 16 bit opcode to its position in one of the
+ * NULL terminated decoder tables. It is filled on first use and keeps the
+ * first entry for an opcode, just like the linear search it replaces.
+ */
+struct opcode_hash {
+	bool initialized;
+	uint16_t opcode[OPCODE_HASH_SIZE];
+	uint16_t pos[OPCODE_HASH_SIZE];		/* Table position + 1 */
+};
+
+static unsigned int opcode_hash_slot(uint16_t opcode)
+{
+	return ((opcode * 40503u) >> 4) & (OPCODE_HASH_SIZE - 1);
+}
+
+static void opcode_hash_add(struct opcode_hash *hash, uint16_t opcode,
+								int pos)
+{
+	unsigned int slot = opcode_hash_slot(opcode);
+
+	while (hash->pos[slot]) {
+		if (hash->opcode[slot] == opcode)
+			return;
+
+		slot = (slot + 1) & (OPCODE_HASH_SIZE - 1);
+	}
+
+	hash->opcode[slot] = opcode;
+	hash->pos[slot] = pos + 1;
+}
+
+static int opcode_hash_find(const struct opcode_hash *hash, uint16_t opcode)
+{
+	unsigned int slot = opcode_hash_slot(opcode);
+
+	while (hash->pos[slot]) {
+		if (hash->opcode[slot] == opcode)
+			return hash->pos[slot] - 1;
+
+		slot = (slot + 1) & (OPCODE_HASH_SIZE - 1);
+	}
+
+	return -1;
+}
+
 struct opcode_data {
 	uint16_t opcode;
 	int bit;
@@ -8351,6 +8417,37 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
+static struct opcode_hash opcode_hash;
+
+static const struct opcode_data *find_opcode_data(uint16_t opcode)
+{
+	int i;
+
+	if (!opcode_hash.initialized) {
+		for (i = 0; opcode_table[i].str; i++)
+			opcode_hash_add(&opcode_hash, opcode_table[i].opcode, i);
+
+		opcode_hash.initialized = true;
+	}
+
+	i = opcode_hash_find(&opcode_hash, opcode);
+	if (i < 0)
+		return NULL;
+
+	return &opcode_table[i];
+}
+
+const char *packet_opcode_str(uint16_t opcode)
+{
+	const struct opcode_data *opcode_data;
+
+	opcode_data = find_opcode_data(opcode);
+	if (!opcode_data)
+		return "Unknown";
+
+	return opcode_data->str;
+}
+
 static const char *get_supported_command(int bit)
 {
 	int i;
@@ -8572,14 +8669,8 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -8667,14 +8758,8 @@ static void cmd_status_evt(const void *data, uint8_t size)
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char vendor_str[150];
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -9754,12 +9839,33 @@ static const struct subevent_data le_meta_event_table[] = {
 	{ }
 };
 
+static const struct subevent_data *le_meta_event_index[256];
+static bool le_meta_event_index_initialized;
+
+static const struct subevent_data *find_le_meta_event_data(uint8_t subevent)
+{
+	int i;
+
+	if (!le_meta_event_index_initialized) {
+		for (i = 0; le_meta_event_table[i].str; i++) {
+			uint8_t evt = le_meta_event_table[i].subevent;
+
+			if (!le_meta_event_index[evt])
+				le_meta_event_index[evt] =
+						&le_meta_event_table[i];
+		}
+
+		le_meta_event_index_initialized = true;
+	}
+
+	return le_meta_event_index[subevent];
+}
+
 static void le_meta_event_evt(const void *data, uint8_t size)
 {
 	uint8_t subevent = *((const uint8_t *) data);
 	struct subevent_data unknown;
-	const struct subevent_data *subevent_data = &unknown;
-	int i;
+	const struct subevent_data *subevent_data;
 
 	unknown.subevent = subevent;
 	unknown.str = "Unknown";
@@ -9767,12 +9873,9 @@ static void le_meta_event_evt(const void *data, uint8_t size)
 	unknown.size = 0;
 	unknown.fixed = true;
 
-	for (i = 0; le_meta_event_table[i].str; i++) {
-		if (le_meta_event_table[i].subevent == subevent) {
-			subevent_data = &le_meta_event_table[i];
-			break;
-		}
-	}
+	subevent_data = find_le_meta_event_data(subevent);
+	if (!subevent_data)
+		subevent_data = &unknown;
 
 	print_subevent(subevent_data, data + 1, size - 1);
 }
@@ -9975,6 +10078,27 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *event_index[256];
+static bool event_index_initialized;
+
+static const struct event_data *find_event_data(uint8_t event)
+{
+	int i;
+
+	if (!event_index_initialized) {
+		for (i = 0; event_table[i].str; i++) {
+			uint8_t evt = event_table[i].event;
+
+			if (!event_index[evt])
+				event_index[evt] = &event_table[i];
+		}
+
+		event_index_initialized = true;
+	}
+
+	return event_index[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -10115,7 +10239,6 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25], vendor_str[150];
-	int i;
 
 	index_list[index].frame++;
 
@@ -10130,12 +10253,7 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode_data(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -10218,7 +10336,6 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	index_list[index].frame++;
 
@@ -10233,12 +10350,7 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event_data(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
@@ -12176,6 +12288,27 @@ static const struct mgmt_data mgmt_command_table[] = {
 	{ }
 };
 
+static struct opcode_hash mgmt_command_hash;
+
+static const struct mgmt_data *find_mgmt_command_data(uint16_t opcode)
+{
+	int i;
+
+	if (!mgmt_command_hash.initialized) {
+		for (i = 0; mgmt_command_table[i].str; i++)
+			opcode_hash_add(&mgmt_command_hash,
+					mgmt_command_table[i].opcode, i);
+
+		mgmt_command_hash.initialized = true;
+	}
+
+	i = opcode_hash_find(&mgmt_command_hash, opcode);
+	if (i < 0)
+		return NULL;
+
+	return &mgmt_command_table[i];
+}
+
 static void mgmt_null_evt(const void *data, uint16_t size)
 {
 }
@@ -12186,7 +12319,6 @@ static void mgmt_command_complete_evt(const void *data, uint16_t size)
 	uint8_t status;
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
-	int i;
 
 	opcode = get_le16(data);
 	status = get_u8(data + 2);
@@ -12194,12 +12326,7 @@ static void mgmt_command_complete_evt(const void *data, uint16_t size)
 	data += 3;
 	size -= 3;
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command_data(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->rsp_func)
@@ -12245,17 +12372,11 @@ static void mgmt_command_status_evt(const void *data, uint16_t size)
 	uint8_t status;
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
-	int i;
 
 	opcode = get_le16(data);
 	status = get_u8(data + 2);
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command_data(opcode);
 
 	if (mgmt_data) {
 		mgmt_color = COLOR_CTRL_COMMAND;
@@ -12629,6 +12750,27 @@ static const struct mgmt_data mgmt_event_table[] = {
 	{ }
 };
 
+static struct opcode_hash mgmt_event_hash;
+
+static const struct mgmt_data *find_mgmt_event_data(uint16_t opcode)
+{
+	int i;
+
+	if (!mgmt_event_hash.initialized) {
+		for (i = 0; mgmt_event_table[i].str; i++)
+			opcode_hash_add(&mgmt_event_hash,
+					mgmt_event_table[i].opcode, i);
+
+		mgmt_event_hash.initialized = true;
+	}
+
+	i = opcode_hash_find(&mgmt_event_hash, opcode);
+	if (i < 0)
+		return NULL;
+
+	return &mgmt_event_table[i];
+}
+
 static void mgmt_print_commands(const void *data, uint16_t num)
 {
 	int i;
@@ -12637,17 +12779,12 @@ static void mgmt_print_commands(const void *data, uint16_t num)
 
 	for (i = 0; i < num; i++) {
 		uint16_t opcode = get_le16(data + (i * 2));
-		const char *str = NULL;
-		int n;
+		const struct mgmt_data *mgmt_data;
 
-		for (n = 0; mgmt_command_table[n].str; n++) {
-			if (mgmt_command_table[n].opcode == opcode) {
-				str = mgmt_command_table[n].str;
-				break;
-			}
-		}
+		mgmt_data = find_mgmt_command_data(opcode);
 
-		print_field("  %s (0x%4.4x)", str ?: "Reserved", opcode);
+		print_field("  %s (0x%4.4x)",
+				mgmt_data ? mgmt_data->str : "Reserved", opcode);
 	}
 }
 
@@ -12659,17 +12796,12 @@ static void mgmt_print_events(const void *data, uint16_t num)
 
 	for (i = 0; i < num; i++) {
 		uint16_t opcode = get_le16(data + (i * 2));
-		const char *str = NULL;
-		int n;
+		const struct mgmt_data *mgmt_data;
 
-		for (n = 0; mgmt_event_table[n].str; n++) {
-			if (mgmt_event_table[n].opcode == opcode) {
-				str = mgmt_event_table[n].str;
-				break;
-			}
-		}
+		mgmt_data = find_mgmt_event_data(opcode);
 
-		print_field("  %s (0x%4.4x)", str ?: "Reserved", opcode);
+		print_field("  %s (0x%4.4x)",
+				mgmt_data ? mgmt_data->str : "Reserved", opcode);
 	}
 }
 
@@ -12681,7 +12813,6 @@ void packet_ctrl_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
 	char channel[11], extra_str[25];
-	int i;
 
 	if (size < 4) {
 		print_packet(tv, cred, '*', index, NULL, COLOR_ERROR,
@@ -12722,12 +12853,7 @@ void packet_ctrl_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += 2;
 	size -= 2;
 
-	for (i = 0; mgmt_command_table[i].str; i++) {
-		if (mgmt_command_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_command_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_command_data(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->func)
@@ -12775,7 +12901,6 @@ void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	const struct mgmt_data *mgmt_data = NULL;
 	const char *mgmt_color, *mgmt_str;
 	char channel[11], extra_str[25];
-	int i;
 
 	if (size < 4) {
 		print_packet(tv, cred, '*', index, NULL, COLOR_ERROR,
@@ -12816,12 +12941,7 @@ void packet_ctrl_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += 2;
 	size -= 2;
 
-	for (i = 0; mgmt_event_table[i].str; i++) {
-		if (mgmt_event_table[i].opcode == opcode) {
-			mgmt_data = &mgmt_event_table[i];
-			break;
-		}
-	}
+	mgmt_data = find_mgmt_event_data(opcode);
 
 	if (mgmt_data) {
 		if (mgmt_data->func)
@@ -162,9 +162,124 @@ static char *file_stat_line(char *filename, struct stat *fstat,
 	return ret;
 }
 
+/*
+ * With --async-io file objects are read and written by a pool of worker
+ * threads so that a slow storage device doesn't stall the mainloop. Each
+ * object has at most one request in flight: writes are queued behind the
+ * caller and only return -EAGAIN while the previous one is still running,
+ * reads return -EAGAIN until data is available and then queue the next
+ * read ahead. Completions are reported with obex_object_set_io_flags().
+ */
+#define FS_WORKERS	4
+#define FS_READ_SIZE	(64 * 1024)
+
+enum fs_op {
+	FS_OP_NONE,
+	FS_OP_READ,
+	FS_OP_WRITE,
+};
+
+struct fs_object {
+	int fd;
+	gboolean busy;
+	gboolean closed;
+	gboolean eof;
+	int err;
+	enum fs_op op;
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	size_t offset;
+	ssize_t result;
+};
+
+static GThreadPool *fs_pool = NULL;
+
+static void fs_free(struct fs_object *obj)
+{
+	g_free(obj->buf);
+	g_free(obj);
+}
+
+static gboolean fs_complete(gpointer data)
+{
+	struct fs_object *obj = data;
+	int flags = G_IO_OUT;
+
+	obj->busy = FALSE;
+
+	if (obj->closed) {
+		close(obj->fd);
+		fs_free(obj);
+		return FALSE;
+	}
+
+	if (obj->result < 0)
+		obj->err = obj->result;
+	else if (obj->op == FS_OP_READ) {
+		obj->len = obj->result;
+		obj->offset = 0;
+		obj->eof = obj->result == 0;
+		flags = G_IO_IN;
+	}
+
+	obj->op = FS_OP_NONE;
+
+	obex_object_set_io_flags(obj, flags, 0);
+
+	return FALSE;
+}
+
+static void fs_worker(gpointer data, gpointer user_data)
+{
+	struct fs_object *obj = data;
+	ssize_t ret;
+	size_t done = 0;
+
+	switch (obj->op) {
+	case FS_OP_READ:
+		do {
+			ret = read(obj->fd, obj->buf, obj->size);
+		} while (ret < 0 && errno == EINTR);
+
+		obj->result = ret < 0 ? -errno : ret;
+		break;
+	case FS_OP_WRITE:
+		obj->result = obj->len;
+
+		while (done < obj->len) {
+			ret = write(obj->fd, obj->buf + done, obj->len - done);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0) {
+				obj->result = ret < 0 ? -errno : -EIO;
+				break;
+			}
+
+			done += ret;
+		}
+		break;
+	case FS_OP_NONE:
+		break;
+	}
+
+	/* Complete at default priority so completions keep up with I/O */
+	g_idle_add_full(G_PRIORITY_DEFAULT, fs_complete, obj, NULL);
+}
+
+static void fs_queue(struct fs_object *obj, enum fs_op op)
+{
+	obj->op = op;
+	obj->busy = TRUE;
+
+	g_thread_pool_push(fs_pool, obj, NULL);
+}
+
 static void *filesystem_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
+	struct fs_object *obj;
 	struct stat stats;
 	struct statvfs buf;
 	int fd, ret;
@@ -216,7 +331,10 @@ done:
 	if (err)
 		*err = 0;
 
-	return GINT_TO_POINTER(fd);
+	obj = g_new0(struct fs_object, 1);
+	obj->fd = fd;
+
+	return obj;
 
 failed:
 	close(fd);
@@ -225,34 +343,121 @@ failed:
 
 static int filesystem_close(void *object)
 {
-	if (close(GPOINTER_TO_INT(object)) < 0)
-		return -errno;
+	struct fs_object *obj = object;
+	int err = obj->err;
 
-	return 0;
+	/* The pending request completes on its own and frees the object */
+	if (obj->busy) {
+		obj->closed = TRUE;
+		return 0;
+	}
+
+	if (close(obj->fd) < 0 && err == 0)
+		err = -errno;
+
+	fs_free(obj);
+
+	return err;
+}
+
+static ssize_t filesystem_read_async(struct fs_object *obj, void *buf,
+								size_t count)
+{
+	size_t len;
+
+	if (obj->offset < obj->len) {
+		len = MIN(count, obj->len - obj->offset);
+		memcpy(buf, obj->buf + obj->offset, len);
+		obj->offset += len;
+
+		if (obj->offset == obj->len && obj->err == 0)
+			fs_queue(obj, FS_OP_READ);
+
+		return len;
+	}
+
+	if (obj->err < 0)
+		return obj->err;
+
+	if (obj->eof)
+		return 0;
+
+	if (obj->busy)
+		return -EAGAIN;
+
+	if (obj->size < FS_READ_SIZE) {
+		obj->buf = g_realloc(obj->buf, FS_READ_SIZE);
+		obj->size = FS_READ_SIZE;
+	}
+
+	fs_queue(obj, FS_OP_READ);
+
+	return -EAGAIN;
 }
 
 static ssize_t filesystem_read(void *object, void *buf, size_t count)
 {
+	struct fs_object *obj = object;
 	ssize_t ret;
 
-	ret = read(GPOINTER_TO_INT(object), buf, count);
+	if (fs_pool)
+		return filesystem_read_async(obj, buf, count);
+
+	ret = read(obj->fd, buf, count);
 	if (ret < 0)
 		return -errno;
 
 	return ret;
 }
 
+static ssize_t filesystem_write_async(struct fs_object *obj,
+					const void *buf, size_t count)
+{
+	if (obj->err < 0)
+		return obj->err;
+
+	if (obj->busy)
+		return -EAGAIN;
+
+	if (obj->size < count) {
+		obj->buf = g_realloc(obj->buf, count);
+		obj->size = count;
+	}
+
+	memcpy(obj->buf, buf, count);
+	obj->len = count;
+
+	fs_queue(obj, FS_OP_WRITE);
+
+	return count;
+}
+
 static ssize_t filesystem_write(void *object, const void *buf, size_t count)
 {
+	struct fs_object *obj = object;
 	ssize_t ret;
 
-	ret = write(GPOINTER_TO_INT(object), buf, count);
+	if (fs_pool)
+		return filesystem_write_async(obj, buf, count);
+
+	ret = write(obj->fd, buf, count);
 	if (ret < 0)
 		return -errno;
 
 	return ret;
 }
 
+static int filesystem_flush(void *object)
+{
+	struct fs_object *obj = object;
+
+	/* Only queued writes need to be waited for, reads ahead don't */
+	if (obj->busy && obj->op == FS_OP_WRITE)
+		return -EAGAIN;
+
+	return obj->err;
+}
+
 static int filesystem_rename(const char *name, const char *destname)
 {
 	int ret;
@@ -308,7 +513,7 @@ static int filesystem_copy(const char *name, const char *destname)
 		return -err;
 	}
 
-	in_fd = GPOINTER_TO_INT(in);
+	in_fd = ((struct fs_object *) in)->fd;
 	ret = fstat(in_fd, &st);
 	if (ret < 0) {
 		error("stat(%s): %s (%d)", name, strerror(errno), errno);
@@ -323,7 +528,7 @@ static int filesystem_copy(const char *name, const char *destname)
 		return -errno;
 	}
 
-	out_fd = GPOINTER_TO_INT(out);
+	out_fd = ((struct fs_object *) out)->fd;
 
 	/* Check if sendfile is supported */
 	ret = sendfile(out_fd, in_fd, NULL, 0);
@@ -333,11 +538,10 @@ static int filesystem_copy(const char *name, const char *destname)
 		goto done;
 	}
 
+	/* The child has its own copy of both descriptors */
 	ret = sendfile_async(out_fd, in_fd, NULL, st.st_size);
-	if (ret < 0)
-		goto done;
-
-	return 0;
+	if (ret > 0)
+		ret = 0;
 
 done:
 	filesystem_close(in);
@@ -659,6 +863,7 @@ static struct obex_mime_type_driver file = {
 	.close = filesystem_close,
 	.read = filesystem_read,
 	.write = filesystem_write,
+	.flush = filesystem_flush,
 	.remove = remove,
 	.move = filesystem_rename,
 	.copy = filesystem_copy,
@@ -695,8 +900,23 @@ static struct obex_mime_type_driver pcsuite = {
 
 static int filesystem_init(void)
 {
+	GError *gerr = NULL;
 	int err;
 
+	if (obex_option_async_io()) {
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+		if (!g_thread_supported())
+			g_thread_init(NULL);
+#endif
+		fs_pool = g_thread_pool_new(fs_worker, NULL, FS_WORKERS,
+							FALSE, &gerr);
+		if (fs_pool == NULL) {
+			error("Unable to start I/O threads: %s",
+							gerr->message);
+			g_error_free(gerr);
+		}
+	}
+
 	err = obex_mime_type_driver_register(&folder);
 	if (err < 0)
 		return err;
@@ -716,7 +936,13 @@ static void filesystem_exit(void)
 {
 	obex_mime_type_driver_unregister(&folder);
 	obex_mime_type_driver_unregister(&capability);
+	obex_mime_type_driver_unregister(&pcsuite);
 	obex_mime_type_driver_unregister(&file);
+
+	if (fs_pool) {
+		g_thread_pool_free(fs_pool, FALSE, TRUE);
+		fs_pool = NULL;
+	}
 }
 
 OBEX_PLUGIN_DEFINE(filesystem, filesystem_init, filesystem_exit)
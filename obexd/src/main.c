@@ -138,6 +138,7 @@ static char *option_noplugin = NULL;
 
 static gboolean option_autoaccept = FALSE;
 static gboolean option_symlinks = FALSE;
+static gboolean option_async_io = FALSE;
 
 static gboolean parse_debug(const char *key, const char *value,
 				gpointer user_data, GError **error)
@@ -176,6 +177,8 @@ static GOptionEntry options[] = {
 				"scripts", "FILE" },
 	{ "auto-accept", 'a', 0, G_OPTION_ARG_NONE, &option_autoaccept,
 				"Automatically accept push requests" },
+	{ "async-io", 'i', 0, G_OPTION_ARG_NONE, &option_async_io,
+				"Read and write files in worker threads" },
 	{ NULL },
 };
 
@@ -199,6 +202,11 @@ const char *obex_option_capability(void)
 	return option_capability;
 }
 
+gboolean obex_option_async_io(void)
+{
+	return option_async_io;
+}
+
 static gboolean is_dir(const char *dir)
 {
 	struct stat st;
@@ -322,30 +322,51 @@ static void cmd_disconnect(GObex *obex, GObexPacket *req, void *user_data)
 	os_set_response(os, 0);
 }
 
-static ssize_t driver_write(struct obex_session *os)
+static size_t driver_write_data(struct obex_session *os, const uint8_t *buf,
+						size_t size, ssize_t *err)
 {
-	ssize_t len = 0;
+	size_t len = 0;
+
+	*err = 0;
 
-	while (os->pending > 0) {
+	while (len < size) {
 		ssize_t w;
 
-		w = os->driver->write(os->object, os->buf + len, os->pending);
+		w = os->driver->write(os->object, buf + len, size - len);
 		if (w < 0) {
-			error("write(): %s (%zd)", strerror(-w), -w);
 			if (w == -EINTR)
 				continue;
-			else if (w == -EINVAL)
-				memmove(os->buf, os->buf + len, os->pending);
+			if (w != -EAGAIN)
+				error("write(): %s (%zd)", strerror(-w), -w);
 
-			return w;
+			*err = w;
+			break;
 		}
 
 		len += w;
 		os->offset += w;
-		os->pending -= w;
 	}
 
-	DBG("%zd written", len);
+	DBG("%zu written", len);
+
+	return len;
+}
+
+static ssize_t driver_write(struct obex_session *os)
+{
+	ssize_t err;
+	size_t len;
+
+	len = driver_write_data(os, os->buf, os->pending, &err);
+
+	os->pending -= len;
+
+	/* Keep what is left at the start of the buffer for the next try */
+	if (os->pending > 0 && len > 0)
+		memmove(os->buf, os->buf + len, os->pending);
+
+	if (err < 0)
+		return err;
 
 	if (os->service->progress != NULL)
 		os->service->progress(os, os->service_data);
@@ -365,12 +386,15 @@ static gssize driver_read(struct obex_session *os, void *buf, gsize size)
 
 	len = os->driver->read(os->object, buf, size);
 	if (len < 0) {
+		if (len == -EAGAIN) {
+			os->driver->set_io_watch(os->object, handle_async_io,
+									os);
+			return len;
+		}
 		error("read(): %s (%zd)", strerror(-len), -len);
 		if (len == -ENOSTR)
 			return 0;
-		if (len == -EAGAIN)
-			os->driver->set_io_watch(os->object, handle_async_io,
-									os);
+		return len;
 	}
 
 	os->offset += len;
@@ -393,9 +417,57 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
+static gboolean handle_async_flush(void *object, int flags, int err,
+							void *user_data)
+{
+	struct obex_session *os = user_data;
+
+	/* Body data the object didn't take yet has to be written first */
+	if (err == 0 && os->pending > 0) {
+		ssize_t ret = driver_write(os);
+
+		if (ret < 0)
+			err = ret;
+	}
+
+	if (err == 0 && os->driver->flush)
+		err = os->driver->flush(os->object);
+
+	if (err == -EAGAIN)
+		return TRUE;
+
+	if (err < 0) {
+		error("flush(): %s (%d)", strerror(-err), -err);
+		os->err = err;
+		os->aborted = TRUE;
+	}
+
+	g_obex_resume(os->obex);
+	os_reset_session(os);
+
+	return FALSE;
+}
+
+static int wait_flush(struct obex_session *os)
+{
+	int err;
+
+	/* recv_data may still have a watch waiting for earlier data */
+	os->driver->set_io_watch(os->object, NULL, NULL);
+
+	err = os->driver->set_io_watch(os->object, handle_async_flush, os);
+	if (err < 0)
+		return err;
+
+	g_obex_suspend(os->obex);
+
+	return 0;
+}
+
 static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 {
 	struct obex_session *os = user_data;
+	int ret;
 
 	DBG("");
 
@@ -404,13 +476,30 @@ static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 		goto reset;
 	}
 
-	if (os->object && os->driver && os->driver->flush) {
-		if (os->driver->flush(os->object) == -EAGAIN) {
-			g_obex_suspend(os->obex);
-			os->driver->set_io_watch(os->object, handle_async_io,
-									os);
+	if (os->object == NULL || os->driver == NULL)
+		goto reset;
+
+	/*
+	 * With SRM the last packet can arrive while the object is still
+	 * busy with earlier ones, wait for it before flushing.
+	 */
+	if (os->pending > 0)
+		ret = -EAGAIN;
+	else if (os->driver->flush)
+		ret = os->driver->flush(os->object);
+	else
+		ret = 0;
+
+	if (ret == -EAGAIN) {
+		ret = wait_flush(os);
+		if (ret == 0)
 			return;
-		}
+	}
+
+	if (ret < 0) {
+		error("flush(): %s (%d)", strerror(-ret), -ret);
+		os->err = ret;
+		os->aborted = TRUE;
 	}
 
 reset:
@@ -505,10 +594,18 @@ done:
 	return FALSE;
 }
 
+static void store_data(struct obex_session *os, const void *buf, gsize size)
+{
+	os->buf = g_realloc(os->buf, os->pending + size);
+	memcpy(os->buf + os->pending, buf, size);
+	os->pending += size;
+}
+
 static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 {
 	struct obex_session *os = user_data;
 	ssize_t ret;
+	size_t len;
 
 	DBG("name=%s type=%s file=%p size=%zu", os->name, os->type, os->object,
 									size);
@@ -520,18 +617,27 @@ static gboolean recv_data(const void *buf, gsize size, gpointer user_data)
 	if (os->size == OBJECT_SIZE_DELETE)
 		os->size = OBJECT_SIZE_UNKNOWN;
 
-	os->buf = g_realloc(os->buf, os->pending + size);
-	memcpy(os->buf + os->pending, buf, size);
-	os->pending += size;
-
 	/* only write if both object and driver are valid */
 	if (os->object == NULL || os->driver == NULL) {
+		store_data(os, buf, size);
 		DBG("Stored %" PRIu64 " bytes into temporary buffer",
 								os->pending);
 		return TRUE;
 	}
 
-	ret = driver_write(os);
+	if (os->pending > 0) {
+		/* Older data has to be written first */
+		store_data(os, buf, size);
+		ret = driver_write(os);
+	} else {
+		/* Write straight from the packet, keep only what is left */
+		len = driver_write_data(os, buf, size, &ret);
+		if (ret == -EAGAIN)
+			store_data(os, (const uint8_t *) buf + len, size - len);
+		else if (ret == 0 && os->service->progress != NULL)
+			os->service->progress(os, os->service_data);
+	}
+
 	if (ret >= 0)
 		return TRUE;
 
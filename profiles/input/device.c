@@ -940,10 +940,8 @@ static int hidp_add_connection(struct input_device *idev)
 								dst_addr);
 	sprintf(handle, "0x%8.8X", idev->handle);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 	str = g_key_file_get_string(key_file, "ServiceRecords", handle, NULL);
-	g_key_file_free(key_file);
 
 	if (!str) {
 		error("Rejected connection from unknown device %s", dst_addr);
@@ -64,6 +64,7 @@
 #include "sdpd.h"
 #include "adapter.h"
 #include "device.h"
+#include "device-index.h"
 #include "profile.h"
 #include "dbus-common.h"
 #include "error.h"
@@ -226,6 +227,8 @@ struct btd_adapter {
 	struct mgmt_cp_start_service_discovery *current_discovery_filter;
 
 	GSList *discovery_found;	/* list of found devices */
+	unsigned int found_reports;	/* reports of this discovery */
+	unsigned int found_unchanged;	/* reports matching the last one */
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
 	guint passive_scan_timeout;	/* timeout between passive scans */
 	guint temp_devices_timeout;	/* timeout for temporary devices */
@@ -236,6 +239,7 @@ struct btd_adapter {
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	struct device_index *device_index; /* Devices by address */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -802,13 +806,61 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static void adapter_index_device(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_add(adapter->device_index, device,
+					device_get_address(device),
+					device_get_conn_address(device));
+}
+
+void btd_adapter_device_addr_changed(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_update(adapter->device_index, device,
+					device_get_address(device),
+					device_get_conn_address(device));
+}
+
+static struct btd_device *find_indexed_device(struct btd_adapter *adapter,
+					const struct device_addr_type *addr)
+{
+	struct btd_device *device = NULL;
+	GSList *l;
+
+	/* Devices that never connected have an all zero connection address */
+	if (!bacmp(&addr->bdaddr, BDADDR_ANY))
+		goto lookup;
+
+	for (l = device_index_lookup(adapter->device_index, &addr->bdaddr);
+							l; l = l->next) {
+		if (device_addr_type_cmp(l->data, addr))
+			continue;
+
+		/*
+		 * With more than one match the first one in the device list
+		 * wins, so leave the ordering to the full list.
+		 */
+		if (device)
+			goto lookup;
+
+		device = l->data;
+	}
+
+	return device;
+
+lookup:
+	l = g_slist_find_custom(adapter->devices, addr, device_addr_type_cmp);
+
+	return l ? l->data : NULL;
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
 {
 	struct device_addr_type addr;
 	struct btd_device *device;
-	GSList *list;
 
 	if (!adapter)
 		return NULL;
@@ -816,13 +868,10 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
-	if (!list)
+	device = find_indexed_device(adapter, &addr);
+	if (!device)
 		return NULL;
 
-	device = list->data;
-
 	/*
 	 * If we're looking up based on public address and the address
 	 * was not previously used over this bearer we may need to
@@ -1143,6 +1192,7 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 		return NULL;
 
 	adapter->devices = g_slist_append(adapter->devices, device);
+	adapter_index_device(adapter, device);
 
 	return device;
 }
@@ -1178,6 +1228,7 @@ void btd_adapter_remove_device(struct btd_adapter *adapter,
 	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
 
 	adapter->devices = g_slist_remove(adapter->devices, dev);
+	device_index_remove(adapter->device_index, dev);
 
 	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
 									dev);
@@ -1740,6 +1791,7 @@ static void invalidate_rssi_and_tx_power(gpointer a)
 
 	device_set_rssi(dev, 0);
 	device_set_tx_power(dev, 127);
+	device_clear_last_adv(dev);
 }
 
 static gboolean remove_temp_devices(gpointer user_data)
@@ -1769,6 +1821,12 @@ static void discovery_cleanup(struct btd_adapter *adapter)
 
 	adapter->discovery_type = 0x00;
 
+	DBG("%u of %u device found reports unchanged",
+			adapter->found_unchanged, adapter->found_reports);
+
+	adapter->found_reports = 0;
+	adapter->found_unchanged = 0;
+
 	if (adapter->discovery_idle_timeout > 0) {
 		g_source_remove(adapter->discovery_idle_timeout);
 		adapter->discovery_idle_timeout = 0;
@@ -4038,8 +4096,7 @@ static void load_devices(struct btd_adapter *adapter)
 					btd_adapter_get_storage_dir(adapter),
 					entry->d_name);
 
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		key_file = storage_get_key_file(filename);
 
 		key_info = get_key_info(key_file, entry->d_name);
 		if (key_info)
@@ -4074,10 +4131,11 @@ static void load_devices(struct btd_adapter *adapter)
 		device = device_create_from_storage(adapter, entry->d_name,
 							key_file);
 		if (!device)
-			goto free;
+			continue;
 
 		btd_device_set_temporary(device, false);
 		adapter->devices = g_slist_append(adapter->devices, device);
+		adapter_index_device(adapter, device);
 
 		/* TODO: register services from pre-loaded list of primaries */
 
@@ -4100,9 +4158,6 @@ device_exist:
 				device_set_ltk_enc_size(device,
 						slave_ltk_info->enc_size);
 		}
-
-free:
-		g_key_file_free(key_file);
 	}
 
 	closedir(dir);
@@ -4774,6 +4829,8 @@ static void adapter_free(gpointer user_data)
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 
+	device_index_free(adapter->device_index);
+
 	/*
 	 * Unregister all handlers for this specific index since
 	 * the adapter bound to them is no longer valid.
@@ -5490,6 +5547,10 @@ static void convert_device_storage(struct btd_adapter *adapter)
 
 	ba2str(&adapter->bdaddr, address);
 
+	/* Make sure nothing cached is pending, files are accessed directly */
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s", address);
+	storage_sync_key_file(filename);
+
 	/* Convert device's name cache */
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/names", address);
 	textfile_foreach(filename, convert_names_entry, address);
@@ -5740,6 +5801,8 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	adapter->device_index = device_index_new();
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -5758,6 +5821,7 @@ static void adapter_remove(struct btd_adapter *adapter)
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
+	device_index_clear(adapter->device_index);
 
 	discovery_cleanup(adapter);
 
@@ -5982,6 +6046,41 @@ static void update_found_devices(struct btd_adapter *adapter,
 	char addr[18];
 	bool duplicate = false;
 
+	adapter->found_reports++;
+
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+
+	/*
+	 * Beacons keep sending the very same advertising data. Unless a
+	 * discovery filter or manufacturer data callback needs to see it,
+	 * a report that matches the last fully processed one can only
+	 * change the RSSI, which is already subject to a threshold.
+	 */
+	if (dev && !adapter->filtered_discovery && !adapter->msd_callbacks &&
+				device_last_adv_match(dev, data, data_len)) {
+		uint8_t flags = device_get_ad_flags(dev);
+
+		adapter->found_unchanged++;
+
+		device_update_last_seen(dev, bdaddr_type);
+
+		if (bdaddr_type != BDADDR_BREDR && flags &&
+						!(flags & EIR_BREDR_UNSUP))
+			device_update_last_seen(dev, BDADDR_BREDR);
+
+		if (!btd_device_is_connected(dev) &&
+					(device_is_temporary(dev) &&
+						!adapter->discovery_list))
+			return;
+
+		device_set_legacy(dev, legacy);
+		device_set_rssi(dev, rssi);
+
+		name_known = device_name_known(dev);
+
+		goto found;
+	}
+
 	memset(&eir_data, 0, sizeof(eir_data));
 	eir_parse(&eir_data, data, data_len);
 
@@ -5992,7 +6091,6 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	ba2str(bdaddr, addr);
 
-	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
 		/*
 		 * If no client has requested discovery or the device is
@@ -6099,8 +6197,11 @@ static void update_found_devices(struct btd_adapter *adapter,
 	if (bdaddr_type != BDADDR_BREDR)
 		device_set_flags(dev, eir_data.flags);
 
+	device_set_last_adv(dev, data, data_len);
+
 	eir_data_free(&eir_data);
 
+found:
 	/*
 	 * Only if at least one client has requested discovery, maintain
 	 * list of found devices and name confirming for legacy devices.
@@ -7300,17 +7401,14 @@ static void store_link_key(struct btd_adapter *adapter,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	gsize length = 0;
 	char key_str[33];
-	char *str;
 	int i;
 
 	ba2str(device_get_address(device), device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7320,13 +7418,9 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	/* Keys are written out right away instead of being deferred */
+	storage_commit_key_file(filename);
+	storage_sync_key_file(filename);
 }
 
 static void new_link_key_callback(uint16_t index, uint16_t length,
@@ -7386,8 +7480,6 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
-	char *str;
 	int i;
 
 	if (master != 0x00 && master != 0x01) {
@@ -7399,8 +7491,7 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -7417,13 +7508,8 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
+	storage_sync_key_file(filename);
 }
 
 static void new_long_term_key_callback(uint16_t index, uint16_t length,
@@ -7499,9 +7585,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
 	gboolean auth;
-	char *str;
 	int i;
 
 	switch (type) {
@@ -7531,8 +7615,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7541,13 +7624,8 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "Counter", counter);
 	g_key_file_set_boolean(key_file, group, "Authenticated", auth);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
+	storage_sync_key_file(filename);
 }
 
 static void new_csrk_callback(uint16_t index, uint16_t length,
@@ -7592,30 +7670,22 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *store_data;
 	char str[33];
-	size_t length = 0;
 	int i;
 
 	ba2str(peer, device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
+	storage_sync_key_file(filename);
 }
 
 static void new_irk_callback(uint16_t index, uint16_t length,
@@ -7680,8 +7750,6 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *store_data;
-	size_t length = 0;
 
 	ba2str(peer, device_addr);
 
@@ -7689,8 +7757,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -7701,13 +7768,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
 }
 
 static void new_conn_param(uint16_t index, uint16_t length,
@@ -8264,15 +8325,12 @@ static void remove_keys(struct btd_adapter *adapter,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	gsize length = 0;
-	char *str;
 
 	ba2str(device_get_address(device), device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -8283,11 +8341,8 @@ static void remove_keys(struct btd_adapter *adapter,
 		g_key_file_remove_group(key_file, "IdentityResolvingKey", NULL);
 	}
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
+	storage_sync_key_file(filename);
 }
 
 static void unpaired_callback(uint16_t index, uint16_t length,
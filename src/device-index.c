@@ -0,0 +1,216 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2006-2010  Nokia Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+
+#include "device-index.h"
+
+/*
+ * Devices are indexed by their address and, for LE devices that resolved
+ * to an identity address, by the address the connection was made with.
+ * Every device that device_addr_type_cmp() can match is therefore found
+ * in the bucket of the address being looked up.
+ */
+struct device_index {
+	GHashTable *buckets;	/* Devices by address */
+	GHashTable *keys;	/* Addresses devices are indexed by */
+};
+
+struct device_bucket {
+	bdaddr_t bdaddr;
+	GSList *devices;
+};
+
+struct device_keys {
+	bdaddr_t bdaddr;
+	bdaddr_t conn_bdaddr;
+};
+
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+	guint hash = 0;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = (hash * 31) + bdaddr->b[i];
+
+	return hash;
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+static void bucket_free(gpointer data)
+{
+	struct device_bucket *bucket = data;
+
+	g_slist_free(bucket->devices);
+	g_free(bucket);
+}
+
+static void bucket_add(struct device_index *index, const bdaddr_t *bdaddr,
+						struct btd_device *device)
+{
+	struct device_bucket *bucket;
+
+	bucket = g_hash_table_lookup(index->buckets, bdaddr);
+	if (!bucket) {
+		bucket = g_new0(struct device_bucket, 1);
+		bacpy(&bucket->bdaddr, bdaddr);
+		g_hash_table_insert(index->buckets, &bucket->bdaddr, bucket);
+	}
+
+	bucket->devices = g_slist_append(bucket->devices, device);
+}
+
+static void bucket_remove(struct device_index *index, const bdaddr_t *bdaddr,
+						struct btd_device *device)
+{
+	struct device_bucket *bucket;
+
+	bucket = g_hash_table_lookup(index->buckets, bdaddr);
+	if (!bucket)
+		return;
+
+	bucket->devices = g_slist_remove(bucket->devices, device);
+	if (!bucket->devices)
+		g_hash_table_remove(index->buckets, bdaddr);
+}
+
+static bool has_conn_key(const struct device_keys *keys)
+{
+	return bacmp(&keys->conn_bdaddr, BDADDR_ANY) &&
+			bacmp(&keys->conn_bdaddr, &keys->bdaddr);
+}
+
+struct device_index *device_index_new(void)
+{
+	struct device_index *index;
+
+	index = g_new0(struct device_index, 1);
+
+	index->buckets = g_hash_table_new_full(bdaddr_hash, bdaddr_equal,
+							NULL, bucket_free);
+	index->keys = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							NULL, g_free);
+
+	return index;
+}
+
+void device_index_free(struct device_index *index)
+{
+	if (!index)
+		return;
+
+	g_hash_table_destroy(index->keys);
+	g_hash_table_destroy(index->buckets);
+	g_free(index);
+}
+
+void device_index_add(struct device_index *index, struct btd_device *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr)
+{
+	struct device_keys *keys;
+
+	keys = g_new0(struct device_keys, 1);
+	bacpy(&keys->bdaddr, bdaddr);
+	bacpy(&keys->conn_bdaddr, conn_bdaddr);
+
+	bucket_add(index, &keys->bdaddr, device);
+
+	if (has_conn_key(keys))
+		bucket_add(index, &keys->conn_bdaddr, device);
+
+	g_hash_table_insert(index->keys, device, keys);
+}
+
+void device_index_remove(struct device_index *index,
+						struct btd_device *device)
+{
+	struct device_keys *keys;
+
+	keys = g_hash_table_lookup(index->keys, device);
+	if (!keys)
+		return;
+
+	bucket_remove(index, &keys->bdaddr, device);
+
+	if (has_conn_key(keys))
+		bucket_remove(index, &keys->conn_bdaddr, device);
+
+	g_hash_table_remove(index->keys, device);
+}
+
+bool device_index_update(struct device_index *index,
+					struct btd_device *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr)
+{
+	if (!g_hash_table_lookup(index->keys, device))
+		return false;
+
+	device_index_remove(index, device);
+	device_index_add(index, device, bdaddr, conn_bdaddr);
+
+	return true;
+}
+
+void device_index_clear(struct device_index *index)
+{
+	g_hash_table_remove_all(index->keys);
+	g_hash_table_remove_all(index->buckets);
+}
+
+/*
+ * Returns the devices that may match the address, in the order they were
+ * added. The list is owned by the index and only valid until it changes.
+ */
+GSList *device_index_lookup(struct device_index *index,
+						const bdaddr_t *bdaddr)
+{
+	struct device_bucket *bucket;
+
+	bucket = g_hash_table_lookup(index->buckets, bdaddr);
+	if (!bucket)
+		return NULL;
+
+	return bucket->devices;
+}
+
+unsigned int device_index_count(struct device_index *index)
+{
+	return g_hash_table_size(index->keys);
+}
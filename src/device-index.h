@@ -0,0 +1,45 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+
+struct btd_device;
+struct device_index;
+
+struct device_index *device_index_new(void);
+void device_index_free(struct device_index *index);
+
+void device_index_add(struct device_index *index, struct btd_device *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr);
+void device_index_remove(struct device_index *index,
+						struct btd_device *device);
+bool device_index_update(struct device_index *index,
+					struct btd_device *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr);
+void device_index_clear(struct device_index *index);
+
+GSList *device_index_lookup(struct device_index *index,
+						const bdaddr_t *bdaddr);
+unsigned int device_index_count(struct device_index *index);
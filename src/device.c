@@ -34,6 +34,8 @@
 #include <errno.h>
 #include <dirent.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -74,6 +76,7 @@
 #include "storage.h"
 #include "attrib-server.h"
 #include "eir.h"
+#include "gatt-cache.h"
 
 #define IO_CAPABILITY_NOINPUTNOOUTPUT	0x03
 
@@ -87,11 +90,6 @@
 
 #define RSSI_THRESHOLD		8
 
-#define GATT_PRIM_SVC_UUID_STR "2800"
-#define GATT_SND_SVC_UUID_STR  "2801"
-#define GATT_INCLUDE_UUID_STR "2802"
-#define GATT_CHARAC_UUID_STR "2803"
-
 #define GATT_EIR_DATA_LEN 240
 
 static DBusConnection *dbus_conn = NULL;
@@ -266,6 +264,8 @@ struct btd_device {
 	guint		store_id;
 
 	uint8_t		eir_data[GATT_EIR_DATA_LEN];
+
+	struct eir_report last_adv;	/* Last fully processed report */
 };
 
 static const uint16_t uuid_list[] = {
@@ -375,10 +375,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	GKeyFile *key_file;
 	char filename[PATH_MAX];
 	char device_addr[18];
-	char *str;
 	char class[9];
 	char **uuids = NULL;
-	gsize length = 0;
 
 	device->store_id = 0;
 
@@ -387,8 +385,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -452,13 +449,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	if (device->remote_csrk)
 		store_csrk(device->remote_csrk, key_file, "RemoteSignatureKey");
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_commit_key_file(filename);
 
-	g_key_file_free(key_file);
 	g_free(uuids);
 
 	return FALSE;
@@ -497,8 +489,6 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	char filename[PATH_MAX];
 	char d_addr[18];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(dev)) {
 		DBG("Can't store name for private addressed device %s",
@@ -509,17 +499,11 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 	g_key_file_set_string(key_file, "General", "Name", name);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
-
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
 }
 
 static void browse_request_free(struct browse_req *req)
@@ -653,6 +637,7 @@ static void device_free(gpointer user_data)
 	g_slist_free_full(device->uuids, g_free);
 	g_slist_free_full(device->primaries, g_free);
 	g_slist_free_full(device->svc_callbacks, svc_dev_remove);
+	eir_report_clear(&device->last_adv);
 
 	/* Reset callbacks since the device is going to be freed */
 	gatt_db_unregister(device->db, device->db_id);
@@ -2170,122 +2155,29 @@ static void store_services(struct btd_device *device)
 	g_key_file_free(key_file);
 }
 
-struct gatt_saver {
-	struct btd_device *device;
-	uint16_t ext_props;
-	GKeyFile *key_file;
-};
-
-static void store_desc(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	const bt_uuid_t *uuid;
-	bt_uuid_t ext_uuid;
-	uint16_t handle_num;
-
-	handle_num = gatt_db_attribute_get_handle(attr);
-	sprintf(handle, "%04hx", handle_num);
-
-	uuid = gatt_db_attribute_get_type(attr);
-	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
-
-	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
-		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
-	else
-		sprintf(value, "%s", uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-}
-
-static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
+static void gatt_cache_filename(struct btd_device *device, char *filename,
+								size_t size)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, value_handle;
-	uint8_t properties;
-	bt_uuid_t uuid;
-
-	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
-						&properties, &saver->ext_props,
-						&uuid)) {
-		warn("Error storing characteristic - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s", value_handle,
-							properties, uuid_str);
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-
-	gatt_db_service_foreach_desc(attr, store_desc, saver);
-}
-
-static void store_incl(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	struct gatt_db_attribute *service;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, start, end;
-	bt_uuid_t uuid;
-
-	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
-		warn("Error storing included service - can't get data");
-		return;
-	}
-
-	service = gatt_db_get_attribute(saver->device->db, start);
-	if (!service) {
-		warn("Error storing included service - can't find it");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-
-	gatt_db_attribute_get_service_uuid(service, &uuid);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
-								end, uuid_str);
+	char dst_addr[18];
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	ba2str(&device->bdaddr, dst_addr);
+	snprintf(filename, size, STORAGEDIR "/%s/cache/%s.gatt",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
 }
 
-static void store_service(struct gatt_db_attribute *attr, void *user_data)
+static void store_gatt_cache(struct btd_device *device)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
-	uint16_t start, end;
-	bt_uuid_t uuid;
-	bool primary;
-	char *type;
-
-	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
-								&uuid)) {
-		warn("Error storing service - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", start);
-
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	char filename[PATH_MAX];
+	GByteArray *cache;
 
-	if (primary)
-		type = GATT_PRIM_SVC_UUID_STR;
-	else
-		type = GATT_SND_SVC_UUID_STR;
+	gatt_cache_filename(device, filename, sizeof(filename));
 
-	sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
+	cache = gatt_cache_store_binary(device->db);
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	storage_commit_data_file(filename, cache->data, cache->len);
 
-	gatt_db_service_foreach_incl(attr, store_incl, saver);
-	gatt_db_service_foreach_char(attr, store_chrc, saver);
+	g_byte_array_free(cache, TRUE);
 }
 
 static void store_gatt_db(struct btd_device *device)
@@ -2293,9 +2185,6 @@ static void store_gatt_db(struct btd_device *device)
 	char filename[PATH_MAX];
 	char dst_addr[18];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
-	struct gatt_saver saver;
 
 	if (device_address_is_private(device)) {
 		DBG("Can't store GATT db for private addressed device %s",
@@ -2311,24 +2200,26 @@ static void store_gatt_db(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				dst_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
+	if (main_opts.gatt_cache_format == BT_GATT_CACHE_FORMAT_BINARY) {
+		/* Don't leave a stale text cache behind */
+		g_key_file_remove_group(key_file, "Attributes", NULL);
+		storage_commit_key_file(filename);
 
-	saver.key_file = key_file;
-	saver.device = device;
+		store_gatt_cache(device);
+		return;
+	}
 
-	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
+	gatt_cache_store_text(device->db, key_file);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	storage_commit_key_file(filename);
 
-	g_free(data);
-	g_key_file_free(key_file);
+	/* Don't leave a stale binary cache behind */
+	gatt_cache_filename(device, filename, sizeof(filename));
+	storage_remove_key_file(filename);
+	unlink(filename);
 }
 
 
@@ -2804,6 +2695,7 @@ void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type)
 
 	bacpy(&dev->conn_bdaddr, &dev->bdaddr);
 	dev->conn_bdaddr_type = dev->bdaddr_type;
+	btd_adapter_device_addr_changed(dev->adapter, dev);
 
 	/* If this is the first connection over this bearer */
 	if (bdaddr_type == BDADDR_BREDR)
@@ -2906,7 +2798,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 {
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *str = NULL;
+	char *str;
 	int len;
 
 	if (device_address_is_private(device))
@@ -2914,10 +2806,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
-		goto failed;
+	key_file = storage_get_key_file(filename);
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
 	if (str) {
@@ -2926,9 +2815,6 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 			str[HCI_MAX_NAME_LENGTH] = '\0';
 	}
 
-failed:
-	g_key_file_free(key_file);
-
 	return str;
 }
 
@@ -2985,11 +2871,8 @@ static void load_services(struct btd_device *device, char **uuids)
 static void convert_info(struct btd_device *device, GKeyFile *key_file)
 {
 	char filename[PATH_MAX];
-	char adapter_addr[18];
 	char device_addr[18];
 	char **uuids;
-	char *str;
-	gsize length = 0;
 
 	/* Load device profile list from legacy properties */
 	uuids = g_key_file_get_string_list(key_file, "General", "SDPServices",
@@ -3009,14 +2892,12 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 	g_key_file_remove_key(key_file, "General", "SDPServices", NULL);
 	g_key_file_remove_key(key_file, "General", "GATTServices", NULL);
 
-	ba2str(btd_adapter_get_address(device->adapter), adapter_addr);
+	/* key_file is the cached info file handed over by load_devices */
 	ba2str(&device->bdaddr, device_addr);
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
-			device_addr);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
+				btd_adapter_get_storage_dir(device->adapter),
+				device_addr);
+	storage_commit_key_file(filename);
 
 	store_device_info(device);
 }
@@ -3256,281 +3137,73 @@ static void add_primary(struct gatt_db_attribute *attr, void *user_data)
 	*new_services = g_slist_append(*new_services, prim);
 }
 
-static void load_desc_value(struct gatt_db_attribute *attrib,
-						int err, void *user_data)
-{
-	if (err)
-		warn("loading descriptor value to db failed");
-}
-
-static int load_desc(char *handle, char *value,
-					struct gatt_db_attribute *service)
-{
-	char uuid_str[MAX_LEN_UUID_STR];
-	struct gatt_db_attribute *att;
-	uint16_t handle_int;
-	uint16_t val;
-	bt_uuid_t uuid, ext_uuid;
-
-	if (sscanf(handle, "%04hx", &handle_int) != 1)
-		return -EIO;
-
-	/* Check if there is any value stored, otherwise it is just the UUID */
-	if (sscanf(value, "%04hx:%s", &val, uuid_str) != 2) {
-		if (sscanf(value, "%s", uuid_str) != 1)
-			return -EIO;
-		val = 0;
-	}
-
-	DBG("loading descriptor handle: 0x%04x, value: 0x%04x, uuid: %s",
-				handle_int, val, uuid_str);
-
-	bt_string_to_uuid(&uuid, uuid_str);
-	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-
-	/* If it is CEP then it must contain the value */
-	if (!bt_uuid_cmp(&uuid, &ext_uuid) && !val) {
-		warn("cannot load CEP descriptor without value");
-		return -EIO;
-	}
-
-	att = gatt_db_service_insert_descriptor(service, handle_int, &uuid,
-							0, NULL, NULL, NULL);
-	if (!att || gatt_db_attribute_get_handle(att) != handle_int) {
-		warn("loading descriptor to db failed");
-		return -EIO;
-	}
-
-	if (val) {
-		if (!gatt_db_attribute_write(att, 0, (uint8_t *)&val,
-						sizeof(val), 0, NULL,
-						load_desc_value, NULL))
-			return -EIO;
-	}
-
-	return 0;
-}
-
-static int load_chrc(char *handle, char *value,
-					struct gatt_db_attribute *service)
-{
-	uint16_t properties, value_handle, handle_int;
-	char uuid_str[MAX_LEN_UUID_STR];
-	struct gatt_db_attribute *att;
-	bt_uuid_t uuid;
-
-	if (sscanf(handle, "%04hx", &handle_int) != 1)
-		return -EIO;
-
-	if (sscanf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hx:%s", &value_handle,
-						&properties, uuid_str) != 3)
-		return -EIO;
-
-	bt_string_to_uuid(&uuid, uuid_str);
-
-	/* Log debug message. */
-	DBG("loading characteristic handle: 0x%04x, value handle: 0x%04x,"
-				" properties 0x%04x uuid: %s", handle_int,
-				value_handle, properties, uuid_str);
-
-	att = gatt_db_service_insert_characteristic(service, value_handle,
-							&uuid, 0, properties,
-							NULL, NULL, NULL);
-	if (!att || gatt_db_attribute_get_handle(att) != value_handle) {
-		warn("loading characteristic to db failed");
-		return -EIO;
-	}
-
-	return 0;
-}
-
-static int load_incl(struct gatt_db *db, char *handle, char *value,
-					struct gatt_db_attribute *service)
-{
-	char uuid_str[MAX_LEN_UUID_STR];
-	struct gatt_db_attribute *att;
-	uint16_t start, end;
-
-	if (sscanf(handle, "%04hx", &start) != 1)
-		return -EIO;
-
-	if (sscanf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", &start, &end,
-								uuid_str) != 3)
-		return -EIO;
-
-	/* Log debug message. */
-	DBG("loading included service: 0x%04x, end: 0x%04x, uuid: %s", start,
-								end, uuid_str);
-
-	att = gatt_db_get_attribute(db, start);
-	if (!att) {
-		warn("loading included service to db failed - no such service");
-		return -EIO;
-	}
-
-	att = gatt_db_service_add_included(service, att);
-	if (!att) {
-		warn("loading included service to db failed");
-		return -EIO;
-	}
-
-	return 0;
-}
-
-static int load_service(struct gatt_db *db, char *handle, char *value)
+static int load_gatt_cache(struct btd_device *device)
 {
-	struct gatt_db_attribute *att;
-	uint16_t start, end;
-	char type[MAX_LEN_UUID_STR], uuid_str[MAX_LEN_UUID_STR];
-	bt_uuid_t uuid;
-	bool primary;
-
-	if (sscanf(handle, "%04hx", &start) != 1)
-		return -EIO;
-
-	if (sscanf(value, "%[^:]:%04hx:%s", type, &end, uuid_str) != 3)
-		return -EIO;
+	char filename[PATH_MAX];
+	struct stat st;
+	void *map;
+	int fd, err;
 
-	if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR))
-		primary = true;
-	else if (g_str_equal(type, GATT_SND_SVC_UUID_STR))
-		primary = false;
-	else
-		return -EIO;
+	gatt_cache_filename(device, filename, sizeof(filename));
 
-	bt_string_to_uuid(&uuid, uuid_str);
+	/* Write out a cache still waiting to be stored before mapping it */
+	storage_sync_key_file(filename);
 
-	/* Log debug message. */
-	DBG("loading service: 0x%04x, end: 0x%04x, uuid: %s",
-							start, end, uuid_str);
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
 
-	att = gatt_db_insert_service(db, start, &uuid, primary,
-							end - start + 1);
-	if (!att) {
-		error("Unable load service into db!");
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
 		return -EIO;
 	}
 
-	return 0;
-}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
-static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
-							struct gatt_db *db)
-{
-	struct gatt_db_attribute *current_service;
-	char **handle, *value, type[MAX_LEN_UUID_STR];
-	int ret;
+	if (map == MAP_FAILED)
+		return -errno;
 
-	/* first load service definitions */
-	for (handle = keys; *handle; handle++) {
-		value = g_key_file_get_string(key_file, "Attributes", *handle,
-									NULL);
+	err = gatt_cache_load_binary(device->db, map, st.st_size);
+	if (err == -EINVAL)
+		warn("Ignoring invalid GATT cache %s", filename);
 
-		if (sscanf(value, "%[^:]:", type) != 1) {
-			warn("Missing Type in attribute definition");
-			g_free(value);
-			return -EIO;
-		}
+	munmap(map, st.st_size);
 
-		if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR) ||
-				g_str_equal(type, GATT_SND_SVC_UUID_STR)) {
-			ret = load_service(db, *handle, value);
-			if (ret) {
-				g_free(value);
-				return ret;
-			}
-		}
-
-		g_free(value);
-	}
-
-	current_service = NULL;
-	/* then fill them with data*/
-	for (handle = keys; *handle; handle++) {
-		value = g_key_file_get_string(key_file, "Attributes", *handle,
-									NULL);
-
-		if (sscanf(value, "%[^:]:", type) != 1) {
-			warn("Missing Type in attribute definition");
-			g_free(value);
-			return -EIO;
-		}
-
-		if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR) ||
-				g_str_equal(type, GATT_SND_SVC_UUID_STR)) {
-			uint16_t tmp;
-			uint16_t start, end;
-			bool primary;
-			bt_uuid_t uuid;
-			char uuid_str[MAX_LEN_UUID_STR];
-
-			if (sscanf(*handle, "%04hx", &tmp) != 1) {
-				warn("Unable to parse attribute handle");
-				g_free(value);
-				return -EIO;
-			}
-
-			if (current_service)
-				gatt_db_service_set_active(current_service,
-									true);
-
-			current_service = gatt_db_get_attribute(db, tmp);
-
-			gatt_db_attribute_get_service_data(current_service,
-							&start, &end,
-							&primary, &uuid);
-
-			bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-		} else if (g_str_equal(type, GATT_INCLUDE_UUID_STR)) {
-			ret = load_incl(db, *handle, value, current_service);
-		} else if (g_str_equal(type, GATT_CHARAC_UUID_STR)) {
-			ret = load_chrc(*handle, value, current_service);
-		} else {
-			ret = load_desc(*handle, value, current_service);
-		}
-
-		g_free(value);
-		if (ret) {
-			gatt_db_clear(db);
-			return ret;
-		}
-	}
-
-	if (current_service)
-		gatt_db_service_set_active(current_service, true);
-
-	return 0;
+	return err;
 }
 
 static void load_gatt_db(struct btd_device *device, const char *local,
 							const char *peer)
 {
-	char **keys, filename[PATH_MAX];
+	char filename[PATH_MAX];
 	GKeyFile *key_file;
+	int err;
 
 	if (!gatt_cache_is_enabled(device))
 		return;
 
 	DBG("Restoring %s gatt database from file", peer);
 
+	/* Fall back to the text cache if there is no valid binary one */
+	if (main_opts.gatt_cache_format == BT_GATT_CACHE_FORMAT_BINARY &&
+						!load_gatt_cache(device))
+		goto done;
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
+	key_file = storage_get_key_file(filename);
 
-	if (!keys) {
+	err = gatt_cache_load_text(device->db, key_file);
+	if (err == -ENOENT) {
 		warn("No cache for %s", peer);
-		g_key_file_free(key_file);
 		return;
 	}
 
-	if (load_gatt_db_impl(key_file, keys, device->db))
+	if (err)
 		warn("Unable to load gatt db from file for %s", peer);
 
-	g_strfreev(keys);
-	g_key_file_free(key_file);
-
+done:
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
 	gatt_db_foreach_service(device->db, NULL, add_primary,
@@ -3991,6 +3664,7 @@ void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
 
 	bacpy(&device->bdaddr, bdaddr);
 	device->bdaddr_type = bdaddr_type;
+	btd_adapter_device_addr_changed(device->adapter, device);
 
 	store_device_info(device);
 
@@ -4123,8 +3797,6 @@ static void device_remove_stored(struct btd_device *device)
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device->bredr_state.bonded) {
 		device->bredr_state.bonded = false;
@@ -4149,24 +3821,22 @@ static void device_remove_stored(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
+
+	/* Pending writes must not recreate the files being deleted */
+	storage_remove_key_file(filename);
 	delete_folder_tree(filename);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
+	storage_commit_key_file(filename);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
-
-	g_free(data);
-	g_key_file_free(key_file);
+	gatt_cache_filename(device, filename, sizeof(filename));
+	storage_remove_key_file(filename);
+	unlink(filename);
 }
 
 void device_remove(struct btd_device *device, gboolean remove_stored)
@@ -4540,8 +4210,7 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 	snprintf(sdp_file, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
 								dstaddr);
 
-	sdp_key_file = g_key_file_new();
-	g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+	sdp_key_file = storage_get_key_file(sdp_file);
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
@@ -4608,16 +4277,8 @@ next:
 		sdp_list_free(svcclass, free);
 	}
 
-	if (sdp_key_file) {
-		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
-
-		g_free(data);
-		g_key_file_free(sdp_key_file);
-	}
+	if (sdp_key_file)
+		storage_commit_key_file(sdp_file);
 
 	if (att_key_file) {
 		data = g_key_file_to_data(att_key_file, &length, NULL);
@@ -5372,6 +5033,12 @@ const bdaddr_t *device_get_address(struct btd_device *device)
 {
 	return &device->bdaddr;
 }
+
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
+
 uint8_t device_get_le_address_type(struct btd_device *device)
 {
 	return device->bdaddr_type;
@@ -5480,16 +5147,13 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 	char device_addr[18];
 	GKeyFile *key_file;
 	uint16_t old_value;
-	gsize length = 0;
-	char *str;
 
 	ba2str(&device->bdaddr, device_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	/* for bonded devices this is done on every connection so limit writes
 	 * to storage if no change needed
@@ -5498,7 +5162,7 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 		old_value = g_key_file_get_integer(key_file, "ServiceChanged",
 							"CCC_BR/EDR", NULL);
 		if (old_value == value)
-			goto done;
+			return;
 
 		g_key_file_set_integer(key_file, "ServiceChanged", "CCC_BR/EDR",
 									value);
@@ -5506,20 +5170,13 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 		old_value = g_key_file_get_integer(key_file, "ServiceChanged",
 							"CCC_LE", NULL);
 		if (old_value == value)
-			goto done;
+			return;
 
 		g_key_file_set_integer(key_file, "ServiceChanged", "CCC_LE",
 									value);
 	}
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
-
-done:
-	g_key_file_free(key_file);
+	storage_commit_key_file(filename);
 }
 void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 							uint16_t *ccc_bredr)
@@ -5533,8 +5190,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 
 	if (ccc_le)
 		*ccc_le = g_key_file_get_integer(key_file, "ServiceChanged",
@@ -5543,8 +5199,6 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 	if (ccc_bredr)
 		*ccc_bredr = g_key_file_get_integer(key_file, "ServiceChanged",
 							"CCC_BR/EDR", NULL);
-
-	g_key_file_free(key_file);
 }
 
 void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
@@ -5636,6 +5290,37 @@ void device_set_eri_data(struct btd_device *device, const uint8_t *data, uint8_t
 	memcpy(device->eir_data, data, len);
 }
 
+uint8_t device_get_ad_flags(struct btd_device *device)
+{
+	return device->ad_flags[0];
+}
+
+void device_set_last_adv(struct btd_device *device, const uint8_t *data,
+							uint8_t data_len)
+{
+	if (!device)
+		return;
+
+	eir_report_set(&device->last_adv, data, data_len);
+}
+
+void device_clear_last_adv(struct btd_device *device)
+{
+	if (!device)
+		return;
+
+	eir_report_clear(&device->last_adv);
+}
+
+bool device_last_adv_match(struct btd_device *device, const uint8_t *data,
+							uint8_t data_len)
+{
+	if (!device)
+		return false;
+
+	return eir_report_match(&device->last_adv, data, data_len);
+}
+
 bool device_is_connectable(struct btd_device *device)
 {
 	if (!device)
@@ -6346,8 +6031,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_get_key_file(filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
@@ -6362,7 +6046,6 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	}
 
 	g_strfreev(keys);
-	g_key_file_free(key_file);
 
 	return recs;
 }
@@ -89,6 +89,7 @@ void device_probe_profile(gpointer a, gpointer b);
 void device_remove_profile(gpointer a, gpointer b);
 struct btd_adapter *device_get_adapter(struct btd_device *device);
 const bdaddr_t *device_get_address(struct btd_device *device);
+const bdaddr_t *device_get_conn_address(struct btd_device *device);
 uint8_t device_get_le_address_type(struct btd_device *device);
 const char *device_get_path(const struct btd_device *device);
 gboolean device_is_temporary(struct btd_device *device);
@@ -108,6 +109,12 @@ void device_set_rssi(struct btd_device *device, int8_t rssi);
 void device_set_tx_power(struct btd_device *device, int8_t tx_power);
 void device_set_flags(struct btd_device *device, uint8_t flags);
 void device_set_eri_data(struct btd_device *device, const uint8_t *data, uint8_t data_len);
+uint8_t device_get_ad_flags(struct btd_device *device);
+void device_set_last_adv(struct btd_device *device, const uint8_t *data,
+							uint8_t data_len);
+void device_clear_last_adv(struct btd_device *device);
+bool device_last_adv_match(struct btd_device *device, const uint8_t *data,
+							uint8_t data_len);
 bool btd_device_is_connected(struct btd_device *dev);
 uint8_t btd_device_get_bdaddr_type(struct btd_device *dev);
 bool device_is_retrying(struct btd_device *device);
@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <glib.h>
@@ -611,3 +612,31 @@ int eir_create_oob(const bdaddr_t *addr, const char *name, uint32_t cod,
 
 	return eir_total_len;
 }
+
+void eir_report_set(struct eir_report *report, const uint8_t *data,
+								uint8_t len)
+{
+	g_free(report->data);
+
+	report->data = len ? g_memdup(data, len) : NULL;
+	report->len = len;
+	report->valid = true;
+}
+
+void eir_report_clear(struct eir_report *report)
+{
+	g_free(report->data);
+
+	report->data = NULL;
+	report->len = 0;
+	report->valid = false;
+}
+
+bool eir_report_match(const struct eir_report *report, const uint8_t *data,
+								uint8_t len)
+{
+	if (!report->valid || report->len != len)
+		return false;
+
+	return !len || !memcmp(report->data, data, len);
+}
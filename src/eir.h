@@ -102,6 +102,13 @@ struct eir_data {
 	GSList *data_list;
 };
 
+/* Raw copy of the last fully processed advertising report of a device */
+struct eir_report {
+	bool valid;
+	uint8_t *data;
+	uint8_t len;
+};
+
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
@@ -110,3 +117,8 @@ int eir_create_oob(const bdaddr_t *addr, const char *name, uint32_t cod,
 			uint16_t did_vendor, uint16_t did_product,
 			uint16_t did_version, uint16_t did_source,
 			sdp_list_t *uuids, uint8_t *data);
+void eir_report_set(struct eir_report *report, const uint8_t *data,
+								uint8_t len);
+void eir_report_clear(struct eir_report *report);
+bool eir_report_match(const struct eir_report *report, const uint8_t *data,
+								uint8_t len);
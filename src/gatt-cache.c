@@ -0,0 +1,742 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2006-2010  Nokia Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+
+#include "log.h"
+#include "gatt-cache.h"
+
+#define GATT_PRIM_SVC_UUID_STR "2800"
+#define GATT_SND_SVC_UUID_STR  "2801"
+#define GATT_INCLUDE_UUID_STR "2802"
+#define GATT_CHARAC_UUID_STR "2803"
+
+#define GATT_CACHE_MAGIC	"BZGATTDB"
+#define GATT_CACHE_VERSION	1
+
+enum {
+	GATT_CACHE_PRIM_SVC,
+	GATT_CACHE_SND_SVC,
+	GATT_CACHE_INCL,
+	GATT_CACHE_CHRC,
+	GATT_CACHE_DESC,
+};
+
+/*
+ * Binary GATT cache: a header followed by one fixed size record per
+ * attribute in the same order as the text cache. All fields are little
+ * endian, 128-bit UUIDs are stored as in bt_uuid_t.
+ */
+struct gatt_cache_hdr {
+	uint8_t magic[8];
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t count;
+	uint32_t hash;
+} __attribute__((packed));
+
+struct gatt_cache_rec {
+	uint16_t handle;
+	uint16_t value;		/* End, value or included handle, or CEP */
+	uint16_t end;		/* End handle of included service */
+	uint8_t type;
+	uint8_t props;
+	uint8_t uuid_type;
+	uint8_t uuid[16];
+} __attribute__((packed));
+
+struct gatt_saver {
+	struct gatt_db *db;
+	uint16_t ext_props;
+	GKeyFile *key_file;
+	GByteArray *cache;
+};
+
+static void gatt_cache_add(GByteArray *cache, uint8_t type, uint16_t handle,
+				uint16_t value, uint16_t end, uint8_t props,
+				const bt_uuid_t *uuid)
+{
+	struct gatt_cache_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	put_le16(handle, &rec.handle);
+	put_le16(value, &rec.value);
+	put_le16(end, &rec.end);
+	rec.type = type;
+	rec.props = props;
+	rec.uuid_type = uuid->type;
+
+	switch (uuid->type) {
+	case BT_UUID16:
+		put_le16(uuid->value.u16, rec.uuid);
+		break;
+	case BT_UUID32:
+		put_le32(uuid->value.u32, rec.uuid);
+		break;
+	case BT_UUID128:
+		memcpy(rec.uuid, &uuid->value.u128, sizeof(rec.uuid));
+		break;
+	case BT_UUID_UNSPEC:
+	default:
+		break;
+	}
+
+	g_byte_array_append(cache, (uint8_t *) &rec, sizeof(rec));
+}
+
+/* FNV-1a, only meant to catch truncated or corrupted files */
+static uint32_t gatt_cache_hash(const uint8_t *data, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void store_desc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct gatt_saver *saver = user_data;
+	GKeyFile *key_file = saver->key_file;
+	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
+	const bt_uuid_t *uuid;
+	bt_uuid_t ext_uuid;
+	uint16_t handle_num;
+
+	handle_num = gatt_db_attribute_get_handle(attr);
+	uuid = gatt_db_attribute_get_type(attr);
+
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+
+	if (saver->cache) {
+		gatt_cache_add(saver->cache, GATT_CACHE_DESC, handle_num,
+				bt_uuid_cmp(uuid, &ext_uuid) ? 0 :
+				saver->ext_props, 0, 0, uuid);
+		return;
+	}
+
+	sprintf(handle, "%04hx", handle_num);
+	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
+
+	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
+		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
+	else
+		sprintf(value, "%s", uuid_str);
+
+	g_key_file_set_string(key_file, "Attributes", handle, value);
+}
+
+static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct gatt_saver *saver = user_data;
+	GKeyFile *key_file = saver->key_file;
+	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
+	uint16_t handle_num, value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
+						&properties, &saver->ext_props,
+						&uuid)) {
+		warn("Error storing characteristic - can't get data");
+		return;
+	}
+
+	if (saver->cache) {
+		gatt_cache_add(saver->cache, GATT_CACHE_CHRC, handle_num,
+					value_handle, 0, properties, &uuid);
+	} else {
+		sprintf(handle, "%04hx", handle_num);
+		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+		sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
+					value_handle, properties, uuid_str);
+		g_key_file_set_string(key_file, "Attributes", handle, value);
+	}
+
+	gatt_db_service_foreach_desc(attr, store_desc, saver);
+}
+
+static void store_incl(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct gatt_saver *saver = user_data;
+	GKeyFile *key_file = saver->key_file;
+	struct gatt_db_attribute *service;
+	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
+	uint16_t handle_num, start, end;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
+		warn("Error storing included service - can't get data");
+		return;
+	}
+
+	service = gatt_db_get_attribute(saver->db, start);
+	if (!service) {
+		warn("Error storing included service - can't find it");
+		return;
+	}
+
+	gatt_db_attribute_get_service_uuid(service, &uuid);
+
+	if (saver->cache) {
+		gatt_cache_add(saver->cache, GATT_CACHE_INCL, handle_num,
+							start, end, 0, &uuid);
+		return;
+	}
+
+	sprintf(handle, "%04hx", handle_num);
+	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
+								end, uuid_str);
+
+	g_key_file_set_string(key_file, "Attributes", handle, value);
+}
+
+static void store_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct gatt_saver *saver = user_data;
+	GKeyFile *key_file = saver->key_file;
+	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
+	uint16_t start, end;
+	bt_uuid_t uuid;
+	bool primary;
+	char *type;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid)) {
+		warn("Error storing service - can't get data");
+		return;
+	}
+
+	if (saver->cache) {
+		gatt_cache_add(saver->cache, primary ? GATT_CACHE_PRIM_SVC :
+					GATT_CACHE_SND_SVC, start, end, 0, 0,
+					&uuid);
+	} else {
+		sprintf(handle, "%04hx", start);
+
+		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+
+		if (primary)
+			type = GATT_PRIM_SVC_UUID_STR;
+		else
+			type = GATT_SND_SVC_UUID_STR;
+
+		sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
+
+		g_key_file_set_string(key_file, "Attributes", handle, value);
+	}
+
+	gatt_db_service_foreach_incl(attr, store_incl, saver);
+	gatt_db_service_foreach_char(attr, store_chrc, saver);
+}
+
+static void load_desc_value(struct gatt_db_attribute *attrib,
+						int err, void *user_data)
+{
+	if (err)
+		warn("loading descriptor value to db failed");
+}
+
+static int load_desc(char *handle, char *value,
+					struct gatt_db_attribute *service)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+	struct gatt_db_attribute *att;
+	uint16_t handle_int;
+	uint16_t val;
+	bt_uuid_t uuid, ext_uuid;
+
+	if (sscanf(handle, "%04hx", &handle_int) != 1)
+		return -EIO;
+
+	/* Check if there is any value stored, otherwise it is just the UUID */
+	if (sscanf(value, "%04hx:%s", &val, uuid_str) != 2) {
+		if (sscanf(value, "%s", uuid_str) != 1)
+			return -EIO;
+		val = 0;
+	}
+
+	DBG("loading descriptor handle: 0x%04x, value: 0x%04x, uuid: %s",
+				handle_int, val, uuid_str);
+
+	bt_string_to_uuid(&uuid, uuid_str);
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+
+	/* If it is CEP then it must contain the value */
+	if (!bt_uuid_cmp(&uuid, &ext_uuid) && !val) {
+		warn("cannot load CEP descriptor without value");
+		return -EIO;
+	}
+
+	att = gatt_db_service_insert_descriptor(service, handle_int, &uuid,
+							0, NULL, NULL, NULL);
+	if (!att || gatt_db_attribute_get_handle(att) != handle_int) {
+		warn("loading descriptor to db failed");
+		return -EIO;
+	}
+
+	if (val) {
+		if (!gatt_db_attribute_write(att, 0, (uint8_t *)&val,
+						sizeof(val), 0, NULL,
+						load_desc_value, NULL))
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int load_chrc(char *handle, char *value,
+					struct gatt_db_attribute *service)
+{
+	uint16_t properties, value_handle, handle_int;
+	char uuid_str[MAX_LEN_UUID_STR];
+	struct gatt_db_attribute *att;
+	bt_uuid_t uuid;
+
+	if (sscanf(handle, "%04hx", &handle_int) != 1)
+		return -EIO;
+
+	if (sscanf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hx:%s", &value_handle,
+						&properties, uuid_str) != 3)
+		return -EIO;
+
+	bt_string_to_uuid(&uuid, uuid_str);
+
+	/* Log debug message. */
+	DBG("loading characteristic handle: 0x%04x, value handle: 0x%04x,"
+				" properties 0x%04x uuid: %s", handle_int,
+				value_handle, properties, uuid_str);
+
+	att = gatt_db_service_insert_characteristic(service, value_handle,
+							&uuid, 0, properties,
+							NULL, NULL, NULL);
+	if (!att || gatt_db_attribute_get_handle(att) != value_handle) {
+		warn("loading characteristic to db failed");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int load_incl(struct gatt_db *db, char *handle, char *value,
+					struct gatt_db_attribute *service)
+{
+	char uuid_str[MAX_LEN_UUID_STR];
+	struct gatt_db_attribute *att;
+	uint16_t start, end;
+
+	if (sscanf(handle, "%04hx", &start) != 1)
+		return -EIO;
+
+	if (sscanf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", &start, &end,
+								uuid_str) != 3)
+		return -EIO;
+
+	/* Log debug message. */
+	DBG("loading included service: 0x%04x, end: 0x%04x, uuid: %s", start,
+								end, uuid_str);
+
+	att = gatt_db_get_attribute(db, start);
+	if (!att) {
+		warn("loading included service to db failed - no such service");
+		return -EIO;
+	}
+
+	att = gatt_db_service_add_included(service, att);
+	if (!att) {
+		warn("loading included service to db failed");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int load_service(struct gatt_db *db, char *handle, char *value)
+{
+	struct gatt_db_attribute *att;
+	uint16_t start, end;
+	char type[MAX_LEN_UUID_STR], uuid_str[MAX_LEN_UUID_STR];
+	bt_uuid_t uuid;
+	bool primary;
+
+	if (sscanf(handle, "%04hx", &start) != 1)
+		return -EIO;
+
+	if (sscanf(value, "%[^:]:%04hx:%s", type, &end, uuid_str) != 3)
+		return -EIO;
+
+	if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR))
+		primary = true;
+	else if (g_str_equal(type, GATT_SND_SVC_UUID_STR))
+		primary = false;
+	else
+		return -EIO;
+
+	bt_string_to_uuid(&uuid, uuid_str);
+
+	/* Log debug message. */
+	DBG("loading service: 0x%04x, end: 0x%04x, uuid: %s",
+							start, end, uuid_str);
+
+	att = gatt_db_insert_service(db, start, &uuid, primary,
+							end - start + 1);
+	if (!att) {
+		error("Unable load service into db!");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
+							struct gatt_db *db)
+{
+	struct gatt_db_attribute *current_service;
+	char **handle, *value, type[MAX_LEN_UUID_STR];
+	int ret;
+
+	/* first load service definitions */
+	for (handle = keys; *handle; handle++) {
+		value = g_key_file_get_string(key_file, "Attributes", *handle,
+									NULL);
+
+		if (sscanf(value, "%[^:]:", type) != 1) {
+			warn("Missing Type in attribute definition");
+			g_free(value);
+			return -EIO;
+		}
+
+		if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR) ||
+				g_str_equal(type, GATT_SND_SVC_UUID_STR)) {
+			ret = load_service(db, *handle, value);
+			if (ret) {
+				g_free(value);
+				return ret;
+			}
+		}
+
+		g_free(value);
+	}
+
+	current_service = NULL;
+	/* then fill them with data*/
+	for (handle = keys; *handle; handle++) {
+		value = g_key_file_get_string(key_file, "Attributes", *handle,
+									NULL);
+
+		if (sscanf(value, "%[^:]:", type) != 1) {
+			warn("Missing Type in attribute definition");
+			g_free(value);
+			return -EIO;
+		}
+
+		if (g_str_equal(type, GATT_PRIM_SVC_UUID_STR) ||
+				g_str_equal(type, GATT_SND_SVC_UUID_STR)) {
+			uint16_t tmp;
+			uint16_t start, end;
+			bool primary;
+			bt_uuid_t uuid;
+			char uuid_str[MAX_LEN_UUID_STR];
+
+			if (sscanf(*handle, "%04hx", &tmp) != 1) {
+				warn("Unable to parse attribute handle");
+				g_free(value);
+				return -EIO;
+			}
+
+			if (current_service)
+				gatt_db_service_set_active(current_service,
+									true);
+
+			current_service = gatt_db_get_attribute(db, tmp);
+
+			gatt_db_attribute_get_service_data(current_service,
+							&start, &end,
+							&primary, &uuid);
+
+			bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
+		} else if (g_str_equal(type, GATT_INCLUDE_UUID_STR)) {
+			ret = load_incl(db, *handle, value, current_service);
+		} else if (g_str_equal(type, GATT_CHARAC_UUID_STR)) {
+			ret = load_chrc(*handle, value, current_service);
+		} else {
+			ret = load_desc(*handle, value, current_service);
+		}
+
+		g_free(value);
+		if (ret) {
+			gatt_db_clear(db);
+			return ret;
+		}
+	}
+
+	if (current_service)
+		gatt_db_service_set_active(current_service, true);
+
+	return 0;
+}
+
+static int gatt_cache_get_uuid(const struct gatt_cache_rec *rec,
+							bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	switch (rec->uuid_type) {
+	case BT_UUID16:
+		return bt_uuid16_create(uuid, get_le16(rec->uuid));
+	case BT_UUID32:
+		return bt_uuid32_create(uuid, get_le32(rec->uuid));
+	case BT_UUID128:
+		memcpy(&u128, rec->uuid, sizeof(u128));
+		return bt_uuid128_create(uuid, u128);
+	case BT_UUID_UNSPEC:
+	default:
+		return -EINVAL;
+	}
+}
+
+static struct gatt_db_attribute *load_cache_desc(
+					struct gatt_db_attribute *service,
+					uint16_t handle, uint16_t value,
+					const bt_uuid_t *uuid)
+{
+	struct gatt_db_attribute *att;
+	bt_uuid_t ext_uuid;
+
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+
+	/* If it is CEP then it must contain the value */
+	if (!bt_uuid_cmp(uuid, &ext_uuid) && !value) {
+		warn("cannot load CEP descriptor without value");
+		return NULL;
+	}
+
+	att = gatt_db_service_insert_descriptor(service, handle, uuid, 0,
+							NULL, NULL, NULL);
+	if (!att || gatt_db_attribute_get_handle(att) != handle)
+		return NULL;
+
+	if (value && !gatt_db_attribute_write(att, 0, (uint8_t *) &value,
+						sizeof(value), 0, NULL,
+						load_desc_value, NULL))
+		return NULL;
+
+	return att;
+}
+
+static int load_gatt_cache_impl(const struct gatt_cache_rec *recs,
+					uint32_t count, struct gatt_db *db)
+{
+	struct gatt_db_attribute *current_service = NULL;
+	struct gatt_db_attribute *att;
+	uint16_t handle = 0, value;
+	bt_uuid_t uuid;
+	uint32_t i;
+
+	/* first load service definitions */
+	for (i = 0; i < count; i++) {
+		const struct gatt_cache_rec *rec = &recs[i];
+
+		if (rec->type != GATT_CACHE_PRIM_SVC &&
+					rec->type != GATT_CACHE_SND_SVC)
+			continue;
+
+		handle = get_le16(&rec->handle);
+		value = get_le16(&rec->value);
+
+		if (value < handle || gatt_cache_get_uuid(rec, &uuid) < 0)
+			goto failed;
+
+		att = gatt_db_insert_service(db, handle, &uuid,
+					rec->type == GATT_CACHE_PRIM_SVC,
+					value - handle + 1);
+		if (!att)
+			goto failed;
+	}
+
+	/* then fill them with data */
+	for (i = 0; i < count; i++) {
+		const struct gatt_cache_rec *rec = &recs[i];
+
+		handle = get_le16(&rec->handle);
+		value = get_le16(&rec->value);
+
+		if (rec->type == GATT_CACHE_PRIM_SVC ||
+					rec->type == GATT_CACHE_SND_SVC) {
+			if (current_service)
+				gatt_db_service_set_active(current_service,
+									true);
+
+			current_service = gatt_db_get_attribute(db, handle);
+			continue;
+		}
+
+		if (!current_service || gatt_cache_get_uuid(rec, &uuid) < 0)
+			goto failed;
+
+		switch (rec->type) {
+		case GATT_CACHE_INCL:
+			att = gatt_db_get_attribute(db, value);
+			if (att)
+				att = gatt_db_service_add_included(
+							current_service, att);
+			break;
+		case GATT_CACHE_CHRC:
+			att = gatt_db_service_insert_characteristic(
+							current_service, value,
+							&uuid, 0, rec->props,
+							NULL, NULL, NULL);
+			if (att && gatt_db_attribute_get_handle(att) != value)
+				att = NULL;
+			break;
+		case GATT_CACHE_DESC:
+			att = load_cache_desc(current_service, handle, value,
+									&uuid);
+			break;
+		default:
+			att = NULL;
+			break;
+		}
+
+		if (!att)
+			goto failed;
+	}
+
+	if (current_service)
+		gatt_db_service_set_active(current_service, true);
+
+	return 0;
+
+failed:
+	warn("Unable to load attribute 0x%04x from GATT cache", handle);
+	gatt_db_clear(db);
+	return -EIO;
+}
+
+/* Replace the Attributes group of key_file with the attributes of db */
+void gatt_cache_store_text(struct gatt_db *db, GKeyFile *key_file)
+{
+	struct gatt_saver saver;
+
+	memset(&saver, 0, sizeof(saver));
+	saver.db = db;
+	saver.key_file = key_file;
+
+	/* Remove current attributes since it might have changed */
+	g_key_file_remove_group(key_file, "Attributes", NULL);
+
+	gatt_db_foreach_service(db, NULL, store_service, &saver);
+}
+
+/* Return the binary cache of db, header included, for the caller to free */
+GByteArray *gatt_cache_store_binary(struct gatt_db *db)
+{
+	struct gatt_saver saver;
+	struct gatt_cache_hdr hdr;
+	GByteArray *cache;
+
+	memset(&saver, 0, sizeof(saver));
+	saver.db = db;
+	saver.cache = g_byte_array_new();
+
+	gatt_db_foreach_service(db, NULL, store_service, &saver);
+
+	cache = saver.cache;
+
+	memcpy(hdr.magic, GATT_CACHE_MAGIC, sizeof(hdr.magic));
+	put_le16(GATT_CACHE_VERSION, &hdr.version);
+	put_le16(sizeof(struct gatt_cache_rec), &hdr.rec_size);
+	put_le32(cache->len / sizeof(struct gatt_cache_rec), &hdr.count);
+	put_le32(gatt_cache_hash(cache->data, cache->len), &hdr.hash);
+
+	g_byte_array_prepend(cache, (uint8_t *) &hdr, sizeof(hdr));
+
+	return cache;
+}
+
+/* Returns -ENOENT if key_file has no Attributes group to load */
+int gatt_cache_load_text(struct gatt_db *db, GKeyFile *key_file)
+{
+	char **keys;
+	int err;
+
+	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
+	if (!keys)
+		return -ENOENT;
+
+	err = load_gatt_db_impl(key_file, keys, db);
+
+	g_strfreev(keys);
+
+	return err;
+}
+
+/* Returns -EINVAL without touching db if data is not a valid cache */
+int gatt_cache_load_binary(struct gatt_db *db, const void *data, size_t len)
+{
+	const struct gatt_cache_hdr *hdr = data;
+	const uint8_t *recs;
+	uint32_t count;
+
+	if (len < sizeof(*hdr))
+		return -EINVAL;
+
+	recs = (const uint8_t *) data + sizeof(*hdr);
+	len -= sizeof(*hdr);
+	count = get_le32(&hdr->count);
+
+	if (memcmp(hdr->magic, GATT_CACHE_MAGIC, sizeof(hdr->magic)) ||
+			get_le16(&hdr->version) != GATT_CACHE_VERSION ||
+			get_le16(&hdr->rec_size) !=
+					sizeof(struct gatt_cache_rec) ||
+			len % sizeof(struct gatt_cache_rec) ||
+			len / sizeof(struct gatt_cache_rec) != count ||
+			gatt_cache_hash(recs, len) != get_le32(&hdr->hash))
+		return -EINVAL;
+
+	return load_gatt_cache_impl((const struct gatt_cache_rec *) recs, count,
+									db);
+}
@@ -35,6 +35,11 @@ typedef enum {
 	BT_GATT_CACHE_NO,
 } bt_gatt_cache_t;
 
+typedef enum {
+	BT_GATT_CACHE_FORMAT_TEXT,
+	BT_GATT_CACHE_FORMAT_BINARY,
+} bt_gatt_cache_format_t;
+
 struct main_opts {
 	char		*name;
 	uint32_t	class;
@@ -54,6 +59,7 @@ struct main_opts {
 
 	bt_mode_t	mode;
 	bt_gatt_cache_t gatt_cache;
+	bt_gatt_cache_format_t gatt_cache_format;
 
 	uint8_t		min_enc_key_size;
 };
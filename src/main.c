@@ -61,6 +61,7 @@
 #include "agent.h"
 #include "profile.h"
 #include "systemd.h"
+#include "storage.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -92,6 +93,8 @@ static const char *supported_options[] = {
 	"MultiProfile",
 	"FastConnectable",
 	"Privacy",
+	"PropertiesChangedInterval",
+	"PropertyRateLimit",
 	NULL
 };
 
@@ -105,6 +108,7 @@ static const char *policy_options[] = {
 
 static const char *gatt_options[] = {
 	"Cache",
+	"CacheFormat",
 	"MinEncKeySize",
 	NULL
 };
@@ -191,6 +195,58 @@ static bt_gatt_cache_t parse_gatt_cache(const char *cache)
 	}
 }
 
+static bt_gatt_cache_format_t parse_gatt_cache_format(const char *format)
+{
+	if (!strcmp(format, "text"))
+		return BT_GATT_CACHE_FORMAT_TEXT;
+	else if (!strcmp(format, "binary"))
+		return BT_GATT_CACHE_FORMAT_BINARY;
+
+	DBG("Invalid value for CacheFormat=%s", format);
+	return BT_GATT_CACHE_FORMAT_TEXT;
+}
+
+static void parse_rate_limit(char **list)
+{
+	int i;
+
+	for (i = 0; list[i]; i++) {
+		char *entry = g_strstrip(list[i]);
+		char *name, *interface = NULL;
+		char *colon, *dot, *end;
+		unsigned long interval;
+
+		colon = strrchr(entry, ':');
+		if (!colon) {
+			warn("Invalid PropertyRateLimit entry: %s", entry);
+			continue;
+		}
+
+		*colon = '\0';
+
+		interval = strtoul(colon + 1, &end, 10);
+		if (end == colon + 1 || *end != '\0') {
+			warn("Invalid PropertyRateLimit interval: %s",
+								colon + 1);
+			continue;
+		}
+
+		/* Property names have no dots, interface names always do */
+		dot = strrchr(entry, '.');
+		if (dot) {
+			*dot = '\0';
+			interface = entry;
+			name = dot + 1;
+		} else
+			name = entry;
+
+		DBG("PropertyRateLimit %s.%s=%lu", interface ? : "*", name,
+								interval);
+
+		g_dbus_set_property_interval(interface, name, interval);
+	}
+}
+
 static void check_options(GKeyFile *config, const char *group,
 						const char **options)
 {
@@ -268,7 +324,7 @@ static int get_mode(const char *str)
 static void parse_config(GKeyFile *config)
 {
 	GError *err = NULL;
-	char *str;
+	char *str, **list;
 	int val;
 	gboolean boolean;
 
@@ -319,6 +375,28 @@ static void parse_config(GKeyFile *config)
 		g_free(str);
 	}
 
+	val = g_key_file_get_integer(config, "General",
+					"PropertiesChangedInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		warn("Invalid PropertiesChangedInterval: %d", val);
+	} else {
+		DBG("PropertiesChangedInterval=%d", val);
+		g_dbus_set_changes_interval(val);
+	}
+
+	list = g_key_file_get_string_list(config, "General",
+					"PropertyRateLimit", NULL, &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		parse_rate_limit(list);
+		g_strfreev(list);
+	}
+
 	str = g_key_file_get_string(config, "General", "Name", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -410,6 +488,15 @@ static void parse_config(GKeyFile *config)
 		g_free(str);
 	}
 
+	str = g_key_file_get_string(config, "GATT", "CacheFormat", &err);
+	if (err) {
+		g_clear_error(&err);
+		main_opts.gatt_cache_format = BT_GATT_CACHE_FORMAT_TEXT;
+	} else {
+		main_opts.gatt_cache_format = parse_gatt_cache_format(str);
+		g_free(str);
+	}
+
 	val = g_key_file_get_integer(config, "GATT",
 						"MinEncKeySize", &err);
 	if (err) {
@@ -830,6 +917,8 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	storage_sync_key_file(NULL);
+
 	rfkill_exit();
 
 	if (main_opts.mode != BT_MODE_LE)
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -43,6 +44,9 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_MAX_READ_BATCH		16  /* Max PDUs handled per wakeup */
+#define ATT_MAX_WRITE_BATCH		16  /* Max PDUs sent per wakeup */
+#define ATT_NOTIFY_TABLE_SIZE		256  /* One entry per opcode */
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -65,13 +69,19 @@ struct bt_att {
 	bool writer_active;
 
 	struct queue *notify_list;	/* List of registered callbacks */
+	struct queue *notify_table[ATT_NOTIFY_TABLE_SIZE]; /* By opcode */
 	struct queue *disconn_list;	/* List of disconnect handlers */
 
 	bool in_req;			/* There's a pending incoming request */
+	bool in_notify;			/* Notify handlers are being called */
+	bool need_notify_cleanup;	/* Notify handlers to be removed */
 
 	uint8_t *buf;
 	uint16_t mtu;
 
+	unsigned int read_wakeups;	/* Number of read events handled */
+	unsigned int read_pdus;		/* Number of PDUs received */
+
 	unsigned int next_send_id;	/* IDs for "send" ops */
 	unsigned int next_reg_id;	/* IDs for registered callbacks */
 
@@ -223,6 +233,7 @@ static void cancel_att_send_op(struct att_send_op *op)
 
 struct att_notify {
 	unsigned int id;
+	bool removed;
 	uint16_t opcode;
 	bt_att_notify_func_t callback;
 	bt_att_destroy_func_t destroy;
@@ -247,6 +258,13 @@ static bool match_notify_id(const void *a, const void *b)
 	return notify->id == id;
 }
 
+static bool match_notify_removed(const void *a, const void *b)
+{
+	const struct att_notify *notify = a;
+
+	return notify->removed;
+}
+
 struct att_disconn {
 	unsigned int id;
 	bool removed;
@@ -440,6 +458,63 @@ static void write_watch_destroy(void *user_data)
 	att->writer_active = false;
 }
 
+static void write_op_sent(struct bt_att *att, struct att_send_op *op,
+								ssize_t len)
+{
+	util_debug(att->debug_callback, att->debug_data,
+					"ATT op 0x%02x", op->opcode);
+
+	util_hexdump('<', op->pdu, len, att->debug_callback, att->debug_data);
+}
+
+/*
+ * Send everything sitting in the write queue with a single sendmmsg() call.
+ * Operations in the write queue never expect a response so they can go out
+ * back to back; requests and indications are still sent one at a time by
+ * can_write_data(). Returns the number of operations sent, or a negative
+ * error in which case the queue is left untouched.
+ */
+static int flush_write_queue(struct bt_att *att)
+{
+	struct att_send_op *ops[ATT_MAX_WRITE_BATCH];
+	struct iovec iov[ATT_MAX_WRITE_BATCH];
+	struct mmsghdr msgs[ATT_MAX_WRITE_BATCH];
+	int count, ret, i;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (count = 0; count < ATT_MAX_WRITE_BATCH; count++) {
+		ops[count] = queue_pop_head(att->write_queue);
+		if (!ops[count])
+			break;
+
+		iov[count].iov_base = ops[count]->pdu;
+		iov[count].iov_len = ops[count]->len;
+		msgs[count].msg_hdr.msg_iov = &iov[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = sendmmsg(att->fd, msgs, count, MSG_DONTWAIT);
+	if (ret < 0)
+		ret = -errno;
+
+	/* Put back whatever was not sent, preserving the original order */
+	for (i = count - 1; i >= (ret < 0 ? 0 : ret); i--)
+		queue_push_head(att->write_queue, ops[i]);
+
+	for (i = 0; i < ret; i++) {
+		write_op_sent(att, ops[i], msgs[i].msg_len);
+
+		/* Set in_req to false to indicate that no request is pending */
+		if (ops[i]->type == ATT_OP_TYPE_RSP)
+			att->in_req = false;
+
+		destroy_att_send_op(ops[i]);
+	}
+
+	return ret;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct bt_att *att = user_data;
@@ -448,6 +523,14 @@ static bool can_write_data(struct io *io, void *user_data)
 	ssize_t ret;
 	struct iovec iov;
 
+	/*
+	 * Coalesce multiple PDUs into one syscall when possible. On failure
+	 * fall back to sending a single PDU so errors are reported to the
+	 * operation the same way as before.
+	 */
+	if (queue_length(att->write_queue) > 1 && flush_write_queue(att) > 0)
+		return true;
+
 	op = pick_next_send_op(att);
 	if (!op)
 		return false;
@@ -467,10 +550,7 @@ static bool can_write_data(struct io *io, void *user_data)
 		return true;
 	}
 
-	util_debug(att->debug_callback, att->debug_data,
-					"ATT op 0x%02x", op->opcode);
-
-	util_hexdump('<', op->pdu, ret, att->debug_callback, att->debug_data);
+	write_op_sent(att, op, ret);
 
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
@@ -750,17 +830,6 @@ struct notify_data {
 	bool handler_found;
 };
 
-static bool opcode_match(uint8_t opcode, uint8_t test_opcode)
-{
-	enum att_op_type op_type = get_op_type(test_opcode);
-
-	if (opcode == BT_ATT_ALL_REQUESTS && (op_type == ATT_OP_TYPE_REQ ||
-						op_type == ATT_OP_TYPE_CMD))
-		return true;
-
-	return opcode == test_opcode;
-}
-
 static void respond_not_supported(struct bt_att *att, uint8_t opcode)
 {
 	struct bt_att_pdu_error_rsp pdu;
@@ -810,10 +879,42 @@ fail:
 	return false;
 }
 
+static void cleanup_notify(struct bt_att *att)
+{
+	unsigned int i;
+
+	for (i = 0; i < ATT_NOTIFY_TABLE_SIZE; i++)
+		queue_remove_all(att->notify_table[i], match_notify_removed,
+								NULL, NULL);
+
+	queue_remove_all(att->notify_list, match_notify_removed, NULL,
+							destroy_att_notify);
+}
+
+static struct att_notify *next_notify(const struct queue_entry **a,
+					const struct queue_entry **b)
+{
+	const struct att_notify *na = *a ? (*a)->data : NULL;
+	const struct att_notify *nb = *b ? (*b)->data : NULL;
+
+	/* Merge both lists in registration order */
+	if (na && (!nb || na->id < nb->id)) {
+		*a = (*a)->next;
+		return (void *) na;
+	}
+
+	if (nb)
+		*b = (*b)->next;
+
+	return (void *) nb;
+}
+
 static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 								ssize_t pdu_len)
 {
-	const struct queue_entry *entry;
+	const struct queue_entry *entry, *all_entry = NULL;
+	struct att_notify *notify;
+	enum att_op_type op_type;
 	bool found;
 
 	if ((opcode & ATT_OP_SIGNED_MASK) && !att->crypto) {
@@ -825,14 +926,28 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 	bt_att_ref(att);
 
 	found = false;
-	entry = queue_get_entries(att->notify_list);
+	op_type = get_op_type(opcode);
 
-	while (entry) {
-		struct att_notify *notify = entry->data;
+	/*
+	 * Only handlers registered for this exact opcode, plus the ones
+	 * registered for BT_ATT_ALL_REQUESTS in case of requests and commands,
+	 * need to be looked at.
+	 */
+	entry = queue_get_entries(att->notify_table[opcode]);
 
-		entry = entry->next;
+	if (opcode != BT_ATT_ALL_REQUESTS && (op_type == ATT_OP_TYPE_REQ ||
+						op_type == ATT_OP_TYPE_CMD))
+		all_entry = queue_get_entries(
+				att->notify_table[BT_ATT_ALL_REQUESTS]);
 
-		if (!opcode_match(notify->opcode, opcode))
+	/*
+	 * Handlers unregistered by a callback are only marked as removed
+	 * until the loop is done, so that the entries walked stay valid.
+	 */
+	att->in_notify = true;
+
+	while ((notify = next_notify(&entry, &all_entry))) {
+		if (notify->removed)
 			continue;
 
 		found = true;
@@ -840,55 +955,47 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 		if (notify->callback)
 			notify->callback(opcode, pdu, pdu_len,
 							notify->user_data);
+	}
 
-		/* callback could remove all entries from notify list */
-		if (queue_isempty(att->notify_list))
-			break;
+	att->in_notify = false;
+
+	if (att->need_notify_cleanup) {
+		cleanup_notify(att);
+		att->need_notify_cleanup = false;
 	}
 
 	/*
 	 * If this was not a command and no handler was registered for it,
 	 * respond with "Not Supported"
 	 */
-	if (!found && get_op_type(opcode) != ATT_OP_TYPE_CMD)
+	if (!found && op_type != ATT_OP_TYPE_CMD)
 		respond_not_supported(att, opcode);
 
 	bt_att_unref(att);
 }
 
-static bool can_read_data(struct io *io, void *user_data)
+static bool handle_pdu(struct bt_att *att, uint8_t *pdu, ssize_t pdu_len)
 {
-	struct bt_att *att = user_data;
 	uint8_t opcode;
-	uint8_t *pdu;
-	ssize_t bytes_read;
-
-	bytes_read = read(att->fd, att->buf, att->mtu);
-	if (bytes_read < 0)
-		return false;
 
-	util_hexdump('>', att->buf, bytes_read,
-					att->debug_callback, att->debug_data);
+	util_hexdump('>', pdu, pdu_len, att->debug_callback, att->debug_data);
 
-	if (bytes_read < ATT_MIN_PDU_LEN)
+	if (pdu_len < ATT_MIN_PDU_LEN)
 		return true;
 
-	pdu = att->buf;
 	opcode = pdu[0];
 
-	bt_att_ref(att);
-
 	/* Act on the received PDU based on the opcode type */
 	switch (get_op_type(opcode)) {
 	case ATT_OP_TYPE_RSP:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT response received: 0x%02x", opcode);
-		handle_rsp(att, opcode, pdu + 1, bytes_read - 1);
+		handle_rsp(att, opcode, pdu + 1, pdu_len - 1);
 		break;
 	case ATT_OP_TYPE_CONF:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT confirmation received: 0x%02x", opcode);
-		handle_conf(att, pdu + 1, bytes_read - 1);
+		handle_conf(att, pdu + 1, pdu_len - 1);
 		break;
 	case ATT_OP_TYPE_REQ:
 		/*
@@ -901,8 +1008,6 @@ static bool can_read_data(struct io *io, void *user_data)
 					"Received request while another is "
 					"pending: 0x%02x", opcode);
 			io_shutdown(att->io);
-			bt_att_unref(att);
-
 			return false;
 		}
 
@@ -919,13 +1024,62 @@ static bool can_read_data(struct io *io, void *user_data)
 		 */
 		util_debug(att->debug_callback, att->debug_data,
 					"ATT PDU received: 0x%02x", opcode);
-		handle_notify(att, opcode, pdu + 1, bytes_read - 1);
+		handle_notify(att, opcode, pdu + 1, pdu_len - 1);
 		break;
 	}
 
+	return true;
+}
+
+static bool can_read_data(struct io *io, void *user_data)
+{
+	struct bt_att *att = user_data;
+	ssize_t bytes_read;
+	unsigned int count;
+	bool ret = true;
+
+	bytes_read = read(att->fd, att->buf, att->mtu);
+	if (bytes_read <= 0)
+		return false;
+
+	bt_att_ref(att);
+
+	att->read_wakeups++;
+
+	/*
+	 * Drain up to ATT_MAX_READ_BATCH PDUs already queued on the socket
+	 * before returning to the mainloop, so that bursts of notifications
+	 * do not cost one poll round trip each. The buffer is looked up on
+	 * every iteration since a handler may have changed the MTU.
+	 */
+	for (count = 1; ; count++) {
+		att->read_pdus++;
+
+		if (!handle_pdu(att, att->buf, bytes_read)) {
+			ret = false;
+			break;
+		}
+
+		/* A handler might have caused the bearer to go away */
+		if (!att->io || count == ATT_MAX_READ_BATCH)
+			break;
+
+		bytes_read = recv(att->fd, att->buf, att->mtu, MSG_DONTWAIT);
+		if (bytes_read <= 0) {
+			/* Leave it to the disconnect path if the peer is gone */
+			if (!bytes_read)
+				ret = false;
+			break;
+		}
+	}
+
+	if (count > 1)
+		util_debug(att->debug_callback, att->debug_data,
+					"ATT handled %u PDUs in one read", count);
+
 	bt_att_unref(att);
 
-	return true;
+	return ret;
 }
 
 static bool is_io_l2cap_based(int fd)
@@ -955,6 +1109,8 @@ static bool is_io_l2cap_based(int fd)
 
 static void bt_att_free(struct bt_att *att)
 {
+	unsigned int i;
+
 	if (att->pending_req)
 		destroy_att_send_op(att->pending_req);
 
@@ -968,6 +1124,10 @@ static void bt_att_free(struct bt_att *att)
 	queue_destroy(att->ind_queue, NULL);
 	queue_destroy(att->write_queue, NULL);
 	queue_destroy(att->notify_list, NULL);
+
+	for (i = 0; i < ATT_NOTIFY_TABLE_SIZE; i++)
+		queue_destroy(att->notify_table[i], NULL);
+
 	queue_destroy(att->disconn_list, NULL);
 
 	if (att->timeout_destroy)
@@ -1103,6 +1263,10 @@ bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 	att->debug_destroy = destroy;
 	att->debug_data = user_data;
 
+	if (att->crypto)
+		util_debug(callback, user_data, "Using %s crypto backend",
+					bt_crypto_get_backend(att->crypto));
+
 	return true;
 }
 
@@ -1136,6 +1300,21 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	return true;
 }
 
+bool bt_att_get_read_stats(struct bt_att *att, unsigned int *wakeups,
+							unsigned int *pdus)
+{
+	if (!att)
+		return false;
+
+	if (wakeups)
+		*wakeups = att->read_wakeups;
+
+	if (pdus)
+		*pdus = att->read_pdus;
+
+	return true;
+}
+
 uint8_t bt_att_get_link_type(struct bt_att *att)
 {
 	struct sockaddr_l2 src;
@@ -1420,11 +1599,16 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 
 	notify->id = att->next_reg_id++;
 
+	if (!att->notify_table[opcode])
+		att->notify_table[opcode] = queue_new();
+
 	if (!queue_push_tail(att->notify_list, notify)) {
 		free(notify);
 		return 0;
 	}
 
+	queue_push_tail(att->notify_table[opcode], notify);
+
 	return notify->id;
 }
 
@@ -1435,21 +1619,53 @@ bool bt_att_unregister(struct bt_att *att, unsigned int id)
 	if (!att || !id)
 		return false;
 
+	if (att->in_notify) {
+		notify = queue_find(att->notify_list, match_notify_id,
+							UINT_TO_PTR(id));
+		if (!notify || notify->removed)
+			return false;
+
+		notify->removed = true;
+		att->need_notify_cleanup = true;
+		return true;
+	}
+
 	notify = queue_remove_if(att->notify_list, match_notify_id,
 							UINT_TO_PTR(id));
 	if (!notify)
 		return false;
 
+	queue_remove(att->notify_table[notify->opcode], notify);
+
 	destroy_att_notify(notify);
 	return true;
 }
 
+static void mark_notify_removed(void *data, void *user_data)
+{
+	struct att_notify *notify = data;
+
+	notify->removed = true;
+}
+
 bool bt_att_unregister_all(struct bt_att *att)
 {
+	unsigned int i;
+
 	if (!att)
 		return false;
 
-	queue_remove_all(att->notify_list, NULL, NULL, destroy_att_notify);
+	if (att->in_notify) {
+		queue_foreach(att->notify_list, mark_notify_removed, NULL);
+		att->need_notify_cleanup = true;
+	} else {
+		for (i = 0; i < ATT_NOTIFY_TABLE_SIZE; i++)
+			queue_remove_all(att->notify_table[i], NULL, NULL,
+									NULL);
+
+		queue_remove_all(att->notify_list, NULL, NULL,
+							destroy_att_notify);
+	}
 	queue_remove_all(att->disconn_list, NULL, NULL, destroy_att_disconn);
 
 	return true;
@@ -26,14 +26,19 @@
 #endif
 
 #include <endian.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <pthread.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "src/shared/btsnoop.h"
 
@@ -66,6 +71,63 @@ struct pklg_pkt {
 } __attribute__ ((packed));
 #define PKLG_PKT_SIZE (sizeof(struct pklg_pkt))
 
+/*
+ * The sidecar index is a cache of record offsets and timestamps. It is
+ * stored in little endian and tied to the size and modification time of
+ * the trace, so a stale index is simply rebuilt.
+ */
+struct btsnoop_index_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	reserved;
+	uint64_t	file_size;	/* Size of the indexed trace */
+	uint64_t	file_mtime;	/* Modification time in nanoseconds */
+	uint64_t	count;		/* Number of entries */
+} __attribute__ ((packed));
+#define BTSNOOP_INDEX_HDR_SIZE (sizeof(struct btsnoop_index_hdr))
+
+struct btsnoop_index_entry {
+	uint64_t	offset;		/* Record offset in the trace */
+	uint64_t	ts;		/* Timestamp microseconds since epoch */
+} __attribute__ ((packed));
+#define BTSNOOP_INDEX_ENTRY_SIZE (sizeof(struct btsnoop_index_entry))
+
+static const uint8_t btsnoop_index_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					    0x70, 0x69, 0x64, 0x78 };
+
+static const uint32_t btsnoop_index_version = 1;
+
+struct btsnoop_index {
+	const struct btsnoop_index_entry *entries;
+	uint64_t count;
+	void *map;
+	size_t map_size;
+};
+
+/*
+ * Records are collected in a write buffer and written out when it fills up,
+ * when the flush interval elapses, before rotating to a new file and when
+ * the last reference is dropped. In async mode a second buffer is handed to
+ * a flusher thread so the caller only blocks if the disk can't keep up.
+ */
+struct btsnoop_buffer {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	unsigned int interval;
+	uint64_t last_flush;
+	bool failed;
+
+	bool async;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t *pending;
+	size_t pending_len;
+	bool busy;
+	bool stop;
+};
+
 struct btsnoop {
 	int ref_count;
 	int fd;
@@ -80,8 +142,311 @@ struct btsnoop {
 	size_t cur_size;
 	unsigned int max_count;
 	unsigned int cur_count;
+	struct btsnoop_buffer *buf;
+	const uint8_t *map;
+	size_t map_size;
+	size_t map_end;
+	size_t map_checked;
+	size_t offset;
+	size_t readahead;
+	uint8_t *data;
+	struct btsnoop_index *idx;
 };
 
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t written;
+
+		written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+static uint64_t get_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *flush_thread(void *user_data)
+{
+	struct btsnoop *btsnoop = user_data;
+	struct btsnoop_buffer *buf = btsnoop->buf;
+	bool written;
+
+	pthread_mutex_lock(&buf->lock);
+
+	while (1) {
+		while (!buf->busy && !buf->stop)
+			pthread_cond_wait(&buf->cond, &buf->lock);
+
+		if (!buf->busy)
+			break;
+
+		pthread_mutex_unlock(&buf->lock);
+
+		written = write_all(btsnoop->fd, buf->pending,
+							buf->pending_len);
+
+		pthread_mutex_lock(&buf->lock);
+
+		if (!written)
+			buf->failed = true;
+
+		buf->busy = false;
+		pthread_cond_broadcast(&buf->cond);
+	}
+
+	pthread_mutex_unlock(&buf->lock);
+
+	return NULL;
+}
+
+/* Wait for the flusher thread to be done with the pending buffer */
+static void wait_flush(struct btsnoop_buffer *buf)
+{
+	pthread_mutex_lock(&buf->lock);
+
+	while (buf->busy)
+		pthread_cond_wait(&buf->cond, &buf->lock);
+
+	pthread_mutex_unlock(&buf->lock);
+}
+
+static bool flush_buffer(struct btsnoop *btsnoop, bool wait)
+{
+	struct btsnoop_buffer *buf = btsnoop->buf;
+	uint8_t *data;
+	bool failed;
+
+	if (!buf)
+		return true;
+
+	buf->last_flush = get_msec();
+
+	if (!buf->async) {
+		if (buf->len && !write_all(btsnoop->fd, buf->data, buf->len))
+			buf->failed = true;
+
+		buf->len = 0;
+		goto done;
+	}
+
+	if (buf->len) {
+		wait_flush(buf);
+
+		/* Swap buffers and let the thread write the full one */
+		data = buf->pending;
+
+		pthread_mutex_lock(&buf->lock);
+		buf->pending = buf->data;
+		buf->pending_len = buf->len;
+		buf->busy = true;
+		pthread_cond_broadcast(&buf->cond);
+		pthread_mutex_unlock(&buf->lock);
+
+		buf->data = data;
+		buf->len = 0;
+	}
+
+	if (wait)
+		wait_flush(buf);
+
+done:
+	if (buf->async)
+		pthread_mutex_lock(&buf->lock);
+
+	failed = buf->failed;
+	buf->failed = false;
+
+	if (buf->async)
+		pthread_mutex_unlock(&buf->lock);
+
+	return !failed;
+}
+
+static void free_buffer(struct btsnoop *btsnoop)
+{
+	struct btsnoop_buffer *buf = btsnoop->buf;
+
+	if (!buf)
+		return;
+
+	flush_buffer(btsnoop, true);
+
+	if (buf->async) {
+		pthread_mutex_lock(&buf->lock);
+		buf->stop = true;
+		pthread_cond_broadcast(&buf->cond);
+		pthread_mutex_unlock(&buf->lock);
+
+		pthread_join(buf->thread, NULL);
+		pthread_cond_destroy(&buf->cond);
+		pthread_mutex_destroy(&buf->lock);
+	}
+
+	free(buf->pending);
+	free(buf->data);
+	free(buf);
+
+	btsnoop->buf = NULL;
+}
+
+static void free_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_index *idx = btsnoop->idx;
+
+	if (!idx)
+		return;
+
+	if (idx->map)
+		munmap(idx->map, idx->map_size);
+	else
+		free((void *) idx->entries);
+
+	free(idx);
+
+	btsnoop->idx = NULL;
+}
+
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	/* Pipes and other special files are read with plain read() */
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_end = st.st_size;
+	btsnoop->offset = 0;
+	btsnoop->readahead = 0;
+}
+
+#define MAP_CHECK_SIZE	(64 * 1024)
+
+/*
+ * Touching pages past the end of a file that got truncated under the
+ * mapping raises SIGBUS. The file size is checked again every time the
+ * reader moves on by MAP_CHECK_SIZE, and records beyond a new end of
+ * file are treated as truncated.
+ */
+static void map_check_size(struct btsnoop *btsnoop, size_t offset)
+{
+	struct stat st;
+
+	if (offset < btsnoop->map_checked)
+		return;
+
+	btsnoop->map_checked = offset + MAP_CHECK_SIZE;
+
+	if (fstat(btsnoop->fd, &st) < 0)
+		return;
+
+	if ((uint64_t) st.st_size < btsnoop->map_end)
+		btsnoop->map_end = st.st_size;
+}
+
+#define READAHEAD_SIZE	(4 * 1024 * 1024)
+
+/*
+ * MADV_SEQUENTIAL alone leaves the kernel faulting in small windows, which
+ * turns into a seek storm when several traces are read interleaved (as in
+ * btsnoop merge). Ask for the next few megabytes up front instead, once
+ * the reader is within half a window of the end of the last request.
+ */
+static void map_readahead(struct btsnoop *btsnoop)
+{
+	size_t start, len, page;
+
+	if (btsnoop->offset + READAHEAD_SIZE / 2 < btsnoop->readahead)
+		return;
+
+	page = sysconf(_SC_PAGESIZE);
+
+	start = btsnoop->readahead;
+	if (btsnoop->offset > start)
+		start = btsnoop->offset & ~(page - 1);
+
+	if (start >= btsnoop->map_end)
+		return;
+
+	len = btsnoop->map_end - start;
+	if (len > READAHEAD_SIZE)
+		len = READAHEAD_SIZE;
+
+	madvise((void *) (btsnoop->map + start), len, MADV_WILLNEED);
+
+	btsnoop->readahead = start + len;
+}
+
+/*
+ * Returns up to len bytes of the trace in *data. Mapped traces hand out a
+ * pointer into the mapping, everything else is read into buf.
+ */
+static ssize_t fetch_data(struct btsnoop *btsnoop, void *buf, size_t len,
+							const void **data)
+{
+	if (!btsnoop->map) {
+		*data = buf;
+		return read(btsnoop->fd, buf, len);
+	}
+
+	map_check_size(btsnoop, btsnoop->offset + len);
+	map_readahead(btsnoop);
+
+	if (btsnoop->offset >= btsnoop->map_end)
+		return 0;
+
+	/* A record cut short is all a truncated trace has left */
+	if (len > btsnoop->map_end - btsnoop->offset) {
+		btsnoop->offset = btsnoop->map_end;
+		errno = EIO;
+		return -1;
+	}
+
+	*data = btsnoop->map + btsnoop->offset;
+	btsnoop->offset += len;
+
+	return len;
+}
+
+static ssize_t read_data(struct btsnoop *btsnoop, void *buf, size_t len)
+{
+	const void *data;
+	ssize_t ret;
+
+	ret = fetch_data(btsnoop, buf, len, &data);
+	if (ret > 0 && data != buf)
+		memcpy(buf, data, ret);
+
+	return ret;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -100,7 +465,9 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 	btsnoop->flags = flags;
 
-	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
+	map_file(btsnoop);
+
+	len = read_data(btsnoop, &hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE)
 		goto failed;
 
@@ -126,12 +493,18 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		btsnoop->pklg_v2 = (hdr.id[1] == 0x01);
 
 		/* Apple Packet Logger format has no header */
-		lseek(btsnoop->fd, 0, SEEK_SET);
+		if (btsnoop->map)
+			btsnoop->offset = 0;
+		else
+			lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
 	return btsnoop_ref(btsnoop);
 
 failed:
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
 	close(btsnoop->fd);
 	free(btsnoop);
 
@@ -209,6 +582,13 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
+	free_buffer(btsnoop);
+	free_index(btsnoop);
+	free(btsnoop->data);
+
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
 	if (btsnoop->fd >= 0)
 		close(btsnoop->fd);
 
@@ -223,12 +603,75 @@ uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
 	return btsnoop->format;
 }
 
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+					unsigned int interval, bool async)
+{
+	struct btsnoop_buffer *buf;
+
+	if (!btsnoop || btsnoop->buf || size < BTSNOOP_PKT_SIZE +
+						BTSNOOP_MAX_PACKET_SIZE)
+		return false;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return false;
+
+	buf->size = size;
+	buf->interval = interval;
+	buf->last_flush = get_msec();
+	buf->async = async;
+
+	buf->data = malloc(size);
+	if (!buf->data)
+		goto failed;
+
+	btsnoop->buf = buf;
+
+	if (!async)
+		return true;
+
+	buf->pending = malloc(size);
+	if (!buf->pending)
+		goto failed;
+
+	pthread_mutex_init(&buf->lock, NULL);
+	pthread_cond_init(&buf->cond, NULL);
+
+	if (pthread_create(&buf->thread, NULL, flush_thread, btsnoop)) {
+		pthread_cond_destroy(&buf->cond);
+		pthread_mutex_destroy(&buf->lock);
+		goto failed;
+	}
+
+	return true;
+
+failed:
+	btsnoop->buf = NULL;
+
+	free(buf->pending);
+	free(buf->data);
+	free(buf);
+
+	return false;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return false;
+
+	return flush_buffer(btsnoop, false);
+}
+
 static bool btsnoop_rotate(struct btsnoop *btsnoop)
 {
 	struct btsnoop_hdr hdr;
 	char path[PATH_MAX];
 	ssize_t written;
 
+	/* Everything buffered belongs to the current file */
+	flush_buffer(btsnoop, true);
+
 	close(btsnoop->fd);
 
 	/* Check if max number of log files has been reached */
@@ -264,6 +707,9 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct btsnoop_buffer *buf;
+	struct iovec iov[2];
+	int iovcnt = 1;
 	uint64_t ts;
 	ssize_t written;
 
@@ -283,19 +729,43 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return false;
+	buf = btsnoop->buf;
+	if (buf) {
+		if (buf->len + BTSNOOP_PKT_SIZE + size > buf->size &&
+					!flush_buffer(btsnoop, false))
+			return false;
 
-	btsnoop->cur_size += BTSNOOP_PKT_SIZE;
+		memcpy(buf->data + buf->len, &pkt, BTSNOOP_PKT_SIZE);
+		buf->len += BTSNOOP_PKT_SIZE;
+
+		if (data && size > 0) {
+			memcpy(buf->data + buf->len, data, size);
+			buf->len += size;
+		}
+
+		btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
+
+		if (buf->interval &&
+				get_msec() - buf->last_flush >= buf->interval)
+			return flush_buffer(btsnoop, false);
+
+		return true;
+	}
+
+	iov[0].iov_base = &pkt;
+	iov[0].iov_len = BTSNOOP_PKT_SIZE;
 
 	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
-			return false;
+		iov[1].iov_base = (void *) data;
+		iov[1].iov_len = size;
+		iovcnt++;
 	}
 
-	btsnoop->cur_size += size;
+	written = writev(btsnoop->fd, iov, iovcnt);
+	if (written < 0)
+		return false;
+
+	btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
 
 	return true;
 }
@@ -380,14 +850,16 @@ bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 
 static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					void *buf, const void **data,
+					uint16_t *size)
 {
-	struct pklg_pkt pkt;
+	const struct pklg_pkt *pkt;
+	struct pklg_pkt hdr;
 	uint32_t toread;
 	uint64_t ts;
 	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = fetch_data(btsnoop, &hdr, PKLG_PKT_SIZE, (const void **) &pkt);
 	if (len == 0)
 		return false;
 
@@ -397,20 +869,25 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	}
 
 	if (btsnoop->pklg_v2) {
-		toread = le32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
+		toread = le32toh(pkt->len) - (PKLG_PKT_SIZE - 4);
 
-		ts = le64toh(pkt.ts);
+		ts = le64toh(pkt->ts);
 		tv->tv_sec = ts & 0xffffffff;
 		tv->tv_usec = ts >> 32;
 	} else {
-		toread = be32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
+		toread = be32toh(pkt->len) - (PKLG_PKT_SIZE - 4);
 
-		ts = be64toh(pkt.ts);
+		ts = be64toh(pkt->ts);
 		tv->tv_sec = ts >> 32;
 		tv->tv_usec = ts & 0xffffffff;
 	}
 
-	switch (pkt.type) {
+	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
+		btsnoop->aborted = true;
+		return false;
+	}
+
+	switch (pkt->type) {
 	case 0x00:
 		*index = 0x0000;
 		*opcode = BTSNOOP_OPCODE_COMMAND_PKT;
@@ -441,13 +918,13 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = fetch_data(btsnoop, buf, toread, data);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	*size = toread;
+	*size = len;
 
 	return true;
 }
@@ -487,11 +964,13 @@ static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
 	return 0xffff;
 }
 
-bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+static bool read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					void *buf, const void **data,
+					uint16_t *size)
 {
-	struct btsnoop_pkt pkt;
+	const struct btsnoop_pkt *pkt;
+	struct btsnoop_pkt hdr;
 	uint32_t toread, flags;
 	uint64_t ts;
 	uint8_t pkt_type;
@@ -501,9 +980,10 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 
 	if (btsnoop->pklg_format)
-		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
+		return pklg_read_hci(btsnoop, tv, index, opcode, buf, data,
+									size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = fetch_data(btsnoop, &hdr, BTSNOOP_PKT_SIZE, (const void **) &pkt);
 	if (len == 0)
 		return false;
 
@@ -512,15 +992,15 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	toread = be32toh(pkt.size);
+	toread = be32toh(pkt->size);
 	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	flags = be32toh(pkt.flags);
+	flags = be32toh(pkt->flags);
 
-	ts = be64toh(pkt.ts) - 0x00E03AB44A676000ll;
+	ts = be64toh(pkt->ts) - 0x00E03AB44A676000ll;
 	tv->tv_sec = (ts / 1000000ll) + 946684800ll;
 	tv->tv_usec = ts % 1000000ll;
 
@@ -531,7 +1011,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = read_data(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -552,19 +1032,353 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = fetch_data(btsnoop, buf, toread, data);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	*size = toread;
+	*size = len;
+
+	return true;
+}
+
+bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					void *data, uint16_t *size)
+{
+	const void *ptr;
+
+	if (!read_hci(btsnoop, tv, index, opcode, data, &ptr, size))
+		return false;
+
+	if (ptr != data)
+		memcpy(data, ptr, *size);
 
 	return true;
 }
 
+/*
+ * Same as btsnoop_read_hci(), but without copying the packet. The data
+ * points into the mapped trace, or into a buffer owned by btsnoop for
+ * traces read from pipes, and stays valid until the next read.
+ */
+bool btsnoop_read_hci_data(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					const void **data, uint16_t *size)
+{
+	if (!btsnoop)
+		return false;
+
+	if (!btsnoop->map && !btsnoop->data) {
+		btsnoop->data = malloc(BTSNOOP_MAX_PACKET_SIZE);
+		if (!btsnoop->data)
+			return false;
+	}
+
+	return read_hci(btsnoop, tv, index, opcode, btsnoop->data, data,
+									size);
+}
+
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size)
 {
 	return false;
 }
+
+static bool scan_record(struct btsnoop *btsnoop, size_t offset,
+						size_t *len, uint64_t *ts)
+{
+	size_t avail = btsnoop->map_end - offset;
+	uint32_t size;
+	uint64_t val;
+
+	if (btsnoop->pklg_format) {
+		struct pklg_pkt pkt;
+
+		if (avail < PKLG_PKT_SIZE)
+			return false;
+
+		memcpy(&pkt, btsnoop->map + offset, PKLG_PKT_SIZE);
+
+		if (btsnoop->pklg_v2) {
+			size = le32toh(pkt.len);
+			val = le64toh(pkt.ts);
+			*ts = (val & 0xffffffff) * 1000000ll + (val >> 32);
+		} else {
+			size = be32toh(pkt.len);
+			val = be64toh(pkt.ts);
+			*ts = (val >> 32) * 1000000ll + (val & 0xffffffff);
+		}
+
+		if (size < PKLG_PKT_SIZE - 4 ||
+			size - (PKLG_PKT_SIZE - 4) > BTSNOOP_MAX_PACKET_SIZE)
+			return false;
+
+		*len = 4 + size;
+	} else {
+		struct btsnoop_pkt pkt;
+
+		if (avail < BTSNOOP_PKT_SIZE)
+			return false;
+
+		memcpy(&pkt, btsnoop->map + offset, BTSNOOP_PKT_SIZE);
+
+		size = be32toh(pkt.size);
+		if (size > BTSNOOP_MAX_PACKET_SIZE)
+			return false;
+
+		val = be64toh(pkt.ts) - 0x00E03AB44A676000ll;
+		*ts = val + 946684800ll * 1000000ll;
+
+		*len = BTSNOOP_PKT_SIZE + size;
+	}
+
+	return *len <= avail;
+}
+
+static uint64_t get_mtime(struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ll +
+							st->st_mtim.tv_nsec;
+}
+
+static struct btsnoop_index *load_index(struct btsnoop *btsnoop,
+							const char *path)
+{
+	const struct btsnoop_index_hdr *hdr;
+	struct btsnoop_index *idx;
+	struct stat st, trace_st;
+	uint64_t count;
+	void *map;
+	int fd;
+
+	if (fstat(btsnoop->fd, &trace_st) < 0)
+		return NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) BTSNOOP_INDEX_HDR_SIZE ||
+					(uint64_t) st.st_size > SIZE_MAX) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	hdr = map;
+	count = le64toh(hdr->count);
+
+	if (memcmp(hdr->id, btsnoop_index_id, sizeof(btsnoop_index_id)) ||
+			le32toh(hdr->version) != btsnoop_index_version ||
+			le64toh(hdr->file_size) != (uint64_t) trace_st.st_size ||
+			le64toh(hdr->file_mtime) != get_mtime(&trace_st) ||
+			count != (st.st_size - BTSNOOP_INDEX_HDR_SIZE) /
+						BTSNOOP_INDEX_ENTRY_SIZE ||
+			(st.st_size - BTSNOOP_INDEX_HDR_SIZE) %
+						BTSNOOP_INDEX_ENTRY_SIZE)
+		goto failed;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		goto failed;
+
+	idx->entries = map + BTSNOOP_INDEX_HDR_SIZE;
+	idx->count = count;
+	idx->map = map;
+	idx->map_size = st.st_size;
+
+	return idx;
+
+failed:
+	munmap(map, st.st_size);
+
+	return NULL;
+}
+
+static void save_index(struct btsnoop *btsnoop, struct btsnoop_index *idx,
+							const char *path)
+{
+	struct btsnoop_index_hdr hdr;
+	struct stat st;
+	int fd;
+
+	if (fstat(btsnoop->fd, &st) < 0)
+		return;
+
+	memcpy(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id));
+	hdr.version = htole32(btsnoop_index_version);
+	hdr.reserved = 0;
+	hdr.file_size = htole64(st.st_size);
+	hdr.file_mtime = htole64(get_mtime(&st));
+	hdr.count = htole64(idx->count);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return;
+
+	/* A partially written index fails validation and gets rebuilt */
+	if (!write_all(fd, (const uint8_t *) &hdr, BTSNOOP_INDEX_HDR_SIZE) ||
+			!write_all(fd, (const uint8_t *) idx->entries,
+					idx->count * BTSNOOP_INDEX_ENTRY_SIZE))
+		unlink(path);
+
+	close(fd);
+}
+
+static struct btsnoop_index *build_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_index *idx;
+	struct btsnoop_index_entry *entries = NULL;
+	size_t size = 0, offset, len;
+	uint64_t count = 0, ts;
+
+	offset = btsnoop->pklg_format ? 0 : BTSNOOP_HDR_SIZE;
+
+	while (1) {
+		map_check_size(btsnoop, offset + BTSNOOP_PKT_SIZE);
+
+		if (offset >= btsnoop->map_end ||
+				!scan_record(btsnoop, offset, &len, &ts))
+			break;
+
+		if (count == size) {
+			struct btsnoop_index_entry *tmp;
+
+			size = size ? size * 2 : 1024;
+
+			tmp = realloc(entries, size * sizeof(*entries));
+			if (!tmp) {
+				free(entries);
+				return NULL;
+			}
+
+			entries = tmp;
+		}
+
+		entries[count].offset = htole64(offset);
+		entries[count].ts = htole64(ts);
+		count++;
+
+		offset += len;
+	}
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx) {
+		free(entries);
+		return NULL;
+	}
+
+	idx->entries = entries;
+	idx->count = count;
+
+	return idx;
+}
+
+/*
+ * With a path, an index saved there before is used as long as it still
+ * matches the trace, otherwise the new index is saved there. Without a
+ * path the index is only kept in memory.
+ */
+bool btsnoop_build_index(struct btsnoop *btsnoop, const char *path)
+{
+	struct btsnoop_index *idx = NULL;
+
+	if (!btsnoop || !btsnoop->map)
+		return false;
+
+	if (btsnoop->idx)
+		return true;
+
+	if (path)
+		idx = load_index(btsnoop, path);
+
+	if (!idx) {
+		idx = build_index(btsnoop);
+		if (!idx)
+			return false;
+
+		if (path)
+			save_index(btsnoop, idx, path);
+	}
+
+	btsnoop->idx = idx;
+
+	return true;
+}
+
+unsigned long btsnoop_get_index_count(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || !btsnoop->idx)
+		return 0;
+
+	return btsnoop->idx->count;
+}
+
+bool btsnoop_seek_packet(struct btsnoop *btsnoop, unsigned long num)
+{
+	struct btsnoop_index *idx;
+
+	if (!btsnoop || !btsnoop->idx)
+		return false;
+
+	idx = btsnoop->idx;
+
+	if (num > idx->count)
+		return false;
+
+	if (num == idx->count)
+		btsnoop->offset = btsnoop->map_end;
+	else
+		btsnoop->offset = le64toh(idx->entries[num].offset);
+
+	/* The trace may have been truncated since it was indexed */
+	if (btsnoop->offset > btsnoop->map_end)
+		btsnoop->offset = btsnoop->map_end;
+
+	btsnoop->aborted = false;
+
+	return true;
+}
+
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv,
+							unsigned long *num)
+{
+	struct btsnoop_index *idx;
+	uint64_t ts, lo, hi;
+
+	if (!btsnoop || !btsnoop->idx || !tv)
+		return false;
+
+	idx = btsnoop->idx;
+	ts = (uint64_t) tv->tv_sec * 1000000ll + tv->tv_usec;
+
+	/*
+	 * Position on the first record not older than the given time. This
+	 * assumes the trace is in chronological order, which is how btmon
+	 * and the kernel produce them.
+	 */
+	lo = 0;
+	hi = idx->count;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (le64toh(idx->entries[mid].ts) < ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (num)
+		*num = lo;
+
+	return btsnoop_seek_packet(btsnoop, lo);
+}
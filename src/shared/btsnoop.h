@@ -107,6 +107,10 @@ void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_format(struct btsnoop *btsnoop);
 
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+					unsigned int interval, bool async);
+bool btsnoop_flush(struct btsnoop *btsnoop);
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv, uint32_t flags,
 			uint32_t drops, const void *data, uint16_t size);
 bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -118,5 +122,14 @@ bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size);
+bool btsnoop_read_hci_data(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					const void **data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+bool btsnoop_build_index(struct btsnoop *btsnoop, const char *path);
+unsigned long btsnoop_get_index_count(struct btsnoop *btsnoop);
+bool btsnoop_seek_packet(struct btsnoop *btsnoop, unsigned long num);
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv,
+							unsigned long *num);
@@ -29,6 +29,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#define HAVE_AESNI
+#endif
 
 #include "src/shared/util.h"
 #include "src/shared/crypto.h"
@@ -72,16 +79,190 @@ struct af_alg_iv {
 #define SOL_ALG		279
 #endif
 
-/* Maximum message length that can be passed to aes_cmac */
-#define CMAC_MSG_MAX	80
+/* Number of keyed sessions kept open per algorithm */
+#define SESSION_MAX	4
+
+/* Number of blocks handed to the cipher in one round trip */
+#define BATCH_BLOCKS	64
+
+/*
+ * A keyed cipher instance. With AF_ALG this is the accepted operation
+ * socket, which can be reused for any number of requests under the same
+ * key; without it, the expanded AES key schedule. Keys are stored most
+ * significant octet first, as handed to the cipher.
+ */
+struct crypto_session {
+	uint8_t key[16];
+	unsigned int stamp;
+	int fd;
+	bool subkeys;
+	uint8_t k1[16];
+	uint8_t k2[16];
+	uint8_t rk[176];
+};
 
 struct bt_crypto {
 	int ref_count;
 	int ecb_aes;
 	int urandom;
 	int cmac_aes;
+	bool aesni;
+	unsigned int stamp;
+	struct crypto_session ecb[SESSION_MAX];
+	struct crypto_session cmac[SESSION_MAX];
 };
 
+static const uint8_t aes_sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static inline uint8_t aes_xtime(uint8_t x)
+{
+	return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static void aes_expand_key(const uint8_t key[16], uint8_t rk[176])
+{
+	uint8_t rcon = 0x01;
+	uint8_t t[4], tmp;
+	int i;
+
+	memcpy(rk, key, 16);
+
+	for (i = 16; i < 176; i += 4) {
+		memcpy(t, rk + i - 4, 4);
+
+		if (i % 16 == 0) {
+			tmp = t[0];
+			t[0] = aes_sbox[t[1]] ^ rcon;
+			t[1] = aes_sbox[t[2]];
+			t[2] = aes_sbox[t[3]];
+			t[3] = aes_sbox[tmp];
+			rcon = aes_xtime(rcon);
+		}
+
+		rk[i] = rk[i - 16] ^ t[0];
+		rk[i + 1] = rk[i - 15] ^ t[1];
+		rk[i + 2] = rk[i - 14] ^ t[2];
+		rk[i + 3] = rk[i - 13] ^ t[3];
+	}
+}
+
+static void aes_encrypt_block(const uint8_t rk[176], const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8_t s[16], t[16], a0, a1, a2, a3, all;
+	int round, c, r;
+
+	for (c = 0; c < 16; c++)
+		s[c] = in[c] ^ rk[c];
+
+	for (round = 1; round <= 10; round++) {
+		/* SubBytes and ShiftRows */
+		for (c = 0; c < 4; c++)
+			for (r = 0; r < 4; r++)
+				t[4 * c + r] =
+					aes_sbox[s[4 * ((c + r) % 4) + r]];
+
+		/* MixColumns, skipped in the final round */
+		for (c = 0; c < 4 && round < 10; c++) {
+			a0 = t[4 * c];
+			a1 = t[4 * c + 1];
+			a2 = t[4 * c + 2];
+			a3 = t[4 * c + 3];
+			all = a0 ^ a1 ^ a2 ^ a3;
+
+			t[4 * c] ^= all ^ aes_xtime(a0 ^ a1);
+			t[4 * c + 1] ^= all ^ aes_xtime(a1 ^ a2);
+			t[4 * c + 2] ^= all ^ aes_xtime(a2 ^ a3);
+			t[4 * c + 3] ^= all ^ aes_xtime(a3 ^ a0);
+		}
+
+		for (c = 0; c < 16; c++)
+			s[c] = t[c] ^ rk[16 * round + c];
+	}
+
+	memcpy(out, s, 16);
+}
+
+#ifdef HAVE_AESNI
+static bool aesni_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return ecx & bit_AES;
+}
+
+__attribute__((target("sse2,aes")))
+static void aesni_encrypt(const uint8_t rk[176], const uint8_t *in,
+						uint8_t *out, size_t blocks)
+{
+	__m128i k[11], b;
+	int i;
+
+	for (i = 0; i < 11; i++)
+		k[i] = _mm_loadu_si128((const __m128i *) (rk + 16 * i));
+
+	for (; blocks; blocks--, in += 16, out += 16) {
+		b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in), k[0]);
+
+		for (i = 1; i < 10; i++)
+			b = _mm_aesenc_si128(b, k[i]);
+
+		b = _mm_aesenclast_si128(b, k[10]);
+		_mm_storeu_si128((__m128i *) out, b);
+	}
+}
+#endif
+
+static void aes_encrypt(const struct bt_crypto *crypto, const uint8_t rk[176],
+				const uint8_t *in, uint8_t *out, size_t blocks)
+{
+#ifdef HAVE_AESNI
+	if (crypto->aesni) {
+		aesni_encrypt(rk, in, out, blocks);
+		return;
+	}
+#endif
+
+	for (; blocks; blocks--, in += 16, out += 16)
+		aes_encrypt_block(rk, in, out);
+}
+
 static int urandom_setup(void)
 {
 	int fd;
@@ -137,29 +318,42 @@ static int cmac_aes_setup(void)
 	return fd;
 }
 
-struct bt_crypto *bt_crypto_new(void)
+static struct bt_crypto *crypto_new(bool kernel)
 {
 	struct bt_crypto *crypto;
+	int i;
 
 	crypto = new0(struct bt_crypto, 1);
 
-	crypto->ecb_aes = ecb_aes_setup();
-	if (crypto->ecb_aes < 0) {
-		free(crypto);
-		return NULL;
+	for (i = 0; i < SESSION_MAX; i++) {
+		crypto->ecb[i].fd = -1;
+		crypto->cmac[i].fd = -1;
 	}
 
 	crypto->urandom = urandom_setup();
 	if (crypto->urandom < 0) {
-		close(crypto->ecb_aes);
 		free(crypto);
 		return NULL;
 	}
 
-	crypto->cmac_aes = cmac_aes_setup();
-	if (crypto->cmac_aes < 0) {
+	/*
+	 * Without AF_ALG support (or when asked not to use it) AES runs in
+	 * user space with AES-NI; a missing cmac(aes) alone is covered by
+	 * building CMAC on top of ecb(aes).
+	 */
+	crypto->ecb_aes = kernel ? ecb_aes_setup() : -1;
+	crypto->cmac_aes = crypto->ecb_aes < 0 ? -1 : cmac_aes_setup();
+
+#ifdef HAVE_AESNI
+	crypto->aesni = aesni_supported();
+#endif
+
+	/*
+	 * The table based AES looks up its S-box with key dependent indexes,
+	 * so cache timing can leak the key. Never fall back to it silently.
+	 */
+	if (kernel && crypto->ecb_aes < 0 && !crypto->aesni) {
 		close(crypto->urandom);
-		close(crypto->ecb_aes);
 		free(crypto);
 		return NULL;
 	}
@@ -167,6 +361,35 @@ struct bt_crypto *bt_crypto_new(void)
 	return bt_crypto_ref(crypto);
 }
 
+struct bt_crypto *bt_crypto_new(void)
+{
+	return crypto_new(true);
+}
+
+/*
+ * Run AES in user space even when AF_ALG is available. Without AES-NI this
+ * uses the table based implementation, which is not constant time and only
+ * meant for tests and benchmarks.
+ */
+struct bt_crypto *bt_crypto_new_software(void)
+{
+	return crypto_new(false);
+}
+
+const char *bt_crypto_get_backend(struct bt_crypto *crypto)
+{
+	if (!crypto)
+		return NULL;
+
+	if (crypto->ecb_aes >= 0)
+		return "af_alg";
+
+	if (crypto->aesni)
+		return "aes-ni";
+
+	return "table";
+}
+
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto)
 {
 	if (!crypto)
@@ -177,17 +400,37 @@ struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto)
 	return crypto;
 }
 
+static void session_clear(struct crypto_session *sess)
+{
+	if (sess->fd >= 0)
+		close(sess->fd);
+
+	memset(sess, 0, sizeof(*sess));
+	sess->fd = -1;
+}
+
 void bt_crypto_unref(struct bt_crypto *crypto)
 {
+	int i;
+
 	if (!crypto)
 		return;
 
 	if (__sync_sub_and_fetch(&crypto->ref_count, 1))
 		return;
 
+	for (i = 0; i < SESSION_MAX; i++) {
+		session_clear(&crypto->ecb[i]);
+		session_clear(&crypto->cmac[i]);
+	}
+
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+
+	if (crypto->ecb_aes >= 0)
+		close(crypto->ecb_aes);
+
+	if (crypto->cmac_aes >= 0)
+		close(crypto->cmac_aes);
 
 	free(crypto);
 }
@@ -212,8 +455,7 @@ static int alg_new(int fd, const void *keyval, socklen_t keylen)
 	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, keyval, keylen) < 0)
 		return -1;
 
-	/* FIXME: This should use accept4() with SOCK_CLOEXEC */
-	return accept(fd, NULL, 0);
+	return accept4(fd, NULL, 0, SOCK_CLOEXEC);
 }
 
 static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
@@ -249,12 +491,67 @@ static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
 		return false;
 
 	len = read(fd, outbuf, outlen);
-	if (len < 0)
+	if (len < 0 || (size_t) len < outlen)
 		return false;
 
 	return true;
 }
 
+/*
+ * Look up the session for key in table, keying a new one in place of the
+ * least recently used entry on a miss. With tfm < 0 the session is a
+ * software key schedule.
+ */
+static struct crypto_session *session_get(struct bt_crypto *crypto,
+					struct crypto_session *table, int tfm,
+					const uint8_t key[16])
+{
+	struct crypto_session *sess, *lru = table;
+	int i;
+
+	for (i = 0; i < SESSION_MAX; i++) {
+		sess = &table[i];
+
+		if (sess->stamp && !memcmp(sess->key, key, 16)) {
+			sess->stamp = ++crypto->stamp;
+			return sess;
+		}
+
+		if (sess->stamp < lru->stamp)
+			lru = sess;
+	}
+
+	session_clear(lru);
+
+	if (tfm >= 0) {
+		lru->fd = alg_new(tfm, key, 16);
+		if (lru->fd < 0)
+			return NULL;
+	} else
+		aes_expand_key(key, lru->rk);
+
+	memcpy(lru->key, key, 16);
+	lru->stamp = ++crypto->stamp;
+
+	return lru;
+}
+
+static bool session_ecb(struct bt_crypto *crypto, struct crypto_session *sess,
+				const uint8_t *in, uint8_t *out, size_t blocks)
+{
+	if (sess->fd < 0) {
+		aes_encrypt(crypto, sess->rk, in, out, blocks);
+		return true;
+	}
+
+	if (!alg_encrypt(sess->fd, in, blocks * 16, out, blocks * 16)) {
+		session_clear(sess);
+		return false;
+	}
+
+	return true;
+}
+
 static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 {
 	int i;
@@ -263,16 +560,208 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+static void cmac_shift(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t msb = in[0] & 0x80;
+	int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	out[15] = (in[15] << 1) ^ (msb ? 0x87 : 0x00);
+}
+
+static bool cmac_subkeys(struct bt_crypto *crypto, struct crypto_session *sess)
+{
+	uint8_t l[16];
+
+	if (sess->subkeys)
+		return true;
+
+	memset(l, 0, 16);
+	if (!session_ecb(crypto, sess, l, l, 1))
+		return false;
+
+	cmac_shift(l, sess->k1);
+	cmac_shift(sess->k1, sess->k2);
+	sess->subkeys = true;
+
+	return true;
+}
+
+static size_t cmac_blocks(size_t len)
+{
+	return len ? (len + 15) / 16 : 1;
+}
+
+/*
+ * Fill block idx of the CMAC input for msg, which is stored least
+ * significant octet first, xored with the chaining value in prev.
+ */
+static void cmac_block(const struct crypto_session *sess,
+				const struct iovec *msg, size_t idx,
+				const uint8_t prev[16], uint8_t out[16])
+{
+	const uint8_t *m = msg->iov_base;
+	size_t len = msg->iov_len;
+	size_t pos = idx * 16;
+	bool last = idx == cmac_blocks(len) - 1;
+	const uint8_t *k = NULL;
+	int i;
+
+	if (last)
+		k = len && len % 16 == 0 ? sess->k1 : sess->k2;
+
+	for (i = 0; i < 16; i++, pos++) {
+		uint8_t b;
+
+		if (pos < len)
+			b = m[len - 1 - pos];
+		else if (pos == len)
+			b = 0x80;
+		else
+			b = 0x00;
+
+		out[i] = prev[i] ^ b ^ (k ? k[i] : 0x00);
+	}
+}
+
+/*
+ * CMAC on top of the block cipher, running the chains of up to
+ * BATCH_BLOCKS messages side by side so that every round is a single
+ * request to the cipher.
+ */
+static bool cmac_ecb(struct bt_crypto *crypto, struct crypto_session *sess,
+				const struct iovec *msg, uint8_t res[][16],
+				size_t count)
+{
+	uint8_t state[BATCH_BLOCKS][16], buf[BATCH_BLOCKS][16];
+	unsigned int active[BATCH_BLOCKS];
+	size_t round, i, n;
+
+	if (!cmac_subkeys(crypto, sess))
+		return false;
+
+	for (; count; count -= n, msg += n, res += n) {
+		n = count < BATCH_BLOCKS ? count : BATCH_BLOCKS;
+		memset(state, 0, sizeof(state));
+
+		for (round = 0; ; round++) {
+			unsigned int num = 0;
+
+			for (i = 0; i < n; i++) {
+				if (round >= cmac_blocks(msg[i].iov_len))
+					continue;
+
+				cmac_block(sess, &msg[i], round, state[i],
+								buf[num]);
+				active[num++] = i;
+			}
+
+			if (!num)
+				break;
+
+			if (!session_ecb(crypto, sess, buf[0], buf[0], num))
+				return false;
+
+			for (i = 0; i < num; i++)
+				memcpy(state[active[i]], buf[i], 16);
+		}
+
+		for (i = 0; i < n; i++)
+			swap_buf(state[i], res[i], 16);
+	}
+
+	return true;
+}
+
+static bool cmac_alg(struct crypto_session *sess, const struct iovec *msg,
+							uint8_t res[16])
+{
+	const uint8_t *m = msg->iov_base;
+	size_t len = msg->iov_len;
+	uint8_t buf[256], out[16];
+	size_t n;
+
+	/* Feed the message most significant octet first */
+	do {
+		n = len < sizeof(buf) ? len : sizeof(buf);
+		swap_buf(m + len - n, buf, n);
+		len -= n;
+
+		if (send(sess->fd, buf, n, len ? MSG_MORE : 0) < 0)
+			goto fail;
+	} while (len);
+
+	if (read(sess->fd, out, 16) < 16)
+		goto fail;
+
+	swap_buf(out, res, 16);
+
+	return true;
+
+fail:
+	session_clear(sess);
+	return false;
+}
+
+static bool aes_cmac_batch(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *msg, uint8_t res[][16],
+				size_t count)
+{
+	struct crypto_session *sess;
+	uint8_t key_msb[16];
+	size_t i, rounds = 0;
+
+	swap_buf(key, key_msb, 16);
+
+	for (i = 0; i < count; i++)
+		if (cmac_blocks(msg[i].iov_len) > rounds)
+			rounds = cmac_blocks(msg[i].iov_len);
+
+	/*
+	 * A cmac(aes) session answers each message in one round trip; the
+	 * side by side chains over ecb(aes) pay off once there are more
+	 * messages than blocks per message.
+	 */
+	if (crypto->cmac_aes >= 0 && count <= rounds) {
+		sess = session_get(crypto, crypto->cmac, crypto->cmac_aes,
+								key_msb);
+		if (!sess)
+			return false;
+
+		for (i = 0; i < count; i++)
+			if (!cmac_alg(sess, &msg[i], res[i]))
+				return false;
+
+		return true;
+	}
+
+	sess = session_get(crypto, crypto->ecb, crypto->ecb_aes, key_msb);
+	if (!sess)
+		return false;
+
+	return cmac_ecb(crypto, sess, msg, res, count);
+}
+
+static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
+			const uint8_t *msg, size_t msg_len, uint8_t res[16])
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) msg;
+	iov.iov_len = msg_len;
+
+	return aes_cmac_batch(crypto, key, &iov, (uint8_t (*)[16]) res, 1);
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12])
 {
-	int fd;
-	int len;
-	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
-	uint8_t msg_s[msg_len];
+	uint8_t out[16];
 
 	if (!crypto)
 		return false;
@@ -283,46 +772,24 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* Add sign_counter to the message */
 	put_le32(sign_cnt, msg + m_len);
 
-	/* The most significant octet of key corresponds to key[0] */
-	swap_buf(key, tmp, 16);
-
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-	/* Swap msg before signing */
-	swap_buf(msg, msg_s, msg_len);
-
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!aes_cmac(crypto, key, msg, msg_len, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
 	 * be placed in the signature
 	 */
-	put_be32(sign_cnt, out + 8);
+	put_le32(sign_cnt, out + 4);
 
 	/*
-	 * The most significant octet of hash corresponds to out[0]  - swap it.
-	 * Then truncate in most significant bit first order to a length of
+	 * Truncate in most significant bit first order to a length of
 	 * 12 octets
 	 */
-	swap_buf(out, tmp, 16);
-	memcpy(signature, tmp + 4, 12);
+	memcpy(signature, out + 4, 12);
 
 	return true;
 }
+
 /*
  * Security function e
  *
@@ -339,8 +806,17 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
-	uint8_t tmp[16], in[16], out[16];
-	int fd;
+	return bt_crypto_e_batch(crypto, key, (const uint8_t (*)[16]) plaintext,
+					(uint8_t (*)[16]) encrypted, 1);
+}
+
+bool bt_crypto_e_batch(struct bt_crypto *crypto, const uint8_t key[16],
+			const uint8_t plaintext[][16], uint8_t encrypted[][16],
+			size_t count)
+{
+	struct crypto_session *sess;
+	uint8_t tmp[16], buf[BATCH_BLOCKS][16];
+	size_t i, n;
 
 	if (!crypto)
 		return false;
@@ -348,23 +824,24 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
+	sess = session_get(crypto, crypto->ecb, crypto->ecb_aes, tmp);
+	if (!sess)
 		return false;
 
+	for (; count; count -= n, plaintext += n, encrypted += n) {
+		n = count < BATCH_BLOCKS ? count : BATCH_BLOCKS;
 
-	/* Most significant octet of plaintextData corresponds to in[0] */
-	swap_buf(plaintext, in, 16);
-
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
-		return false;
-	}
+		/* Most significant octet of plaintextData is in[0] */
+		for (i = 0; i < n; i++)
+			swap_buf(plaintext[i], buf[i], 16);
 
-	/* Most significant octet of encryptedData corresponds to out[0] */
-	swap_buf(out, encrypted, 16);
+		if (!session_ecb(crypto, sess, buf[0], buf[0], n))
+			return false;
 
-	close(fd);
+		/* Most significant octet of encryptedData is out[0] */
+		for (i = 0; i < n; i++)
+			swap_buf(buf[i], encrypted[i], 16);
+	}
 
 	return true;
 }
@@ -568,41 +1045,6 @@ bool bt_crypto_s1(struct bt_crypto *crypto, const uint8_t k[16],
 	return bt_crypto_e(crypto, k, res, res);
 }
 
-static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
-			const uint8_t *msg, size_t msg_len, uint8_t res[16])
-{
-	uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-	ssize_t len;
-	int fd;
-
-	if (msg_len > CMAC_MSG_MAX)
-		return false;
-
-	swap_buf(key, key_msb, 16);
-	fd = alg_new(crypto->cmac_aes, key_msb, 16);
-	if (fd < 0)
-		return false;
-
-	swap_buf(msg, msg_msb, msg_len);
-	len = send(fd, msg_msb, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	swap_buf(out, res, 16);
-
-	close(fd);
-
-	return true;
-}
-
 bool bt_crypto_f4(struct bt_crypto *crypto, uint8_t u[32], uint8_t v[32],
 				uint8_t x[16], uint8_t z, uint8_t res[16])
 {
@@ -688,3 +1130,13 @@ bool bt_crypto_h6(struct bt_crypto *crypto, const uint8_t w[16],
 
 	return true;
 }
+
+bool bt_crypto_cmac_batch(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *msg, uint8_t res[][16],
+				size_t count)
+{
+	if (!crypto)
+		return false;
+
+	return aes_cmac_batch(crypto, key, msg, res, count);
+}
@@ -23,10 +23,15 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+
+struct iovec;
 
 struct bt_crypto;
 
 struct bt_crypto *bt_crypto_new(void);
+struct bt_crypto *bt_crypto_new_software(void);
+const char *bt_crypto_get_backend(struct bt_crypto *crypto);
 
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto);
 void bt_crypto_unref(struct bt_crypto *crypto);
@@ -36,6 +41,12 @@ bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 
 bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16]);
+bool bt_crypto_e_batch(struct bt_crypto *crypto, const uint8_t key[16],
+			const uint8_t plaintext[][16], uint8_t encrypted[][16],
+			size_t count);
+bool bt_crypto_cmac_batch(struct bt_crypto *crypto, const uint8_t key[16],
+				const struct iovec *msg, uint8_t res[][16],
+				size_t count);
 bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 					const uint8_t r[3], uint8_t hash[3]);
 bool bt_crypto_c1(struct bt_crypto *crypto, const uint8_t k[16],
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "ecc.h"
 
@@ -132,37 +133,6 @@ static uint64_t vli_test_bit(const uint64_t *vli, unsigned int bit)
 	return (vli[bit / 64] & ((uint64_t) 1 << (bit % 64)));
 }
 
-/* Counts the number of 64-bit "digits" in vli. */
-static unsigned int vli_num_digits(const uint64_t *vli)
-{
-	int i;
-
-	/* Search from the end until we find a non-zero digit.
-	 * We do it in reverse because we expect that most digits will
-	 * be nonzero.
-	 */
-	for (i = NUM_ECC_DIGITS - 1; i >= 0 && vli[i] == 0; i--);
-
-	return (i + 1);
-}
-
-/* Counts the number of bits required for vli. */
-static unsigned int vli_num_bits(const uint64_t *vli)
-{
-	unsigned int i, num_digits;
-	uint64_t digit;
-
-	num_digits = vli_num_digits(vli);
-	if (num_digits == 0)
-		return 0;
-
-	digit = vli[num_digits - 1];
-	for (i = 0; digit; i++)
-		digit >>= 1;
-
-	return ((num_digits - 1) * 64 + i);
-}
-
 /* Sets dest = src. */
 static void vli_set(uint64_t *dest, const uint64_t *src)
 {
@@ -600,10 +570,6 @@ static bool ecc_point_is_zero(const struct ecc_point *point)
 	return (vli_is_zero(point->x) && vli_is_zero(point->y));
 }
 
-/* Point multiplication algorithm using Montgomery's ladder with co-Z
- * coordinates. From http://eprint.iacr.org/2011/338.pdf
- */
-
 /* Double in place */
 static void ecc_point_double_jacobian(uint64_t *x1, uint64_t *y1, uint64_t *z1)
 {
@@ -659,132 +625,254 @@ static void apply_z(uint64_t *x1, uint64_t *y1, uint64_t *z)
 	vli_mod_mult_fast(y1, y1, t1); /* y1 * z^3 */
 }
 
-/* P = (x1, y1) => 2P, (x2, y2) => P' */
-static void xycz_initial_double(uint64_t *x1, uint64_t *y1, uint64_t *x2,
-					uint64_t *y2, uint64_t *p_initial_z)
+/* Input P = (x1, y1, z1) in Jacobian and Q = (x2, y2) in affine
+ * coordinates. Output P + Q in place of P. P and Q must be neither equal
+ * nor opposite.
+ */
+static void ecc_point_add_mixed(uint64_t *x1, uint64_t *y1, uint64_t *z1,
+				const uint64_t *x2, const uint64_t *y2)
 {
-	uint64_t z[NUM_ECC_DIGITS];
+	uint64_t t1[NUM_ECC_DIGITS];
+	uint64_t t2[NUM_ECC_DIGITS];
+	uint64_t t3[NUM_ECC_DIGITS];
+	uint64_t t4[NUM_ECC_DIGITS];
 
-	vli_set(x2, x1);
-	vli_set(y2, y1);
+	vli_mod_square_fast(t1, z1);      /* t1 = z1^2 */
+	vli_mod_mult_fast(t2, t1, z1);    /* t2 = z1^3 */
+	vli_mod_mult_fast(t1, t1, x2);    /* t1 = x2*z1^2 = U2 */
+	vli_mod_mult_fast(t2, t2, y2);    /* t2 = y2*z1^3 = S2 */
+	vli_mod_sub(t1, t1, x1, curve_p); /* t1 = U2 - x1 = H */
+	vli_mod_sub(t2, t2, y1, curve_p); /* t2 = S2 - y1 = R */
+	vli_mod_mult_fast(z1, z1, t1);    /* z3 = z1*H */
+
+	vli_mod_square_fast(t3, t1);      /* t3 = H^2 */
+	vli_mod_mult_fast(t4, t3, t1);    /* t4 = H^3 */
+	vli_mod_mult_fast(t3, t3, x1);    /* t3 = x1*H^2 = V */
+	vli_mod_square_fast(x1, t2);      /* t1 = R^2 */
+	vli_mod_sub(x1, x1, t4, curve_p); /* t1 = R^2 - H^3 */
+	vli_mod_sub(x1, x1, t3, curve_p); /* t1 = R^2 - H^3 - V */
+	vli_mod_sub(x1, x1, t3, curve_p); /* t1 = R^2 - H^3 - 2V = x3 */
+
+	vli_mod_sub(t3, t3, x1, curve_p); /* t3 = V - x3 */
+	vli_mod_mult_fast(t3, t3, t2);    /* t3 = R*(V - x3) */
+	vli_mod_mult_fast(t4, t4, y1);    /* t4 = y1*H^3 */
+	vli_mod_sub(y1, t3, t4, curve_p); /* t2 = R*(V - x3) - y1*H^3 = y3 */
+}
+
+/* Point multiplication with fixed 4-bit windows over a table of the
+ * multiples 1P .. 15P in affine coordinates, so that each window costs
+ * four doublings and a single mixed addition. The generator has one such
+ * table for every window position, computed once, which leaves only the
+ * additions for key generation. The tables are built on first use under
+ * pthread_once(), so keys may be generated from any thread.
+ */
 
-	vli_clear(z);
-	z[0] = 1;
+#define WINDOW_BITS	4
+#define WINDOW_SIZE	((1 << WINDOW_BITS) - 1)
+#define NUM_WINDOWS	(ECC_BYTES * 8 / WINDOW_BITS)
 
-	if (p_initial_z)
-		vli_set(z, p_initial_z);
+static struct ecc_point curve_g_table[NUM_WINDOWS][WINDOW_SIZE];
+static pthread_once_t curve_g_table_once = PTHREAD_ONCE_INIT;
 
-	apply_z(x1, y1, z);
+static unsigned int vli_window(const uint64_t *vli, unsigned int window)
+{
+	unsigned int bit = window * WINDOW_BITS;
+
+	return (vli[bit / 64] >> (bit % 64)) & WINDOW_SIZE;
+}
 
-	ecc_point_double_jacobian(x1, y1, z);
+/* Sets dest = src when mask is all ones, leaves it alone when zero. */
+static void vli_cond_set(uint64_t *dest, const uint64_t *src, uint64_t mask)
+{
+	unsigned int i;
 
-	apply_z(x2, y2, z);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		dest[i] = (dest[i] & ~mask) | (src[i] & mask);
 }
 
-/* Input P = (x1, y1, Z), Q = (x2, y2, Z)
- * Output P' = (x1', y1', Z3), P + Q = (x3, y3, Z3)
- * or P => P', Q => P + Q
+/* Converts count Jacobian points to affine coordinates, sharing a single
+ * inversion between them.
  */
-static void xycz_add(uint64_t *x1, uint64_t *y1, uint64_t *x2, uint64_t *y2)
+static void ecc_points_normalize(struct ecc_point *points,
+					uint64_t z[][NUM_ECC_DIGITS],
+					int count)
 {
-	/* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-	uint64_t t5[NUM_ECC_DIGITS];
+	uint64_t prod[WINDOW_SIZE][NUM_ECC_DIGITS];
+	uint64_t inv[NUM_ECC_DIGITS];
+	uint64_t zi[NUM_ECC_DIGITS];
+	int i;
 
-	vli_mod_sub(t5, x2, x1, curve_p); /* t5 = x2 - x1 */
-	vli_mod_square_fast(t5, t5);      /* t5 = (x2 - x1)^2 = A */
-	vli_mod_mult_fast(x1, x1, t5);    /* t1 = x1*A = B */
-	vli_mod_mult_fast(x2, x2, t5);    /* t3 = x2*A = C */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y2 - y1 */
-	vli_mod_square_fast(t5, y2);      /* t5 = (y2 - y1)^2 = D */
+	vli_set(prod[0], z[0]);
+	for (i = 1; i < count; i++)
+		vli_mod_mult_fast(prod[i], prod[i - 1], z[i]);
 
-	vli_mod_sub(t5, t5, x1, curve_p); /* t5 = D - B */
-	vli_mod_sub(t5, t5, x2, curve_p); /* t5 = D - B - C = x3 */
-	vli_mod_sub(x2, x2, x1, curve_p); /* t3 = C - B */
-	vli_mod_mult_fast(y1, y1, x2);    /* t2 = y1*(C - B) */
-	vli_mod_sub(x2, x1, t5, curve_p); /* t3 = B - x3 */
-	vli_mod_mult_fast(y2, y2, x2);    /* t4 = (y2 - y1)*(B - x3) */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y3 */
+	vli_mod_inv(inv, prod[count - 1], curve_p);
 
-	vli_set(x2, t5);
+	for (i = count - 1; i > 0; i--) {
+		vli_mod_mult_fast(zi, inv, prod[i - 1]); /* 1 / z[i] */
+		vli_mod_mult_fast(inv, inv, z[i]);       /* 1 / prod[i - 1] */
+		apply_z(points[i].x, points[i].y, zi);
+	}
+
+	apply_z(points[0].x, points[0].y, inv);
+}
+
+/* table[j - 1] = j * point for j = 1 .. WINDOW_SIZE */
+static void ecc_point_multiples(struct ecc_point table[WINDOW_SIZE],
+					const struct ecc_point *point)
+{
+	uint64_t z[WINDOW_SIZE][NUM_ECC_DIGITS];
+	int j;
+
+	table[0] = *point;
+	vli_clear(z[0]);
+	z[0][0] = 1;
+
+	table[1] = *point;
+	vli_set(z[1], z[0]);
+	ecc_point_double_jacobian(table[1].x, table[1].y, z[1]);
+
+	for (j = 2; j < WINDOW_SIZE; j++) {
+		table[j] = table[j - 1];
+		vli_set(z[j], z[j - 1]);
+		ecc_point_add_mixed(table[j].x, table[j].y, z[j],
+						point->x, point->y);
+	}
+
+	ecc_points_normalize(table, z, WINDOW_SIZE);
+}
+
+static void curve_g_table_init(void)
+{
+	struct ecc_point base = curve_g;
+	uint64_t z[NUM_ECC_DIGITS];
+	int i;
+
+	for (i = 0; i < NUM_WINDOWS; i++) {
+		ecc_point_multiples(curve_g_table[i], &base);
+
+		/* Next base = 16 * base = 2 * (8 * base) */
+		base = curve_g_table[i][7];
+		vli_clear(z);
+		z[0] = 1;
+		ecc_point_double_jacobian(base.x, base.y, z);
+		vli_mod_inv(z, z, curve_p);
+		apply_z(base.x, base.y, z);
+	}
 }
 
-/* Input P = (x1, y1, Z), Q = (x2, y2, Z)
- * Output P + Q = (x3, y3, Z3), P - Q = (x3', y3', Z3)
- * or P => P - Q, Q => P + Q
+/* (x1, y1, z1) += digit * P, where table holds the multiples of P and
+ * infinity tracks whether the accumulator is still the point at infinity.
+ * The table is scanned and the candidates selected with masks so that
+ * the memory access pattern does not depend on the digit. The first
+ * point taken into the accumulator is randomized by initial_z if given.
  */
-static void xycz_add_c(uint64_t *x1, uint64_t *y1, uint64_t *x2, uint64_t *y2)
+static void ecc_point_add_window(uint64_t *x1, uint64_t *y1, uint64_t *z1,
+				uint64_t *infinity,
+				const struct ecc_point table[WINDOW_SIZE],
+				unsigned int digit, const uint64_t *initial_z)
 {
-	/* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-	uint64_t t5[NUM_ECC_DIGITS];
-	uint64_t t6[NUM_ECC_DIGITS];
-	uint64_t t7[NUM_ECC_DIGITS];
+	struct ecc_point q = table[0];
+	uint64_t x2[NUM_ECC_DIGITS];
+	uint64_t y2[NUM_ECC_DIGITS];
+	uint64_t z2[NUM_ECC_DIGITS];
+	uint64_t take, mask;
+	unsigned int j;
+
+	for (j = 1; j < WINDOW_SIZE; j++) {
+		mask = -(uint64_t) (j + 1 == digit);
+		vli_cond_set(q.x, table[j].x, mask);
+		vli_cond_set(q.y, table[j].y, mask);
+	}
 
-	vli_mod_sub(t5, x2, x1, curve_p); /* t5 = x2 - x1 */
-	vli_mod_square_fast(t5, t5);      /* t5 = (x2 - x1)^2 = A */
-	vli_mod_mult_fast(x1, x1, t5);    /* t1 = x1*A = B */
-	vli_mod_mult_fast(x2, x2, t5);    /* t3 = x2*A = C */
-	vli_mod_add(t5, y2, y1, curve_p); /* t4 = y2 + y1 */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y2 - y1 */
+	take = -(uint64_t) (digit != 0);
 
-	vli_mod_sub(t6, x2, x1, curve_p); /* t6 = C - B */
-	vli_mod_mult_fast(y1, y1, t6);    /* t2 = y1 * (C - B) */
-	vli_mod_add(t6, x1, x2, curve_p); /* t6 = B + C */
-	vli_mod_square_fast(x2, y2);      /* t3 = (y2 - y1)^2 */
-	vli_mod_sub(x2, x2, t6, curve_p); /* t3 = x3 */
+	/* Accumulator + Q */
+	vli_set(x2, x1);
+	vli_set(y2, y1);
+	vli_set(z2, z1);
+	ecc_point_add_mixed(x2, y2, z2, q.x, q.y);
+
+	mask = take & ~*infinity;
+	vli_cond_set(x1, x2, mask);
+	vli_cond_set(y1, y2, mask);
+	vli_cond_set(z1, z2, mask);
+
+	/* Q alone, while the accumulator is still at infinity */
+	vli_clear(z2);
+	z2[0] = 1;
+	if (initial_z)
+		vli_set(z2, initial_z);
 
-	vli_mod_sub(t7, x1, x2, curve_p); /* t7 = B - x3 */
-	vli_mod_mult_fast(y2, y2, t7);    /* t4 = (y2 - y1)*(B - x3) */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y3 */
+	apply_z(q.x, q.y, z2);
 
-	vli_mod_square_fast(t7, t5);      /* t7 = (y2 + y1)^2 = F */
-	vli_mod_sub(t7, t7, t6, curve_p); /* t7 = x3' */
-	vli_mod_sub(t6, t7, x1, curve_p); /* t6 = x3' - B */
-	vli_mod_mult_fast(t6, t6, t5);    /* t6 = (y2 + y1)*(x3' - B) */
-	vli_mod_sub(y1, t6, y1, curve_p); /* t2 = y3' */
+	mask = take & *infinity;
+	vli_cond_set(x1, q.x, mask);
+	vli_cond_set(y1, q.y, mask);
+	vli_cond_set(z1, z2, mask);
 
-	vli_set(x1, t7);
+	*infinity &= ~take;
+}
+
+static void ecc_point_mult_finish(struct ecc_point *result,
+					uint64_t *x, uint64_t *y, uint64_t *z,
+					uint64_t infinity)
+{
+	if (infinity) {
+		vli_clear(result->x);
+		vli_clear(result->y);
+		return;
+	}
+
+	vli_mod_inv(z, z, curve_p);
+	apply_z(x, y, z);
+
+	vli_set(result->x, x);
+	vli_set(result->y, y);
 }
 
 static void ecc_point_mult(struct ecc_point *result,
 				const struct ecc_point *point,
-				uint64_t *scalar, uint64_t *initial_z,
-				int num_bits)
+				const uint64_t *scalar,
+				const uint64_t *initial_z)
 {
-	/* R0 and R1 */
-	uint64_t rx[2][NUM_ECC_DIGITS];
-	uint64_t ry[2][NUM_ECC_DIGITS];
-	uint64_t z[NUM_ECC_DIGITS];
-	int i, nb;
+	struct ecc_point table[WINDOW_SIZE];
+	uint64_t x[NUM_ECC_DIGITS] = { 0 };
+	uint64_t y[NUM_ECC_DIGITS] = { 0 };
+	uint64_t z[NUM_ECC_DIGITS] = { 0 };
+	uint64_t infinity = ~0ull;
+	int i, j;
 
-	vli_set(rx[1], point->x);
-	vli_set(ry[1], point->y);
+	ecc_point_multiples(table, point);
 
-	xycz_initial_double(rx[1], ry[1], rx[0], ry[0], initial_z);
+	for (i = NUM_WINDOWS - 1; i >= 0; i--) {
+		for (j = 0; j < WINDOW_BITS; j++)
+			ecc_point_double_jacobian(x, y, z);
 
-	for (i = num_bits - 2; i > 0; i--) {
-		nb = !vli_test_bit(scalar, i);
-		xycz_add_c(rx[1 - nb], ry[1 - nb], rx[nb], ry[nb]);
-		xycz_add(rx[nb], ry[nb], rx[1 - nb], ry[1 - nb]);
+		ecc_point_add_window(x, y, z, &infinity, table,
+					vli_window(scalar, i), initial_z);
 	}
 
-	nb = !vli_test_bit(scalar, 0);
-	xycz_add_c(rx[1 - nb], ry[1 - nb], rx[nb], ry[nb]);
+	ecc_point_mult_finish(result, x, y, z, infinity);
+}
 
-	/* Find final 1/Z value. */
-	vli_mod_sub(z, rx[1], rx[0], curve_p); /* X1 - X0 */
-	vli_mod_mult_fast(z, z, ry[1 - nb]); /* Yb * (X1 - X0) */
-	vli_mod_mult_fast(z, z, point->x);   /* xP * Yb * (X1 - X0) */
-	vli_mod_inv(z, z, curve_p);          /* 1 / (xP * Yb * (X1 - X0)) */
-	vli_mod_mult_fast(z, z, point->y);   /* yP / (xP * Yb * (X1 - X0)) */
-	vli_mod_mult_fast(z, z, rx[1 - nb]); /* Xb * yP / (xP * Yb * (X1 - X0)) */
-	/* End 1/Z calculation */
+/* result = scalar * G using the per-window tables of the generator */
+static void ecc_point_mult_base(struct ecc_point *result,
+						const uint64_t *scalar)
+{
+	uint64_t x[NUM_ECC_DIGITS] = { 0 };
+	uint64_t y[NUM_ECC_DIGITS] = { 0 };
+	uint64_t z[NUM_ECC_DIGITS] = { 0 };
+	uint64_t infinity = ~0ull;
+	int i;
 
-	xycz_add(rx[nb], ry[nb], rx[1 - nb], ry[1 - nb]);
+	pthread_once(&curve_g_table_once, curve_g_table_init);
 
-	apply_z(rx[0], ry[0], z);
+	for (i = 0; i < NUM_WINDOWS; i++)
+		ecc_point_add_window(x, y, z, &infinity, curve_g_table[i],
+					vli_window(scalar, i), NULL);
 
-	vli_set(result->x, rx[0]);
-	vli_set(result->y, ry[0]);
+	ecc_point_mult_finish(result, x, y, z, infinity);
 }
 
 static bool ecc_valid_point(const struct ecc_point *point)
@@ -870,7 +958,7 @@ bool ecc_make_public_key(const uint8_t private_key[32], uint8_t public_key[64])
 	if (vli_cmp(curve_n, priv) != 1)
 		return false;
 
-	ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+	ecc_point_mult_base(&pk, priv);
 
 	if (ecc_point_is_zero(&pk))
 		return false;
@@ -898,7 +986,7 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 		if (vli_cmp(curve_n, priv) != 1)
 			continue;
 
-		ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+		ecc_point_mult_base(&pk, priv);
 	} while (ecc_point_is_zero(&pk));
 
 	ecc_native2bytes(priv, private_key);
@@ -937,7 +1025,7 @@ bool ecdh_shared_secret(const uint8_t public_key[64],
 
 	ecc_bytes2native(private_key, priv);
 
-	ecc_point_mult(&product, &pk, priv, rand, vli_num_bits(priv));
+	ecc_point_mult(&product, &pk, priv, rand);
 
 	ecc_native2bytes(product.x, secret);
 
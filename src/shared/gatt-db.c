@@ -60,7 +60,12 @@ struct gatt_db {
 	uint16_t next_handle;
 	struct queue *services;
 
-	struct queue *notify_list;
+	/* Services sorted by handle, kept in sync with services queue */
+	struct gatt_db_service **index;
+	unsigned int index_len;
+	unsigned int index_size;
+
+	struct vqueue *notify_list;
 	unsigned int next_notify_id;
 };
 
@@ -223,7 +228,7 @@ struct gatt_db *gatt_db_new(void)
 
 	db = new0(struct gatt_db, 1);
 	db->services = queue_new();
-	db->notify_list = queue_new();
+	db->notify_list = vqueue_new();
 	db->next_handle = 0x0001;
 
 	return gatt_db_ref(db);
@@ -269,7 +274,7 @@ static void notify_service_changed(struct gatt_db *db,
 {
 	struct notify_data data;
 
-	if (queue_isempty(db->notify_list))
+	if (vqueue_isempty(db->notify_list))
 		return;
 
 	data.attr = service->attributes[0];
@@ -277,16 +282,22 @@ static void notify_service_changed(struct gatt_db *db,
 
 	gatt_db_ref(db);
 
-	queue_foreach(db->notify_list, handle_notify, &data);
+	vqueue_foreach(db->notify_list, handle_notify, &data);
 
 	gatt_db_unref(db);
 }
 
+static unsigned int index_lookup(struct gatt_db *db, uint16_t handle);
+static void index_remove(struct gatt_db *db, struct gatt_db_service *service);
+
 static void gatt_db_service_destroy(void *data)
 {
 	struct gatt_db_service *service = data;
 	int i;
 
+	if (service->db)
+		index_remove(service->db, service);
+
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
@@ -306,9 +317,14 @@ static void gatt_db_destroy(struct gatt_db *db)
 	 * Clear the notify list before clearing the services to prevent the
 	 * latter from sending service_removed events.
 	 */
-	queue_destroy(db->notify_list, notify_destroy);
+	vqueue_destroy(db->notify_list, notify_destroy);
 	db->notify_list = NULL;
 
+	/* No need to keep the index in sync while tearing down */
+	free(db->index);
+	db->index = NULL;
+	db->index_len = 0;
+
 	queue_destroy(db->services, gatt_db_service_destroy);
 	free(db);
 }
@@ -439,6 +455,98 @@ static void gatt_db_service_get_handles(const struct gatt_db_service *service,
 						service->num_handles - 1;
 }
 
+/*
+ * Returns the position in the index of the first service whose range ends at
+ * or after the given handle, or index_len if there is none. Since services
+ * never overlap, both start and end handles are sorted in the index.
+ */
+static unsigned int index_lookup(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int low = 0, high = db->index_len;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+		uint16_t end;
+
+		gatt_db_service_get_handles(db->index[mid], NULL, &end);
+
+		if (end < handle)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static bool index_insert(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int pos;
+
+	if (db->index_len == db->index_size) {
+		struct gatt_db_service **index;
+		unsigned int size;
+
+		size = db->index_size ? db->index_size * 2 : 8;
+
+		index = realloc(db->index, size * sizeof(*index));
+		if (!index)
+			return false;
+
+		db->index = index;
+		db->index_size = size;
+	}
+
+	pos = index_lookup(db, service->attributes[0]->handle);
+
+	memmove(&db->index[pos + 1], &db->index[pos],
+			(db->index_len - pos) * sizeof(*db->index));
+
+	db->index[pos] = service;
+	db->index_len++;
+
+	return true;
+}
+
+static void index_remove(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int pos;
+
+	pos = index_lookup(db, service->attributes[0]->handle);
+	if (pos == db->index_len || db->index[pos] != service)
+		return;
+
+	db->index_len--;
+
+	memmove(&db->index[pos], &db->index[pos + 1],
+			(db->index_len - pos) * sizeof(*db->index));
+}
+
+/*
+ * Calls func for each service overlapping the given range. The index is
+ * looked up again after each call so func may modify the database.
+ */
+static void index_foreach(struct gatt_db *db, uint16_t start, uint16_t end,
+					queue_foreach_func_t func, void *user_data)
+{
+	unsigned int i = index_lookup(db, start);
+
+	while (i < db->index_len) {
+		uint16_t svc_start, svc_end;
+
+		gatt_db_service_get_handles(db->index[i], &svc_start, &svc_end);
+		if (svc_start > end)
+			break;
+
+		func(db->index[i], user_data);
+
+		if (svc_end >= end)
+			break;
+
+		i = index_lookup(db, svc_end + 1);
+	}
+}
+
 struct clear_range {
 	uint16_t start, end;
 };
@@ -486,16 +594,17 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 						uint16_t start, uint16_t end,
 						struct gatt_db_service **after)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
 	uint16_t cur_start, cur_end;
+	unsigned int i;
 
-	*after = NULL;
+	/* Services ending before start can neither overlap nor follow */
+	i = index_lookup(db, start);
 
-	services_entry = queue_get_entries(db->services);
+	*after = i ? db->index[i - 1] : NULL;
 
-	while (services_entry) {
-		service = services_entry->data;
+	for (; i < db->index_len; i++) {
+		service = db->index[i];
 
 		gatt_db_service_get_handles(service, &cur_start, &cur_end);
 
@@ -509,7 +618,6 @@ static struct gatt_db_service *find_insert_loc(struct gatt_db *db,
 			return NULL;
 
 		*after = service;
-		services_entry = services_entry->next;
 	}
 
 	return NULL;
@@ -559,17 +667,26 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (!service)
 		return NULL;
 
-	if (after) {
+	service->attributes[0]->handle = handle;
+	service->num_handles = num_handles;
+
+	if (!index_insert(db, service))
+		goto fail;
+
+	/* From here on destroying the service drops it from the index */
+	service->db = db;
+
+	/* Services are mostly appended, avoid walking the list for those */
+	if (after && after == queue_peek_tail(db->services)) {
+		if (!queue_push_tail(db->services, service))
+			goto fail;
+	} else if (after) {
 		if (!queue_push_after(db->services, after, service))
 			goto fail;
 	} else if (!queue_push_head(db->services, service)) {
 		goto fail;
 	}
 
-	service->db = db;
-	service->attributes[0]->handle = handle;
-	service->num_handles = num_handles;
-
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
@@ -611,7 +728,7 @@ unsigned int gatt_db_register(struct gatt_db *db,
 
 	notify->id = db->next_notify_id++;
 
-	if (!queue_push_tail(db->notify_list, notify)) {
+	if (!vqueue_push_tail(db->notify_list, notify)) {
 		free(notify);
 		return 0;
 	}
@@ -626,11 +743,12 @@ bool gatt_db_unregister(struct gatt_db *db, unsigned int id)
 	if (!db || !id)
 		return false;
 
-	notify = queue_find(db->notify_list, match_notify_id, UINT_TO_PTR(id));
+	notify = vqueue_find(db->notify_list, match_notify_id,
+							UINT_TO_PTR(id));
 	if (!notify)
 		return false;
 
-	queue_remove(db->notify_list, notify);
+	vqueue_remove(db->notify_list, notify);
 	notify_destroy(notify);
 
 	return true;
@@ -1023,31 +1141,28 @@ void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
 							const bt_uuid_t type,
 							struct queue *queue)
 {
-	const struct queue_entry *services_entry;
 	struct gatt_db_service *service;
-	uint16_t grp_start, grp_end, uuid_size;
+	uint16_t grp_start, uuid_size;
+	unsigned int i;
 
 	uuid_size = 0;
 
-	services_entry = queue_get_entries(db->services);
+	for (i = index_lookup(db, start_handle); i < db->index_len; i++) {
+		service = db->index[i];
 
-	while (services_entry) {
-		service = services_entry->data;
+		grp_start = service->attributes[0]->handle;
+
+		if (grp_start > end_handle)
+			break;
 
 		if (!service->active)
-			goto next_service;
+			continue;
 
 		if (bt_uuid_cmp(&type, &service->attributes[0]->uuid))
-			goto next_service;
-
-		grp_start = service->attributes[0]->handle;
-		grp_end = grp_start + service->num_handles - 1;
-
-		if (grp_end < start_handle || grp_start > end_handle)
-			goto next_service;
+			continue;
 
-		if (grp_start < start_handle || grp_start > end_handle)
-			goto next_service;
+		if (grp_start < start_handle)
+			continue;
 
 		if (!uuid_size)
 			uuid_size = service->attributes[0]->value_len;
@@ -1055,9 +1170,6 @@ void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
 			return;
 
 		queue_push_tail(queue, service->attributes[0]);
-
-next_service:
-		services_entry = services_entry->next;
 	}
 }
 
@@ -1127,7 +1239,7 @@ unsigned int gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
 	data.func = func;
 	data.user_data = user_data;
 
-	queue_foreach(db->services, find_by_type, &data);
+	index_foreach(db, start_handle, end_handle, find_by_type, &data);
 
 	return data.num_of_res;
 }
@@ -1151,7 +1263,7 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db *db,
 	data.value = value;
 	data.value_len = value_len;
 
-	queue_foreach(db->services, find_by_type, &data);
+	index_foreach(db, start_handle, end_handle, find_by_type, &data);
 
 	return data.num_of_res;
 }
@@ -1197,12 +1309,20 @@ void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
 						struct queue *queue)
 {
 	struct read_by_type_data data;
+	unsigned int i;
+
 	data.uuid = type;
 	data.start_handle = start_handle;
 	data.end_handle = end_handle;
 	data.queue = queue;
 
-	queue_foreach(db->services, read_by_type, &data);
+	/* Only visit services overlapping the requested range */
+	for (i = index_lookup(db, start_handle); i < db->index_len; i++) {
+		if (db->index[i]->attributes[0]->handle > end_handle)
+			break;
+
+		read_by_type(db->index[i], &data);
+	}
 }
 
 
@@ -1247,12 +1367,19 @@ void gatt_db_find_information(struct gatt_db *db, uint16_t start_handle,
 							struct queue *queue)
 {
 	struct find_information_data data;
+	unsigned int i;
 
 	data.start_handle = start_handle;
 	data.end_handle = end_handle;
 	data.queue = queue;
 
-	queue_foreach(db->services, find_information, &data);
+	/* Only visit services overlapping the requested range */
+	for (i = index_lookup(db, start_handle); i < db->index_len; i++) {
+		if (db->index[i]->attributes[0]->handle > end_handle)
+			break;
+
+		find_information(db->index[i], &data);
+	}
 }
 
 void gatt_db_foreach_service(struct gatt_db *db, const bt_uuid_t *uuid,
@@ -1310,7 +1437,8 @@ void gatt_db_foreach_service_in_range(struct gatt_db *db,
 	data.start = start_handle;
 	data.end = end_handle;
 
-	queue_foreach(db->services, foreach_service_in_range, &data);
+	index_foreach(db, start_handle, end_handle, foreach_service_in_range,
+									&data);
 }
 
 void gatt_db_service_foreach(struct gatt_db_attribute *attrib,
@@ -1393,28 +1521,21 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
-
-	gatt_db_service_get_handles(service, &start, &end);
-
-	return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 							uint16_t handle)
 {
 	struct gatt_db_service *service;
+	unsigned int i;
 
 	if (!db || !handle)
 		return NULL;
 
-	service = queue_find(db->services, find_service_for_handle,
-						UINT_TO_PTR(handle));
-	if (!service)
+	i = index_lookup(db, handle);
+	if (i == db->index_len)
+		return NULL;
+
+	service = db->index[i];
+	if (service->attributes[0]->handle > handle)
 		return NULL;
 
 	return service->attributes[0];
@@ -1433,6 +1554,11 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 
 	service = attrib->service;
 
+	/* Attributes are usually allocated with consecutive handles */
+	i = handle - attrib->handle;
+	if (service->attributes[i] && service->attributes[i]->handle == handle)
+		return service->attributes[i];
+
 	for (i = 0; i < service->num_handles; i++) {
 		if (!service->attributes[i])
 			continue;
@@ -51,10 +51,43 @@
  */
 #define DEFAULT_MAX_PREP_QUEUE_LEN 30
 
+/* Maximum number of discovery responses cached per database */
+#define RSP_CACHE_MAX_ENTRIES 64
+
+/*
+ * Discovery responses (Read By Group Type and Read By Type for declarations)
+ * only depend on the database layout, so they are cached per gatt_db and
+ * shared by all servers using it. Any service being activated or removed
+ * flushes the cache.
+ */
+struct rsp_cache_entry {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	bt_uuid_t type;
+	uint16_t mtu;
+	uint8_t ecode;
+	uint8_t *pdu;
+	uint16_t len;
+};
+
+struct rsp_cache {
+	struct gatt_db *db;
+	int ref_count;
+	unsigned int db_id;
+	struct queue *entries;
+};
+
+static struct queue *rsp_caches;
+
 struct async_read_op {
 	struct bt_gatt_server *server;
 	uint8_t opcode;
 	bool done;
+	bool cache;
+	uint16_t start;
+	uint16_t end;
+	bt_uuid_t type;
 	uint8_t *pdu;
 	size_t pdu_len;
 	size_t value_len;
@@ -117,8 +150,169 @@ struct bt_gatt_server {
 
 	bt_gatt_server_mtu_func_t mtu_callback;
 	void *mtu_data;
+
+	struct rsp_cache *rsp_cache;
+};
+
+static void rsp_cache_entry_free(void *data)
+{
+	struct rsp_cache_entry *entry = data;
+
+	free(entry->pdu);
+	free(entry);
+}
+
+static void rsp_cache_flush(struct gatt_db_attribute *attrib, void *user_data)
+{
+	struct rsp_cache *cache = user_data;
+
+	queue_remove_all(cache->entries, NULL, NULL, rsp_cache_entry_free);
+}
+
+static bool match_rsp_cache_db(const void *a, const void *b)
+{
+	const struct rsp_cache *cache = a;
+
+	return cache->db == b;
+}
+
+static struct rsp_cache *rsp_cache_get(struct gatt_db *db)
+{
+	struct rsp_cache *cache;
+
+	cache = queue_find(rsp_caches, match_rsp_cache_db, db);
+	if (cache) {
+		cache->ref_count++;
+		return cache;
+	}
+
+	cache = new0(struct rsp_cache, 1);
+	cache->db = db;
+	cache->ref_count = 1;
+	cache->entries = queue_new();
+	cache->db_id = gatt_db_register(db, rsp_cache_flush, rsp_cache_flush,
+								cache, NULL);
+
+	if (!rsp_caches)
+		rsp_caches = queue_new();
+
+	queue_push_tail(rsp_caches, cache);
+
+	return cache;
+}
+
+static void rsp_cache_unref(struct rsp_cache *cache)
+{
+	if (!cache || --cache->ref_count)
+		return;
+
+	queue_remove(rsp_caches, cache);
+	if (queue_isempty(rsp_caches)) {
+		queue_destroy(rsp_caches, NULL);
+		rsp_caches = NULL;
+	}
+
+	gatt_db_unregister(cache->db, cache->db_id);
+	queue_destroy(cache->entries, rsp_cache_entry_free);
+	free(cache);
+}
+
+struct rsp_cache_key {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	const bt_uuid_t *type;
+	uint16_t mtu;
 };
 
+static bool match_rsp_cache_key(const void *a, const void *b)
+{
+	const struct rsp_cache_entry *entry = a;
+	const struct rsp_cache_key *key = b;
+
+	return entry->opcode == key->opcode && entry->start == key->start &&
+				entry->end == key->end &&
+				entry->mtu == key->mtu &&
+				!bt_uuid_cmp(&entry->type, key->type);
+}
+
+static bool rsp_cache_send(struct bt_gatt_server *server, uint8_t opcode,
+					uint16_t start, uint16_t end,
+					const bt_uuid_t *type)
+{
+	struct rsp_cache_entry *entry;
+	struct rsp_cache_key key;
+
+	if (!server->rsp_cache)
+		return false;
+
+	key.opcode = opcode;
+	key.start = start;
+	key.end = end;
+	key.type = type;
+	key.mtu = bt_att_get_mtu(server->att);
+
+	entry = queue_find(server->rsp_cache->entries, match_rsp_cache_key,
+									&key);
+	if (!entry)
+		return false;
+
+	util_debug(server->debug_callback, server->debug_data,
+				"Using cached response for opcode 0x%02x",
+				opcode);
+
+	if (entry->ecode) {
+		bt_att_send_error_rsp(server->att, opcode, start, entry->ecode);
+		return true;
+	}
+
+	if (opcode == BT_ATT_OP_READ_BY_TYPE_REQ)
+		opcode = BT_ATT_OP_READ_BY_TYPE_RSP;
+	else
+		opcode = BT_ATT_OP_READ_BY_GRP_TYPE_RSP;
+
+	bt_att_send(server->att, opcode, entry->pdu, entry->len, NULL, NULL,
+									NULL);
+
+	return true;
+}
+
+static void rsp_cache_store(struct bt_gatt_server *server, uint8_t opcode,
+					uint16_t start, uint16_t end,
+					const bt_uuid_t *type, uint8_t ecode,
+					const uint8_t *pdu, uint16_t len)
+{
+	struct rsp_cache_entry *entry;
+
+	if (!server->rsp_cache)
+		return;
+
+	if (queue_length(server->rsp_cache->entries) >= RSP_CACHE_MAX_ENTRIES)
+		rsp_cache_entry_free(queue_pop_head(
+						server->rsp_cache->entries));
+
+	entry = new0(struct rsp_cache_entry, 1);
+	entry->opcode = opcode;
+	entry->start = start;
+	entry->end = end;
+	entry->type = *type;
+	entry->mtu = bt_att_get_mtu(server->att);
+	entry->ecode = ecode;
+
+	if (len) {
+		entry->pdu = malloc(len);
+		if (!entry->pdu) {
+			free(entry);
+			return;
+		}
+
+		memcpy(entry->pdu, pdu, len);
+		entry->len = len;
+	}
+
+	queue_push_tail(server->rsp_cache->entries, entry);
+}
+
 static void bt_gatt_server_free(struct bt_gatt_server *server)
 {
 	if (server->debug_destroy)
@@ -145,6 +339,7 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
 
+	rsp_cache_unref(server->rsp_cache);
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
 	free(server);
@@ -293,10 +488,17 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	if (rsp_cache_send(server, opcode, start, end, &type)) {
+		queue_destroy(q, NULL);
+		return;
+	}
+
 	gatt_db_read_by_group_type(server->db, start, end, type, q);
 
 	if (queue_isempty(q)) {
 		ecode = BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND;
+		rsp_cache_store(server, opcode, start, end, &type, ecode,
+								NULL, 0);
 		goto error;
 	}
 
@@ -308,6 +510,9 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 
 	queue_destroy(q, NULL);
 
+	rsp_cache_store(server, opcode, start, end, &type, 0, rsp_pdu,
+								rsp_len);
+
 	bt_att_send(server->att, BT_ATT_OP_READ_BY_GRP_TYPE_RSP,
 							rsp_pdu, rsp_len,
 							NULL, NULL, NULL);
@@ -451,6 +656,11 @@ static void process_read_by_type(struct async_read_op *op)
 	attr = queue_pop_head(op->db_data);
 
 	if (op->done || !attr) {
+		if (op->cache)
+			rsp_cache_store(server, op->opcode, op->start, op->end,
+						&op->type, 0, op->pdu,
+						op->pdu_len);
+
 		bt_att_send(server->att, BT_ATT_OP_READ_BY_TYPE_RSP, op->pdu,
 								op->pdu_len,
 								NULL, NULL,
@@ -477,6 +687,16 @@ error:
 	async_read_op_destroy(op);
 }
 
+static bool is_static_decl_type(const bt_uuid_t *type)
+{
+	bt_uuid_t chrc, incl;
+
+	bt_uuid16_create(&chrc, GATT_CHARAC_UUID);
+	bt_uuid16_create(&incl, GATT_INCLUDE_UUID);
+
+	return !bt_uuid_cmp(type, &chrc) || !bt_uuid_cmp(type, &incl);
+}
+
 static void read_by_type_cb(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data)
 {
@@ -487,6 +707,7 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 	uint8_t ecode;
 	struct queue *q = NULL;
 	struct async_read_op *op;
+	bool cache;
 
 	if (length != 6 && length != 20) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -515,10 +736,24 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	/*
+	 * Only characteristic and include declarations are cached since their
+	 * values are static and readable without security.
+	 */
+	cache = is_static_decl_type(&type);
+
+	if (cache && rsp_cache_send(server, opcode, start, end, &type)) {
+		queue_destroy(q, NULL);
+		return;
+	}
+
 	gatt_db_read_by_type(server->db, start, end, type, q);
 
 	if (queue_isempty(q)) {
 		ecode = BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND;
+		if (cache)
+			rsp_cache_store(server, opcode, start, end, &type,
+							ecode, NULL, 0);
 		goto error;
 	}
 
@@ -538,6 +773,10 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 	op->opcode = opcode;
 	op->server = server;
 	op->db_data = q;
+	op->cache = cache;
+	op->start = start;
+	op->end = end;
+	op->type = type;
 	server->pending_read_op = op;
 
 	process_read_by_type(op);
@@ -1577,6 +1816,7 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 	server->max_prep_queue_len = DEFAULT_MAX_PREP_QUEUE_LEN;
 	server->prep_queue = queue_new();
 	server->min_enc_size = min_enc_size;
+	server->rsp_cache = rsp_cache_get(db);
 
 	if (!gatt_server_register_att_handlers(server)) {
 		bt_gatt_server_free(server);
@@ -578,7 +578,11 @@ struct hfp_gw *hfp_gw_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	/* Mirrored so that commands never need reassembly on wrap around */
+	hfp->read_buf = ringbuf_new_mirrored(4096);
+	if (!hfp->read_buf)
+		hfp->read_buf = ringbuf_new(4096);
+
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
@@ -1252,7 +1256,10 @@ struct hfp_hf *hfp_hf_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	hfp->read_buf = ringbuf_new_mirrored(4096);
+	if (!hfp->read_buf)
+		hfp->read_buf = ringbuf_new(4096);
+
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
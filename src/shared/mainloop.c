@@ -27,6 +27,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -38,7 +39,8 @@
 
 #include "mainloop.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 10
+#define MAX_EPOLL_EVENTS 256
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -52,17 +54,56 @@ struct mainloop_data {
 	void *user_data;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/* Entries indexed by fd, grown on demand */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+static unsigned int mainloop_count;
+
+/*
+ * All timeouts share a single timerfd driving a hierarchical timer wheel.
+ * Level 0 has a granularity of 1 ms and each following level covers
+ * TIMER_WHEEL_SIZE slots of the previous one. Timeouts further away than
+ * the whole wheel are parked in the top level and re-inserted when their
+ * slot is reached.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
 
 struct timeout_data {
-	int fd;
+	int id;
+	bool armed;
+	uint64_t expires;
+	unsigned int level;
+	unsigned int slot;
+	struct timeout_data *prev;
+	struct timeout_data *next;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+struct timer_wheel {
+	int fd;
+	uint64_t now;
+	uint64_t next;
+	unsigned int count;
+	bool dispatching;
+	uint64_t bitmap[TIMER_WHEEL_LEVELS];
+	struct timeout_data *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+	/* Timeouts indexed by id - 1, with a stack of ids free for reuse */
+	struct timeout_data **list;
+	unsigned int list_size;
+	unsigned int *free_ids;
+	unsigned int free_count;
+};
+
+static struct timer_wheel wheel = { .fd = -1 };
+
 struct signal_data {
 	int fd;
 	sigset_t mask;
@@ -73,18 +114,55 @@ struct signal_data {
 
 static struct signal_data *signal_data;
 
+static void timer_destroy(void *user_data);
+
 void mainloop_init(void)
 {
-	unsigned int i;
+	if (wheel.fd >= 0)
+		timer_destroy(NULL);
 
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+	mainloop_count = 0;
 
 	epoll_terminate = 0;
 }
 
+static bool mainloop_list_grow(int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size = mainloop_list_size;
+
+	if (!size)
+		size = MIN_MAINLOOP_ENTRIES;
+
+	while (size <= (unsigned int) fd)
+		size *= 2;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return false;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return true;
+}
+
+static struct mainloop_data *mainloop_list_get(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
+
 void mainloop_quit(void)
 {
 	epoll_terminate = 1;
@@ -123,29 +201,64 @@ static void signal_callback(int fd, uint32_t events, void *user_data)
 
 int mainloop_run(void)
 {
+	struct epoll_event *events;
+	unsigned int max_events = MIN_EPOLL_EVENTS;
 	unsigned int i;
 
+	events = malloc(max_events * sizeof(*events));
+	if (!events)
+		return EXIT_FAILURE;
+
 	if (signal_data) {
-		if (sigprocmask(SIG_BLOCK, &signal_data->mask, NULL) < 0)
+		if (sigprocmask(SIG_BLOCK, &signal_data->mask, NULL) < 0) {
+			free(events);
 			return EXIT_FAILURE;
+		}
 
 		signal_data->fd = signalfd(-1, &signal_data->mask,
 						SFD_NONBLOCK | SFD_CLOEXEC);
-		if (signal_data->fd < 0)
+		if (signal_data->fd < 0) {
+			free(events);
 			return EXIT_FAILURE;
+		}
 
 		if (mainloop_add_fd(signal_data->fd, EPOLLIN,
 				signal_callback, signal_data, NULL) < 0) {
 			close(signal_data->fd);
+			free(events);
 			return EXIT_FAILURE;
 		}
 	}
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		/*
+		 * Size the event batch to the number of registered fds so a
+		 * busy loop is served with as few epoll_wait calls as
+		 * possible. This is only done here since the buffer must not
+		 * move while events are dispatched.
+		 */
+		if (max_events < mainloop_count &&
+					max_events < MAX_EPOLL_EVENTS) {
+			struct epoll_event *tmp;
+			unsigned int size = max_events;
+
+			while (size < mainloop_count &&
+						size < MAX_EPOLL_EVENTS)
+				size *= 2;
+
+			if (size > MAX_EPOLL_EVENTS)
+				size = MAX_EPOLL_EVENTS;
+
+			tmp = realloc(events, size * sizeof(*events));
+			if (tmp) {
+				events = tmp;
+				max_events = size;
+			}
+		}
+
+		nfds = epoll_wait(epoll_fd, events, max_events, -1);
 		if (nfds < 0)
 			continue;
 
@@ -165,13 +278,16 @@ int mainloop_run(void)
 			signal_data->destroy(signal_data->user_data);
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	free(events);
+
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
 
 		if (data) {
 			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+			mainloop_count--;
 
 			if (data->destroy)
 				data->destroy(data->user_data);
@@ -180,6 +296,10 @@ int mainloop_run(void)
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -193,9 +313,13 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_list_size &&
+						!mainloop_list_grow(fd))
+		return -ENOMEM;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -218,6 +342,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	}
 
 	mainloop_list[fd] = data;
+	mainloop_count++;
 
 	return 0;
 }
@@ -228,10 +353,10 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_get(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -253,14 +378,15 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_list_get(fd);
 	if (!data)
 		return -ENXIO;
 
 	mainloop_list[fd] = NULL;
+	mainloop_count--;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
@@ -272,48 +398,327 @@ int mainloop_remove_fd(int fd)
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t timer_now(bool round_up)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
+	uint64_t msec;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	msec = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	if (round_up && ts.tv_nsec % 1000000)
+		msec++;
 
-	free(data);
+	return msec;
+}
+
+static void timer_link(struct timeout_data *data)
+{
+	uint64_t delta, expires = data->expires;
+	unsigned int level;
+
+	delta = expires > wheel.now ? expires - wheel.now : 0;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	/* Park timeouts beyond the wheel range in the furthest slot */
+	if (delta >= (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)))
+		expires = wheel.now +
+			(1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+	else if (!delta)
+		expires = wheel.now;
+
+	data->level = level;
+	data->slot = (expires >> (TIMER_WHEEL_BITS * level)) &
+							TIMER_WHEEL_MASK;
+
+	data->prev = NULL;
+	data->next = wheel.slots[level][data->slot];
+	if (data->next)
+		data->next->prev = data;
+
+	wheel.slots[level][data->slot] = data;
+	wheel.bitmap[level] |= 1ULL << data->slot;
+	wheel.count++;
+	data->armed = true;
+}
+
+static void timer_unlink(struct timeout_data *data)
+{
+	if (!data->armed)
+		return;
+
+	if (data->prev)
+		data->prev->next = data->next;
+	else
+		wheel.slots[data->level][data->slot] = data->next;
+
+	if (data->next)
+		data->next->prev = data->prev;
+
+	if (!wheel.slots[data->level][data->slot])
+		wheel.bitmap[data->level] &= ~(1ULL << data->slot);
+
+	data->prev = NULL;
+	data->next = NULL;
+	data->armed = false;
+	wheel.count--;
+}
+
+/*
+ * Returns the time at which the next non-empty slot needs to be processed,
+ * either to fire its timeouts (level 0) or to cascade them down.
+ */
+static uint64_t timer_next_event(void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned int shift = TIMER_WHEEL_BITS * level;
+		unsigned int cur = (wheel.now >> shift) & TIMER_WHEEL_MASK;
+		uint64_t base, ahead, when;
+
+		if (!wheel.bitmap[level])
+			continue;
+
+		base = (wheel.now >> (shift + TIMER_WHEEL_BITS)) <<
+						(shift + TIMER_WHEEL_BITS);
+
+		/*
+		 * The current slot of an upper level has already been
+		 * cascaded, so anything there belongs to the next rotation.
+		 */
+		if (!level)
+			ahead = wheel.bitmap[level] & (~0ULL << cur);
+		else if (cur < TIMER_WHEEL_MASK)
+			ahead = wheel.bitmap[level] & (~0ULL << (cur + 1));
+		else
+			ahead = 0;
+
+		if (ahead)
+			when = base + ((uint64_t) __builtin_ctzll(ahead) << shift);
+		else
+			when = base + (1ULL << (shift + TIMER_WHEEL_BITS)) +
+				((uint64_t) __builtin_ctzll(wheel.bitmap[level])
+								<< shift);
+
+		if (when < next)
+			next = when;
+	}
+
+	return next;
+}
+
+static void timer_arm(void)
+{
+	struct itimerspec itimer;
+	uint64_t next;
+
+	next = wheel.count ? timer_next_event() : 0;
+	if (next == wheel.next)
+		return;
+
+	memset(&itimer, 0, sizeof(itimer));
+	itimer.it_value.tv_sec = next / 1000;
+	itimer.it_value.tv_nsec = (next % 1000) * 1000 * 1000;
+
+	if (timerfd_settime(wheel.fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	wheel.next = next;
+}
+
+static void timer_process(uint64_t when)
+{
+	unsigned int level;
+
+	wheel.now = when;
+
+	/* Cascade upper level slots starting at this point in time */
+	for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+		unsigned int shift = TIMER_WHEEL_BITS * level;
+		struct timeout_data *data;
+		unsigned int slot;
+
+		if (when & ((1ULL << shift) - 1))
+			continue;
+
+		slot = (when >> shift) & TIMER_WHEEL_MASK;
+
+		while ((data = wheel.slots[level][slot])) {
+			timer_unlink(data);
+			timer_link(data);
+		}
+	}
+
+	/*
+	 * Fire everything due now. Callbacks may add, modify or remove any
+	 * timeout, so the slot is looked at again after every call.
+	 */
+	while (1) {
+		struct timeout_data *data;
+
+		data = wheel.slots[0][when & TIMER_WHEEL_MASK];
+		if (!data)
+			break;
+
+		timer_unlink(data);
+
+		if (data->callback)
+			data->callback(data->id, data->user_data);
+	}
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static void timer_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
+	uint64_t expired, now;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
-	if (result != sizeof(expired))
+	/* A re-armed timer can have nothing to read while timers are due */
+	result = read(wheel.fd, &expired, sizeof(expired));
+	if (result < 0 && errno != EAGAIN)
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	if (result >= 0 && result != sizeof(expired))
+		return;
+
+	wheel.next = 0;
+	wheel.dispatching = true;
+	now = timer_now(false);
+
+	while (wheel.count) {
+		uint64_t next = timer_next_event();
+
+		if (next > now)
+			break;
+
+		timer_process(next);
+	}
+
+	wheel.dispatching = false;
+
+	if (!wheel.count)
+		wheel.now = now;
+
+	timer_arm();
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static void timer_destroy(void *user_data)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	unsigned int i;
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	for (i = 0; i < wheel.list_size; i++) {
+		struct timeout_data *data = wheel.list[i];
+
+		if (!data)
+			continue;
+
+		wheel.list[i] = NULL;
+		timer_unlink(data);
+
+		if (data->destroy)
+			data->destroy(data->user_data);
+
+		free(data);
+	}
+
+	close(wheel.fd);
+
+	free(wheel.list);
+	free(wheel.free_ids);
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	memset(&wheel, 0, sizeof(wheel));
+	wheel.fd = -1;
+}
+
+static bool timer_init(void)
+{
+	if (wheel.fd >= 0)
+		return true;
+
+	wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel.fd < 0)
+		return false;
+
+	if (mainloop_add_fd(wheel.fd, EPOLLIN, timer_callback, NULL,
+							timer_destroy) < 0) {
+		close(wheel.fd);
+		wheel.fd = -1;
+		return false;
+	}
+
+	wheel.now = timer_now(false);
+
+	return true;
+}
+
+static int timer_alloc_id(struct timeout_data *data)
+{
+	unsigned int index;
+
+	if (!wheel.free_count) {
+		unsigned int size = wheel.list_size ? wheel.list_size * 2 : 64;
+		struct timeout_data **list;
+		unsigned int *ids;
+
+		list = realloc(wheel.list, size * sizeof(*list));
+		if (!list)
+			return -ENOMEM;
+
+		wheel.list = list;
+
+		ids = realloc(wheel.free_ids, size * sizeof(*ids));
+		if (!ids)
+			return -ENOMEM;
+
+		wheel.free_ids = ids;
+
+		/* Push new ids in reverse so the lowest is handed out first */
+		for (index = size; index > wheel.list_size; index--) {
+			wheel.list[index - 1] = NULL;
+			wheel.free_ids[wheel.free_count++] = index - 1;
+		}
+
+		wheel.list_size = size;
+	}
+
+	index = wheel.free_ids[--wheel.free_count];
+	wheel.list[index] = data;
+
+	return index + 1;
+}
+
+static struct timeout_data *timer_lookup(int id)
+{
+	if (id <= 0 || (unsigned int) id > wheel.list_size)
+		return NULL;
+
+	return wheel.list[id - 1];
+}
+
+static void timer_start(struct timeout_data *data, unsigned int msec)
+{
+	/* Keep the wheel close to the current time when it is idle */
+	if (!wheel.count && !wheel.dispatching)
+		wheel.now = timer_now(false);
+
+	data->expires = timer_now(true) + msec;
+
+	timer_link(data);
+
+	/* The timer is re-armed anyway once dispatching is done */
+	if (wheel.dispatching)
+		return;
+
+	if (!wheel.next || data->expires < wheel.next)
+		timer_arm();
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -324,6 +729,9 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (!timer_init())
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -333,46 +741,54 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	data->id = timer_alloc_id(data);
+	if (data->id < 0) {
 		free(data);
 		return -EIO;
 	}
 
-	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
-	}
+	/* A zero timeout is registered but never fires until modified */
+	if (msec > 0)
+		timer_start(data, msec);
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
-
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
-	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
+	data = timer_lookup(id);
+	if (!data)
 		return -EIO;
 
+	if (msec > 0) {
+		timer_unlink(data);
+		timer_start(data, msec);
+	}
+
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timer_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timer_unlink(data);
+
+	wheel.list[id - 1] = NULL;
+	wheel.free_ids[wheel.free_count++] = id - 1;
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
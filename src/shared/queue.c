@@ -25,16 +25,124 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
+
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
+/*
+ * Released entries are kept on a per-thread free list so that steady state
+ * push and pop cycles don't go through malloc. The list is bounded to avoid
+ * holding on to memory after a burst, and freed when its thread exits.
+ */
+#define ENTRY_CACHE_MAX 256
+
+static __thread struct queue_entry *entry_cache;
+static __thread unsigned int entry_cache_len;
+static __thread bool entry_cache_registered;
+
+static pthread_once_t entry_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t entry_cache_key;
+
 struct queue {
 	int ref_count;
 	struct queue_entry *head;
 	struct queue_entry *tail;
 	unsigned int entries;
+	struct queue_entry *spare;
+	unsigned int spares;
+	unsigned int reserved;
 };
 
+static void entry_cache_destroy(void *data)
+{
+	while (entry_cache) {
+		struct queue_entry *entry = entry_cache;
+
+		entry_cache = entry->next;
+		free(entry);
+	}
+
+	entry_cache_len = 0;
+	entry_cache_registered = false;
+}
+
+static void entry_cache_key_create(void)
+{
+	pthread_key_create(&entry_cache_key, entry_cache_destroy);
+}
+
+/* The key destructor only runs for threads with a non-NULL value */
+static bool entry_cache_register(void)
+{
+	if (entry_cache_registered)
+		return true;
+
+	if (pthread_once(&entry_cache_once, entry_cache_key_create))
+		return false;
+
+	if (pthread_setspecific(entry_cache_key, &entry_cache))
+		return false;
+
+	entry_cache_registered = true;
+
+	return true;
+}
+
+static struct queue_entry *queue_entry_new(struct queue *queue, void *data)
+{
+	struct queue_entry *entry;
+
+	if (queue->spare) {
+		entry = queue->spare;
+		queue->spare = entry->next;
+		queue->spares--;
+	} else if (entry_cache) {
+		entry = entry_cache;
+		entry_cache = entry->next;
+		entry_cache_len--;
+	} else {
+		entry = new0(struct queue_entry, 1);
+	}
+
+	entry->data = data;
+	entry->next = NULL;
+
+	return entry;
+}
+
+/* Must be called after the entry has been accounted out of queue->entries */
+static void queue_entry_free(struct queue *queue, struct queue_entry *entry)
+{
+	if (queue->entries + queue->spares < queue->reserved) {
+		entry->next = queue->spare;
+		queue->spare = entry;
+		queue->spares++;
+		return;
+	}
+
+	if (entry_cache_len < ENTRY_CACHE_MAX && entry_cache_register()) {
+		entry->next = entry_cache;
+		entry_cache = entry;
+		entry_cache_len++;
+		return;
+	}
+
+	free(entry);
+}
+
+static void queue_release_spares(struct queue *queue, unsigned int keep)
+{
+	while (queue->spares > keep) {
+		struct queue_entry *entry = queue->spare;
+
+		queue->spare = entry->next;
+		queue->spares--;
+
+		free(entry);
+	}
+}
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -50,6 +158,7 @@ static void queue_unref(struct queue *queue)
 	if (__sync_sub_and_fetch(&queue->ref_count, 1))
 		return;
 
+	queue_release_spares(queue, 0);
 	free(queue);
 }
 
@@ -75,14 +184,34 @@ void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 	queue_unref(queue);
 }
 
-static struct queue_entry *queue_entry_new(void *data)
+/*
+ * Preallocate entries so that the queue can hold up to count entries
+ * without allocating, and keep that many around when entries are removed.
+ * A count of 0 drops the reservation.
+ */
+bool queue_reserve(struct queue *queue, unsigned int count)
 {
-	struct queue_entry *entry;
+	if (!queue)
+		return false;
 
-	entry = new0(struct queue_entry, 1);
-	entry->data = data;
+	queue->reserved = count;
 
-	return entry;
+	if (queue->entries >= count) {
+		queue_release_spares(queue, 0);
+		return true;
+	}
+
+	queue_release_spares(queue, count - queue->entries);
+
+	while (queue->entries + queue->spares < count) {
+		struct queue_entry *entry = new0(struct queue_entry, 1);
+
+		entry->next = queue->spare;
+		queue->spare = entry;
+		queue->spares++;
+	}
+
+	return true;
 }
 
 bool queue_push_tail(struct queue *queue, void *data)
@@ -92,7 +221,7 @@ bool queue_push_tail(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = queue_entry_new(data);
+	entry = queue_entry_new(queue, data);
 
 	if (queue->tail)
 		queue->tail->next = entry;
@@ -114,7 +243,7 @@ bool queue_push_head(struct queue *queue, void *data)
 	if (!queue)
 		return false;
 
-	entry = queue_entry_new(data);
+	entry = queue_entry_new(queue, data);
 
 	entry->next = queue->head;
 
@@ -147,7 +276,7 @@ bool queue_push_after(struct queue *queue, void *entry, void *data)
 	if (!qentry)
 		return false;
 
-	new_entry = queue_entry_new(data);
+	new_entry = queue_entry_new(queue, data);
 
 	new_entry->next = qentry->next;
 
@@ -178,8 +307,8 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
 	queue->entries--;
+	queue_entry_free(queue, entry);
 
 	return data;
 }
@@ -266,8 +395,8 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
 		queue->entries--;
+		queue_entry_free(queue, entry);
 
 		return true;
 	}
@@ -302,8 +431,8 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
 			queue->entries--;
+			queue_entry_free(queue, entry);
 
 			return data;
 		} else {
@@ -345,6 +474,9 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 		queue->tail = NULL;
 		queue->entries = 0;
 
+		/* Entries are recycled into the queue, keep it alive */
+		queue_ref(queue);
+
 		while (entry) {
 			struct queue_entry *tmp = entry;
 
@@ -353,9 +485,11 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_free(queue, tmp);
 			count++;
 		}
+
+		queue_unref(queue);
 	}
 
 	return count;
@@ -384,3 +518,301 @@ bool queue_isempty(struct queue *queue)
 
 	return queue->entries == 0;
 }
+
+/*
+ * Array backed variant of struct queue for lists that are mostly iterated
+ * and rarely modified. Every running vqueue_foreach() registers a cursor
+ * so that entries can be added and removed from within the callback with
+ * the same semantics as for struct queue.
+ */
+struct vqueue_iter {
+	unsigned int pos;
+	struct vqueue_iter *next;
+};
+
+struct vqueue {
+	int ref_count;
+	void **data;
+	unsigned int len;
+	unsigned int size;
+	struct vqueue_iter *iters;
+};
+
+static struct vqueue *vqueue_ref(struct vqueue *vq)
+{
+	if (!vq)
+		return NULL;
+
+	__sync_fetch_and_add(&vq->ref_count, 1);
+
+	return vq;
+}
+
+static void vqueue_unref(struct vqueue *vq)
+{
+	if (__sync_sub_and_fetch(&vq->ref_count, 1))
+		return;
+
+	free(vq->data);
+	free(vq);
+}
+
+struct vqueue *vqueue_new(void)
+{
+	struct vqueue *vq;
+
+	vq = new0(struct vqueue, 1);
+
+	return vqueue_ref(vq);
+}
+
+void vqueue_destroy(struct vqueue *vq, queue_destroy_func_t destroy)
+{
+	if (!vq)
+		return;
+
+	vqueue_remove_all(vq, NULL, NULL, destroy);
+
+	vqueue_unref(vq);
+}
+
+static bool vqueue_grow(struct vqueue *vq)
+{
+	unsigned int size;
+	void **data;
+
+	if (vq->len < vq->size)
+		return true;
+
+	size = vq->size ? vq->size * 2 : 4;
+
+	data = realloc(vq->data, size * sizeof(*data));
+	if (!data)
+		return false;
+
+	vq->data = data;
+	vq->size = size;
+
+	return true;
+}
+
+static void *vqueue_remove_at(struct vqueue *vq, unsigned int index)
+{
+	struct vqueue_iter *iter;
+	void *data = vq->data[index];
+
+	vq->len--;
+	memmove(&vq->data[index], &vq->data[index + 1],
+				(vq->len - index) * sizeof(*vq->data));
+
+	for (iter = vq->iters; iter; iter = iter->next) {
+		if (iter->pos > index)
+			iter->pos--;
+	}
+
+	return data;
+}
+
+bool vqueue_push_tail(struct vqueue *vq, void *data)
+{
+	if (!vq || !vqueue_grow(vq))
+		return false;
+
+	vq->data[vq->len++] = data;
+
+	return true;
+}
+
+bool vqueue_push_head(struct vqueue *vq, void *data)
+{
+	struct vqueue_iter *iter;
+
+	if (!vq || !vqueue_grow(vq))
+		return false;
+
+	memmove(&vq->data[1], &vq->data[0], vq->len * sizeof(*vq->data));
+	vq->data[0] = data;
+	vq->len++;
+
+	for (iter = vq->iters; iter; iter = iter->next)
+		iter->pos++;
+
+	return true;
+}
+
+void *vqueue_pop_head(struct vqueue *vq)
+{
+	if (!vq || !vq->len)
+		return NULL;
+
+	return vqueue_remove_at(vq, 0);
+}
+
+void *vqueue_peek_head(struct vqueue *vq)
+{
+	if (!vq || !vq->len)
+		return NULL;
+
+	return vq->data[0];
+}
+
+void *vqueue_peek_tail(struct vqueue *vq)
+{
+	if (!vq || !vq->len)
+		return NULL;
+
+	return vq->data[vq->len - 1];
+}
+
+void vqueue_foreach(struct vqueue *vq, queue_foreach_func_t function,
+							void *user_data)
+{
+	struct vqueue_iter iter, **tmp;
+
+	if (!vq || !function || !vq->len)
+		return;
+
+	vqueue_ref(vq);
+
+	iter.pos = 0;
+	iter.next = vq->iters;
+	vq->iters = &iter;
+
+	while (iter.pos < vq->len && vq->ref_count > 1)
+		function(vq->data[iter.pos++], user_data);
+
+	for (tmp = &vq->iters; *tmp != &iter; tmp = &(*tmp)->next)
+		;
+
+	*tmp = iter.next;
+
+	vqueue_unref(vq);
+}
+
+static int vqueue_find_index(struct vqueue *vq, queue_match_func_t function,
+							const void *match_data)
+{
+	unsigned int i;
+
+	if (!function)
+		function = direct_match;
+
+	for (i = 0; i < vq->len; i++) {
+		if (function(vq->data[i], match_data))
+			return i;
+	}
+
+	return -1;
+}
+
+void *vqueue_find(struct vqueue *vq, queue_match_func_t function,
+							const void *match_data)
+{
+	int index;
+
+	if (!vq)
+		return NULL;
+
+	index = vqueue_find_index(vq, function, match_data);
+	if (index < 0)
+		return NULL;
+
+	return vq->data[index];
+}
+
+bool vqueue_remove(struct vqueue *vq, void *data)
+{
+	int index;
+
+	if (!vq)
+		return false;
+
+	index = vqueue_find_index(vq, direct_match, data);
+	if (index < 0)
+		return false;
+
+	vqueue_remove_at(vq, index);
+
+	return true;
+}
+
+void *vqueue_remove_if(struct vqueue *vq, queue_match_func_t function,
+							void *user_data)
+{
+	int index;
+
+	if (!vq)
+		return NULL;
+
+	index = vqueue_find_index(vq, function, user_data);
+	if (index < 0)
+		return NULL;
+
+	return vqueue_remove_at(vq, index);
+}
+
+unsigned int vqueue_remove_all(struct vqueue *vq, queue_match_func_t function,
+				void *user_data, queue_destroy_func_t destroy)
+{
+	struct vqueue_iter *iter;
+	unsigned int count = 0, len, i;
+	void **data;
+
+	if (!vq)
+		return 0;
+
+	if (function) {
+		while (vq->len) {
+			void *match;
+			unsigned int entries = vq->len;
+
+			match = vqueue_remove_if(vq, function, user_data);
+			if (entries == vq->len)
+				break;
+
+			if (destroy)
+				destroy(match);
+
+			count++;
+		}
+
+		return count;
+	}
+
+	data = vq->data;
+	len = vq->len;
+
+	vq->data = NULL;
+	vq->len = 0;
+	vq->size = 0;
+
+	for (iter = vq->iters; iter; iter = iter->next)
+		iter->pos = 0;
+
+	for (i = 0; i < len; i++) {
+		if (destroy)
+			destroy(data[i]);
+
+		count++;
+	}
+
+	free(data);
+
+	return count;
+}
+
+unsigned int vqueue_length(struct vqueue *vq)
+{
+	if (!vq)
+		return 0;
+
+	return vq->len;
+}
+
+bool vqueue_isempty(struct vqueue *vq)
+{
+	if (!vq)
+		return true;
+
+	return vq->len == 0;
+}
@@ -34,6 +34,7 @@ struct queue_entry {
 
 struct queue *queue_new(void);
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy);
+bool queue_reserve(struct queue *queue, unsigned int count);
 
 bool queue_push_tail(struct queue *queue, void *data);
 bool queue_push_head(struct queue *queue, void *data);
@@ -62,3 +63,28 @@ const struct queue_entry *queue_get_entries(struct queue *queue);
 
 unsigned int queue_length(struct queue *queue);
 bool queue_isempty(struct queue *queue);
+
+struct vqueue;
+
+struct vqueue *vqueue_new(void);
+void vqueue_destroy(struct vqueue *vq, queue_destroy_func_t destroy);
+
+bool vqueue_push_tail(struct vqueue *vq, void *data);
+bool vqueue_push_head(struct vqueue *vq, void *data);
+void *vqueue_pop_head(struct vqueue *vq);
+void *vqueue_peek_head(struct vqueue *vq);
+void *vqueue_peek_tail(struct vqueue *vq);
+
+void vqueue_foreach(struct vqueue *vq, queue_foreach_func_t function,
+							void *user_data);
+void *vqueue_find(struct vqueue *vq, queue_match_func_t function,
+							const void *match_data);
+
+bool vqueue_remove(struct vqueue *vq, void *data);
+void *vqueue_remove_if(struct vqueue *vq, queue_match_func_t function,
+							void *user_data);
+unsigned int vqueue_remove_all(struct vqueue *vq, queue_match_func_t function,
+				void *user_data, queue_destroy_func_t destroy);
+
+unsigned int vqueue_length(struct vqueue *vq);
+bool vqueue_isempty(struct vqueue *vq);
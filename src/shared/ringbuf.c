@@ -27,8 +27,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
 
 #include "src/shared/util.h"
 #include "src/shared/ringbuf.h"
@@ -42,6 +45,7 @@ struct ringbuf {
 	size_t size;
 	size_t in;
 	size_t out;
+	bool mirrored;
 	ringbuf_tracing_func_t in_tracing;
 	void *in_data;
 };
@@ -85,12 +89,79 @@ struct ringbuf *ringbuf_new(size_t size)
 	return ringbuf;
 }
 
+/*
+ * Create a ring buffer whose memory is mapped twice back to back, so that
+ * data and free space are always contiguous in memory no matter where they
+ * wrap around. The size is rounded up to a power of two multiple of the
+ * page size. Returns NULL if the system does not support it.
+ */
+struct ringbuf *ringbuf_new_mirrored(size_t size)
+{
+#ifdef __NR_memfd_create
+	struct ringbuf *ringbuf;
+	size_t real_size;
+	long page_size;
+	void *base;
+	int fd;
+
+	if (size < 2 || size > UINT_MAX / 2)
+		return NULL;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size < 0)
+		return NULL;
+
+	real_size = align_power2(MAX(size, (size_t) page_size));
+
+	fd = syscall(__NR_memfd_create, "ringbuf", 0);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, real_size) < 0)
+		goto fail;
+
+	/* Reserve twice the space and map the file into both halves */
+	base = mmap(NULL, real_size * 2, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		goto fail;
+
+	if (mmap(base, real_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			mmap(base + real_size, real_size,
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, real_size * 2);
+		goto fail;
+	}
+
+	close(fd);
+
+	ringbuf = new0(struct ringbuf, 1);
+	ringbuf->buffer = base;
+	ringbuf->size = real_size;
+	ringbuf->mirrored = true;
+	ringbuf->in = RINGBUF_RESET;
+	ringbuf->out = RINGBUF_RESET;
+
+	return ringbuf;
+
+fail:
+	close(fd);
+#endif
+	return NULL;
+}
+
 void ringbuf_free(struct ringbuf *ringbuf)
 {
 	if (!ringbuf)
 		return;
 
-	free(ringbuf->buffer);
+	if (ringbuf->mirrored)
+		munmap(ringbuf->buffer, ringbuf->size * 2);
+	else
+		free(ringbuf->buffer);
+
 	free(ringbuf);
 }
 
@@ -148,42 +219,117 @@ void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap)
 	if (!ringbuf)
 		return NULL;
 
-	offset = (ringbuf->out + offset) & (ringbuf->size - 1);
-
 	if (len_nowrap) {
 		size_t len = ringbuf->in - ringbuf->out;
-		*len_nowrap = MIN(len, ringbuf->size - offset);
+		size_t pos = (ringbuf->out + offset) & (ringbuf->size - 1);
+
+		/* Only count the queued data following the offset */
+		len = offset < len ? len - offset : 0;
+
+		if (ringbuf->mirrored)
+			*len_nowrap = len;
+		else
+			*len_nowrap = MIN(len, ringbuf->size - pos);
 	}
 
+	offset = (ringbuf->out + offset) & (ringbuf->size - 1);
+
 	return ringbuf->buffer + offset;
 }
 
-ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
+static int get_iov(struct ringbuf *ringbuf, size_t pos, size_t len,
+							struct iovec *iov)
 {
-	size_t len, offset, end;
-	struct iovec iov[2];
-	ssize_t consumed;
-
-	if (!ringbuf || fd < 0)
-		return -1;
+	size_t offset, end;
 
-	/* Determine how much data is available */
-	len = ringbuf->in - ringbuf->out;
 	if (!len)
 		return 0;
 
-	/* Grab data from buffer starting at offset until the end */
-	offset = ringbuf->out & (ringbuf->size - 1);
-	end = MIN(len, ringbuf->size - offset);
+	offset = pos & (ringbuf->size - 1);
+
+	if (ringbuf->mirrored)
+		end = len;
+	else
+		end = MIN(len, ringbuf->size - offset);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
 
+	if (end == len)
+		return 1;
+
 	/* Use second vector for remainder from the beginning */
 	iov[1].iov_base = ringbuf->buffer;
 	iov[1].iov_len = len - end;
 
-	consumed = writev(fd, iov, 2);
+	return 2;
+}
+
+/*
+ * Describe the queued data as up to two iovecs, returning how many were
+ * filled. The data stays queued until released with ringbuf_drain().
+ */
+int ringbuf_get_data_iov(struct ringbuf *ringbuf, struct iovec iov[2])
+{
+	if (!ringbuf || !iov)
+		return -1;
+
+	return get_iov(ringbuf, ringbuf->out, ringbuf->in - ringbuf->out, iov);
+}
+
+/*
+ * Describe the free space as up to two iovecs, returning how many were
+ * filled. Data placed there becomes visible with ringbuf_commit().
+ */
+int ringbuf_get_space_iov(struct ringbuf *ringbuf, struct iovec iov[2])
+{
+	if (!ringbuf || !iov)
+		return -1;
+
+	return get_iov(ringbuf, ringbuf->in,
+				ringbuf->size - ringbuf->in + ringbuf->out, iov);
+}
+
+size_t ringbuf_commit(struct ringbuf *ringbuf, size_t count)
+{
+	struct iovec iov[2];
+	size_t avail;
+	int i, cnt;
+
+	if (!ringbuf)
+		return 0;
+
+	avail = ringbuf->size - ringbuf->in + ringbuf->out;
+	count = MIN(count, avail);
+
+	if (ringbuf->in_tracing) {
+		cnt = get_iov(ringbuf, ringbuf->in, count, iov);
+
+		for (i = 0; i < cnt; i++)
+			ringbuf->in_tracing(iov[i].iov_base, iov[i].iov_len,
+							ringbuf->in_data);
+	}
+
+	ringbuf->in += count;
+
+	return count;
+}
+
+ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
+{
+	struct iovec iov[2];
+	ssize_t consumed;
+	int cnt;
+
+	if (!ringbuf || fd < 0)
+		return -1;
+
+	/* Grab the data, using a second vector if it wraps around */
+	cnt = get_iov(ringbuf, ringbuf->out, ringbuf->in - ringbuf->out, iov);
+	if (!cnt)
+		return 0;
+
+	consumed = writev(fd, iov, cnt);
 	if (consumed < 0)
 		return -1;
 
@@ -220,6 +366,8 @@ int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
 int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 {
 	size_t avail, offset, end;
+	struct iovec iov[2];
+	va_list aq;
 	char *str;
 	int len;
 
@@ -231,6 +379,30 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 	if (!avail)
 		return -1;
 
+	/*
+	 * Try formatting straight into the ring. This works whenever the
+	 * string and the nul byte vsnprintf always writes fit in front of
+	 * the wrap around point.
+	 */
+	get_iov(ringbuf, ringbuf->in, avail, iov);
+
+	if (iov[0].iov_len > 1) {
+		va_copy(aq, ap);
+		len = vsnprintf(iov[0].iov_base, iov[0].iov_len, format, aq);
+		va_end(aq);
+
+		if (len < 0)
+			return -1;
+
+		if ((size_t) len < iov[0].iov_len) {
+			ringbuf_commit(ringbuf, len);
+			return len;
+		}
+
+		if ((size_t) len > avail)
+			return -1;
+	}
+
 	len = vasprintf(&str, format, ap);
 	if (len < 0)
 		return -1;
@@ -267,43 +439,24 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 
 ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd)
 {
-	size_t avail, offset, end;
 	struct iovec iov[2];
 	ssize_t consumed;
+	int cnt;
 
 	if (!ringbuf || fd < 0)
 		return -1;
 
-	/* Determine how much can actually be consumed */
-	avail = ringbuf->size - ringbuf->in + ringbuf->out;
-	if (!avail)
+	/* Determine where data can be consumed into, wrapping if needed */
+	cnt = get_iov(ringbuf, ringbuf->in,
+				ringbuf->size - ringbuf->in + ringbuf->out, iov);
+	if (!cnt)
 		return -1;
 
-	/* Determine how much to consume before wrapping */
-	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN(avail, ringbuf->size - offset);
-
-	iov[0].iov_base = ringbuf->buffer + offset;
-	iov[0].iov_len = end;
-
-	/* Now put the remainder into the second vector */
-	iov[1].iov_base = ringbuf->buffer;
-	iov[1].iov_len = avail - end;
-
-	consumed = readv(fd, iov, 2);
+	consumed = readv(fd, iov, cnt);
 	if (consumed < 0)
 		return -1;
 
-	if (ringbuf->in_tracing) {
-		size_t len = MIN((size_t) consumed, end);
-		ringbuf->in_tracing(ringbuf->buffer + offset, len,
-							ringbuf->in_data);
-		if (consumed - len > 0)
-			ringbuf->in_tracing(ringbuf->buffer, consumed - len,
-							ringbuf->in_data);
-	}
-
-	ringbuf->in += consumed;
+	ringbuf_commit(ringbuf, consumed);
 
 	return consumed;
 }
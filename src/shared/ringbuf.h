@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 typedef void (*ringbuf_tracing_func_t)(const void *buf, size_t count,
 							void *user_data);
@@ -31,6 +32,7 @@ typedef void (*ringbuf_tracing_func_t)(const void *buf, size_t count,
 struct ringbuf;
 
 struct ringbuf *ringbuf_new(size_t size);
+struct ringbuf *ringbuf_new_mirrored(size_t size);
 void ringbuf_free(struct ringbuf *ringbuf);
 
 bool ringbuf_set_input_tracing(struct ringbuf *ringbuf,
@@ -42,9 +44,12 @@ size_t ringbuf_len(struct ringbuf *ringbuf);
 size_t ringbuf_drain(struct ringbuf *ringbuf, size_t count);
 void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap);
 ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd);
+int ringbuf_get_data_iov(struct ringbuf *ringbuf, struct iovec iov[2]);
 
 size_t ringbuf_avail(struct ringbuf *ringbuf);
 int ringbuf_printf(struct ringbuf *ringbuf, const char *format, ...)
 					__attribute__((format(printf, 2, 3)));
 int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap);
 ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd);
+int ringbuf_get_space_iov(struct ringbuf *ringbuf, struct iovec iov[2]);
+size_t ringbuf_commit(struct ringbuf *ringbuf, size_t count);
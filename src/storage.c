@@ -32,6 +32,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <time.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -43,6 +45,7 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "log.h"
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
@@ -50,6 +53,19 @@
 /* When all services should trust a remote device */
 #define GLOBAL_TRUST "[all]"
 
+/* Seconds a modified key file is kept in memory before being written */
+#define STORAGE_FLUSH_TIMEOUT 5
+
+struct stored_file {
+	char *filename;
+	GKeyFile *key_file;
+	GByteArray *data;	/* Contents of a binary file instead */
+	bool dirty;
+};
+
+static GHashTable *stored_files = NULL;
+static guint flush_id = 0;
+
 struct match {
 	GSList *keys;
 	char *pattern;
@@ -196,3 +212,214 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+static void stored_file_free(gpointer data)
+{
+	struct stored_file *file = data;
+
+	if (file->key_file)
+		g_key_file_free(file->key_file);
+
+	if (file->data)
+		g_byte_array_free(file->data, TRUE);
+
+	g_free(file->filename);
+	g_free(file);
+}
+
+static void stored_file_write(struct stored_file *file)
+{
+	GError *gerr = NULL;
+	const char *contents;
+	char *data = NULL;
+	gsize length = 0;
+
+	if (!file->dirty)
+		return;
+
+	file->dirty = false;
+
+	if (file->data) {
+		contents = (const char *) file->data->data;
+		length = file->data->len;
+	} else {
+		data = g_key_file_to_data(file->key_file, &length, NULL);
+		contents = data;
+	}
+
+	/* A key file left without any group holds nothing worth keeping */
+	if (length == 0) {
+		if (unlink(file->filename) < 0 && errno != ENOENT)
+			error("Unable to remove %s: %s (%d)", file->filename,
+							strerror(errno), errno);
+		goto done;
+	}
+
+	create_file(file->filename, S_IRUSR | S_IWUSR);
+
+	if (!g_file_set_contents(file->filename, contents, length, &gerr)) {
+		error("Unable to write %s: %s", file->filename, gerr->message);
+		g_error_free(gerr);
+	}
+
+done:
+
+	g_free(data);
+}
+
+static gboolean path_match(const char *filename, const char *path)
+{
+	size_t len;
+
+	if (!path)
+		return TRUE;
+
+	len = strlen(path);
+
+	if (strncmp(filename, path, len))
+		return FALSE;
+
+	return filename[len] == '\0' || filename[len] == '/';
+}
+
+static gboolean sync_file(gpointer key, gpointer value, gpointer user_data)
+{
+	struct stored_file *file = value;
+
+	if (!path_match(file->filename, user_data))
+		return FALSE;
+
+	stored_file_write(file);
+
+	return TRUE;
+}
+
+static gboolean drop_file(gpointer key, gpointer value, gpointer user_data)
+{
+	struct stored_file *file = value;
+
+	return path_match(file->filename, user_data);
+}
+
+static gboolean flush_timeout(gpointer user_data)
+{
+	flush_id = 0;
+
+	/*
+	 * Write out everything that was modified and drop all entries so
+	 * the cache only holds the files used within the last interval.
+	 */
+	g_hash_table_foreach_remove(stored_files, sync_file, NULL);
+
+	return FALSE;
+}
+
+static void schedule_flush(void)
+{
+	if (flush_id > 0)
+		return;
+
+	flush_id = g_timeout_add_seconds(STORAGE_FLUSH_TIMEOUT, flush_timeout,
+									NULL);
+}
+
+/*
+ * Return the cached key file for filename, loading it from disk if it is
+ * not cached yet. The key file is owned by the cache and must not be freed
+ * by the caller; use storage_commit_key_file() to have modifications
+ * written out.
+ */
+GKeyFile *storage_get_key_file(const char *filename)
+{
+	struct stored_file *file;
+
+	if (!stored_files)
+		stored_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+							NULL, stored_file_free);
+
+	file = g_hash_table_lookup(stored_files, filename);
+	if (file)
+		return file->key_file;
+
+	file = g_new0(struct stored_file, 1);
+	file->filename = g_strdup(filename);
+	file->key_file = g_key_file_new();
+	g_key_file_load_from_file(file->key_file, filename, 0, NULL);
+
+	g_hash_table_insert(stored_files, file->filename, file);
+
+	schedule_flush();
+
+	return file->key_file;
+}
+
+/* Mark the cached key file as modified so it gets written on next flush */
+void storage_commit_key_file(const char *filename)
+{
+	struct stored_file *file;
+
+	if (!stored_files)
+		return;
+
+	file = g_hash_table_lookup(stored_files, filename);
+	if (!file)
+		return;
+
+	file->dirty = true;
+
+	schedule_flush();
+}
+
+/*
+ * Replace the contents of a binary file and have them written on next
+ * flush, like a committed key file. Use storage_sync_key_file() and
+ * storage_remove_key_file() on filename as for key files.
+ */
+void storage_commit_data_file(const char *filename, const void *data,
+								size_t len)
+{
+	struct stored_file *file;
+
+	if (!stored_files)
+		stored_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+							NULL, stored_file_free);
+
+	file = g_hash_table_lookup(stored_files, filename);
+	if (!file) {
+		file = g_new0(struct stored_file, 1);
+		file->filename = g_strdup(filename);
+		file->data = g_byte_array_new();
+		g_hash_table_insert(stored_files, file->filename, file);
+	}
+
+	if (!file->data)
+		return;
+
+	g_byte_array_set_size(file->data, 0);
+	g_byte_array_append(file->data, data, len);
+	file->dirty = true;
+
+	schedule_flush();
+}
+
+/*
+ * Write out pending modifications of path, or of every file below it when
+ * path is a directory, and drop them from the cache. This must be called
+ * before accessing those files directly. A NULL path syncs everything.
+ */
+void storage_sync_key_file(const char *path)
+{
+	if (!stored_files)
+		return;
+
+	g_hash_table_foreach_remove(stored_files, sync_file, (gpointer) path);
+}
+
+/* Discard cached entries of path, or of every file below it, unwritten */
+void storage_remove_key_file(const char *path)
+{
+	if (!stored_files)
+		return;
+
+	g_hash_table_foreach_remove(stored_files, drop_file, (gpointer) path);
+}
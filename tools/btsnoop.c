@@ -38,7 +38,9 @@
 #include <endian.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
+#include "src/shared/util.h"
 #include "src/shared/btsnoop.h"
 
 struct btsnoop_hdr {
@@ -63,33 +65,6 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 
 static const uint32_t btsnoop_version = 1;
 
-static int create_btsnoop(const char *path)
-{
-	struct btsnoop_hdr hdr;
-	ssize_t written;
-	int fd;
-
-	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
-				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (fd < 0) {
-		perror("failed to output file");
-		return -1;
-	}
-
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(2001);
-
-	written = write(fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		perror("failed to write output header");
-		close(fd);
-		return -1;
-	}
-
-	return fd;
-}
-
 static int open_btsnoop(const char *path, uint32_t *type)
 {
 	struct btsnoop_hdr hdr;
@@ -127,149 +102,194 @@ static int open_btsnoop(const char *path, uint32_t *type)
 	return fd;
 }
 
-#define MAX_MERGE 8
+/* Output index assigned to an index of one input file */
+struct index_map {
+	uint16_t input;
+	uint16_t output;
+};
 
-static void command_merge(const char *output, int argc, char *argv[])
+struct merge_input {
+	unsigned int num;
+	struct btsnoop *btsnoop;
+	struct index_map *map;
+	unsigned int map_len;
+	struct timeval tv;
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t size;
+	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+};
+
+/* Inputs are ordered by the time of their next packet, then by position */
+static bool merge_before(const struct merge_input *a,
+					const struct merge_input *b)
 {
-	struct btsnoop_pkt input_pkt[MAX_MERGE];
-	unsigned char buf[2048];
-	int output_fd, input_fd[MAX_MERGE], num_input = 0;
-	int i, select_input;
-	ssize_t len, written;
-	uint32_t toread, flags;
-	uint16_t index, opcode;
-
-	if (argc > MAX_MERGE) {
-		fprintf(stderr, "only up to %d files allowed\n", MAX_MERGE);
-		return;
-	}
+	if (timercmp(&a->tv, &b->tv, !=))
+		return timercmp(&a->tv, &b->tv, <);
 
-	for (i = 0; i < argc; i++) {
-		uint32_t type;
-		int fd;
+	return a->num < b->num;
+}
 
-		fd = open_btsnoop(argv[i], &type);
-		if (fd < 0)
-			break;
+static void heap_down(struct merge_input **heap, unsigned int len,
+							unsigned int pos)
+{
+	struct merge_input *tmp;
+	unsigned int child;
 
-		if (type != 1002) {
-			fprintf(stderr, "unsupported link data type %u\n",
-									type);
-			close(fd);
+	while ((child = 2 * pos + 1) < len) {
+		if (child + 1 < len && merge_before(heap[child + 1],
+								heap[child]))
+			child++;
+
+		if (!merge_before(heap[child], heap[pos]))
 			break;
-		}
 
-		input_fd[num_input++] = fd;
+		tmp = heap[pos];
+		heap[pos] = heap[child];
+		heap[child] = tmp;
+		pos = child;
 	}
+}
 
-	if (num_input != argc) {
-		fprintf(stderr, "failed to open all input files\n");
-		goto close_input;
+static bool merge_read(struct merge_input *input)
+{
+	return btsnoop_read_hci(input->btsnoop, &input->tv, &input->index,
+				&input->opcode, input->buf, &input->size);
+}
+
+static uint16_t merge_map_index(struct merge_input *input,
+						uint16_t *next_index)
+{
+	unsigned int i;
+
+	/* Packets not bound to a controller keep their special index */
+	if (input->index == 0xffff)
+		return 0xffff;
+
+	for (i = 0; i < input->map_len; i++) {
+		if (input->map[i].input == input->index)
+			return input->map[i].output;
 	}
 
-	output_fd = create_btsnoop(output);
-	if (output_fd < 0)
-		goto close_input;
+	if (*next_index == 0xffff) {
+		fprintf(stderr, "too many controllers\n");
+		exit(EXIT_FAILURE);
+	}
 
-	for (i = 0; i < num_input; i++) {
-		len = read(input_fd[i], &input_pkt[i], BTSNOOP_PKT_SIZE);
-		if (len < 0 || len != BTSNOOP_PKT_SIZE) {
-			close(input_fd[i]);
-			input_fd[i] = -1;
-		}
+	input->map = realloc(input->map, (i + 1) * sizeof(*input->map));
+	if (!input->map) {
+		perror("failed to allocate index map");
+		exit(EXIT_FAILURE);
 	}
 
-next_packet:
-	select_input = -1;
+	input->map[i].input = input->index;
+	input->map[i].output = (*next_index)++;
+	input->map_len++;
+
+	return input->map[i].output;
+}
 
-	for (i = 0; i < num_input; i++) {
-		uint64_t ts;
+#define MERGE_BUFFER_SIZE	(1024 * 1024)
 
-		if (input_fd[i] < 0)
-			continue;
+static void command_merge(const char *output, int argc, char *argv[])
+{
+	struct merge_input *inputs, **heap;
+	struct btsnoop *out;
+	unsigned int num_heap = 0;
+	uint16_t next_index = 0;
+	uint16_t index;
+	uint32_t type;
+	int i;
+
+	inputs = calloc(argc, sizeof(*inputs));
+	heap = calloc(argc, sizeof(*heap));
+	if (!inputs || !heap) {
+		perror("failed to allocate inputs");
+		goto free_inputs;
+	}
 
-		if (select_input < 0) {
-			select_input = i;
-			continue;
+	for (i = 0; i < argc; i++) {
+		struct merge_input *input = &inputs[i];
+
+		input->num = i;
+		input->btsnoop = btsnoop_open(argv[i],
+						BTSNOOP_FLAG_PKLG_SUPPORT);
+		if (!input->btsnoop) {
+			fprintf(stderr, "failed to open %s\n", argv[i]);
+			goto close_input;
 		}
 
-		ts = be64toh(input_pkt[i].ts);
+		type = btsnoop_get_format(input->btsnoop);
 
-		if (ts < be64toh(input_pkt[select_input].ts))
-			select_input = i;
+		switch (type) {
+		case BTSNOOP_FORMAT_HCI:
+		case BTSNOOP_FORMAT_UART:
+			/* Single controller files map in command line order */
+			input->map = new0(struct index_map, 1);
+			input->map[0].output = next_index++;
+			input->map_len = 1;
+			break;
+		case BTSNOOP_FORMAT_MONITOR:
+			/* Controllers are mapped as they show up */
+			break;
+		default:
+			fprintf(stderr, "unsupported link data type %u\n",
+									type);
+			goto close_input;
+		}
 	}
 
-	if (select_input < 0)
-		goto close_output;
+	out = btsnoop_create(output, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	if (!out) {
+		perror("failed to output file");
+		goto close_input;
+	}
 
-	toread = be32toh(input_pkt[select_input].size);
-	flags = be32toh(input_pkt[select_input].flags);
+	btsnoop_set_buffer(out, MERGE_BUFFER_SIZE, 0, true);
 
-	len = read(input_fd[select_input], buf, toread);
-	if (len < 0 || len != (ssize_t) toread) {
-		close(input_fd[select_input]);
-		input_fd[select_input] = -1;
-		goto next_packet;
+	for (i = 0; i < argc; i++) {
+		if (merge_read(&inputs[i]))
+			heap[num_heap++] = &inputs[i];
 	}
 
-	written = htobe32(toread - 1);
-	input_pkt[select_input].size = written;
-	input_pkt[select_input].len = written;
+	for (i = num_heap / 2 - 1; i >= 0; i--)
+		heap_down(heap, num_heap, i);
 
-	switch (buf[0]) {
-	case 0x01:
-		opcode = BTSNOOP_OPCODE_COMMAND_PKT;
-		break;
-	case 0x02:
-		if (flags & 0x01)
-			opcode = BTSNOOP_OPCODE_ACL_RX_PKT;
-		else
-			opcode = BTSNOOP_OPCODE_ACL_TX_PKT;
-		break;
-	case 0x03:
-		if (flags & 0x01)
-			opcode = BTSNOOP_OPCODE_SCO_RX_PKT;
-		else
-			opcode = BTSNOOP_OPCODE_SCO_TX_PKT;
-		break;
-	case 0x04:
-		opcode = BTSNOOP_OPCODE_EVENT_PKT;
-		break;
-	default:
-		goto skip_write;
-	}
+	while (num_heap > 0) {
+		struct merge_input *input = heap[0];
 
-	index = select_input;
-	input_pkt[select_input].flags = htobe32((index << 16) | opcode);
+		/* Packets of unknown H:4 type are dropped */
+		if (input->opcode != 0xffff) {
+			index = merge_map_index(input, &next_index);
 
-	written = write(output_fd, &input_pkt[select_input], BTSNOOP_PKT_SIZE);
-	if (written != BTSNOOP_PKT_SIZE) {
-		fprintf(stderr, "write of packet header failed\n");
-		goto close_output;
-	}
+			if (!btsnoop_write_hci(out, &input->tv, index,
+						input->opcode, 0, input->buf,
+						input->size)) {
+				fprintf(stderr, "write of packet failed\n");
+				break;
+			}
+		}
 
-	written = write(output_fd, buf + 1, toread - 1);
-	if (written != (ssize_t) toread - 1) {
-		fprintf(stderr, "write of packet data failed\n");
-		goto close_output;
-	}
+		if (!merge_read(input))
+			heap[0] = heap[--num_heap];
 
-skip_write:
-	len = read(input_fd[select_input],
-				&input_pkt[select_input], BTSNOOP_PKT_SIZE);
-	if (len < 0 || len != BTSNOOP_PKT_SIZE) {
-		close(input_fd[select_input]);
-		input_fd[select_input] = -1;
+		heap_down(heap, num_heap, 0);
 	}
 
-	goto next_packet;
+	if (!btsnoop_flush(out))
+		fprintf(stderr, "write of packet data failed\n");
 
-close_output:
-	close(output_fd);
+	btsnoop_unref(out);
 
 close_input:
-	for (i = 0; i < num_input; i++)
-		close(input_fd[i]);
+	for (i = 0; i < argc; i++) {
+		btsnoop_unref(inputs[i].btsnoop);
+		free(inputs[i].map);
+	}
+
+free_inputs:
+	free(heap);
+	free(inputs);
 }
 
 static void command_extract_eir(const char *input)
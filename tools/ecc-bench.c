@@ -0,0 +1,213 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "src/shared/ecc.h"
+
+#define MAX_THREADS	64
+
+struct bench {
+	unsigned int count;
+	unsigned int failed;
+	pthread_t thread;
+};
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+				(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void report(const char *label, unsigned int count, double secs)
+{
+	printf("%-24s %8u in %8.3f s  %10.1f ops/s  %8.1f us/op\n",
+				label, count, secs, count / secs,
+				secs * 1e6 / count);
+}
+
+static void *make_keys(void *user_data)
+{
+	struct bench *bench = user_data;
+	uint8_t public_key[64], private_key[32];
+	unsigned int i;
+
+	for (i = 0; i < bench->count; i++) {
+		if (!ecc_make_key(public_key, private_key))
+			bench->failed++;
+	}
+
+	return NULL;
+}
+
+static bool bench_make_key(unsigned int count, unsigned int threads)
+{
+	struct bench bench[MAX_THREADS];
+	struct timespec start;
+	unsigned int i, failed = 0;
+
+	memset(bench, 0, sizeof(bench));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* All threads race for the generator tables on their first key */
+	for (i = 0; i < threads; i++) {
+		bench[i].count = count / threads + (i < count % threads);
+
+		if (pthread_create(&bench[i].thread, NULL, make_keys,
+							&bench[i])) {
+			fprintf(stderr, "Failed to create thread\n");
+			return false;
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(bench[i].thread, NULL);
+		failed += bench[i].failed;
+	}
+
+	report("ecc_make_key", count, elapsed(&start));
+
+	if (failed) {
+		fprintf(stderr, "%u key generations failed\n", failed);
+		return false;
+	}
+
+	return true;
+}
+
+static bool bench_shared_secret(unsigned int count)
+{
+	uint8_t public1[64], public2[64];
+	uint8_t private1[32], private2[32];
+	uint8_t shared1[32], shared2[32];
+	struct timespec start;
+	unsigned int i;
+
+	if (!ecc_make_key(public1, private1) ||
+				!ecc_make_key(public2, private2))
+		return false;
+
+	if (!ecdh_shared_secret(public2, private1, shared2))
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < count; i++) {
+		if (!ecdh_shared_secret(public1, private2, shared1))
+			return false;
+	}
+
+	report("ecdh_shared_secret", count, elapsed(&start));
+
+	if (memcmp(shared1, shared2, sizeof(shared1))) {
+		fprintf(stderr, "Shared secrets are not identical\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void usage(void)
+{
+	printf("ECC benchmark\n"
+		"Usage:\n");
+	printf("\tecc-bench [options]\n");
+	printf("Options:\n"
+		"\t-c, --count <num>      Number of operations (default 1000)\n"
+		"\t-t, --threads <num>    Key generation threads (default 1)\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "count",   required_argument, NULL, 'c' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "version", no_argument,       NULL, 'v' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = 1000;
+	unsigned int threads = 1;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "c:t:vh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'v':
+			printf("%s\n", VERSION);
+			return EXIT_SUCCESS;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 0) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (count < 1 || threads < 1 || threads > MAX_THREADS ||
+							threads > count) {
+		fprintf(stderr, "Invalid count or number of threads\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!bench_make_key(count, threads))
+		return EXIT_FAILURE;
+
+	if (!bench_shared_secret(count))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+
+static char dir_path[32];
+static char trace_path[PATH_MAX];
+static char index_path[PATH_MAX];
+static char old_path[PATH_MAX];
+
+#define PACKET_COUNT	1000
+#define PACKET_SIZE	1000
+#define PACKET_USEC	10000
+
+/* Size of the trace with every record complete up to the given one */
+#define TRACE_SIZE(n)	(16 + (n) * (24 + PACKET_SIZE))
+
+static void test_setup(const void *test_data)
+{
+	strcpy(dir_path, "/tmp/test-btsnoop-XXXXXX");
+
+	if (!mkdtemp(dir_path)) {
+		tester_setup_failed();
+		return;
+	}
+
+	snprintf(trace_path, sizeof(trace_path), "%s/trace", dir_path);
+	snprintf(index_path, sizeof(index_path), "%s/trace.idx", dir_path);
+	snprintf(old_path, sizeof(old_path), "%s/trace.old", dir_path);
+
+	tester_setup_complete();
+}
+
+static void test_teardown(const void *test_data)
+{
+	unlink(trace_path);
+	unlink(index_path);
+	unlink(old_path);
+	rmdir(dir_path);
+
+	tester_teardown_complete();
+}
+
+static void packet_time(unsigned int num, struct timeval *tv)
+{
+	tv->tv_sec = 1500000000 + num / (1000000 / PACKET_USEC);
+	tv->tv_usec = num % (1000000 / PACKET_USEC) * PACKET_USEC;
+}
+
+static void write_packet(struct btsnoop *btsnoop, unsigned int num)
+{
+	uint8_t buf[PACKET_SIZE];
+	struct timeval tv;
+
+	memset(buf, num, sizeof(buf));
+	put_le32(num, buf);
+	packet_time(num, &tv);
+
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_EVENT_PKT,
+							0, buf, sizeof(buf)));
+}
+
+static void create_trace(unsigned int count)
+{
+	struct btsnoop *btsnoop;
+	unsigned int i;
+
+	unlink(trace_path);
+	unlink(index_path);
+
+	btsnoop = btsnoop_create(trace_path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop != NULL);
+
+	for (i = 0; i < count; i++)
+		write_packet(btsnoop, i);
+
+	btsnoop_unref(btsnoop);
+}
+
+/* Returns the number of the next packet, or -1 at the end of the trace */
+static int read_packet(struct btsnoop *btsnoop)
+{
+	struct timeval tv, expect;
+	const void *data;
+	uint16_t index, opcode, size;
+	unsigned int num;
+
+	if (!btsnoop_read_hci_data(btsnoop, &tv, &index, &opcode,
+							&data, &size))
+		return -1;
+
+	g_assert(opcode == BTSNOOP_OPCODE_EVENT_PKT);
+	g_assert(size == PACKET_SIZE);
+
+	num = get_le32(data);
+	packet_time(num, &expect);
+
+	g_assert(!timercmp(&tv, &expect, !=));
+
+	return num;
+}
+
+static void get_mtime(const char *path, struct timespec *ts)
+{
+	struct stat st;
+
+	g_assert(stat(path, &st) == 0);
+
+	*ts = st.st_mtim;
+}
+
+static void test_index(const void *test_data)
+{
+	struct btsnoop *btsnoop;
+	struct timespec mtime1, mtime2;
+	uint8_t buf[PACKET_SIZE];
+	uint16_t index, opcode, size;
+	unsigned long num;
+	struct timeval tv;
+	struct stat st;
+
+	create_trace(PACKET_COUNT);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+
+	g_assert(btsnoop_build_index(btsnoop, index_path));
+	g_assert(btsnoop_get_index_count(btsnoop) == PACKET_COUNT);
+
+	g_assert(stat(index_path, &st) == 0);
+	g_assert(st.st_size == 40 + PACKET_COUNT * 16);
+
+	g_assert(btsnoop_seek_packet(btsnoop, 500));
+	g_assert(read_packet(btsnoop) == 500);
+	g_assert(read_packet(btsnoop) == 501);
+
+	/* The copying reader returns the same packets */
+	g_assert(btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size));
+	g_assert(size == PACKET_SIZE);
+	g_assert(get_le32(buf) == 502);
+
+	g_assert(btsnoop_seek_packet(btsnoop, PACKET_COUNT));
+	g_assert(read_packet(btsnoop) == -1);
+	g_assert(!btsnoop_seek_packet(btsnoop, PACKET_COUNT + 1));
+
+	/* Seeking by time lands on the first packet not older than it */
+	packet_time(250, &tv);
+	tv.tv_usec += PACKET_USEC / 2;
+	g_assert(btsnoop_seek_time(btsnoop, &tv, &num));
+	g_assert(num == 251);
+	g_assert(read_packet(btsnoop) == 251);
+
+	btsnoop_unref(btsnoop);
+
+	/* A matching sidecar index is loaded instead of rebuilt */
+	get_mtime(index_path, &mtime1);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+
+	g_assert(btsnoop_build_index(btsnoop, index_path));
+	g_assert(btsnoop_get_index_count(btsnoop) == PACKET_COUNT);
+
+	get_mtime(index_path, &mtime2);
+	g_assert(mtime1.tv_sec == mtime2.tv_sec &&
+					mtime1.tv_nsec == mtime2.tv_nsec);
+
+	g_assert(btsnoop_seek_packet(btsnoop, PACKET_COUNT - 1));
+	g_assert(read_packet(btsnoop) == PACKET_COUNT - 1);
+
+	btsnoop_unref(btsnoop);
+
+	/* A sidecar of an older trace is replaced */
+	create_trace(PACKET_COUNT / 2);
+	g_assert(rename(trace_path, old_path) == 0);
+	create_trace(PACKET_COUNT);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+	g_assert(btsnoop_build_index(btsnoop, index_path));
+	btsnoop_unref(btsnoop);
+
+	g_assert(rename(old_path, trace_path) == 0);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+	g_assert(btsnoop_build_index(btsnoop, index_path));
+	g_assert(btsnoop_get_index_count(btsnoop) == PACKET_COUNT / 2);
+	btsnoop_unref(btsnoop);
+
+	tester_test_passed();
+}
+
+static void test_truncate(const void *test_data)
+{
+	struct btsnoop *btsnoop;
+	int i, num;
+
+	create_trace(PACKET_COUNT);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+
+	for (i = 0; i < 100; i++)
+		g_assert(read_packet(btsnoop) == i);
+
+	/* Cut the last remaining record in half */
+	g_assert(truncate(trace_path, TRACE_SIZE(500) + PACKET_SIZE / 2) == 0);
+
+	while ((num = read_packet(btsnoop)) >= 0)
+		g_assert(num == i++);
+
+	g_assert(i == 500);
+
+	btsnoop_unref(btsnoop);
+
+	/* Indexing stops at the last complete record as well */
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+
+	g_assert(truncate(trace_path, TRACE_SIZE(250)) == 0);
+
+	g_assert(btsnoop_build_index(btsnoop, NULL));
+	g_assert(btsnoop_get_index_count(btsnoop) == 250);
+
+	btsnoop_unref(btsnoop);
+
+	tester_test_passed();
+}
+
+/* Holds a few records, so most of them go out while writing */
+#define BUFFER_SIZE	(16 * 1024)
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+
+	g_assert(stat(path, &st) == 0);
+
+	return st.st_size;
+}
+
+static void test_buffer(const void *test_data)
+{
+	bool async = GPOINTER_TO_INT(test_data);
+	struct btsnoop *btsnoop;
+	gchar *expect, *contents;
+	gsize expect_len, len;
+	uint8_t buf[PACKET_SIZE];
+	uint16_t index, opcode, size;
+	struct timeval tv, expect_tv;
+	unsigned int i;
+
+	/* What the unbuffered writer produces */
+	create_trace(PACKET_COUNT);
+	g_assert(g_file_get_contents(trace_path, &expect, &expect_len, NULL));
+	unlink(trace_path);
+
+	btsnoop = btsnoop_create(trace_path, 0, 0, BTSNOOP_FORMAT_MONITOR);
+	g_assert(btsnoop != NULL);
+	g_assert(btsnoop_set_buffer(btsnoop, BUFFER_SIZE, 0, async));
+
+	for (i = 0; i < PACKET_COUNT / 2; i++)
+		write_packet(btsnoop, i);
+
+	g_assert(file_size(trace_path) < TRACE_SIZE(PACKET_COUNT / 2));
+
+	g_assert(btsnoop_flush(btsnoop));
+
+	/* In async mode the flush is only handed to the writer thread */
+	if (!async)
+		g_assert(file_size(trace_path) ==
+						TRACE_SIZE(PACKET_COUNT / 2));
+
+	for (; i < PACKET_COUNT; i++)
+		write_packet(btsnoop, i);
+
+	g_assert(file_size(trace_path) < TRACE_SIZE(PACKET_COUNT));
+
+	/* Dropping the last reference writes out what is still buffered */
+	btsnoop_unref(btsnoop);
+
+	g_assert(g_file_get_contents(trace_path, &contents, &len, NULL));
+	g_assert(len == expect_len);
+	g_assert(memcmp(contents, expect, len) == 0);
+
+	g_free(contents);
+	g_free(expect);
+
+	btsnoop = btsnoop_open(trace_path, 0);
+	g_assert(btsnoop != NULL);
+
+	for (i = 0; btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf,
+								&size); i++) {
+		g_assert(opcode == BTSNOOP_OPCODE_EVENT_PKT);
+		g_assert(size == PACKET_SIZE);
+		g_assert(get_le32(buf) == i);
+
+		packet_time(i, &expect_tv);
+		g_assert(!timercmp(&tv, &expect_tv, !=));
+	}
+
+	g_assert(i == PACKET_COUNT);
+
+	btsnoop_unref(btsnoop);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/btsnoop/index", NULL, test_setup, test_index,
+							test_teardown);
+	tester_add("/btsnoop/truncate", NULL, test_setup, test_truncate,
+							test_teardown);
+	tester_add("/btsnoop/buffer/sync", GINT_TO_POINTER(false), test_setup,
+						test_buffer, test_teardown);
+	tester_add("/btsnoop/buffer/async", GINT_TO_POINTER(true), test_setup,
+						test_buffer, test_teardown);
+
+	return tester_run();
+}
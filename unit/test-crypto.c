@@ -30,9 +30,11 @@
 #include "src/shared/tester.h"
 
 #include <string.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 static struct bt_crypto *crypto;
+static struct bt_crypto *software;
 
 static void print_debug(const char *str, void *user_data)
 {
@@ -179,6 +181,124 @@ static const struct test_data test_data_5 = {
 	.key = key_5,
 };
 
+static void test_ah(gconstpointer data)
+{
+	struct bt_crypto *c = *(struct bt_crypto * const *) data;
+	const uint8_t irk[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t r[3] = { 0x94, 0x81, 0x70 };
+	const uint8_t exp[3] = { 0xaa, 0xfb, 0x0d };
+	uint8_t hash[3];
+
+	g_assert(bt_crypto_ah(c, irk, r, hash));
+
+	tester_debug("Result:");
+	util_hexdump(' ', hash, 3, print_debug, NULL);
+
+	g_assert(!memcmp(hash, exp, 3));
+
+	tester_test_passed();
+}
+
+static void test_e_batch(gconstpointer data)
+{
+	struct bt_crypto *c = *(struct bt_crypto * const *) data;
+	uint8_t in[150][16], out[150][16], exp[16];
+	unsigned int i;
+
+	for (i = 0; i < 150; i++)
+		memset(in[i], i, 16);
+
+	g_assert(bt_crypto_e_batch(c, key, (const uint8_t (*)[16]) in, out,
+									150));
+
+	for (i = 0; i < 150; i++) {
+		g_assert(bt_crypto_e(c, key, in[i], exp));
+		g_assert(!memcmp(out[i], exp, 16));
+	}
+
+	tester_test_passed();
+}
+
+/* RFC 4493 test vectors, most significant octet first */
+static const uint8_t cmac_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static const uint8_t cmac_msg[64] = {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+	0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+	0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+	0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+	0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+};
+
+static const struct {
+	size_t len;
+	uint8_t t[16];
+} cmac_vectors[] = {
+	{ 0, { 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28,
+	       0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 } },
+	{ 16, { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44,
+		0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c } },
+	{ 40, { 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30,
+		0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 } },
+	{ 64, { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92,
+		0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe } },
+};
+
+static void swap_block(const uint8_t *src, uint8_t *dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[len - 1 - i] = src[i];
+}
+
+static void test_cmac_batch(gconstpointer data)
+{
+	struct bt_crypto *c = *(struct bt_crypto * const *) data;
+	uint8_t k[16], m[4][64], res[100][16], exp[16];
+	struct iovec iov[100];
+	unsigned int i;
+
+	swap_block(cmac_key, k, 16);
+
+	/* Few messages go through one round trip per message */
+	for (i = 0; i < 4; i++) {
+		swap_block(cmac_msg, m[i], cmac_vectors[i].len);
+		iov[i].iov_base = m[i];
+		iov[i].iov_len = cmac_vectors[i].len;
+	}
+
+	g_assert(bt_crypto_cmac_batch(c, k, iov, res, 4));
+
+	for (i = 0; i < 4; i++) {
+		swap_block(cmac_vectors[i].t, exp, 16);
+		g_assert(!memcmp(res[i], exp, 16));
+	}
+
+	/* Many messages run their chains side by side */
+	for (i = 0; i < 100; i++) {
+		iov[i].iov_base = m[i % 4];
+		iov[i].iov_len = cmac_vectors[i % 4].len;
+	}
+
+	g_assert(bt_crypto_cmac_batch(c, k, iov, res, 100));
+
+	for (i = 0; i < 100; i++) {
+		swap_block(cmac_vectors[i % 4].t, exp, 16);
+		g_assert(!memcmp(res[i], exp, 16));
+	}
+
+	tester_test_passed();
+}
+
 static bool result_compare(const uint8_t exp[12], uint8_t res[12])
 {
 	int i;
@@ -208,6 +328,20 @@ static void test_sign(gconstpointer data)
 	tester_test_passed();
 }
 
+static void test_backend(gconstpointer data)
+{
+	const char *backend = bt_crypto_get_backend(crypto);
+	const char *sw_backend = bt_crypto_get_backend(software);
+
+	tester_debug("Default: %s, software: %s", backend, sw_backend);
+
+	/* Table based AES is never picked without asking for it */
+	g_assert(strcmp(backend, "table"));
+	g_assert(strcmp(sw_backend, "af_alg"));
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -216,8 +350,16 @@ int main(int argc, char *argv[])
 	if (!crypto)
 		return 0;
 
+	software = bt_crypto_new_software();
+	if (!software) {
+		bt_crypto_unref(crypto);
+		return 0;
+	}
+
 	tester_init(&argc, &argv);
 
+	tester_add("/crypto/backend", NULL, NULL, test_backend, NULL);
+
 	tester_add("/crypto/h6", NULL, NULL, test_h6, NULL);
 
 	tester_add("/crypto/sign_att_1", &test_data_1, NULL, test_sign, NULL);
@@ -226,8 +368,19 @@ int main(int argc, char *argv[])
 	tester_add("/crypto/sign_att_4", &test_data_4, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_5", &test_data_5, NULL, test_sign, NULL);
 
+	tester_add("/crypto/ah", &crypto, NULL, test_ah, NULL);
+	tester_add("/crypto/e_batch", &crypto, NULL, test_e_batch, NULL);
+	tester_add("/crypto/cmac_batch", &crypto, NULL, test_cmac_batch, NULL);
+
+	tester_add("/crypto/software/ah", &software, NULL, test_ah, NULL);
+	tester_add("/crypto/software/e_batch", &software, NULL,
+							test_e_batch, NULL);
+	tester_add("/crypto/software/cmac_batch", &software, NULL,
+							test_cmac_batch, NULL);
+
 	exit_status = tester_run();
 
+	bt_crypto_unref(software);
 	bt_crypto_unref(crypto);
 
 	return exit_status;
@@ -0,0 +1,254 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+
+#include "src/shared/tester.h"
+#include "src/device-index.h"
+
+struct btd_device {
+	bdaddr_t bdaddr;
+	bdaddr_t conn_bdaddr;
+};
+
+static void make_addr(bdaddr_t *bdaddr, uint32_t value)
+{
+	memset(bdaddr, 0, sizeof(*bdaddr));
+
+	bdaddr->b[0] = value;
+	bdaddr->b[1] = value >> 8;
+	bdaddr->b[2] = value >> 16;
+	bdaddr->b[5] = 0xc0;
+}
+
+static void device_set(struct device_index *index, struct btd_device *device,
+					const bdaddr_t *bdaddr,
+					const bdaddr_t *conn_bdaddr)
+{
+	bacpy(&device->bdaddr, bdaddr);
+	bacpy(&device->conn_bdaddr, conn_bdaddr);
+
+	/* What btd_adapter_device_addr_changed() does for a device */
+	g_assert(device_index_update(index, device, bdaddr, conn_bdaddr));
+}
+
+static void assert_lookup(struct device_index *index, const bdaddr_t *bdaddr,
+					struct btd_device *first,
+					struct btd_device *second)
+{
+	GSList *list = device_index_lookup(index, bdaddr);
+	unsigned int count = 0;
+
+	if (first)
+		count++;
+
+	if (second)
+		count++;
+
+	g_assert(g_slist_nth_data(list, 0) == first);
+	g_assert(g_slist_nth_data(list, 1) == second);
+	g_assert(g_slist_length(list) == count);
+}
+
+static void test_addr_changed(const void *test_data)
+{
+	struct device_index *index = device_index_new();
+	struct btd_device dev1, dev2, dev3;
+	bdaddr_t rpa1, rpa2, identity;
+
+	make_addr(&rpa1, 1);
+	make_addr(&rpa2, 2);
+	make_addr(&identity, 3);
+
+	/* Found by its resolvable private address, never connected */
+	bacpy(&dev1.bdaddr, &rpa1);
+	bacpy(&dev1.conn_bdaddr, BDADDR_ANY);
+	device_index_add(index, &dev1, &dev1.bdaddr, &dev1.conn_bdaddr);
+
+	assert_lookup(index, &rpa1, &dev1, NULL);
+	assert_lookup(index, BDADDR_ANY, NULL, NULL);
+	g_assert(device_index_count(index) == 1);
+
+	/* Connected and resolved to its identity address */
+	device_set(index, &dev1, &identity, &rpa1);
+
+	assert_lookup(index, &identity, &dev1, NULL);
+	assert_lookup(index, &rpa1, &dev1, NULL);
+
+	/* Reconnected using another private address */
+	device_set(index, &dev1, &identity, &rpa2);
+
+	assert_lookup(index, &identity, &dev1, NULL);
+	assert_lookup(index, &rpa2, &dev1, NULL);
+	assert_lookup(index, &rpa1, NULL, NULL);
+
+	/* Connected using its identity address */
+	device_set(index, &dev1, &identity, &identity);
+
+	assert_lookup(index, &identity, &dev1, NULL);
+	assert_lookup(index, &rpa2, NULL, NULL);
+
+	/* Another device shows up with the address the first one used */
+	bacpy(&dev2.bdaddr, &rpa2);
+	bacpy(&dev2.conn_bdaddr, BDADDR_ANY);
+	device_index_add(index, &dev2, &dev2.bdaddr, &dev2.conn_bdaddr);
+
+	device_set(index, &dev1, &identity, &rpa2);
+
+	assert_lookup(index, &rpa2, &dev2, &dev1);
+	g_assert(device_index_count(index) == 2);
+
+	/* Devices that are not indexed are left alone */
+	g_assert(!device_index_update(index, &dev3, &rpa1, BDADDR_ANY));
+	assert_lookup(index, &rpa1, NULL, NULL);
+	g_assert(device_index_count(index) == 2);
+
+	device_index_remove(index, &dev2);
+
+	assert_lookup(index, &rpa2, &dev1, NULL);
+	g_assert(device_index_count(index) == 1);
+
+	device_index_remove(index, &dev1);
+
+	assert_lookup(index, &rpa2, NULL, NULL);
+	assert_lookup(index, &identity, NULL, NULL);
+	g_assert(device_index_count(index) == 0);
+
+	device_index_free(index);
+
+	tester_test_passed();
+}
+
+/*
+ * Replay a discovery with many devices around, each reported over and
+ * over again, and compare the index against a walk of the device list.
+ * The walk is slow enough that only a sample of the reports goes to it.
+ */
+#define BENCH_DEVICES	5000
+#define BENCH_REPORTS	100000
+#define BENCH_SAMPLE	(BENCH_REPORTS / 100)
+
+static struct btd_device *list_find(GSList *list, const bdaddr_t *bdaddr)
+{
+	for (; list; list = list->next) {
+		struct btd_device *device = list->data;
+
+		if (!bacmp(&device->bdaddr, bdaddr) ||
+				!bacmp(&device->conn_bdaddr, bdaddr))
+			return device;
+	}
+
+	return NULL;
+}
+
+static void test_bench(const void *test_data)
+{
+	struct device_index *index = device_index_new();
+	struct btd_device *devices;
+	GSList *list = NULL;
+	GTimer *timer = g_timer_new();
+	unsigned int i, found = 0;
+	bdaddr_t *reports;
+
+	devices = g_new0(struct btd_device, BENCH_DEVICES);
+	reports = g_new0(bdaddr_t, BENCH_REPORTS);
+
+	for (i = 0; i < BENCH_DEVICES; i++) {
+		make_addr(&devices[i].bdaddr, i);
+
+		/* Every tenth device resolved to an identity address */
+		if (!(i % 10)) {
+			bacpy(&devices[i].conn_bdaddr, &devices[i].bdaddr);
+			make_addr(&devices[i].bdaddr, BENCH_DEVICES + i);
+		}
+
+		device_index_add(index, &devices[i], &devices[i].bdaddr,
+						&devices[i].conn_bdaddr);
+		list = g_slist_prepend(list, &devices[i]);
+	}
+
+	list = g_slist_reverse(list);
+
+	/* Some reports come from devices that are not known yet */
+	for (i = 0; i < BENCH_REPORTS; i++)
+		make_addr(&reports[i], g_random_int_range(0,
+						BENCH_DEVICES * 11 / 10));
+
+	g_timer_start(timer);
+
+	for (i = 0; i < BENCH_REPORTS; i++) {
+		GSList *l = device_index_lookup(index, &reports[i]);
+
+		if (l)
+			found++;
+	}
+
+	tester_debug("Index: %u reports, %u found in %.3f s", BENCH_REPORTS,
+					found, g_timer_elapsed(timer, NULL));
+
+	found = 0;
+	g_timer_start(timer);
+
+	for (i = 0; i < BENCH_SAMPLE; i++) {
+		GSList *l = device_index_lookup(index, &reports[i]);
+		struct btd_device *device = list_find(list, &reports[i]);
+
+		/* Both agree on every report */
+		g_assert(g_slist_nth_data(l, 0) == device);
+		g_assert(g_slist_length(l) <= 1);
+
+		if (device)
+			found++;
+	}
+
+	tester_debug("List: %u reports, %u found in %.3f s", BENCH_SAMPLE,
+					found, g_timer_elapsed(timer, NULL));
+
+	g_slist_free(list);
+	g_free(reports);
+	g_free(devices);
+	g_timer_destroy(timer);
+	device_index_free(index);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/device-index/addr-changed", NULL, NULL,
+						test_addr_changed, NULL);
+	tester_add("/device-index/bench", NULL, NULL, test_bench, NULL);
+
+	return tester_run();
+}
@@ -92,8 +92,19 @@ static int test_sample(uint8_t priv_a[32], uint8_t priv_b[32],
 				uint8_t dhkey[32])
 {
 	uint8_t dhkey_a[32], dhkey_b[32];
+	uint8_t pub[64];
 	int fails = 0;
 
+	if (!ecc_make_public_key(priv_a, pub) || memcmp(pub, pub_a, 64)) {
+		tester_debug("Public key A doesn't match!");
+		fails++;
+	}
+
+	if (!ecc_make_public_key(priv_b, pub) || memcmp(pub, pub_b, 64)) {
+		tester_debug("Public key B doesn't match!");
+		fails++;
+	}
+
 	memset(dhkey_a, 0, sizeof(dhkey_a));
 	ecdh_shared_secret(pub_b, priv_a, dhkey_a);
 
@@ -247,6 +258,25 @@ static void test_sample_3(const void *data)
 	tester_test_passed();
 }
 
+static void test_base(const void *data)
+{
+	uint8_t one[32] = { 0x01 };
+	uint8_t g[64], public[64], private[32], secret[32];
+	int i;
+
+	/* The generator itself, computed through the fixed base tables */
+	g_assert(ecc_make_public_key(one, g));
+
+	/* priv * G through the generic multiplication must agree */
+	for (i = 0; i < PAIR_COUNT; i++) {
+		g_assert(ecc_make_key(public, private));
+		g_assert(ecdh_shared_secret(g, private, secret));
+		g_assert(!memcmp(secret, public, 32));
+	}
+
+	tester_test_passed();
+}
+
 static void test_invalid_pub(const void *data)
 {
 	uint8_t priv_a[32] = {	0xbd, 0x1a, 0x3c, 0xcd, 0xa6, 0xb8, 0x99, 0x58,
@@ -290,6 +320,8 @@ int main(int argc, char *argv[])
 	tester_add("/ecdh/sample/2", NULL, NULL, test_sample_2, NULL);
 	tester_add("/ecdh/sample/3", NULL, NULL, test_sample_3, NULL);
 
+	tester_add("/ecdh/base", NULL, NULL, test_base, NULL);
+
 	tester_add("/ecdh/invalid", NULL, NULL, test_invalid_pub, NULL);
 
 	return tester_run();
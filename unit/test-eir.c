@@ -654,6 +654,64 @@ static const struct test_data uri_beacon_test = {
 	.uuid = uri_beacon_uuid,
 };
 
+/* Take the unchanged report fast path the way update_found_devices() does */
+static bool report_parsed(struct eir_report *last, const uint8_t *data,
+								uint8_t len)
+{
+	struct eir_data eir;
+
+	if (eir_report_match(last, data, len))
+		return false;
+
+	memset(&eir, 0, sizeof(eir));
+	eir_parse(&eir, data, len);
+	eir_data_free(&eir);
+
+	eir_report_set(last, data, len);
+
+	return true;
+}
+
+static void test_report(const void *data)
+{
+	struct eir_report last;
+	uint8_t buf[sizeof(uri_beacon_data)];
+	unsigned int i, parsed = 0;
+
+	memset(&last, 0, sizeof(last));
+	memcpy(buf, uri_beacon_data, sizeof(buf));
+
+	/* A beacon repeating itself is only parsed the first time */
+	for (i = 0; i < 10; i++) {
+		if (report_parsed(&last, buf, sizeof(buf)))
+			parsed++;
+	}
+
+	g_assert_cmpuint(parsed, ==, 1);
+
+	/* Any changed byte is parsed once more */
+	buf[sizeof(buf) - 1] ^= 0x01;
+	g_assert(report_parsed(&last, buf, sizeof(buf)));
+	g_assert(!report_parsed(&last, buf, sizeof(buf)));
+
+	/* So is the same data with a different length */
+	g_assert(report_parsed(&last, buf, sizeof(buf) - 1));
+	g_assert(!report_parsed(&last, buf, sizeof(buf) - 1));
+
+	/* Empty reports can be skipped too */
+	g_assert(report_parsed(&last, NULL, 0));
+	g_assert(!report_parsed(&last, NULL, 0));
+
+	/* Nothing is skipped after the end of discovery clears the report */
+	g_assert(report_parsed(&last, buf, sizeof(buf)));
+	eir_report_clear(&last);
+	g_assert(report_parsed(&last, buf, sizeof(buf)));
+
+	eir_report_clear(&last);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -680,5 +738,7 @@ int main(int argc, char *argv[])
 	tester_add("ad/g-tag", &gigaset_gtag_test, NULL, test_parsing, NULL);
 	tester_add("ad/uri-beacon", &uri_beacon_test, NULL, test_parsing, NULL);
 
+	tester_add("/eir/report", NULL, NULL, test_report, NULL);
+
 	return tester_run();
 }
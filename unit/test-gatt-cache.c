@@ -0,0 +1,252 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/tester.h"
+#include "src/gatt-cache.h"
+
+/* Roughly what a device with many vendor services exposes */
+#define DB_SERVICES	40
+#define BENCH_LOADS	200
+
+static void write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	g_assert(!err);
+}
+
+static void add_uuid(bt_uuid_t *uuid, unsigned int num)
+{
+	uint128_t u128;
+
+	/* Every other one is a 128-bit vendor UUID */
+	if (num % 2) {
+		bt_uuid16_create(uuid, 0x1800 + num);
+		return;
+	}
+
+	memset(&u128, num, sizeof(u128));
+	bt_uuid128_create(uuid, u128);
+}
+
+static struct gatt_db *create_db(void)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct gatt_db_attribute *service, *prev = NULL, *att;
+	uint16_t cep = 0x0001;
+	bt_uuid_t uuid, desc;
+	unsigned int i, j;
+
+	for (i = 0; i < DB_SERVICES; i++) {
+		add_uuid(&uuid, i);
+
+		/* Every fifth service is a secondary one */
+		service = gatt_db_add_service(db, &uuid, i % 5 != 4, 16);
+		g_assert(service);
+
+		if (prev && i % 4 == 0)
+			g_assert(gatt_db_service_add_included(service, prev));
+
+		for (j = 0; j < 3; j++) {
+			add_uuid(&uuid, i * 3 + j);
+
+			g_assert(gatt_db_service_add_characteristic(service,
+						&uuid, BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ |
+						BT_GATT_CHRC_PROP_NOTIFY |
+						BT_GATT_CHRC_PROP_EXT_PROP,
+						NULL, NULL, NULL));
+
+			bt_uuid16_create(&desc, GATT_CLIENT_CHARAC_CFG_UUID);
+			g_assert(gatt_db_service_add_descriptor(service, &desc,
+						BT_ATT_PERM_READ, NULL, NULL,
+						NULL));
+
+			bt_uuid16_create(&desc, GATT_CHARAC_EXT_PROPER_UUID);
+			att = gatt_db_service_add_descriptor(service, &desc,
+						BT_ATT_PERM_READ, NULL, NULL,
+						NULL);
+			g_assert(att);
+			g_assert(gatt_db_attribute_write(att, 0,
+						(uint8_t *) &cep, sizeof(cep),
+						0, NULL, write_cb, NULL));
+		}
+
+		gatt_db_service_set_active(service, true);
+		prev = service;
+	}
+
+	return db;
+}
+
+static GKeyFile *store_text(struct gatt_db *db, char **data, gsize *len)
+{
+	GKeyFile *key_file = g_key_file_new();
+
+	gatt_cache_store_text(db, key_file);
+
+	if (data)
+		*data = g_key_file_to_data(key_file, len, NULL);
+
+	return key_file;
+}
+
+static void assert_same_db(struct gatt_db *db, GByteArray *expect)
+{
+	GByteArray *cache = gatt_cache_store_binary(db);
+
+	g_assert(cache->len == expect->len);
+	g_assert(!memcmp(cache->data, expect->data, cache->len));
+
+	g_byte_array_free(cache, TRUE);
+}
+
+static void test_round_trip(const void *test_data)
+{
+	struct gatt_db *db = create_db();
+	struct gatt_db *copy;
+	GByteArray *cache;
+	GKeyFile *key_file;
+
+	cache = gatt_cache_store_binary(db);
+
+	/* Both formats give back the database they were stored from */
+	key_file = store_text(db, NULL, NULL);
+	copy = gatt_db_new();
+	g_assert(gatt_cache_load_text(copy, key_file) == 0);
+	assert_same_db(copy, cache);
+	gatt_db_unref(copy);
+	g_key_file_free(key_file);
+
+	copy = gatt_db_new();
+	g_assert(gatt_cache_load_binary(copy, cache->data, cache->len) == 0);
+	assert_same_db(copy, cache);
+	gatt_db_unref(copy);
+
+	/* A key file without attributes has no cache to load */
+	key_file = g_key_file_new();
+	copy = gatt_db_new();
+	g_assert(gatt_cache_load_text(copy, key_file) == -ENOENT);
+	g_assert(gatt_db_isempty(copy));
+
+	/* Truncated or corrupted binary caches are not loaded */
+	g_assert(gatt_cache_load_binary(copy, cache->data,
+						cache->len - 1) == -EINVAL);
+	g_assert(gatt_cache_load_binary(copy, cache->data, 8) == -EINVAL);
+
+	cache->data[cache->len / 2] ^= 0x01;
+	g_assert(gatt_cache_load_binary(copy, cache->data,
+						cache->len) == -EINVAL);
+	g_assert(gatt_db_isempty(copy));
+
+	gatt_db_unref(copy);
+	g_key_file_free(key_file);
+	g_byte_array_free(cache, TRUE);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+/*
+ * Time reloading the same database from either format the way
+ * load_gatt_db() does on reconnect, parsing the key file included.
+ */
+static void test_bench(const void *test_data)
+{
+	struct gatt_db *db = create_db();
+	GTimer *timer = g_timer_new();
+	GByteArray *cache;
+	GKeyFile *key_file;
+	char *text;
+	gsize len;
+	unsigned int i;
+
+	g_key_file_free(store_text(db, &text, &len));
+	cache = gatt_cache_store_binary(db);
+
+	tester_debug("Text cache %zu bytes, binary cache %u bytes", len,
+								cache->len);
+
+	g_timer_start(timer);
+
+	for (i = 0; i < BENCH_LOADS; i++) {
+		struct gatt_db *copy = gatt_db_new();
+
+		key_file = g_key_file_new();
+		g_assert(g_key_file_load_from_data(key_file, text, len, 0,
+								NULL));
+		g_assert(gatt_cache_load_text(copy, key_file) == 0);
+		g_key_file_free(key_file);
+		gatt_db_unref(copy);
+	}
+
+	tester_debug("Text: %u loads in %.3f s", BENCH_LOADS,
+						g_timer_elapsed(timer, NULL));
+
+	g_timer_start(timer);
+
+	for (i = 0; i < BENCH_LOADS; i++) {
+		struct gatt_db *copy = gatt_db_new();
+
+		g_assert(gatt_cache_load_binary(copy, cache->data,
+							cache->len) == 0);
+		gatt_db_unref(copy);
+	}
+
+	tester_debug("Binary: %u loads in %.3f s", BENCH_LOADS,
+						g_timer_elapsed(timer, NULL));
+
+	g_byte_array_free(cache, TRUE);
+	g_free(text);
+	g_timer_destroy(timer);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-cache/round-trip", NULL, NULL, test_round_trip,
+									NULL);
+	tester_add("/gatt-cache/bench", NULL, NULL, test_bench, NULL);
+
+	return tester_run();
+}
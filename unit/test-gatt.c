@@ -30,6 +30,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 
@@ -2105,6 +2106,448 @@ static void test_read_by_type(gconstpointer data)
 					read_by_type_cb, context, NULL));
 }
 
+struct db_count {
+	unsigned int count;
+	uint16_t start, end;
+};
+
+static void count_service(struct gatt_db_attribute *attrib, void *user_data)
+{
+	struct db_count *count = user_data;
+	uint16_t handle = gatt_db_attribute_get_handle(attrib);
+
+	g_assert(handle >= count->start && handle <= count->end);
+
+	count->count++;
+}
+
+/*
+ * Fill the whole handle space with small services, each holding a single
+ * characteristic, and time range queries against it.
+ */
+#define DB_SERVICE_HANDLES	3
+#define DB_SERVICES		(UINT16_MAX / DB_SERVICE_HANDLES)
+#define DB_WINDOW		(100 * DB_SERVICE_HANDLES)
+
+static void test_db_range_query(gconstpointer data)
+{
+	struct gatt_db *db = gatt_db_new();
+	struct gatt_db_attribute *attrib;
+	struct queue *queue = queue_new();
+	struct db_count count;
+	bt_uuid_t svc_uuid, chrc_uuid, primary_uuid;
+	unsigned int i, start;
+	GTimer *timer;
+
+	bt_uuid16_create(&svc_uuid, 0x180f);
+	bt_uuid16_create(&chrc_uuid, 0x2a19);
+	bt_uuid16_create(&primary_uuid, GATT_PRIM_SVC_UUID);
+
+	timer = g_timer_new();
+
+	for (i = 0; i < DB_SERVICES; i++) {
+		attrib = gatt_db_add_service(db, &svc_uuid, true,
+							DB_SERVICE_HANDLES);
+		g_assert(attrib);
+
+		g_assert(gatt_db_service_add_characteristic(attrib,
+						&chrc_uuid, BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+
+		gatt_db_service_set_active(attrib, true);
+	}
+
+	tester_debug("Populated %u services in %.3f s", DB_SERVICES,
+					g_timer_elapsed(timer, NULL));
+	g_timer_start(timer);
+
+	/* Every handle resolves to the service covering it */
+	for (i = 1; i <= DB_SERVICES * DB_SERVICE_HANDLES; i++) {
+		attrib = gatt_db_get_attribute(db, i);
+		g_assert(attrib);
+		g_assert_cmpint(gatt_db_attribute_get_handle(attrib), ==, i);
+	}
+
+	tester_debug("Looked up %u handles in %.3f s",
+					DB_SERVICES * DB_SERVICE_HANDLES,
+					g_timer_elapsed(timer, NULL));
+	g_timer_start(timer);
+
+	/* Each service range holds exactly one characteristic value */
+	for (start = 1; start < DB_SERVICES * DB_SERVICE_HANDLES;
+						start += DB_SERVICE_HANDLES) {
+		gatt_db_read_by_type(db, start, start + DB_SERVICE_HANDLES - 1,
+							chrc_uuid, queue);
+		g_assert_cmpint(queue_length(queue), ==, 1);
+		queue_remove_all(queue, NULL, NULL, NULL);
+	}
+
+	tester_debug("Read %u service ranges by type in %.3f s", DB_SERVICES,
+					g_timer_elapsed(timer, NULL));
+	g_timer_start(timer);
+
+	/* Windows sliding over the database each see the same services */
+	for (start = 1; start <= UINT16_MAX - DB_WINDOW;
+						start += DB_SERVICE_HANDLES) {
+		count.count = 0;
+		count.start = start;
+		count.end = start + DB_WINDOW - 1;
+
+		gatt_db_find_by_type(db, count.start, count.end,
+					&primary_uuid, count_service, &count);
+		g_assert_cmpint(count.count, ==,
+					DB_WINDOW / DB_SERVICE_HANDLES);
+	}
+
+	tester_debug("Found services in %u windows in %.3f s",
+			(UINT16_MAX - DB_WINDOW) / DB_SERVICE_HANDLES + 1,
+			g_timer_elapsed(timer, NULL));
+
+	gatt_db_read_by_group_type(db, 1, UINT16_MAX, primary_uuid, queue);
+	g_assert_cmpint(queue_length(queue), ==, DB_SERVICES);
+
+	g_timer_destroy(timer);
+	queue_destroy(queue, NULL);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+#define ATT_BURST		40
+#define ATT_READ_BATCH		16  /* ATT_MAX_READ_BATCH of bt_att */
+
+struct att_burst {
+	struct bt_att *att;
+	int fd;
+	unsigned int sent;
+	unsigned int count;
+	GTimer *timer;
+};
+
+static struct att_burst *att_burst_new(void)
+{
+	struct att_burst *burst = g_new0(struct att_burst, 1);
+	int sv[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+								sv) == 0);
+
+	burst->att = bt_att_new(sv[0], false);
+	g_assert(burst->att);
+
+	bt_att_set_close_on_unref(burst->att, true);
+	bt_att_set_debug(burst->att, print_debug, "bt_att:", NULL);
+
+	burst->fd = sv[1];
+	burst->timer = g_timer_new();
+
+	return burst;
+}
+
+static gboolean att_burst_done(gpointer user_data)
+{
+	struct att_burst *burst = user_data;
+
+	bt_att_unref(burst->att);
+
+	if (burst->fd >= 0)
+		close(burst->fd);
+
+	g_timer_destroy(burst->timer);
+	g_free(burst);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+static void att_burst_notify(uint8_t opcode, const void *pdu,
+					uint16_t length, void *user_data)
+{
+	struct att_burst *burst = user_data;
+	unsigned int wakeups, pdus;
+
+	g_assert_cmpint(length, ==, 3);
+	g_assert_cmpint(get_le16(pdu), ==, 0x0003);
+	g_assert_cmpint(((const uint8_t *) pdu)[2], ==, burst->count);
+
+	if (++burst->count < ATT_BURST)
+		return;
+
+	/* The whole burst was queued before the first wakeup */
+	g_assert(bt_att_get_read_stats(burst->att, &wakeups, &pdus));
+	g_assert_cmpint(pdus, ==, ATT_BURST);
+	g_assert_cmpint(wakeups, ==,
+			(ATT_BURST + ATT_READ_BATCH - 1) / ATT_READ_BATCH);
+
+	g_idle_add(att_burst_done, burst);
+}
+
+static void test_att_read_batch(gconstpointer data)
+{
+	struct att_burst *burst = att_burst_new();
+	uint8_t pdu[4];
+	unsigned int i;
+
+	g_assert(bt_att_register(burst->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					att_burst_notify, burst, NULL));
+
+	pdu[0] = BT_ATT_OP_HANDLE_VAL_NOT;
+	put_le16(0x0003, pdu + 1);
+
+	for (i = 0; i < ATT_BURST; i++) {
+		pdu[3] = i;
+		g_assert(write(burst->fd, pdu, sizeof(pdu)) == sizeof(pdu));
+	}
+}
+
+#define ATT_WRITE_BURST		1000
+
+static gboolean att_burst_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct att_burst *burst = user_data;
+	uint8_t buf[8];
+	ssize_t len;
+
+	g_assert(!(cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)));
+
+	while ((len = recv(burst->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		g_assert_cmpint(len, ==, 5);
+		g_assert_cmpint(buf[0], ==, BT_ATT_OP_HANDLE_VAL_NOT);
+		g_assert_cmpint(get_le16(buf + 1), ==, 0x0003);
+		g_assert_cmpint(get_le16(buf + 3), ==, burst->count);
+
+		if (++burst->count == ATT_WRITE_BURST) {
+			tester_debug("Received %u notifications in %.3f s",
+					burst->count,
+					g_timer_elapsed(burst->timer, NULL));
+			g_idle_add(att_burst_done, burst);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+#define ATT_EOF_BURST		3
+
+static void att_eof_notify(uint8_t opcode, const void *pdu,
+					uint16_t length, void *user_data)
+{
+	struct att_burst *burst = user_data;
+
+	g_assert_cmpint(length, ==, 3);
+	g_assert_cmpint(((const uint8_t *) pdu)[2], ==, burst->count);
+
+	burst->count++;
+}
+
+static void att_eof_disconnect(int err, void *user_data)
+{
+	struct att_burst *burst = user_data;
+	unsigned int wakeups, pdus;
+
+	/* The end of the stream must not be taken for another PDU */
+	g_assert(bt_att_get_read_stats(burst->att, &wakeups, &pdus));
+	g_assert_cmpint(burst->count, ==, ATT_EOF_BURST);
+	g_assert_cmpint(pdus, ==, ATT_EOF_BURST);
+
+	g_idle_add(att_burst_done, burst);
+}
+
+static void test_att_read_eof(gconstpointer data)
+{
+	struct att_burst *burst = att_burst_new();
+	uint8_t pdu[4];
+	unsigned int i;
+
+	g_assert(bt_att_register(burst->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					att_eof_notify, burst, NULL));
+	g_assert(bt_att_register_disconnect(burst->att, att_eof_disconnect,
+								burst, NULL));
+
+	pdu[0] = BT_ATT_OP_HANDLE_VAL_NOT;
+	put_le16(0x0003, pdu + 1);
+
+	for (i = 0; i < ATT_EOF_BURST; i++) {
+		pdu[3] = i;
+		g_assert(write(burst->fd, pdu, sizeof(pdu)) == sizeof(pdu));
+	}
+
+	/* The peer hangs up right after its last PDU */
+	close(burst->fd);
+	burst->fd = -1;
+}
+
+static void test_att_write_batch(gconstpointer data)
+{
+	struct att_burst *burst = att_burst_new();
+	GIOChannel *channel;
+	uint8_t pdu[4];
+	unsigned int i;
+	int size = 1;
+
+	/*
+	 * The burst is far larger than the socket queue, so most batches are
+	 * only sent in part and the rest has to go out in order later.
+	 */
+	g_assert(setsockopt(bt_att_get_fd(burst->att), SOL_SOCKET, SO_SNDBUF,
+						&size, sizeof(size)) == 0);
+
+	put_le16(0x0003, pdu);
+
+	for (i = 0; i < ATT_WRITE_BURST; i++) {
+		put_le16(i, pdu + 2);
+		g_assert(bt_att_send(burst->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					pdu, sizeof(pdu), NULL, NULL, NULL));
+	}
+
+	channel = g_io_channel_unix_new(burst->fd);
+	g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+						att_burst_read, burst);
+	g_io_channel_unref(channel);
+}
+
+struct att_order {
+	struct att_burst *burst;
+	unsigned int ids[5];
+	char seen[16];
+	unsigned int len;
+};
+
+/* Handlers fire by registration id, not by how they were looked up */
+#define ATT_ORDER_EXPECTED	"ABCDEADA"
+
+static const struct {
+	uint8_t opcode;
+	char tag;
+} att_order_regs[] = {
+	{ BT_ATT_ALL_REQUESTS, 'A' },
+	{ BT_ATT_OP_WRITE_CMD, 'B' },
+	{ BT_ATT_ALL_REQUESTS, 'C' },
+	{ BT_ATT_OP_WRITE_CMD, 'D' },
+	{ BT_ATT_OP_HANDLE_VAL_NOT, 'E' },
+};
+
+static struct att_order att_order;
+
+static void att_order_notify(uint8_t opcode, const void *pdu,
+					uint16_t length, void *user_data)
+{
+	struct att_order *order = &att_order;
+	char tag = GPOINTER_TO_UINT(user_data);
+
+	order->seen[order->len++] = tag;
+
+	/* Unregistering in the middle of the stream must take effect */
+	if (tag == 'E')
+		g_assert(bt_att_unregister(order->burst->att, order->ids[1]));
+
+	/* So must unregistering the handler that is up next */
+	if (tag == 'A' && order->len > 1 && order->seen[order->len - 2] == 'E')
+		g_assert(bt_att_unregister(order->burst->att, order->ids[2]));
+
+	if (order->len < strlen(ATT_ORDER_EXPECTED))
+		return;
+
+	g_assert_cmpstr(order->seen, ==, ATT_ORDER_EXPECTED);
+
+	g_idle_add(att_burst_done, order->burst);
+}
+
+static void test_att_dispatch_order(gconstpointer data)
+{
+	struct att_order *order = &att_order;
+	static const uint8_t write_cmd[] = { BT_ATT_OP_WRITE_CMD,
+							0x03, 0x00, 0x01 };
+	static const uint8_t write_req[] = { BT_ATT_OP_WRITE_REQ,
+							0x03, 0x00, 0x01 };
+	static const uint8_t notify[] = { BT_ATT_OP_HANDLE_VAL_NOT,
+							0x03, 0x00, 0x01 };
+	unsigned int i;
+
+	memset(order, 0, sizeof(*order));
+	order->burst = att_burst_new();
+
+	for (i = 0; i < G_N_ELEMENTS(att_order_regs); i++) {
+		order->ids[i] = bt_att_register(order->burst->att,
+					att_order_regs[i].opcode,
+					att_order_notify,
+					GUINT_TO_POINTER(att_order_regs[i].tag),
+					NULL);
+		g_assert(order->ids[i]);
+	}
+
+	g_assert(write(order->burst->fd, write_cmd, 4) == 4);
+	g_assert(write(order->burst->fd, notify, 4) == 4);
+	g_assert(write(order->burst->fd, write_cmd, 4) == 4);
+	g_assert(write(order->burst->fd, write_req, 4) == 4);
+}
+
+#define ATT_DISPATCH_COUNT	10000
+
+static gboolean att_burst_write(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct att_burst *burst = user_data;
+	static const uint8_t pdu[] = { BT_ATT_OP_HANDLE_VAL_NOT,
+							0x03, 0x00, 0x01 };
+
+	g_assert(!(cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)));
+
+	while (burst->sent < ATT_DISPATCH_COUNT) {
+		if (send(burst->fd, pdu, sizeof(pdu), MSG_DONTWAIT) < 0) {
+			g_assert(errno == EAGAIN);
+			return TRUE;
+		}
+
+		burst->sent++;
+	}
+
+	return FALSE;
+}
+
+static void att_dispatch_notify(uint8_t opcode, const void *pdu,
+					uint16_t length, void *user_data)
+{
+	struct att_burst *burst = user_data;
+
+	if (++burst->count < ATT_DISPATCH_COUNT)
+		return;
+
+	tester_debug("Dispatched %u notifications in %.3f s", burst->count,
+					g_timer_elapsed(burst->timer, NULL));
+
+	g_idle_add(att_burst_done, burst);
+}
+
+static void test_att_dispatch(gconstpointer data)
+{
+	unsigned int regs = GPOINTER_TO_UINT(data);
+	struct att_burst *burst = att_burst_new();
+	static const uint8_t opcodes[] = { BT_ATT_ALL_REQUESTS,
+					BT_ATT_OP_WRITE_CMD, BT_ATT_OP_READ_REQ,
+					BT_ATT_OP_HANDLE_VAL_IND };
+	GIOChannel *channel;
+	unsigned int i;
+
+	/* Only one of the registrations matches the notifications */
+	for (i = 1; i < regs; i++)
+		g_assert(bt_att_register(burst->att,
+					opcodes[i % G_N_ELEMENTS(opcodes)],
+					att_dispatch_notify, NULL, NULL));
+
+	g_assert(bt_att_register(burst->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					att_dispatch_notify, burst, NULL));
+
+	channel = g_io_channel_unix_new(burst->fd);
+	g_io_add_watch(channel, G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+						att_burst_write, burst);
+	g_io_channel_unref(channel);
+}
+
 static void test_long_read(struct context *context)
 {
 	const struct test_step *step = context->data->step;
@@ -2330,10 +2773,50 @@ static const struct test_step test_indication_server_1 = {
 	.length = 0x03,
 };
 
+/*
+ * Toggle a Battery Service right after the last one of the database so the
+ * next discovery request has to see it appear or go away.
+ */
+#define RSP_CACHE_HANDLE	0x0009
+
+static void test_server_toggle_service(struct context *context)
+{
+	struct gatt_db_attribute *attr;
+	bt_uuid_t uuid;
+
+	attr = gatt_db_get_attribute(context->server_db, RSP_CACHE_HANDLE);
+	if (attr) {
+		g_assert(gatt_db_remove_service(context->server_db, attr));
+		context_process(context);
+		return;
+	}
+
+	bt_uuid16_create(&uuid, 0x180f);
+	attr = gatt_db_add_service(context->server_db, &uuid, true, 4);
+	g_assert(attr);
+	g_assert_cmpint(gatt_db_attribute_get_handle(attr), ==,
+							RSP_CACHE_HANDLE);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	g_assert(gatt_db_service_add_characteristic(attr, &uuid,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+
+	gatt_db_service_set_active(attr, true);
+
+	context_process(context);
+}
+
+static const struct test_step test_rsp_cache = {
+	.func = test_server_toggle_service,
+};
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
 	struct gatt_db *ts_small_db, *ts_large_db_1;
+	struct gatt_db *rsp_cache_db_1, *rsp_cache_db_2;
 
 	tester_init(&argc, &argv);
 
@@ -2342,6 +2825,8 @@ int main(int argc, char *argv[])
 	service_db_3 = make_service_data_3_db();
 	ts_small_db = make_test_spec_small_db();
 	ts_large_db_1 = make_test_spec_large_db_1();
+	rsp_cache_db_1 = make_service_data_1_db();
+	rsp_cache_db_2 = make_service_data_1_db();
 
 	/*
 	 * Server Configuration
@@ -4459,6 +4944,69 @@ int main(int argc, char *argv[])
 			raw_pdu(0x18, 0x01),
 			raw_pdu(0x01, 0x18, 0x25, 0x00, 0x06));
 
+	tester_add("/gatt-db/range-query", NULL, NULL, test_db_range_query,
+									NULL);
+
+	tester_add("/att/read-batch", NULL, NULL, test_att_read_batch, NULL);
+	tester_add("/att/read-eof", NULL, NULL, test_att_read_eof, NULL);
+	tester_add("/att/write-batch", NULL, NULL, test_att_write_batch, NULL);
+	tester_add("/att/dispatch-order", NULL, NULL, test_att_dispatch_order,
+									NULL);
+	tester_add("/att/dispatch/1", GUINT_TO_POINTER(1), NULL,
+						test_att_dispatch, NULL);
+	tester_add("/att/dispatch/10", GUINT_TO_POINTER(10), NULL,
+						test_att_dispatch, NULL);
+	tester_add("/att/dispatch/100", GUINT_TO_POINTER(100), NULL,
+						test_att_dispatch, NULL);
+
+	/*
+	 * Cached discovery responses
+	 *
+	 * Repeat a discovery request, then add and remove a service and check
+	 * the next response follows the database instead of the cache.
+	 */
+	define_test_server("/gatt/server/rsp-cache/read-by-group",
+			test_server, rsp_cache_db_1, &test_rsp_cache,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x04, 0x00, 0x01, 0x18,
+					0x05, 0x00, 0x08, 0x00, 0x0d, 0x18),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x04, 0x00, 0x01, 0x18,
+					0x05, 0x00, 0x08, 0x00, 0x0d, 0x18),
+			raw_pdu(),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x04, 0x00, 0x01, 0x18,
+					0x05, 0x00, 0x08, 0x00, 0x0d, 0x18,
+					0x09, 0x00, 0x0c, 0x00, 0x0f, 0x18),
+			raw_pdu(),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x04, 0x00, 0x01, 0x18,
+					0x05, 0x00, 0x08, 0x00, 0x0d, 0x18));
+
+	define_test_server("/gatt/server/rsp-cache/read-by-type",
+			test_server, rsp_cache_db_2, &test_rsp_cache,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,
+					0x2a, 0x06, 0x00, 0x0a, 0x07, 0x00,
+					0x29, 0x2a),
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,
+					0x2a, 0x06, 0x00, 0x0a, 0x07, 0x00,
+					0x29, 0x2a),
+			raw_pdu(),
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,
+					0x2a, 0x06, 0x00, 0x0a, 0x07, 0x00,
+					0x29, 0x2a, 0x0a, 0x00, 0x02, 0x0b,
+					0x00, 0x19, 0x2a),
+			raw_pdu(),
+			raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),
+			raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,
+					0x2a, 0x06, 0x00, 0x0a, 0x07, 0x00,
+					0x29, 0x2a));
+
 	define_test_server("/robustness/unkown-request",
 			test_server, service_db_1, NULL,
 			raw_pdu(0x03, 0x00, 0x02),
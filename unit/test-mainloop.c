@@ -0,0 +1,321 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "src/shared/mainloop.h"
+#include "src/shared/tester.h"
+
+/* Far more than the 128 entries the fd table starts with */
+#define PIPE_COUNT	300
+
+struct pipe_data {
+	int fds[2];
+	unsigned int fired;
+	bool destroyed;
+};
+
+static struct pipe_data pipes[PIPE_COUNT];
+static unsigned int pipes_fired;
+
+static void pipe_destroy(void *user_data)
+{
+	struct pipe_data *data = user_data;
+
+	data->destroyed = true;
+}
+
+static void pipe_callback(int fd, uint32_t events, void *user_data)
+{
+	struct pipe_data *data = user_data;
+	char c;
+
+	g_assert(fd == data->fds[0]);
+	g_assert(events & EPOLLIN);
+	g_assert(read(fd, &c, 1) == 1);
+
+	data->fired++;
+
+	g_assert(mainloop_remove_fd(fd) == 0);
+	g_assert(data->destroyed);
+
+	if (++pipes_fired == PIPE_COUNT)
+		mainloop_quit();
+}
+
+static void test_fds(const void *test_data)
+{
+	struct rlimit rlim;
+	unsigned int i;
+	int max_fd = 0;
+
+	g_assert(getrlimit(RLIMIT_NOFILE, &rlim) == 0);
+
+	if (rlim.rlim_cur < PIPE_COUNT * 2 + 64) {
+		tester_test_abort();
+		return;
+	}
+
+	mainloop_init();
+
+	memset(pipes, 0, sizeof(pipes));
+	pipes_fired = 0;
+
+	for (i = 0; i < PIPE_COUNT; i++) {
+		g_assert(pipe(pipes[i].fds) == 0);
+
+		g_assert(mainloop_add_fd(pipes[i].fds[0], EPOLLIN,
+						pipe_callback, &pipes[i],
+						pipe_destroy) == 0);
+
+		if (pipes[i].fds[0] > max_fd)
+			max_fd = pipes[i].fds[0];
+	}
+
+	g_assert(max_fd >= PIPE_COUNT * 2);
+
+	/* Make every fd ready at once before the loop starts */
+	for (i = 0; i < PIPE_COUNT; i++)
+		g_assert(write(pipes[i].fds[1], "x", 1) == 1);
+
+	g_assert(mainloop_run() == EXIT_SUCCESS);
+
+	for (i = 0; i < PIPE_COUNT; i++) {
+		g_assert(pipes[i].fired == 1);
+
+		close(pipes[i].fds[0]);
+		close(pipes[i].fds[1]);
+	}
+
+	tester_test_passed();
+}
+
+struct timer_data {
+	unsigned int msec;
+	int id;
+	unsigned int fired;
+	bool destroyed;
+};
+
+static struct timespec timer_start;
+static unsigned int timers_pending;
+static unsigned int timer_late;
+
+static unsigned int timer_elapsed(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - timer_start.tv_sec) * 1000 +
+			(now.tv_nsec - timer_start.tv_nsec) / 1000000;
+}
+
+static void timer_destroy(void *user_data)
+{
+	struct timer_data *data = user_data;
+
+	data->destroyed = true;
+}
+
+static void timer_callback(int id, void *user_data)
+{
+	struct timer_data *data = user_data;
+	unsigned int elapsed = timer_elapsed();
+
+	g_assert(id == data->id);
+	g_assert(elapsed >= data->msec);
+
+	if (elapsed - data->msec > timer_late)
+		timer_late = elapsed - data->msec;
+
+	data->fired++;
+
+	g_assert(mainloop_remove_timeout(id) == 0);
+	g_assert(data->destroyed);
+
+	if (!--timers_pending)
+		mainloop_quit();
+}
+
+static void timer_add_full(struct timer_data *data, unsigned int msec,
+					mainloop_timeout_func callback)
+{
+	memset(data, 0, sizeof(*data));
+	data->msec = msec;
+
+	data->id = mainloop_add_timeout(msec, callback, data, timer_destroy);
+	g_assert(data->id > 0);
+
+	timers_pending++;
+}
+
+static void timer_add(struct timer_data *data, unsigned int msec)
+{
+	timer_add_full(data, msec, timer_callback);
+}
+
+static void timer_init(void)
+{
+	mainloop_init();
+
+	clock_gettime(CLOCK_MONOTONIC, &timer_start);
+	timers_pending = 0;
+	timer_late = 0;
+}
+
+/*
+ * Level 0 of the wheel covers 64 ms and level 1 covers 4096 ms, so these
+ * have to cascade down one or two levels before they fire.
+ */
+static const unsigned int cascade_msec[] = {
+	4300, 1, 64, 63, 65, 4095, 200, 4096, 128,
+};
+
+static void test_timeout_cascade(const void *test_data)
+{
+	struct timer_data timers[G_N_ELEMENTS(cascade_msec)];
+	unsigned int i;
+
+	timer_init();
+
+	for (i = 0; i < G_N_ELEMENTS(cascade_msec); i++)
+		timer_add(&timers[i], cascade_msec[i]);
+
+	g_assert(mainloop_run() == EXIT_SUCCESS);
+
+	for (i = 0; i < G_N_ELEMENTS(cascade_msec); i++)
+		g_assert(timers[i].fired == 1);
+
+	tester_debug("Fired at most %u ms late", timer_late);
+
+	tester_test_passed();
+}
+
+static struct timer_data remove_timers[5];
+
+static void timer_remove_callback(int id, void *user_data)
+{
+	struct timer_data *data = user_data;
+	unsigned int i;
+
+	data->fired++;
+
+	/*
+	 * Remove every timeout including this one, the one due in the same
+	 * slot and one still sitting in an upper level of the wheel.
+	 */
+	for (i = 0; i < 4; i++) {
+		g_assert(mainloop_remove_timeout(remove_timers[i].id) == 0);
+		g_assert(remove_timers[i].destroyed);
+		timers_pending--;
+	}
+
+	/* Ids of removed timeouts are handed out again */
+	timer_add(&remove_timers[4], 100);
+	g_assert(remove_timers[4].id <= 4);
+}
+
+static void test_timeout_remove(const void *test_data)
+{
+	timer_init();
+
+	timer_add_full(&remove_timers[0], 10, timer_remove_callback);
+	timer_add_full(&remove_timers[1], 10, timer_remove_callback);
+	timer_add(&remove_timers[2], 50);
+	timer_add(&remove_timers[3], 5000);
+
+	g_assert(mainloop_run() == EXIT_SUCCESS);
+
+	g_assert(remove_timers[0].fired + remove_timers[1].fired == 1);
+	g_assert(!remove_timers[2].fired && !remove_timers[3].fired);
+	g_assert(remove_timers[4].fired == 1);
+
+	tester_test_passed();
+}
+
+#define TIMER_COUNT	10000
+
+static void test_timeout_bench(const void *test_data)
+{
+	struct timer_data *timers;
+	unsigned int i, removed = 0;
+
+	timers = g_new0(struct timer_data, TIMER_COUNT);
+
+	timer_init();
+
+	for (i = 0; i < TIMER_COUNT; i++)
+		timer_add(&timers[i], 1 + i % 1000);
+
+	tester_debug("Added %u timeouts in %u ms", TIMER_COUNT,
+							timer_elapsed());
+
+	/* Every tenth timeout is removed again before it fires */
+	for (i = 0; i < TIMER_COUNT; i += 10) {
+		g_assert(mainloop_remove_timeout(timers[i].id) == 0);
+		timers_pending--;
+		removed++;
+	}
+
+	g_assert(mainloop_run() == EXIT_SUCCESS);
+
+	for (i = 0; i < TIMER_COUNT; i++) {
+		g_assert(timers[i].destroyed);
+		g_assert(timers[i].fired == (i % 10 ? 1 : 0));
+	}
+
+	tester_debug("Fired %u timeouts in %u ms, at most %u ms late",
+					TIMER_COUNT - removed, timer_elapsed(),
+					timer_late);
+
+	g_free(timers);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/mainloop/fds", NULL, NULL, test_fds, NULL);
+	tester_add("/mainloop/timeout/cascade", NULL, NULL,
+						test_timeout_cascade, NULL);
+	tester_add("/mainloop/timeout/remove", NULL, NULL,
+						test_timeout_remove, NULL);
+	tester_add("/mainloop/timeout/bench", NULL, NULL,
+						test_timeout_bench, NULL);
+
+	return tester_run();
+}
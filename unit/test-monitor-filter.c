@@ -0,0 +1,174 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+#include "monitor/filter.h"
+
+#include <glib.h>
+
+#define FILTER_EXPR	"hci0,hci1,handle=1,handle=2,cid=0x0040"
+
+#define ACL_START	0x02
+#define ACL_CONT	0x01
+
+struct acl_pkt {
+	uint16_t index;
+	uint16_t handle;
+	uint8_t flags;
+	uint16_t cid;
+	bool kernel;
+	bool match;
+};
+
+/*
+ * Interleaved fragments of the same handle on two controllers. Start
+ * fragments of a wanted handle always reach user space, since only they
+ * decide about their continuations.
+ */
+static const struct acl_pkt acl_fragments[] = {
+	{ 0, 1, ACL_START, 0x0040, true, true },
+	{ 1, 1, ACL_START, 0x0041, true, false },
+	{ 0, 1, ACL_CONT, 0, true, true },
+	{ 1, 1, ACL_CONT, 0, true, false },
+	{ 0, 1, ACL_START, 0x0041, true, false },
+	{ 1, 1, ACL_START, 0x0040, true, true },
+	{ 0, 1, ACL_CONT, 0, true, false },
+	{ 1, 1, ACL_CONT, 0, true, true },
+	{ 0, 2, ACL_START, 0x0040, true, true },
+	{ 0, 3, ACL_START, 0x0040, false, false },
+	{ 0, 3, ACL_CONT, 0, false, false },
+	{ 0, 2, ACL_CONT, 0, true, true },
+	{ 2, 1, ACL_START, 0x0040, false, false },
+	{ 2, 1, ACL_CONT, 0, false, false },
+	{ }
+};
+
+static uint16_t build_acl(const struct acl_pkt *pkt, uint8_t *buf)
+{
+	uint16_t len = 0;
+
+	put_le16(pkt->handle | pkt->flags << 12, buf);
+
+	if (pkt->flags == ACL_START) {
+		put_le16(8, buf + 4);
+		put_le16(pkt->cid, buf + 6);
+		len = 4;
+	}
+
+	memset(buf + 4 + len, 0xaa, 4);
+	len += 4;
+
+	put_le16(len, buf + 2);
+
+	return len + 4;
+}
+
+static void test_fragments(const void *test_data)
+{
+	const struct acl_pkt *pkt;
+	uint8_t buf[16];
+
+	for (pkt = acl_fragments; pkt->handle; pkt++) {
+		uint16_t len = build_acl(pkt, buf);
+		bool match;
+
+		match = filter_packet(pkt->index, BTSNOOP_OPCODE_ACL_RX_PKT,
+								buf, len);
+
+		tester_debug("hci%u handle %u flags 0x%2.2x: %s", pkt->index,
+				pkt->handle, pkt->flags, match ? "yes" : "no");
+
+		g_assert(match == pkt->match);
+	}
+
+	tester_test_passed();
+}
+
+static void test_attach(const void *test_data)
+{
+	const struct acl_pkt *pkt;
+	uint8_t buf[22];
+	int fd[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fd) == 0);
+	g_assert(filter_attach(fd[1]) == 0);
+
+	for (pkt = acl_fragments; pkt->handle; pkt++) {
+		uint16_t len = build_acl(pkt, buf + 6);
+
+		put_le16(BTSNOOP_OPCODE_ACL_RX_PKT, buf);
+		put_le16(pkt->index, buf + 2);
+		put_le16(len, buf + 4);
+
+		g_assert(write(fd[0], buf, len + 6) == len + 6);
+	}
+
+	/* The user space filter completes what the kernel let through */
+	for (pkt = acl_fragments; pkt->handle; pkt++) {
+		ssize_t len;
+
+		if (!pkt->kernel)
+			continue;
+
+		len = read(fd[1], buf, sizeof(buf));
+		g_assert(len > 6);
+
+		g_assert(get_le16(buf + 2) == pkt->index);
+		g_assert((get_le16(buf + 6) & 0x0fff) == pkt->handle);
+
+		g_assert(filter_packet(get_le16(buf + 2), get_le16(buf),
+					buf + 6, len - 6) == pkt->match);
+	}
+
+	g_assert(read(fd[1], buf, sizeof(buf)) < 0 && errno == EAGAIN);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	if (!filter_set(FILTER_EXPR))
+		return 1;
+
+	tester_add("/monitor/filter/fragments", NULL, NULL,
+							test_fragments, NULL);
+	tester_add("/monitor/filter/attach", NULL, NULL, test_attach, NULL);
+
+	return tester_run();
+}
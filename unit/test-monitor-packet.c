@@ -0,0 +1,230 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* The decoder tables and their lookups are private to packet.c */
+#include "monitor/packet.c"
+
+#include <fcntl.h>
+
+#include <glib.h>
+
+#include "src/shared/tester.h"
+
+/* The linear searches the decoder used before the tables got an index */
+static const struct opcode_data *linear_opcode_data(uint16_t opcode)
+{
+	int i;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode == opcode)
+			return &opcode_table[i];
+	}
+
+	return NULL;
+}
+
+static const struct event_data *linear_event_data(uint8_t event)
+{
+	int i;
+
+	for (i = 0; event_table[i].str; i++) {
+		if (event_table[i].event == event)
+			return &event_table[i];
+	}
+
+	return NULL;
+}
+
+static const struct subevent_data *linear_le_meta_event_data(uint8_t subevent)
+{
+	int i;
+
+	for (i = 0; le_meta_event_table[i].str; i++) {
+		if (le_meta_event_table[i].subevent == subevent)
+			return &le_meta_event_table[i];
+	}
+
+	return NULL;
+}
+
+static const char *linear_error_str(uint8_t error)
+{
+	int i;
+
+	for (i = 0; error2str_table[i].str; i++) {
+		if (error2str_table[i].error == error)
+			return error2str_table[i].str;
+	}
+
+	return NULL;
+}
+
+static const struct mgmt_data *linear_mgmt_data(const struct mgmt_data *table,
+							uint16_t opcode)
+{
+	int i;
+
+	for (i = 0; table[i].str; i++) {
+		if (table[i].opcode == opcode)
+			return &table[i];
+	}
+
+	return NULL;
+}
+
+static void test_lookup(const void *test_data)
+{
+	unsigned int i;
+
+	for (i = 0; i <= UINT16_MAX; i++) {
+		g_assert(find_opcode_data(i) == linear_opcode_data(i));
+		g_assert(find_mgmt_command_data(i) ==
+				linear_mgmt_data(mgmt_command_table, i));
+		g_assert(find_mgmt_event_data(i) ==
+				linear_mgmt_data(mgmt_event_table, i));
+	}
+
+	for (i = 0; i <= UINT8_MAX; i++) {
+		g_assert(find_event_data(i) == linear_event_data(i));
+		g_assert(find_le_meta_event_data(i) ==
+						linear_le_meta_event_data(i));
+		g_assert(find_error_str(i) == linear_error_str(i));
+	}
+
+	tester_test_passed();
+}
+
+/*
+ * Look up every known HCI opcode plus as many unknown ones, the way a
+ * trace full of Command Complete events does, then decode such events.
+ */
+#define BENCH_ROUNDS	2000
+#define BENCH_DECODE	50
+
+static void bench_lookup(const uint16_t *opcodes, unsigned int count)
+{
+	GTimer *timer = g_timer_new();
+	unsigned int i, j, found = 0;
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		for (j = 0; j < count; j++) {
+			if (linear_opcode_data(opcodes[j]))
+				found++;
+		}
+	}
+
+	tester_debug("Linear: %u lookups, %u found in %.3f s",
+					BENCH_ROUNDS * count, found,
+					g_timer_elapsed(timer, NULL));
+
+	found = 0;
+	g_timer_start(timer);
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		for (j = 0; j < count; j++) {
+			if (find_opcode_data(opcodes[j]))
+				found++;
+		}
+	}
+
+	tester_debug("Index: %u lookups, %u found in %.3f s",
+					BENCH_ROUNDS * count, found,
+					g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+}
+
+static void bench_decode(const uint16_t *opcodes, unsigned int count)
+{
+	uint8_t evt[HCI_EVENT_HDR_SIZE + 255];
+	GTimer *timer;
+	struct timeval tv;
+	unsigned int i, j;
+	int fd, out;
+
+	memset(evt, 0, sizeof(evt));
+	evt[0] = EVT_CMD_COMPLETE;
+	evt[1] = 255;
+	evt[2] = 1;
+
+	memset(&tv, 0, sizeof(tv));
+
+	/* Only the decoding is of interest, not the terminal */
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+	g_assert(out >= 0 && fd >= 0);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	timer = g_timer_new();
+
+	for (i = 0; i < BENCH_DECODE; i++) {
+		for (j = 0; j < count; j++) {
+			put_le16(opcodes[j], evt + 3);
+			packet_hci_event(&tv, NULL, 0, evt, sizeof(evt));
+		}
+	}
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+
+	tester_debug("Decoded %u events in %.3f s", BENCH_DECODE * count,
+						g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+}
+
+static void test_bench(const void *test_data)
+{
+	uint16_t *opcodes;
+	unsigned int i, count;
+
+	for (count = 0; opcode_table[count].str; count++)
+		;
+
+	opcodes = g_new(uint16_t, count * 2);
+
+	for (i = 0; i < count; i++) {
+		opcodes[i * 2] = opcode_table[i].opcode;
+		opcodes[i * 2 + 1] = 0xfc00 | i;
+	}
+
+	bench_lookup(opcodes, count * 2);
+	bench_decode(opcodes, count * 2);
+
+	g_free(opcodes);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/monitor/packet/lookup", NULL, NULL, test_lookup, NULL);
+	tester_add("/monitor/packet/bench", NULL, NULL, test_bench, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,377 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "obexd/src/obexd.h"
+#include "obexd/src/obex.h"
+#include "obexd/src/plugin.h"
+#include "obexd/src/mimetype.h"
+
+#define TEST_SIZE	(1024 * 1024 + 123)
+#define TEST_CHUNK	(32 * 1024)
+#define TEST_TIMEOUT	10
+
+extern struct obex_plugin_desc __obex_builtin_filesystem;
+
+struct test_data {
+	struct obex_mime_type_driver *driver;
+	GMainLoop *mainloop;
+	char path[32];
+	void *object;
+	uint8_t *data;
+	uint8_t *buf;
+	size_t offset;
+	int err;
+	unsigned int io_count;
+	void (*resume)(struct test_data *d);
+};
+
+/* The filesystem driver only needs these from the rest of the daemon */
+gboolean obex_option_async_io(void)
+{
+	return TRUE;
+}
+
+gboolean obex_option_symlinks(void)
+{
+	return TRUE;
+}
+
+const char *obex_option_root_folder(void)
+{
+	return "/";
+}
+
+int memncmp0(const void *a, size_t na, const void *b, size_t nb)
+{
+	if (na != nb)
+		return na - nb;
+
+	if (a == NULL)
+		return -(a != b);
+
+	if (b == NULL)
+		return a != b;
+
+	return memcmp(a, b, na);
+}
+
+static gboolean test_timeout(gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	d->err = -ETIMEDOUT;
+	g_main_loop_quit(d->mainloop);
+
+	return FALSE;
+}
+
+static gboolean test_io_cb(void *object, int flags, int err, void *user_data)
+{
+	struct test_data *d = user_data;
+
+	g_assert(object == d->object);
+
+	d->io_count++;
+	d->resume(d);
+
+	return TRUE;
+}
+
+static void test_setup(struct test_data *d)
+{
+	int fd;
+
+	memset(d, 0, sizeof(*d));
+
+	g_assert(__obex_builtin_filesystem.init() == 0);
+
+	d->driver = obex_mime_type_driver_find(NULL, 0, NULL, NULL, 0);
+	g_assert(d->driver != NULL);
+
+	strcpy(d->path, "/tmp/test-obexd-XXXXXX");
+	fd = mkstemp(d->path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	d->data = g_malloc(TEST_SIZE);
+	d->buf = g_malloc0(TEST_SIZE);
+
+	for (fd = 0; fd < TEST_SIZE; fd++)
+		d->data[fd] = g_random_int();
+
+	d->mainloop = g_main_loop_new(NULL, FALSE);
+}
+
+static void test_open(struct test_data *d, const char *path, int oflag)
+{
+	int err;
+
+	d->object = d->driver->open(path, oflag, 0600, NULL, NULL, &err);
+	g_assert(d->object != NULL);
+	g_assert_cmpint(err, ==, 0);
+
+	d->driver->set_io_watch(d->object, test_io_cb, d);
+}
+
+static void test_close(struct test_data *d)
+{
+	d->driver->set_io_watch(d->object, NULL, NULL);
+
+	d->err = d->driver->close(d->object);
+	d->object = NULL;
+}
+
+static void test_run(struct test_data *d)
+{
+	guint id;
+
+	id = g_timeout_add_seconds(TEST_TIMEOUT, test_timeout, d);
+
+	d->resume(d);
+	g_main_loop_run(d->mainloop);
+
+	g_source_remove(id);
+}
+
+/* Wait for every queued request and run its completion */
+static void test_drain(struct test_data *d)
+{
+	__obex_builtin_filesystem.exit();
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static void test_teardown(struct test_data *d)
+{
+	unlink(d->path);
+
+	g_main_loop_unref(d->mainloop);
+	g_free(d->data);
+	g_free(d->buf);
+}
+
+static void assert_file(struct test_data *d)
+{
+	gchar *contents;
+	gsize len;
+
+	g_assert(g_file_get_contents(d->path, &contents, &len, NULL));
+	g_assert_cmpuint(len, ==, TEST_SIZE);
+	g_assert(memcmp(contents, d->data, TEST_SIZE) == 0);
+
+	g_free(contents);
+}
+
+static void write_next(struct test_data *d)
+{
+	ssize_t ret;
+
+	while (d->offset < TEST_SIZE) {
+		size_t count = g_random_int_range(1, TEST_CHUNK);
+
+		count = MIN(count, TEST_SIZE - d->offset);
+
+		ret = d->driver->write(d->object, d->data + d->offset, count);
+		if (ret == -EAGAIN)
+			return;
+
+		g_assert_cmpint(ret, ==, count);
+		d->offset += ret;
+	}
+
+	ret = d->driver->flush(d->object);
+	if (ret == -EAGAIN)
+		return;
+
+	d->err = ret;
+	g_main_loop_quit(d->mainloop);
+}
+
+static void read_next(struct test_data *d)
+{
+	ssize_t ret;
+
+	do {
+		size_t count = g_random_int_range(1, TEST_CHUNK);
+
+		count = MIN(count, TEST_SIZE - d->offset);
+
+		ret = d->driver->read(d->object, d->buf + d->offset, count);
+		if (ret == -EAGAIN)
+			return;
+
+		g_assert_cmpint(ret, >=, 0);
+		d->offset += ret;
+	} while (ret > 0 && d->offset < TEST_SIZE);
+
+	d->err = 0;
+	g_main_loop_quit(d->mainloop);
+}
+
+static void test_write_read(void)
+{
+	struct test_data d;
+
+	test_setup(&d);
+
+	test_open(&d, d.path, O_WRONLY | O_TRUNC);
+	d.resume = write_next;
+	test_run(&d);
+	g_assert_cmpint(d.err, ==, 0);
+	test_close(&d);
+	g_assert_cmpint(d.err, ==, 0);
+
+	assert_file(&d);
+
+	test_open(&d, d.path, O_RDONLY);
+	d.offset = 0;
+	d.io_count = 0;
+	d.resume = read_next;
+	test_run(&d);
+	g_assert_cmpint(d.err, ==, 0);
+	test_close(&d);
+	g_assert_cmpint(d.err, ==, 0);
+
+	/* Each chunk is read on a worker and completes through the watch */
+	g_assert_cmpuint(d.io_count, >=, TEST_SIZE / (64 * 1024));
+	g_assert_cmpuint(d.offset, ==, TEST_SIZE);
+	g_assert(memcmp(d.buf, d.data, TEST_SIZE) == 0);
+
+	test_drain(&d);
+	test_teardown(&d);
+}
+
+static void test_close_read_in_flight(void)
+{
+	struct test_data d;
+	ssize_t ret;
+
+	test_setup(&d);
+	g_assert(g_file_set_contents(d.path, (char *) d.data, TEST_SIZE,
+								NULL));
+
+	test_open(&d, d.path, O_RDONLY);
+
+	ret = d.driver->read(d.object, d.buf, TEST_CHUNK);
+	g_assert_cmpint(ret, ==, -EAGAIN);
+
+	test_close(&d);
+	g_assert_cmpint(d.err, ==, 0);
+
+	/* The completion frees the closed object without reporting it */
+	test_drain(&d);
+	g_assert_cmpuint(d.io_count, ==, 0);
+
+	test_teardown(&d);
+}
+
+static void test_close_write_in_flight(void)
+{
+	struct test_data d;
+	ssize_t ret;
+
+	test_setup(&d);
+
+	test_open(&d, d.path, O_WRONLY | O_TRUNC);
+
+	ret = d.driver->write(d.object, d.data, TEST_SIZE);
+	g_assert_cmpint(ret, ==, TEST_SIZE);
+
+	test_close(&d);
+	g_assert_cmpint(d.err, ==, 0);
+
+	/* The queued write still reaches the file */
+	test_drain(&d);
+	g_assert_cmpuint(d.io_count, ==, 0);
+
+	assert_file(&d);
+
+	test_teardown(&d);
+}
+
+static void write_full(struct test_data *d)
+{
+	ssize_t ret;
+
+	while ((ret = d->driver->write(d->object, d->data, TEST_CHUNK)) > 0)
+		d->offset += ret;
+
+	if (ret == -EAGAIN)
+		return;
+
+	d->err = ret;
+	g_main_loop_quit(d->mainloop);
+}
+
+static void test_write_error(void)
+{
+	struct test_data d;
+
+	test_setup(&d);
+
+	test_open(&d, "/dev/full", O_WRONLY);
+	d.resume = write_full;
+	test_run(&d);
+
+	/* The failed write is reported by the following write */
+	g_assert_cmpint(d.err, ==, -ENOSPC);
+	g_assert_cmpuint(d.offset, ==, TEST_CHUNK);
+
+	g_assert_cmpint(d.driver->flush(d.object), ==, -ENOSPC);
+
+	test_close(&d);
+	g_assert_cmpint(d.err, ==, -ENOSPC);
+
+	test_drain(&d);
+	test_teardown(&d);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/obexd/filesystem/write_read", test_write_read);
+	g_test_add_func("/obexd/filesystem/close_read_in_flight",
+						test_close_read_in_flight);
+	g_test_add_func("/obexd/filesystem/close_write_in_flight",
+						test_close_write_in_flight);
+	g_test_add_func("/obexd/filesystem/write_error", test_write_error);
+
+	return g_test_run();
+}
@@ -0,0 +1,417 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2026  agent <agent@local>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "gobex/gobex.h"
+
+#include "obexd/src/obexd.h"
+#include "obexd/src/obex.h"
+#include "obexd/src/obex-priv.h"
+#include "obexd/src/server.h"
+#include "obexd/src/manager.h"
+#include "obexd/src/service.h"
+#include "obexd/src/mimetype.h"
+
+#define TEST_MTU	32767
+#define TEST_TIMEOUT	10
+
+struct test_data {
+	GMainLoop *mainloop;
+	GObex *obex;
+	GError *err;
+	char path[32];
+	uint8_t *data;
+	size_t size;
+	size_t sent;
+	int fd;
+	size_t chunk;
+	unsigned int delay;
+	bool ready;
+	guint ready_id;
+	unsigned int partial;
+	unsigned int eagain;
+};
+
+/* The object the mime driver below writes to */
+static struct test_data *current;
+
+/* Only the PUT path of the session needs these from the rest of obexd */
+void manager_emit_transfer_property(struct obex_transfer *transfer,
+								char *name)
+{
+}
+
+static void *service_connect(struct obex_session *os, int *err)
+{
+	*err = 0;
+
+	return current;
+}
+
+static int service_chkput(struct obex_session *os, void *user_data)
+{
+	return 0;
+}
+
+static int service_put(struct obex_session *os, void *user_data)
+{
+	return obex_put_stream_start(os, current->path);
+}
+
+static struct obex_service_driver service = {
+	.name = "Test",
+	.service = OBEX_OPP,
+	.connect = service_connect,
+	.chkput = service_chkput,
+	.put = service_put,
+};
+
+static void *mime_open(const char *name, int oflag, mode_t mode,
+				void *driver_data, size_t *size, int *err)
+{
+	current->fd = open(name, oflag, mode);
+	if (current->fd < 0) {
+		*err = -errno;
+		return NULL;
+	}
+
+	*err = 0;
+
+	return current;
+}
+
+static int mime_close(void *object)
+{
+	struct test_data *d = object;
+
+	close(d->fd);
+	d->fd = -1;
+
+	return 0;
+}
+
+static gboolean mime_ready(gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	d->ready_id = 0;
+	d->ready = true;
+
+	obex_object_set_io_flags(d, G_IO_OUT, 0);
+
+	return FALSE;
+}
+
+/*
+ * With a chunk set the object takes at most that much per write and is
+ * not ready for another one until the main loop has run, or the delay
+ * has passed, so a packet ends up written in part and the rest refused
+ * with -EAGAIN.
+ */
+static ssize_t mime_write(void *object, const void *buf, size_t count)
+{
+	struct test_data *d = object;
+	ssize_t ret;
+
+	if (!d->ready) {
+		d->eagain++;
+		return -EAGAIN;
+	}
+
+	if (d->chunk) {
+		if (count > d->chunk) {
+			count = d->chunk;
+			d->partial++;
+		}
+
+		d->ready = false;
+
+		if (d->delay)
+			d->ready_id = g_timeout_add(d->delay, mime_ready, d);
+		else
+			d->ready_id = g_idle_add_full(G_PRIORITY_DEFAULT,
+							mime_ready, d, NULL);
+	}
+
+	ret = write(d->fd, buf, count);
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+static int mime_flush(void *object)
+{
+	return 0;
+}
+
+static struct obex_mime_type_driver mime = {
+	.open = mime_open,
+	.close = mime_close,
+	.write = mime_write,
+	.flush = mime_flush,
+};
+
+static gboolean test_timeout(gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	g_set_error(&d->err, G_OBEX_ERROR, G_OBEX_ERROR_TIMEOUT, "Timed out");
+	g_main_loop_quit(d->mainloop);
+
+	return FALSE;
+}
+
+static gssize provide_data(void *buf, gsize len, gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	len = MIN(len, d->size - d->sent);
+
+	memcpy(buf, d->data + d->sent, len);
+	d->sent += len;
+
+	return len;
+}
+
+static void put_complete(GObex *obex, GError *err, gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	if (err)
+		d->err = g_error_copy(err);
+
+	g_main_loop_quit(d->mainloop);
+}
+
+static void connect_complete(GObex *obex, GError *err, GObexPacket *rsp,
+							gpointer user_data)
+{
+	struct test_data *d = user_data;
+
+	if (err) {
+		d->err = g_error_copy(err);
+		g_main_loop_quit(d->mainloop);
+		return;
+	}
+
+	g_obex_put_req(obex, provide_data, put_complete, d, &d->err,
+				G_OBEX_HDR_NAME, "test.bin",
+				G_OBEX_HDR_LENGTH, (guint32) d->size,
+				G_OBEX_HDR_INVALID);
+	if (d->err)
+		g_main_loop_quit(d->mainloop);
+}
+
+static void test_setup(struct test_data *d, size_t size, size_t chunk)
+{
+	size_t i;
+	int fd;
+
+	memset(d, 0, sizeof(*d));
+
+	strcpy(d->path, "/tmp/test-obexd-XXXXXX");
+	fd = mkstemp(d->path);
+	g_assert(fd >= 0);
+	close(fd);
+
+	d->fd = -1;
+	d->size = size;
+	d->chunk = chunk;
+	d->ready = true;
+
+	d->data = g_malloc(size);
+	for (i = 0; i < size; i++)
+		d->data[i] = g_random_int();
+
+	d->mainloop = g_main_loop_new(NULL, FALSE);
+
+	current = d;
+
+	g_assert(obex_mime_type_driver_register(&mime) == 0);
+}
+
+static void test_put(struct test_data *d)
+{
+	struct obex_server server;
+	GIOChannel *io;
+	guint id;
+	int sv[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0,
+								sv) == 0);
+
+	memset(&server, 0, sizeof(server));
+	server.drivers = g_slist_append(NULL, &service);
+
+	io = g_io_channel_unix_new(sv[1]);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	g_assert(obex_session_start(io, TEST_MTU, TEST_MTU, FALSE,
+							&server) == 0);
+	g_io_channel_unref(io);
+
+	io = g_io_channel_unix_new(sv[0]);
+	g_io_channel_set_close_on_unref(io, TRUE);
+	d->obex = g_obex_new(io, G_OBEX_TRANSPORT_PACKET, TEST_MTU, TEST_MTU);
+	g_io_channel_unref(io);
+	g_assert(d->obex != NULL);
+
+	id = g_timeout_add_seconds(TEST_TIMEOUT, test_timeout, d);
+
+	g_obex_connect(d->obex, connect_complete, d, &d->err,
+							G_OBEX_HDR_INVALID);
+	g_assert_no_error(d->err);
+
+	g_main_loop_run(d->mainloop);
+
+	/* The session closes the object on its own once it is flushed */
+	while (d->fd >= 0 && d->err == NULL)
+		g_main_context_iteration(NULL, TRUE);
+
+	g_assert_no_error(d->err);
+	g_source_remove(id);
+
+	g_obex_unref(d->obex);
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	g_slist_free(server.drivers);
+}
+
+static void test_teardown(struct test_data *d)
+{
+	if (d->ready_id > 0)
+		g_source_remove(d->ready_id);
+
+	obex_mime_type_driver_unregister(&mime);
+	current = NULL;
+
+	unlink(d->path);
+
+	g_main_loop_unref(d->mainloop);
+	g_free(d->data);
+}
+
+static void assert_file(struct test_data *d)
+{
+	gchar *contents;
+	gsize len;
+
+	g_assert_cmpint(d->fd, ==, -1);
+	g_assert_cmpuint(d->sent, ==, d->size);
+
+	g_assert(g_file_get_contents(d->path, &contents, &len, NULL));
+	g_assert_cmpuint(len, ==, d->size);
+	g_assert(memcmp(contents, d->data, len) == 0);
+
+	g_free(contents);
+}
+
+static void test_put_partial(void)
+{
+	struct test_data d;
+
+	/* Every packet is written in several parts and refused in between */
+	test_setup(&d, 1024 * 1024 + 123, 10000);
+
+	test_put(&d);
+	assert_file(&d);
+
+	g_assert_cmpuint(d.partial, >, 0);
+	g_assert_cmpuint(d.eagain, >, 0);
+
+	test_teardown(&d);
+}
+
+static void test_put_final_pending(void)
+{
+	struct test_data d;
+
+	/*
+	 * The object stays busy with the first write while SRM brings in
+	 * the rest, so the PUT completes with a watch for that write set.
+	 */
+	test_setup(&d, 4 * TEST_MTU, TEST_MTU);
+	d.delay = 100;
+
+	test_put(&d);
+	assert_file(&d);
+
+	g_assert_cmpuint(d.eagain, >, 0);
+
+	test_teardown(&d);
+}
+
+static void test_put_bench(void)
+{
+	struct test_data d;
+	GTimer *timer;
+	double elapsed;
+
+	test_setup(&d, 16 * 1024 * 1024, 0);
+
+	timer = g_timer_new();
+	test_put(&d);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	assert_file(&d);
+	g_assert_cmpuint(d.eagain, ==, 0);
+
+	if (g_test_verbose())
+		g_print("%zu bytes in %.3f s, %.1f MB/s\n", d.size, elapsed,
+					d.size / elapsed / (1024 * 1024));
+
+	g_timer_destroy(timer);
+	test_teardown(&d);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/obexd/session/put_partial", test_put_partial);
+	g_test_add_func("/obexd/session/put_final_pending",
+						test_put_final_pending);
+	g_test_add_func("/obexd/session/put_bench", test_put_bench);
+
+	return g_test_run();
+}
@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
@@ -259,6 +261,348 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+static void test_reuse(const void *data)
+{
+	struct queue *queue;
+	const struct queue_entry *entry;
+	unsigned int i;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	g_assert(queue_push_tail(queue, UINT_TO_PTR(1)));
+	entry = queue_get_entries(queue);
+	g_assert(queue_pop_head(queue) == UINT_TO_PTR(1));
+
+	/* Released entries are recycled by the following pushes */
+	for (i = 0; i < 1024; i++) {
+		g_assert(queue_push_head(queue, UINT_TO_PTR(i)));
+		g_assert(queue_get_entries(queue) == entry);
+		g_assert(queue_get_entries(queue)->next == NULL);
+		g_assert(queue_remove(queue, UINT_TO_PTR(i)));
+	}
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static void test_reserve(const void *data)
+{
+	struct queue *queue, *other;
+	const struct queue_entry *entry;
+	const struct queue_entry *reserved[4];
+	unsigned int i, j;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	other = queue_new();
+	g_assert(other != NULL);
+
+	g_assert(queue_reserve(queue, 4));
+
+	for (i = 0; i < 4; i++)
+		g_assert(queue_push_tail(queue, UINT_TO_PTR(i + 1)));
+
+	for (entry = queue_get_entries(queue), i = 0; entry;
+						entry = entry->next, i++)
+		reserved[i] = entry;
+
+	g_assert(queue_remove_all(queue, NULL, NULL, NULL) == 4);
+
+	/* Reserved entries stay with their queue */
+	for (i = 0; i < 4; i++)
+		g_assert(queue_push_tail(other, UINT_TO_PTR(i + 1)));
+
+	for (entry = queue_get_entries(other); entry; entry = entry->next) {
+		for (j = 0; j < 4; j++)
+			g_assert(entry != reserved[j]);
+	}
+
+	for (i = 0; i < 4; i++)
+		g_assert(queue_push_tail(queue, UINT_TO_PTR(i + 1)));
+
+	for (entry = queue_get_entries(queue); entry; entry = entry->next) {
+		for (j = 0; j < 4; j++) {
+			if (entry == reserved[j])
+				break;
+		}
+
+		g_assert(j < 4);
+	}
+
+	g_assert(queue_length(queue) == 4);
+	g_assert(queue_pop_head(queue) == UINT_TO_PTR(1));
+
+	g_assert(queue_reserve(queue, 0));
+
+	queue_destroy(other, NULL);
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+#define BENCH_WINDOW	64
+#define BENCH_CYCLES	(1024 * 1024)
+
+static void bench_cycles(struct queue *queue, unsigned int cycles,
+							GHashTable *entries)
+{
+	const struct queue_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < cycles; i++) {
+		queue_push_tail(queue, UINT_TO_PTR(i + 1));
+
+		if (queue_length(queue) <= BENCH_WINDOW)
+			continue;
+
+		if (entries)
+			g_hash_table_add(entries,
+					(void *) queue_get_entries(queue));
+
+		queue_pop_head(queue);
+	}
+
+	for (entry = queue_get_entries(queue); entry && entries;
+							entry = entry->next)
+		g_hash_table_add(entries, (void *) entry);
+
+	queue_remove_all(queue, NULL, NULL, NULL);
+}
+
+static void test_bench_alloc(const void *data)
+{
+	struct queue *queue;
+	GHashTable *entries;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	entries = g_hash_table_new(NULL, NULL);
+
+	/* Each distinct entry address stands for one allocation */
+	bench_cycles(queue, BENCH_CYCLES, entries);
+
+	tester_debug("%u push/pop cycles, %u allocations", BENCH_CYCLES,
+					g_hash_table_size(entries));
+
+	g_assert(g_hash_table_size(entries) <= BENCH_WINDOW + 1);
+
+	g_hash_table_destroy(entries);
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static void test_bench_throughput(const void *data)
+{
+	struct queue *queue;
+	GTimer *timer;
+	double elapsed;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	timer = g_timer_new();
+
+	bench_cycles(queue, BENCH_CYCLES, NULL);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	tester_debug("%u push/pop cycles in %.3f s (%.0f cycles/s)",
+				BENCH_CYCLES, elapsed, BENCH_CYCLES / elapsed);
+
+	g_timer_destroy(timer);
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static void *thread_cycles(void *user_data)
+{
+	struct queue *queue = user_data;
+
+	bench_cycles(queue, 1024, NULL);
+
+	return NULL;
+}
+
+static void test_thread(const void *data)
+{
+	struct queue *queue;
+	pthread_t thread;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	/* Entries cached by the thread are released when it exits */
+	g_assert(pthread_create(&thread, NULL, thread_cycles, queue) == 0);
+	g_assert(pthread_join(thread, NULL) == 0);
+
+	g_assert(queue_isempty(queue));
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static void test_vqueue_basic(const void *data)
+{
+	struct vqueue *vq;
+	unsigned int n, i;
+
+	vq = vqueue_new();
+	g_assert(vq != NULL);
+
+	for (n = 0; n < 1024; n++) {
+		for (i = 1; i < n + 2; i++)
+			vqueue_push_tail(vq, UINT_TO_PTR(i));
+
+		g_assert(vqueue_length(vq) == n + 1);
+		g_assert(vqueue_peek_tail(vq) == UINT_TO_PTR(n + 1));
+
+		for (i = 1; i < n + 2; i++) {
+			void *ptr;
+
+			ptr = vqueue_pop_head(vq);
+			g_assert(ptr != NULL);
+			g_assert(i == PTR_TO_UINT(ptr));
+		}
+
+		g_assert(vqueue_isempty(vq) == true);
+	}
+
+	g_assert(vqueue_push_tail(vq, UINT_TO_PTR(2)));
+	g_assert(vqueue_push_head(vq, UINT_TO_PTR(1)));
+	g_assert(vqueue_push_tail(vq, UINT_TO_PTR(3)));
+	g_assert(vqueue_peek_head(vq) == UINT_TO_PTR(1));
+	g_assert(vqueue_find(vq, NULL, UINT_TO_PTR(3)) == UINT_TO_PTR(3));
+	g_assert(vqueue_remove(vq, UINT_TO_PTR(2)));
+	g_assert(!vqueue_remove(vq, UINT_TO_PTR(2)));
+	g_assert(vqueue_remove_if(vq, match_int, UINT_TO_PTR(3)) ==
+							UINT_TO_PTR(3));
+	g_assert(vqueue_remove_all(vq, NULL, NULL, NULL) == 1);
+	g_assert(vqueue_isempty(vq));
+
+	vqueue_destroy(vq, NULL);
+	tester_test_passed();
+}
+
+static void vqueue_foreach_destroy(void *data, void *user_data)
+{
+	struct vqueue *vq = user_data;
+
+	vqueue_destroy(vq, NULL);
+}
+
+static void test_vqueue_foreach_destroy(const void *data)
+{
+	struct vqueue *vq;
+
+	vq = vqueue_new();
+	g_assert(vq != NULL);
+
+	vqueue_push_tail(vq, UINT_TO_PTR(1));
+	vqueue_push_tail(vq, UINT_TO_PTR(2));
+
+	vqueue_foreach(vq, vqueue_foreach_destroy, vq);
+	tester_test_passed();
+}
+
+struct vqueue_visit {
+	struct vqueue *vq;
+	unsigned int count;
+	unsigned int sum;
+};
+
+static void vqueue_foreach_remove(void *data, void *user_data)
+{
+	struct vqueue_visit *visit = user_data;
+
+	visit->count++;
+	visit->sum += PTR_TO_UINT(data);
+
+	g_assert(vqueue_remove(visit->vq, data));
+}
+
+static void test_vqueue_foreach_remove(const void *data)
+{
+	struct vqueue_visit visit = { .count = 0, .sum = 0 };
+
+	visit.vq = vqueue_new();
+	g_assert(visit.vq != NULL);
+
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(1));
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(2));
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(3));
+
+	vqueue_foreach(visit.vq, vqueue_foreach_remove, &visit);
+	g_assert(visit.count == 3);
+	g_assert(visit.sum == 6);
+	g_assert(vqueue_isempty(visit.vq));
+
+	vqueue_destroy(visit.vq, NULL);
+	tester_test_passed();
+}
+
+static void vqueue_foreach_remove_backward(void *data, void *user_data)
+{
+	struct vqueue_visit *visit = user_data;
+
+	visit->count++;
+
+	vqueue_remove(visit->vq, UINT_TO_PTR(2));
+	vqueue_remove(visit->vq, UINT_TO_PTR(1));
+}
+
+static void test_vqueue_foreach_remove_backward(const void *data)
+{
+	struct vqueue_visit visit = { .count = 0, .sum = 0 };
+
+	visit.vq = vqueue_new();
+	g_assert(visit.vq != NULL);
+
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(1));
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(2));
+
+	vqueue_foreach(visit.vq, vqueue_foreach_remove_backward, &visit);
+	g_assert(visit.count == 1);
+
+	vqueue_destroy(visit.vq, NULL);
+	tester_test_passed();
+}
+
+static void vqueue_foreach_push(void *data, void *user_data)
+{
+	struct vqueue_visit *visit = user_data;
+
+	visit->count++;
+	visit->sum += PTR_TO_UINT(data);
+
+	/* Entries added at the head are skipped, at the tail visited */
+	if (PTR_TO_UINT(data) == 2) {
+		vqueue_push_head(visit->vq, UINT_TO_PTR(10));
+		vqueue_push_tail(visit->vq, UINT_TO_PTR(4));
+	}
+}
+
+static void test_vqueue_foreach_push(const void *data)
+{
+	struct vqueue_visit visit = { .count = 0, .sum = 0 };
+
+	visit.vq = vqueue_new();
+	g_assert(visit.vq != NULL);
+
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(1));
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(2));
+	vqueue_push_tail(visit.vq, UINT_TO_PTR(3));
+
+	vqueue_foreach(visit.vq, vqueue_foreach_push, &visit);
+	g_assert(visit.count == 4);
+	g_assert(visit.sum == 10);
+	g_assert(vqueue_length(visit.vq) == 5);
+
+	vqueue_destroy(visit.vq, NULL);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -276,6 +620,21 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/reuse",  NULL, NULL, test_reuse, NULL);
+	tester_add("/queue/reserve",  NULL, NULL, test_reserve, NULL);
+	tester_add("/queue/thread",  NULL, NULL, test_thread, NULL);
+	tester_add("/queue/bench/alloc",  NULL, NULL, test_bench_alloc, NULL);
+	tester_add("/queue/bench/throughput",  NULL, NULL,
+						test_bench_throughput, NULL);
+	tester_add("/vqueue/basic", NULL, NULL, test_vqueue_basic, NULL);
+	tester_add("/vqueue/foreach_destroy", NULL, NULL,
+					test_vqueue_foreach_destroy, NULL);
+	tester_add("/vqueue/foreach_remove", NULL, NULL,
+					test_vqueue_foreach_remove, NULL);
+	tester_add("/vqueue/foreach_remove_backward", NULL, NULL,
+				test_vqueue_foreach_remove_backward, NULL);
+	tester_add("/vqueue/foreach_push", NULL, NULL,
+					test_vqueue_foreach_push, NULL);
 
 	return tester_run();
 }
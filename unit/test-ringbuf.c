@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include <glib.h>
 
@@ -145,6 +146,169 @@ static void test_printf(const void *data)
 	tester_test_passed();
 }
 
+static void test_peek(const void *data)
+{
+	struct ringbuf *rb;
+	size_t len;
+	char *ptr;
+
+	rb = ringbuf_new(16);
+	g_assert(rb != NULL);
+	g_assert(ringbuf_capacity(rb) == 16);
+
+	g_assert(ringbuf_printf(rb, "%s", "abcdefghijkl") == 12);
+	g_assert(ringbuf_drain(rb, 8) == 8);
+	g_assert(ringbuf_printf(rb, "%s", "0123456789") == 10);
+
+	/* Lengths stop at the end of the buffer and of the queued data */
+	ptr = ringbuf_peek(rb, 0, &len);
+	g_assert(len == 8);
+	g_assert(strncmp(ptr, "ijkl0123", 8) == 0);
+
+	ptr = ringbuf_peek(rb, 4, &len);
+	g_assert(len == 4);
+	g_assert(strncmp(ptr, "0123", 4) == 0);
+
+	ptr = ringbuf_peek(rb, 8, &len);
+	g_assert(len == 6);
+	g_assert(strncmp(ptr, "456789", 6) == 0);
+
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
+static void fill_iov(const struct iovec *iov, int cnt, unsigned char start)
+{
+	int i;
+	size_t j;
+
+	for (i = 0; i < cnt; i++) {
+		unsigned char *ptr = iov[i].iov_base;
+
+		for (j = 0; j < iov[i].iov_len; j++)
+			ptr[j] = start++;
+	}
+}
+
+static void check_iov(const struct iovec *iov, int cnt, unsigned char start,
+								size_t len)
+{
+	size_t total = 0, j;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		const unsigned char *ptr = iov[i].iov_base;
+
+		for (j = 0; j < iov[i].iov_len; j++)
+			g_assert(ptr[j] == start++);
+
+		total += iov[i].iov_len;
+	}
+
+	g_assert(total == len);
+}
+
+static void test_iov(const void *data)
+{
+	struct ringbuf *rb, *rb2;
+	struct iovec iov[2];
+	int fds[2], cnt;
+
+	rb = ringbuf_new(16);
+	g_assert(rb != NULL);
+
+	cnt = ringbuf_get_space_iov(rb, iov);
+	g_assert(cnt == 1);
+	g_assert(iov[0].iov_len == 16);
+
+	fill_iov(iov, cnt, 0);
+	g_assert(ringbuf_commit(rb, 12) == 12);
+	g_assert(ringbuf_drain(rb, 8) == 8);
+
+	/* Free space now wraps around the end of the buffer */
+	cnt = ringbuf_get_space_iov(rb, iov);
+	g_assert(cnt == 2);
+	g_assert(iov[0].iov_len == 4);
+	g_assert(iov[1].iov_len == 8);
+
+	fill_iov(iov, cnt, 12);
+	g_assert(ringbuf_commit(rb, 20) == 12);
+	g_assert(ringbuf_avail(rb) == 0);
+
+	cnt = ringbuf_get_data_iov(rb, iov);
+	g_assert(cnt == 2);
+	check_iov(iov, cnt, 8, 16);
+
+	/* Pass the wrapped data through a pipe into another ring buffer */
+	g_assert(pipe(fds) == 0);
+
+	rb2 = ringbuf_new(16);
+	g_assert(rb2 != NULL);
+
+	g_assert(ringbuf_write(rb, fds[1]) == 16);
+	g_assert(ringbuf_len(rb) == 0);
+	g_assert(ringbuf_read(rb2, fds[0]) == 16);
+
+	cnt = ringbuf_get_data_iov(rb2, iov);
+	g_assert(cnt == 1);
+	check_iov(iov, cnt, 8, 16);
+
+	close(fds[0]);
+	close(fds[1]);
+
+	ringbuf_free(rb2);
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
+static void test_mirrored(const void *data)
+{
+	struct ringbuf *rb;
+	struct iovec iov[2];
+	size_t capa, len;
+	char *ptr;
+	int cnt;
+
+	rb = ringbuf_new_mirrored(100);
+	if (!rb) {
+		tester_test_abort();
+		return;
+	}
+
+	capa = ringbuf_capacity(rb);
+	g_assert(capa >= 100);
+	g_assert((capa & (capa - 1)) == 0);
+
+	/* Move the write position close to the end of the buffer */
+	g_assert(ringbuf_commit(rb, capa - 4) == capa - 4);
+	g_assert(ringbuf_drain(rb, capa - 8) == capa - 8);
+
+	cnt = ringbuf_get_space_iov(rb, iov);
+	g_assert(cnt == 1);
+	g_assert(iov[0].iov_len == capa - 4);
+
+	g_assert(ringbuf_printf(rb, "%s", "wraparound") == 10);
+
+	/* Data across the wrap around point is seen contiguously */
+	ptr = ringbuf_peek(rb, 4, &len);
+	g_assert(len == 10);
+	g_assert(strncmp(ptr, "wraparound", 10) == 0);
+
+	ptr = ringbuf_peek(rb, 8, &len);
+	g_assert(len == 6);
+	g_assert(strncmp(ptr, "around", 6) == 0);
+
+	ringbuf_peek(rb, 14, &len);
+	g_assert(len == 0);
+
+	cnt = ringbuf_get_data_iov(rb, iov);
+	g_assert(cnt == 1);
+	g_assert(iov[0].iov_len == 14);
+
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -152,6 +316,9 @@ int main(int argc, char *argv[])
 	tester_add("/ringbuf/power2", NULL, NULL, test_power2, NULL);
 	tester_add("/ringbuf/alloc", NULL, NULL, test_alloc, NULL);
 	tester_add("/ringbuf/printf", NULL, NULL, test_printf, NULL);
+	tester_add("/ringbuf/peek", NULL, NULL, test_peek, NULL);
+	tester_add("/ringbuf/iov", NULL, NULL, test_iov, NULL);
+	tester_add("/ringbuf/mirrored", NULL, NULL, test_mirrored, NULL);
 
 	return tester_run();
 }